@@ -12,6 +12,12 @@ import (
 	"github.com/agenthands/GUI-Actor/pkg/tokenizer"
 )
 
+// MetricsWriter is implemented by engines that export metrics
+// (KV memory, GPU profile) in the Prometheus text exposition format
+type MetricsWriter interface {
+	WriteMetrics(w io.Writer) error
+}
+
 // Server handles HTTP requests for chat completions
 type Server struct {
 	tree      *radix.Tree
@@ -22,7 +28,11 @@ type Server struct {
 }
 
 // NewServer creates a new HTTP server
+// Engines that offload (radix.Offloader) get offloaded prefixes prefetched on a tree hit
 func NewServer(tree *radix.Tree, engine radix.MLXEngine, tok *tokenizer.Tokenizer, model any) *Server {
+	if offloader, ok := engine.(radix.Offloader); ok {
+		tree.SetPrefetch(offloader.PrefetchCache)
+	}
 	return &Server{
 		tree:      tree,
 		engine:    engine,
@@ -196,9 +206,26 @@ func (s *Server) GenerateAutoregressive(inputTokens []uint32, maxTokens int) ([]
 }
 
 // finalizeNode runs MLX computation and finalizes a pending node
+// Engines that implement radix.AsyncForwarder finish it from their completion
+// instead, so the caller does not wait on the GPU
 func (s *Server) finalizeNode(node *radix.Node, baseHandle uint64) {
+	if async, ok := s.engine.(radix.AsyncForwarder); ok {
+		err := async.SubmitForward(s.model, node.Tokens, baseHandle, func(logits []float32, newHandle uint64, err error) {
+			s.completeNode(node, logits, newHandle, err)
+		})
+		if err != nil {
+			radix.PoisonNode(node, err)
+		}
+		return
+	}
+
 	// Run forward pass
 	logits, newHandle, err := s.engine.ForwardWithCache(s.model, node.Tokens, baseHandle)
+	s.completeNode(node, logits, newHandle, err)
+}
+
+// completeNode finalizes (or poisons) a pending node with its forward's result
+func (s *Server) completeNode(node *radix.Node, logits []float32, newHandle uint64, err error) {
 	if err != nil {
 		// Poison the node on error
 		radix.PoisonNode(node, err)
@@ -214,6 +241,28 @@ func (s *Server) finalizeNode(node *radix.Node, baseHandle uint64) {
 
 	// Unpin node (allows LRU eviction)
 	s.tree.Unpin(node)
+
+	s.relieveMemoryPressure()
+}
+
+// relieveMemoryPressure evicts LRU prefixes by bytes when the engine reports
+// KV memory above its eviction watermark. Engines that offload get their LRU
+// prefixes offloaded first; only what that cannot cover is evicted.
+func (s *Server) relieveMemoryPressure() {
+	reporter, ok := s.engine.(radix.MemoryReporter)
+	if !ok {
+		return
+	}
+	over := reporter.MemoryOverage()
+	if offloader, ok := s.engine.(radix.Offloader); ok && over > 0 {
+		offloaded := s.tree.OffloadBytes(over, reporter.CacheBytes, offloader.OffloadCache)
+		slog.Debug("Offloaded cached prefixes under memory pressure", "requested_bytes", over, "offloaded_bytes", offloaded)
+		over -= offloaded
+	}
+	if over > 0 {
+		freed := s.tree.EvictBytes(over, reporter.CacheBytes, s.engine.FreeCache)
+		slog.Debug("Evicted cached prefixes under memory pressure", "requested_bytes", over, "freed_bytes", freed)
+	}
 }
 
 // HealthCheckHandler handles GET /health
@@ -229,10 +278,29 @@ func (s *Server) HealthCheckHandler(w http.ResponseWriter, r *http.Request) {
 	})
 }
 
+// MetricsHandler handles GET /metrics for Prometheus scrapes
+func (s *Server) MetricsHandler(w http.ResponseWriter, r *http.Request) {
+	if r.Method != http.MethodGet {
+		http.Error(w, "Method not allowed", http.StatusMethodNotAllowed)
+		return
+	}
+	metrics, ok := s.engine.(MetricsWriter)
+	if !ok {
+		http.Error(w, "Metrics not supported by engine", http.StatusNotFound)
+		return
+	}
+
+	w.Header().Set("Content-Type", "text/plain; version=0.0.4")
+	if err := metrics.WriteMetrics(w); err != nil {
+		slog.Warn("Failed to write metrics", "error", err)
+	}
+}
+
 // RegisterRoutes registers all HTTP routes
 func (s *Server) RegisterRoutes(mux *http.ServeMux) {
 	mux.HandleFunc("/v1/chat/completions", s.ChatCompletionHandler)
 	mux.HandleFunc("/health", s.HealthCheckHandler)
+	mux.HandleFunc("/metrics", s.MetricsHandler)
 }
 
 // LogHandler wraps handlers with request logging
@@ -3,6 +3,9 @@ package http
 import (
 	"bytes"
 	"encoding/json"
+	"errors"
+	"fmt"
+	"io"
 	"net/http"
 	"net/http/httptest"
 	"testing"
@@ -396,3 +399,287 @@ func TestCompletionUsage(t *testing.T) {
 		t.Error("TotalTokens should equal PromptTokens + CompletionTokens")
 	}
 }
+
+// memoryEngine is a mock engine that reports KV memory pressure
+type memoryEngine struct {
+	radix.MockMLXEngine
+	overage int64
+	bytes   int64
+}
+
+func (e *memoryEngine) CacheBytes(handle uint64) int64 { return e.bytes }
+func (e *memoryEngine) MemoryOverage() int64           { return e.overage }
+
+func TestRelieveMemoryPressure(t *testing.T) {
+	tests := []struct {
+		name      string
+		overage   int64
+		wantFreed []uint64
+	}{
+		{"below watermark", 0, nil},
+		{"one node", 100, []uint64{100}},
+		{"all nodes", 1000, []uint64{100, 200}},
+	}
+
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			tree := radix.NewTree()
+			var freed []uint64
+			engine := &memoryEngine{overage: tt.overage, bytes: 100}
+			engine.FreeFunc = func(handle uint64) { freed = append(freed, handle) }
+			server := NewServer(tree, engine, tokenizer.NewTokenizer(32000), "test-model")
+
+			for i, handle := range []uint64{100, 200} {
+				node, _ := tree.InsertPending([]uint32{uint32(i + 1)}, engine, nil)
+				radix.FinalizeNode(node, handle)
+				tree.Unpin(node)
+			}
+
+			server.relieveMemoryPressure()
+
+			if len(freed) != len(tt.wantFreed) {
+				t.Fatalf("Expected %d handles freed, got %v", len(tt.wantFreed), freed)
+			}
+			for i := range freed {
+				if freed[i] != tt.wantFreed[i] {
+					t.Errorf("Expected handle %d freed, got %d", tt.wantFreed[i], freed[i])
+				}
+			}
+		})
+	}
+}
+
+func TestRelieveMemoryPressureWithoutReporter(t *testing.T) {
+	tree := radix.NewTree()
+	engine := &radix.MockMLXEngine{
+		FreeFunc: func(handle uint64) { t.Errorf("Unexpected FreeCache(%d)", handle) },
+	}
+	server := NewServer(tree, engine, tokenizer.NewTokenizer(32000), "test-model")
+
+	node, _ := tree.InsertPending([]uint32{1}, engine, nil)
+	radix.FinalizeNode(node, 100)
+	tree.Unpin(node)
+
+	server.relieveMemoryPressure()
+}
+
+// offloadEngine is a memoryEngine that can offload handles
+type offloadEngine struct {
+	memoryEngine
+	offloadErr error
+	failHandle uint64 // offloading this handle fails, 0 for none
+	offloaded  []uint64
+	prefetched []uint64
+}
+
+// CacheBytes reports no device bytes for offloaded handles, like the engine
+func (e *offloadEngine) CacheBytes(handle uint64) int64 {
+	for _, h := range e.offloaded {
+		if h == handle {
+			return 0
+		}
+	}
+	return e.bytes
+}
+
+func (e *offloadEngine) OffloadCache(handle uint64) error {
+	if e.offloadErr != nil {
+		return e.offloadErr
+	}
+	if handle == e.failHandle {
+		return errors.New("disk full")
+	}
+	e.offloaded = append(e.offloaded, handle)
+	return nil
+}
+
+func (e *offloadEngine) PrefetchCache(handle uint64) {
+	e.prefetched = append(e.prefetched, handle)
+}
+
+func TestRelieveMemoryPressureOffloadsFirst(t *testing.T) {
+	tests := []struct {
+		name          string
+		overage       int64
+		offloadErr    error
+		wantOffloaded []uint64
+		wantFreed     []uint64
+	}{
+		{"below watermark", 0, nil, nil, nil},
+		{"offload covers overage", 150, nil, []uint64{100, 200}, nil},
+		{"offload fails, evict", 100, errors.New("disk full"), nil, []uint64{100}},
+	}
+
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			tree := radix.NewTree()
+			var freed []uint64
+			engine := &offloadEngine{memoryEngine: memoryEngine{overage: tt.overage, bytes: 100}, offloadErr: tt.offloadErr}
+			engine.FreeFunc = func(handle uint64) { freed = append(freed, handle) }
+			server := NewServer(tree, engine, tokenizer.NewTokenizer(32000), "test-model")
+
+			for i, handle := range []uint64{100, 200} {
+				node, _ := tree.InsertPending([]uint32{uint32(i + 1)}, engine, nil)
+				radix.FinalizeNode(node, handle)
+				tree.Unpin(node)
+			}
+
+			server.relieveMemoryPressure()
+
+			if fmt.Sprint(engine.offloaded) != fmt.Sprint(tt.wantOffloaded) {
+				t.Errorf("Expected handles %v offloaded, got %v", tt.wantOffloaded, engine.offloaded)
+			}
+			if fmt.Sprint(freed) != fmt.Sprint(tt.wantFreed) {
+				t.Errorf("Expected handles %v freed, got %v", tt.wantFreed, freed)
+			}
+		})
+	}
+}
+
+func TestRelieveMemoryPressureEvictsResidentBeforeOffloaded(t *testing.T) {
+	tree := radix.NewTree()
+	var freed []uint64
+	engine := &offloadEngine{memoryEngine: memoryEngine{overage: 200, bytes: 100}, failHandle: 200}
+	engine.FreeFunc = func(handle uint64) { freed = append(freed, handle) }
+	server := NewServer(tree, engine, tokenizer.NewTokenizer(32000), "test-model")
+
+	for i, handle := range []uint64{100, 200, 300} {
+		node, _ := tree.InsertPending([]uint32{uint32(i + 1)}, engine, nil)
+		radix.FinalizeNode(node, handle)
+		tree.Unpin(node)
+	}
+
+	// Offload covers handle 100 and fails on 200; the remaining overage must
+	// come from resident handles, not from dropping the offloaded one
+	server.relieveMemoryPressure()
+
+	if fmt.Sprint(engine.offloaded) != fmt.Sprint([]uint64{100}) {
+		t.Errorf("Expected handles [100] offloaded, got %v", engine.offloaded)
+	}
+	if fmt.Sprint(freed) != fmt.Sprint([]uint64{200}) {
+		t.Errorf("Expected handles [200] freed, got %v", freed)
+	}
+	if node := tree.Match([]uint32{1}); node == nil || node.CacheHandle != 100 {
+		t.Errorf("Expected offloaded prefix to stay matchable, got %v", node)
+	}
+}
+
+func TestOffloadedPrefixPrefetchedOnMatch(t *testing.T) {
+	tree := radix.NewTree()
+	engine := &offloadEngine{memoryEngine: memoryEngine{overage: 100, bytes: 100}}
+	server := NewServer(tree, engine, tokenizer.NewTokenizer(32000), "test-model")
+
+	node, _ := tree.InsertPending([]uint32{1, 2}, engine, nil)
+	radix.FinalizeNode(node, 100)
+	tree.Unpin(node)
+
+	server.relieveMemoryPressure()
+	tree.Match([]uint32{1, 2, 3})
+
+	if len(engine.prefetched) != 1 || engine.prefetched[0] != 100 {
+		t.Errorf("Expected handle 100 prefetched on match, got %v", engine.prefetched)
+	}
+}
+
+// asyncEngine completes submitted forwards from another goroutine
+type asyncEngine struct {
+	radix.MockMLXEngine
+	submitErr  error
+	forwardErr error
+}
+
+func (e *asyncEngine) SubmitForward(model any, tokens []uint32, base uint64, done func([]float32, uint64, error)) error {
+	if e.submitErr != nil {
+		return e.submitErr
+	}
+	go func() {
+		if e.forwardErr != nil {
+			done(nil, 0, e.forwardErr)
+			return
+		}
+		done(make([]float32, 8), base+1, nil)
+	}()
+	return nil
+}
+
+func TestFinalizeNodeAsync(t *testing.T) {
+	tests := []struct {
+		name       string
+		submitErr  error
+		forwardErr error
+		wantHandle uint64
+	}{
+		{"finalized", nil, nil, 11},
+		{"submit fails", errors.New("model not loaded"), nil, 0},
+		{"forward fails", nil, errors.New("out of memory"), 0},
+	}
+
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			tree := radix.NewTree()
+			engine := &asyncEngine{submitErr: tt.submitErr, forwardErr: tt.forwardErr}
+			engine.ForwardFunc = func(model any, tokens []uint32, base uint64) ([]float32, uint64, error) {
+				t.Error("Unexpected synchronous ForwardWithCache")
+				return nil, 0, nil
+			}
+			server := NewServer(tree, engine, tokenizer.NewTokenizer(32000), "test-model")
+
+			node, _ := tree.InsertPending([]uint32{1, 2}, engine, nil)
+			server.finalizeNode(node, 10)
+
+			err := node.Wait()
+			wantErr := tt.submitErr
+			if wantErr == nil {
+				wantErr = tt.forwardErr
+			}
+			if !errors.Is(err, wantErr) {
+				t.Fatalf("Expected error %v, got %v", wantErr, err)
+			}
+			if node.CacheHandle != tt.wantHandle {
+				t.Errorf("Expected handle %d, got %d", tt.wantHandle, node.CacheHandle)
+			}
+		})
+	}
+}
+
+// metricsEngine is a mock engine that exports metrics
+type metricsEngine struct {
+	radix.MockMLXEngine
+	body string
+}
+
+func (e *metricsEngine) WriteMetrics(w io.Writer) error {
+	_, err := io.WriteString(w, e.body)
+	return err
+}
+
+func TestMetricsHandler(t *testing.T) {
+	tests := []struct {
+		name       string
+		engine     radix.MLXEngine
+		method     string
+		wantStatus int
+		wantBody   string
+	}{
+		{"exports engine metrics", &metricsEngine{body: "mlx_kv_used_bytes 10\n"}, "GET", http.StatusOK, "mlx_kv_used_bytes 10\n"},
+		{"engine without metrics", &radix.MockMLXEngine{}, "GET", http.StatusNotFound, ""},
+		{"wrong method", &metricsEngine{}, "POST", http.StatusMethodNotAllowed, ""},
+	}
+
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			server := NewServer(radix.NewTree(), tt.engine, tokenizer.NewTokenizer(32000), "test-model")
+			req := httptest.NewRequest(tt.method, "/metrics", nil)
+			w := httptest.NewRecorder()
+
+			server.MetricsHandler(w, req)
+
+			if w.Code != tt.wantStatus {
+				t.Errorf("Expected status %d, got %d", tt.wantStatus, w.Code)
+			}
+			if tt.wantBody != "" && w.Body.String() != tt.wantBody {
+				t.Errorf("Expected body %q, got %q", tt.wantBody, w.Body.String())
+			}
+		})
+	}
+}
@@ -0,0 +1,15 @@
+package mlx
+
+// ForwardFuture is a forward queued with SubmitForward
+// Done is closed once the forward has finished; Result then collects its
+// logits and cache handle (or error) without blocking. Every future must be
+// collected exactly once, or its cache handle is never published to anyone.
+type ForwardFuture struct {
+	ticket uint64
+	done   chan struct{}
+}
+
+// Done is closed when the forward has finished
+func (f *ForwardFuture) Done() <-chan struct{} {
+	return f.done
+}
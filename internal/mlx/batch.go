@@ -0,0 +1,30 @@
+package mlx
+
+import "errors"
+
+// packBatch flattens per-sequence token spans into the ragged layout the C API
+// expects: all tokens back to back plus one count per sequence
+func packBatch(tokens [][]uint32, baseHandles []uint64) ([]uint32, []int32, error) {
+	if len(tokens) == 0 {
+		return nil, nil, errors.New("batch must contain at least one sequence")
+	}
+	if len(baseHandles) != len(tokens) {
+		return nil, nil, errors.New("batch needs one base cache handle per sequence")
+	}
+
+	total := 0
+	for _, seq := range tokens {
+		if len(seq) == 0 {
+			return nil, nil, errors.New("batch sequences must not be empty")
+		}
+		total += len(seq)
+	}
+
+	flat := make([]uint32, 0, total)
+	counts := make([]int32, len(tokens))
+	for i, seq := range tokens {
+		flat = append(flat, seq...)
+		counts[i] = int32(len(seq))
+	}
+	return flat, counts, nil
+}
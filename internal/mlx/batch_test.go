@@ -0,0 +1,53 @@
+package mlx
+
+import (
+	"reflect"
+	"testing"
+)
+
+func TestPackBatch(t *testing.T) {
+	tests := []struct {
+		name       string
+		tokens     [][]uint32
+		bases      []uint64
+		wantFlat   []uint32
+		wantCounts []int32
+		wantErr    bool
+	}{
+		{
+			name:       "single sequence",
+			tokens:     [][]uint32{{1, 2, 3}},
+			bases:      []uint64{RootCacheHandle},
+			wantFlat:   []uint32{1, 2, 3},
+			wantCounts: []int32{3},
+		},
+		{
+			name:       "ragged decode and prefill",
+			tokens:     [][]uint32{{7}, {1, 2, 3, 4}, {9}},
+			bases:      []uint64{5, RootCacheHandle, 5},
+			wantFlat:   []uint32{7, 1, 2, 3, 4, 9},
+			wantCounts: []int32{1, 4, 1},
+		},
+		{name: "empty batch", tokens: nil, bases: nil, wantErr: true},
+		{name: "empty sequence", tokens: [][]uint32{{1}, {}}, bases: []uint64{0, 0}, wantErr: true},
+		{name: "handle count mismatch", tokens: [][]uint32{{1}, {2}}, bases: []uint64{0}, wantErr: true},
+	}
+
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			flat, counts, err := packBatch(tt.tokens, tt.bases)
+			if (err != nil) != tt.wantErr {
+				t.Fatalf("packBatch() error = %v, wantErr %v", err, tt.wantErr)
+			}
+			if tt.wantErr {
+				return
+			}
+			if !reflect.DeepEqual(flat, tt.wantFlat) {
+				t.Errorf("flat = %v, want %v", flat, tt.wantFlat)
+			}
+			if !reflect.DeepEqual(counts, tt.wantCounts) {
+				t.Errorf("counts = %v, want %v", counts, tt.wantCounts)
+			}
+		})
+	}
+}
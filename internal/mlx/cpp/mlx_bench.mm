@@ -0,0 +1,349 @@
+// mlx_bench: standalone benchmark harness for the mlx_engine C API
+//
+// Sweeps prompt length x batch size x cache-hit ratio through MLXLoadModel,
+// MLXSliceCache and MLXForwardBatch and reports prefill/decode throughput,
+// time to first token, per-step decode latency and peak memory; then times
+// every kernel on its own through MLXBenchmarkKernel. Results are one JSON
+// document on stdout, progress goes to stderr.
+//
+// Usage:
+//   mlx_bench --model <dir> [--vocab N] [--weight-format f32|f16|bf16|q8|q4]
+//             [--prompt-lens 128,512,2048] [--batch-sizes 1,4,8]
+//             [--hit-ratios 0,0.5,0.9] [--decode-steps 32]
+//             [--kernel-rows 1,8,128] [--kernel-context 1024] [--kernel-iters 50]
+//             [--skip-sweep] [--skip-kernels]
+
+#import <Metal/Metal.h>
+
+#include "mlx_engine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Options {
+    std::string model;
+    int vocab_size = 152064;
+    int weight_format = MLX_WEIGHT_FORMAT_F32;
+    std::vector<int> prompt_lens = {128, 512, 2048};
+    std::vector<int> batch_sizes = {1, 4, 8};
+    std::vector<double> hit_ratios = {0.0, 0.5, 0.9};
+    int decode_steps = 32;
+    std::vector<int> kernel_rows = {1, 8, 128};
+    int kernel_context = 1024;
+    int kernel_iters = 50;
+    bool sweep = true;
+    bool kernels = true;
+};
+
+const char* const kKernels[] = {"linear", "linear_rope", "gated_mlp", "down_proj", "rmsnorm",
+                                "add_rmsnorm", "kv_write", "paged_attention", "lm_head", "sample"};
+const char* const kWeightFormats[] = {"f32", "f16", "bf16", "q8", "q4"};
+
+[[noreturn]] void Usage(const char* message) {
+    fprintf(stderr, "mlx_bench: %s\n", message);
+    fprintf(stderr, "usage: mlx_bench --model <dir> [--vocab N] [--weight-format f32|f16|bf16|q8|q4]\n"
+                    "                 [--prompt-lens L,..] [--batch-sizes B,..] [--hit-ratios R,..]\n"
+                    "                 [--decode-steps N] [--kernel-rows R,..] [--kernel-context N]\n"
+                    "                 [--kernel-iters N] [--skip-sweep] [--skip-kernels]\n");
+    exit(2);
+}
+
+template <typename T>
+std::vector<T> ParseList(const char* arg) {
+    std::vector<T> values;
+    for (const char* p = arg; *p;) {
+        char* end = nullptr;
+        double value = strtod(p, &end);
+        if (end == p) Usage("malformed list");
+        if (*end && *end != ',') Usage("malformed list");
+        values.push_back(static_cast<T>(value));
+        p = *end == ',' ? end + 1 : end;
+    }
+    if (values.empty()) Usage("empty list");
+    return values;
+}
+
+Options ParseOptions(int argc, char** argv) {
+    Options opts;
+    for (int i = 1; i < argc; i++) {
+        std::string flag = argv[i];
+        auto value = [&]() -> const char* {
+            if (i + 1 >= argc) Usage(("missing value for " + flag).c_str());
+            return argv[++i];
+        };
+        if (flag == "--model") opts.model = value();
+        else if (flag == "--vocab") opts.vocab_size = atoi(value());
+        else if (flag == "--weight-format") {
+            std::string name = value();
+            auto it = std::find(std::begin(kWeightFormats), std::end(kWeightFormats), name);
+            if (it == std::end(kWeightFormats)) Usage("unknown weight format");
+            opts.weight_format = static_cast<int>(it - std::begin(kWeightFormats));
+        }
+        else if (flag == "--prompt-lens") opts.prompt_lens = ParseList<int>(value());
+        else if (flag == "--batch-sizes") opts.batch_sizes = ParseList<int>(value());
+        else if (flag == "--hit-ratios") opts.hit_ratios = ParseList<double>(value());
+        else if (flag == "--decode-steps") opts.decode_steps = atoi(value());
+        else if (flag == "--kernel-rows") opts.kernel_rows = ParseList<int>(value());
+        else if (flag == "--kernel-context") opts.kernel_context = atoi(value());
+        else if (flag == "--kernel-iters") opts.kernel_iters = atoi(value());
+        else if (flag == "--skip-sweep") opts.sweep = false;
+        else if (flag == "--skip-kernels") opts.kernels = false;
+        else Usage(("unknown flag " + flag).c_str());
+    }
+    if (opts.model.empty()) Usage("--model is required");
+    if (opts.vocab_size <= 0 || opts.decode_steps < 0 || opts.kernel_context < 0 || opts.kernel_iters <= 0) {
+        Usage("counts must be positive");
+    }
+    for (int len : opts.prompt_lens) if (len < 1) Usage("prompt lengths must be >= 1");
+    for (int size : opts.batch_sizes) if (size < 1) Usage("batch sizes must be >= 1");
+    for (double ratio : opts.hit_ratios) if (ratio < 0.0 || ratio > 1.0) Usage("hit ratios must be in [0, 1]");
+    return opts;
+}
+
+double Seconds(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+// Nearest-rank percentile of unsorted samples
+double Percentile(std::vector<double> samples, double p) {
+    if (samples.empty()) return 0.0;
+    std::sort(samples.begin(), samples.end());
+    size_t rank = static_cast<size_t>(p / 100.0 * samples.size() + 0.5);
+    return samples[std::min(samples.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+std::string JsonString(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+            continue;
+        }
+        out += c;
+    }
+    return out + "\"";
+}
+
+// Device allocations and KV pool usage, sampled after every engine call
+struct PeakMemory {
+    id<MTLDevice> device = MTLCreateSystemDefaultDevice();
+    uint64_t device_bytes = 0;
+    int64_t kv_bytes = 0;
+
+    void Reset() {
+        device_bytes = 0;
+        kv_bytes = 0;
+        Sample();
+    }
+
+    void Sample() {
+        device_bytes = std::max<uint64_t>(device_bytes, [device currentAllocatedSize]);
+        MLXMemoryStats stats;
+        if (MLXGetMemoryStats(&stats) == MLX_SUCCESS) kv_bytes = std::max(kv_bytes, stats.used_bytes);
+    }
+};
+
+// Deterministic token ids that stay clear of the low (special) ids
+struct TokenSource {
+    uint32_t state;
+    int vocab_size;
+
+    uint32_t Next() {
+        state = state * 1664525u + 1013904223u;
+        return 1000 + (state >> 8) % static_cast<uint32_t>(std::max(1, vocab_size - 1000));
+    }
+
+    std::vector<uint32_t> Take(int n) {
+        std::vector<uint32_t> tokens(n);
+        for (auto& token : tokens) token = Next();
+        return tokens;
+    }
+};
+
+void Check(int status, char* error, const char* what) {
+    if (status == MLX_SUCCESS) return;
+    fprintf(stderr, "mlx_bench: %s failed (%d): %s\n", what, status, error ? error : "");
+    MLXFreeError(error);
+    exit(1);
+}
+
+struct ScenarioResult {
+    int prompt_tokens;
+    int batch_size;
+    double hit_ratio;
+    int cached_tokens;
+    double ttft_ms;
+    double prefill_tok_s;
+    double decode_tok_s;
+    double step_p50_ms;
+    double step_p99_ms;
+    uint64_t peak_device_bytes;
+    int64_t peak_kv_bytes;
+};
+
+// One sweep point: a shared prefix of hit_ratio * prompt_tokens is cached the
+// way the radix tree caches one (forward a donor prompt, slice it to the
+// prefix), then batch_size prompts that extend it are prefilled in one
+// MLXForwardBatch and decoded greedily for decode_steps steps.
+ScenarioResult RunScenario(const Options& opts, int prompt_tokens, int batch_size, double hit_ratio,
+                           PeakMemory& peak, TokenSource& source) {
+    ScenarioResult result = {};
+    result.prompt_tokens = prompt_tokens;
+    result.batch_size = batch_size;
+    result.hit_ratio = hit_ratio;
+    int cached = std::min(prompt_tokens - 1, static_cast<int>(prompt_tokens * hit_ratio + 0.5));
+    result.cached_tokens = cached;
+
+    size_t vocab = opts.vocab_size;
+    std::vector<float> logits(static_cast<size_t>(batch_size) * vocab);
+    char* error = nullptr;
+    peak.Reset();
+
+    uint64_t prefix = MLX_ROOT_CACHE_HANDLE;
+    std::vector<uint32_t> prefix_tokens = source.Take(cached);
+    if (cached > 0) {
+        std::vector<uint32_t> donor = prefix_tokens;
+        std::vector<uint32_t> donor_suffix = source.Take(prompt_tokens - cached);
+        donor.insert(donor.end(), donor_suffix.begin(), donor_suffix.end());
+        uint64_t donor_handle = 0;
+        Check(MLXForwardWithCache(0, donor.data(), static_cast<int>(donor.size()), MLX_ROOT_CACHE_HANDLE,
+                                  logits.data(), static_cast<int>(vocab), &donor_handle, &error),
+              error, "MLXForwardWithCache (warm prefix)");
+        Check(MLXSliceCache(donor_handle, cached, &prefix, &error), error, "MLXSliceCache");
+        MLXFreeCache(donor_handle);
+        peak.Sample();
+    }
+
+    // Prefill: every prompt's uncached suffix in one ragged batch
+    int suffix_tokens = prompt_tokens - cached;
+    std::vector<uint32_t> tokens;
+    std::vector<int> counts(batch_size, suffix_tokens);
+    std::vector<uint64_t> bases(batch_size, prefix), handles(batch_size);
+    for (int i = 0; i < batch_size; i++) {
+        std::vector<uint32_t> suffix = source.Take(suffix_tokens);
+        tokens.insert(tokens.end(), suffix.begin(), suffix.end());
+    }
+    auto start = std::chrono::steady_clock::now();
+    Check(MLXForwardBatch(0, batch_size, tokens.data(), counts.data(), bases.data(), logits.data(),
+                          static_cast<int>(logits.size()), handles.data(), &error),
+          error, "MLXForwardBatch (prefill)");
+    double prefill_s = Seconds(start);
+    peak.Sample();
+    result.ttft_ms = prefill_s * 1e3;
+    result.prefill_tok_s = static_cast<double>(batch_size) * suffix_tokens / prefill_s;
+
+    // Decode: one greedy token per sequence per step
+    std::vector<double> step_ms;
+    double decode_s = 0.0;
+    std::fill(counts.begin(), counts.end(), 1);
+    for (int step = 0; step < opts.decode_steps; step++) {
+        for (int i = 0; i < batch_size; i++) {
+            const float* row = logits.data() + static_cast<size_t>(i) * vocab;
+            tokens[i] = static_cast<uint32_t>(std::max_element(row, row + vocab) - row);
+        }
+        std::vector<uint64_t> next(batch_size);
+        start = std::chrono::steady_clock::now();
+        Check(MLXForwardBatch(0, batch_size, tokens.data(), counts.data(), handles.data(), logits.data(),
+                              static_cast<int>(logits.size()), next.data(), &error),
+              error, "MLXForwardBatch (decode)");
+        double s = Seconds(start);
+        peak.Sample();
+        decode_s += s;
+        step_ms.push_back(s * 1e3);
+        for (uint64_t handle : handles) MLXFreeCache(handle);
+        handles = next;
+    }
+    for (uint64_t handle : handles) MLXFreeCache(handle);
+    if (prefix != MLX_ROOT_CACHE_HANDLE) MLXFreeCache(prefix);
+
+    result.decode_tok_s = decode_s > 0.0 ? static_cast<double>(batch_size) * opts.decode_steps / decode_s : 0.0;
+    result.step_p50_ms = Percentile(step_ms, 50);
+    result.step_p99_ms = Percentile(step_ms, 99);
+    result.peak_device_bytes = peak.device_bytes;
+    result.peak_kv_bytes = peak.kv_bytes;
+    return result;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    @autoreleasepool {
+        Options opts = ParseOptions(argc, argv);
+
+        auto load_start = std::chrono::steady_clock::now();
+        MLXLoadOptions load_options = {};
+        load_options.weight_format = opts.weight_format;
+        int status = MLXLoadModelWithOptions(opts.model.c_str(), opts.vocab_size, &load_options);
+        if (status != MLX_SUCCESS) {
+            fprintf(stderr, "mlx_bench: MLXLoadModelWithOptions failed (%d)\n", status);
+            return 1;
+        }
+        double load_s = Seconds(load_start);
+
+        PeakMemory peak;
+        TokenSource source = {0x2545f491u, opts.vocab_size};
+
+        printf("{\n");
+        printf("  \"device\": %s,\n", JsonString([[peak.device name] UTF8String]).c_str());
+        printf("  \"model\": %s,\n", JsonString(opts.model).c_str());
+        printf("  \"weight_format\": \"%s\",\n", kWeightFormats[opts.weight_format]);
+        printf("  \"load_s\": %.3f,\n", load_s);
+
+        printf("  \"sweep\": [");
+        if (opts.sweep) {
+            const char* sep = "\n";
+            for (int prompt_tokens : opts.prompt_lens) {
+                for (int batch_size : opts.batch_sizes) {
+                    for (double hit_ratio : opts.hit_ratios) {
+                        fprintf(stderr, "sweep: prompt=%d batch=%d hit=%.2f\n", prompt_tokens, batch_size, hit_ratio);
+                        ScenarioResult r = RunScenario(opts, prompt_tokens, batch_size, hit_ratio, peak, source);
+                        printf("%s    {\"prompt_tokens\": %d, \"batch_size\": %d, \"cache_hit_ratio\": %.3f, "
+                               "\"cached_tokens\": %d, \"ttft_ms\": %.3f, \"prefill_tok_s\": %.1f, "
+                               "\"decode_steps\": %d, \"decode_tok_s\": %.1f, \"step_p50_ms\": %.3f, "
+                               "\"step_p99_ms\": %.3f, \"peak_device_bytes\": %llu, \"peak_kv_bytes\": %lld}",
+                               sep, r.prompt_tokens, r.batch_size, r.hit_ratio, r.cached_tokens, r.ttft_ms,
+                               r.prefill_tok_s, opts.decode_steps, r.decode_tok_s, r.step_p50_ms, r.step_p99_ms,
+                               static_cast<unsigned long long>(r.peak_device_bytes),
+                               static_cast<long long>(r.peak_kv_bytes));
+                        sep = ",\n";
+                        fflush(stdout);
+                    }
+                }
+            }
+            printf("\n  ");
+        }
+        printf("],\n");
+
+        printf("  \"kernels\": [");
+        if (opts.kernels) {
+            const char* sep = "\n";
+            for (const char* kernel : kKernels) {
+                for (int rows : opts.kernel_rows) {
+                    fprintf(stderr, "kernel: %s rows=%d\n", kernel, rows);
+                    double gpu_ns = 0.0;
+                    char* error = nullptr;
+                    Check(MLXBenchmarkKernel(kernel, rows, opts.kernel_context, opts.kernel_iters, &gpu_ns, &error),
+                          error, kernel);
+                    printf("%s    {\"kernel\": \"%s\", \"rows\": %d, \"context_tokens\": %d, \"iterations\": %d, "
+                           "\"gpu_us\": %.3f}",
+                           sep, kernel, rows, opts.kernel_context, opts.kernel_iters, gpu_ns / 1e3);
+                    sep = ",\n";
+                    fflush(stdout);
+                }
+            }
+            printf("\n  ");
+        }
+        printf("]\n}\n");
+        return 0;
+    }
+}
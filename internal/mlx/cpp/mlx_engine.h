@@ -7,6 +7,39 @@
 extern "C" {
 #endif
 
+// Constants
+#define MLX_ROOT_CACHE_HANDLE 0
+#define MLX_DEFAULT_MODEL_HANDLE 0
+
+// Weight formats (MLXLoadOptions)
+#define MLX_WEIGHT_FORMAT_F32 0
+#define MLX_WEIGHT_FORMAT_F16 1
+#define MLX_WEIGHT_FORMAT_BF16 2
+#define MLX_WEIGHT_FORMAT_Q8 3
+#define MLX_WEIGHT_FORMAT_Q4 4
+#define MLX_DEFAULT_QUANT_GROUP_SIZE 64
+
+// Prompt tokens per sequence per engine step (MLXLoadOptions)
+#define MLX_DEFAULT_PREFILL_CHUNK_TOKENS 512
+
+// Largest top_k / num_logprobs served by MLXForwardSample
+#define MLX_MAX_SAMPLE_CANDIDATES 256
+
+// Cache residency tiers (MLXOffloadCache, MLXGetCacheTier)
+#define MLX_CACHE_TIER_DEVICE 0
+#define MLX_CACHE_TIER_HOST 1
+#define MLX_CACHE_TIER_DISK 2
+
+// Profiled kernel kinds (MLXGetProfileStats)
+#define MLX_KERNEL_MATMUL 0
+#define MLX_KERNEL_ROPE 1
+#define MLX_KERNEL_ATTENTION 2
+#define MLX_KERNEL_NORM 3
+#define MLX_KERNEL_MLP 4
+#define MLX_KERNEL_SAMPLE 5
+#define MLX_KERNEL_OTHER 6
+#define MLX_NUM_KERNEL_KINDS 7
+
 // Error codes
 #define MLX_SUCCESS 0
 #define MLX_ERROR_INVALID_HANDLE -1
@@ -15,8 +48,79 @@ extern "C" {
 #define MLX_ERROR_COMPUTATION_FAILED -4
 #define MLX_ERROR_MODEL_NOT_LOADED -5
 
+// Submitted forward still running (MLXPollForward)
+#define MLX_PENDING 1
+
+// Completion of a submitted forward (MLXSubmitForward); runs on an engine thread
+typedef void (*MLXForwardCallback)(uint64_t ticket, int status, uintptr_t user_data);
+
+// Per-load settings (MLXLoadModelWithOptions, MLXLoadModelHandle, MLXServeShard);
+// zero-initialized or NULL selects the defaults
+typedef struct {
+    int weight_format;                  // MLX_WEIGHT_FORMAT_*
+    int quant_group_size;               // Q8/Q4 group; <= 0 = MLX_DEFAULT_QUANT_GROUP_SIZE
+    int prefill_chunk_tokens;           // <= 0 = MLX_DEFAULT_PREFILL_CHUNK_TOKENS
+    const char* pipeline_cache_dir;     // NULL or "" = $TMPDIR or /tmp
+    const char* tensor_parallel_peers;  // Comma-separated host:port of ranks 1..N-1; NULL or "" = unsharded
+} MLXLoadOptions;
+
+// KV pool usage in bytes (MLXGetMemoryStats)
+typedef struct {
+    int64_t used_bytes;
+    int64_t budget_bytes;
+    int64_t capacity_bytes;
+    int64_t block_bytes;
+    int64_t host_bytes;
+    int64_t disk_bytes;
+} MLXMemoryStats;
+
+// GPU profile totals (MLXGetProfileStats)
+typedef struct {
+    int num_layers;
+    int enabled;
+    int timestamps_supported;
+    uint64_t command_buffers;
+    uint64_t gpu_ns;
+    uint64_t upload_bytes;
+    uint64_t download_bytes;
+} MLXProfileStats;
+
+// One preprocessed image (MLXForwardMultimodal)
+typedef struct {
+    const float* pixel_values;  // [grid_t * grid_h * grid_w, 3 * 2 * 14 * 14] normalized patches, merge-window order
+    int grid_t;
+    int grid_h;
+    int grid_w;
+    uint64_t hash;  // Content hash keying the image cache; 0 hashes pixel_values
+} MLXImageInput;
+
+// Encoded-image cache usage (MLXGetImageCacheStats)
+typedef struct {
+    int64_t entries;
+    int64_t bytes;
+    int64_t budget_bytes;
+    uint64_t hits;
+    uint64_t misses;
+} MLXImageCacheStats;
+
+// One grounding candidate (MLXForwardPointer)
+typedef struct {
+    int image;    // Index into the images array
+    int patch;    // Merged patch within the image
+    float score;  // Pointer head probability
+    float x;      // Patch center, normalized to the image width
+    float y;      // Patch center, normalized to the image height
+} MLXPointerCandidate;
+
 // C API declarations
 int MLXLoadModel(const char* model_path, int vocab_size);
+int MLXLoadModelWithOptions(const char* model_path, int vocab_size, const MLXLoadOptions* options);
+int MLXLoadModelHandle(const char* model_path, int vocab_size, const MLXLoadOptions* options,
+                       uintptr_t* out_model_handle);
+int MLXUnloadModel(uintptr_t model_handle);
+int MLXSetDefaultModel(uintptr_t model_handle);
+int MLXServeShard(const char* model_path, int vocab_size, const MLXLoadOptions* options, int rank, int size,
+                  const char* listen_address, char** out_error);
 
 int MLXForwardWithCache(
     uintptr_t model_handle,
@@ -29,6 +133,103 @@ int MLXForwardWithCache(
     char** out_error
 );
 
+int MLXSubmitForward(
+    uintptr_t model_handle,
+    const uint32_t* tokens,
+    int num_tokens,
+    uint64_t base_cache_handle,
+    MLXForwardCallback callback,
+    uintptr_t user_data,
+    uint64_t* out_ticket,
+    char** out_error
+);
+int MLXPollForward(uint64_t ticket, float* out_logits, int out_logits_size, uint64_t* out_cache_handle,
+                   char** out_error);
+int MLXWaitForward(uint64_t ticket, float* out_logits, int out_logits_size, uint64_t* out_cache_handle,
+                   char** out_error);
+
+int MLXForwardBatch(
+    uintptr_t model_handle,
+    int num_sequences,
+    const uint32_t* tokens,
+    const int* token_counts,
+    const uint64_t* base_cache_handles,
+    float* out_logits,
+    int out_logits_size,
+    uint64_t* out_cache_handles,
+    char** out_error
+);
+
+int MLXForwardSample(
+    uintptr_t model_handle,
+    const uint32_t* tokens,
+    int num_tokens,
+    uint64_t base_cache_handle,
+    float temperature,
+    int top_k,
+    float top_p,
+    uint64_t seed,  // Noise keyed on (seed, position of the last token): fresh per decoded position
+    const uint32_t* bias_token_ids,
+    const float* bias_values,
+    int num_bias,
+    int num_logprobs,
+    uint32_t* out_token,
+    uint32_t* out_top_ids,
+    float* out_top_logprobs,
+    uint64_t* out_cache_handle,
+    char** out_error
+);
+
+int MLXForwardMultimodal(
+    uintptr_t model_handle,
+    const uint32_t* tokens,
+    int num_tokens,
+    const MLXImageInput* images,
+    int num_images,
+    uint64_t base_cache_handle,
+    float* out_logits,
+    int out_logits_size,
+    uint64_t* out_cache_handle,
+    char** out_error
+);
+
+int MLXForwardPointer(
+    uintptr_t model_handle,
+    const uint32_t* tokens,
+    int num_tokens,
+    const MLXImageInput* images,
+    int num_images,
+    uint64_t base_cache_handle,
+    int top_k,
+    MLXPointerCandidate* out_candidates,
+    int* out_count,
+    uint64_t* out_cache_handle,
+    char** out_error
+);
+
+int MLXSetImageCacheBudget(int64_t budget_bytes);
+int MLXGetImageCacheStats(MLXImageCacheStats* out_stats);
+
+int MLXVerifyDraft(
+    uintptr_t model_handle,
+    const uint32_t* tokens,
+    int num_tokens,
+    uint64_t base_cache_handle,
+    float temperature,
+    int top_k,
+    float top_p,
+    uint64_t seed,
+    int* out_accepted,
+    uint32_t* out_tokens,
+    float* out_logits,
+    int out_logits_size,
+    uint64_t* out_cache_handle,
+    char** out_error
+);
+
+int MLXDraftNgram(uint64_t cache_handle, const uint32_t* pending_tokens, int num_pending,
+                  int max_ngram, int max_draft, uint32_t* out_draft, int* out_count);
+
 int MLXSliceCache(
     uint64_t cache_handle,
     int keep_tokens,
@@ -36,6 +237,27 @@ int MLXSliceCache(
     char** out_error
 );
 
+int MLXGetMemoryStats(MLXMemoryStats* out_stats);
+int MLXGetCacheBytes(uint64_t cache_handle, int64_t* out_bytes, int64_t* out_exclusive_bytes);
+int MLXSetMemoryBudget(int64_t budget_bytes);
+
+int MLXOffloadCache(uint64_t cache_handle, int tier, char** out_error);
+int MLXPrefetchCache(uint64_t cache_handle);
+int MLXGetCacheTier(uint64_t cache_handle, int* out_tier);
+int MLXSetOffloadConfig(const char* directory, int64_t host_budget_bytes);
+
+int MLXExportCache(uint64_t cache_handle, const char* path, char** out_error);
+int MLXImportCache(const char* path, uint64_t* out_cache_handle, char** out_error);
+int MLXGetCacheTokens(uint64_t cache_handle, uint32_t* out_tokens, int capacity, int* out_count);
+int MLXGetModelFingerprint(uint64_t* out_fingerprint);
+
+int MLXSetProfiling(int enabled);
+int MLXGetProfileStats(MLXProfileStats* out_stats, uint64_t* out_kernel_ns, uint64_t* out_kernel_counts, int capacity);
+int MLXResetProfileStats(void);
+
+int MLXBenchmarkKernel(const char* kernel, int rows, int context_tokens, int iterations,
+                       double* out_gpu_ns, char** out_error);
+
 void MLXFreeCache(uint64_t cache_handle);
 void MLXFreeError(char* error);
 
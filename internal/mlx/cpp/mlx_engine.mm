@@ -5,17 +5,52 @@
 
 #import <Metal/Metal.h>
 #include <vector>
+#include <array>
 #include <memory>
+#include <functional>
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
 #include <unordered_map>
+#include <string>
+#include <deque>
+#include <list>
 #include <cstring>
+#include <cstdlib>
 #include <cmath>
-#include <fstream>
 #include <algorithm>
+#include <utility>
+#include <dispatch/dispatch.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <mach-o/getsect.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "mlx_engine.h"
 
 namespace mlx_vllm {
 
+// Storage format of the linear projection weights (values match MLX_WEIGHT_FORMAT_*)
+enum class WeightFormat : int {
+    F32 = MLX_WEIGHT_FORMAT_F32,
+    F16 = MLX_WEIGHT_FORMAT_F16,
+    BF16 = MLX_WEIGHT_FORMAT_BF16,
+    Q8 = MLX_WEIGHT_FORMAT_Q8,   // uint8, one fp16 scale/zero point per group
+    Q4 = MLX_WEIGHT_FORMAT_Q4,   // uint4 packed two per byte (low nibble first), fp16 scale/zero per group
+};
+
+// MLP gate activation (values match MLP_ACTIVATION in mlx_kernels.metal)
+enum class Activation : uint32_t {
+    SiLU = 0,  // Qwen2: down(silu(gate) * up)
+    GELU = 1,  // tanh approximation
+};
+
 // Model Configuration (Qwen2-VL-7B) - actual model parameters
 struct ModelConfig {
     int hidden_size = 3584;
@@ -28,750 +63,4087 @@ struct ModelConfig {
     float rms_norm_eps = 1e-6f;
     int max_position_embeddings = 32768;
     float rope_theta = 10000.0f;
+    Activation hidden_act = Activation::SiLU;
+    std::array<int, 3> mrope_section = {16, 24, 24};  // M-RoPE (temporal, height, width) split of the head_dim / 2 frequencies
+    int kv_block_size = 16;     // Tokens per KV cache block
+    int kv_num_blocks = 2048;   // Blocks in the KV pool (kv_num_blocks * kv_block_size tokens total)
+    WeightFormat weight_format = WeightFormat::F32;  // Projections and lm_head; embeddings and norms stay fp32
+    int quant_group_size = 64;  // Elements per scale/zero group along in_features (Q8/Q4)
+    int max_concurrent_forwards = 4;  // Engine steps encoding/executing at once (ForwardScheduler)
+    int prefill_chunk_tokens = MLX_DEFAULT_PREFILL_CHUNK_TOKENS;  // Most tokens one sequence adds per step
+    int max_step_tokens = 2048;  // Packed rows per step across all sequences
+    int64_t kv_budget_bytes = 0;  // Cap on allocated KV blocks; 0 = the whole pool (MLXSetMemoryBudget)
+    int64_t activation_arena_bytes = 0;  // Idle activation buffers kept for reuse; 0 = sized from the shapes (ActivationArena)
+
+    // Tensor parallelism: each rank holds 1/tp_size of every layer's heads and MLP columns (TensorParallelGroup)
+    int tp_rank = 0;
+    int tp_size = 1;
+    std::vector<std::string> tp_peers;  // Rank 0: host:port of ranks 1..tp_size-1 (MLXLoadOptions)
+    std::string pipeline_cache_dir;  // Pipeline archive directory (MLXLoadOptions); "" = $TMPDIR or /tmp
+
+    // Vision tower (Qwen2-VL ViT), loaded when bin_weights has vision.* files
+    int vision_depth = 32;
+    int vision_embed_dim = 1280;
+    int vision_num_heads = 16;
+    int vision_mlp_dim = 5120;           // embed_dim * mlp_ratio
+    int vision_patch_size = 14;
+    int vision_temporal_patch_size = 2;
+    int vision_spatial_merge_size = 2;   // Patches merged per side into one LLM token
+    int vision_merger_dim = 5120;        // embed_dim * spatial_merge_size^2
+    float vision_rope_theta = 10000.0f;
+    float vision_norm_eps = 1e-6f;
+    uint32_t image_token_id = 151655;    // <|image_pad|> placeholder, one per merged patch
+    int64_t image_cache_budget_bytes = 512ll << 20;  // Encoded screenshots kept (MLXSetImageCacheBudget)
+
+    // GUI-Actor pointer head (VisionHead_MultiPatch), loaded when bin_weights has pointer.* files
+    int pointer_num_heads = 8;
+    int pointer_proj_dim = 0;         // Projection MLP width; 0 = hidden_size
+    float pointer_norm_eps = 1e-5f;
+};
+
+// On-device sampling controls; layout mirrors SamplingParams in mlx_kernels.metal
+struct SamplingParams {
+    float temperature;      // <= 0: greedy
+    int32_t top_k;          // <= 0: no top-k limit
+    float top_p;            // >= 1: no nucleus limit
+    uint32_t seed_lo;
+    uint32_t seed_hi;
+    uint32_t num_logprobs;  // Top (id, logprob) pairs to return, <= MLX_MAX_SAMPLE_CANDIDATES
+    uint32_t position;      // KV position of the token behind logits row 0; row r draws at position + r
+};
+
+// Result of a sampled forward pass
+struct SampleResult {
+    uint32_t token;
+    std::vector<uint32_t> top_ids;
+    std::vector<float> top_logprobs;
 };
 
-// Global model and Metal device
+// Weight conversion helpers (load time, CPU)
+
+// fp32 -> bf16 with round-to-nearest-even
+inline uint16_t float_to_bf16(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    if ((bits & 0x7fffffff) > 0x7f800000) {
+        return static_cast<uint16_t>((bits >> 16) | 0x0040);  // keep NaN quiet
+    }
+    bits += 0x7fff + ((bits >> 16) & 1);
+    return static_cast<uint16_t>(bits >> 16);
+}
+
+// Asymmetric group-wise quantization to `bits` (8 or 4) bits
+// Each group of group_size consecutive values gets scale = range / qmax and an
+// integer zero point, with the range widened to include 0 so zero is exact.
+// 4-bit values are packed two per byte, even element in the low nibble.
+inline void quantize_groups(const float* src, size_t count, int group_size, int bits,
+                            uint8_t* dst, _Float16* scales, _Float16* zeros) {
+    const int qmax = (1 << bits) - 1;
+    size_t num_groups = count / group_size;
+    dispatch_apply(num_groups, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t g) {
+        const float* x = src + g * group_size;
+        float lo = 0.0f, hi = 0.0f;
+        for (int i = 0; i < group_size; i++) {
+            lo = std::min(lo, x[i]);
+            hi = std::max(hi, x[i]);
+        }
+        _Float16 scale_h = static_cast<_Float16>(hi > lo ? (hi - lo) / qmax : 1.0f);
+        float scale = static_cast<float>(scale_h);
+        if (scale == 0.0f) scale = 1.0f;  // range underflowed fp16
+        float zero = std::clamp(std::round(-lo / scale), 0.0f, static_cast<float>(qmax));
+        scales[g] = static_cast<_Float16>(scale);
+        zeros[g] = static_cast<_Float16>(zero);
+
+        auto quantize = [&](float v) {
+            return static_cast<uint8_t>(std::clamp(std::round(v / scale) + zero, 0.0f, static_cast<float>(qmax)));
+        };
+        if (bits == 8) {
+            for (int i = 0; i < group_size; i++) dst[g * group_size + i] = quantize(x[i]);
+        } else {
+            for (int i = 0; i < group_size; i += 2) {
+                dst[(g * group_size + i) / 2] = quantize(x[i]) | (quantize(x[i + 1]) << 4);
+            }
+        }
+    });
+}
+
+// Metal device shared by every loaded model (see ModelRegistry)
 static id<MTLDevice> g_device = nil;
-static std::shared_ptr<class Qwen2VLModel> g_model;
-static std::mutex g_model_mutex;
 
-// KV Cache Entry
-struct KVCache {
-    uint64_t id;
-    std::vector<float> logits;
-    std::vector<uint32_t> tokens;
-    std::vector<std::vector<float>> key_cache;  // [layer][seq_len * kv_heads * head_dim]
-    std::vector<std::vector<float>> value_cache; // [layer][seq_len * kv_heads * head_dim]
-    std::shared_ptr<KVCache> parent;
-    int ref_count;
-    int seq_length;
+// Admission control for concurrent forward passes
+//
+// Each admitted caller encodes its own command buffers on its own thread and
+// submits them to the model's shared queue, so host-side work (embedding,
+// block tables, encoding) overlaps across requests. The scheduler only bounds
+// how many forwards are in flight at once, since each holds its activations
+// alive, and admits waiters in arrival order so a burst of long prefills
+// cannot starve the requests queued behind it.
+class ForwardScheduler {
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    int max_in_flight_;
+    int in_flight_ = 0;
+    uint64_t next_ticket_ = 0;
+    uint64_t now_serving_ = 0;
 
-    KVCache(uint64_t _id, const std::vector<uint32_t>& _tokens,
-            std::shared_ptr<KVCache> _parent = nullptr, int seq_len = 0, int num_layers = 28)
-        : id(_id), tokens(_tokens), parent(_parent), ref_count(1), seq_length(seq_len) {
-        key_cache.resize(num_layers);
-        value_cache.resize(num_layers);
+    void Release() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            in_flight_--;
+        }
+        cv_.notify_all();
     }
 
-    std::vector<uint32_t> GetFullTokenSequence() const {
-        std::vector<uint32_t> result;
-        auto current = this;
-        while (current) {
-            result.insert(result.begin(), current->tokens.begin(), current->tokens.end());
-            current = current->parent.get();
+public:
+    explicit ForwardScheduler(int max_in_flight) : max_in_flight_(std::max(max_in_flight, 1)) {}
+
+    // RAII admission; the slot is released when the Slot is destroyed
+    class Slot {
+    private:
+        ForwardScheduler* scheduler_;
+
+    public:
+        explicit Slot(ForwardScheduler* scheduler) : scheduler_(scheduler) {}
+        Slot(Slot&& other) noexcept : scheduler_(other.scheduler_) { other.scheduler_ = nullptr; }
+        Slot(const Slot&) = delete;
+        Slot& operator=(const Slot&) = delete;
+        ~Slot() {
+            if (scheduler_) scheduler_->Release();
         }
-        return result;
+    };
+
+    // Blocks until this caller is first in line and a slot is free
+    Slot Acquire() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        uint64_t ticket = next_ticket_++;
+        cv_.wait(lock, [&] { return ticket == now_serving_ && in_flight_ < max_in_flight_; });
+        now_serving_++;
+        in_flight_++;
+        lock.unlock();
+        cv_.notify_all();  // the next ticket may also fit
+        return Slot(this);
     }
 };
 
-// Cache Registry
-class CacheRegistry {
+// Thrown when the KV block pool cannot satisfy an allocation
+struct OutOfMemoryError : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// Paged KV storage
+//
+// K and V live in one MTLBuffer slab per layer, carved into fixed-size blocks
+// of block_size tokens: slot s of block b starts at ((b * block_size) + s) * kv_dim.
+// The same block id addresses every layer's slab, so a block table describes a
+// sequence's K/V for the whole model. Blocks are refcounted so that forks and
+// slices share their prefix instead of copying it.
+//
+// Allocation is capped by a budget (in blocks, set in bytes) that can sit below
+// the slab capacity, so a host can bound KV memory and lower it at runtime;
+// blocks already handed out are never reclaimed by lowering it.
+//
+// A mirrored pool is rank 0's view of a tensor-parallel group: every rank holds
+// slabs for its own KV heads under the same block ids, so allocation happens
+// here only and the host-side block copies are logged for the other ranks.
+class KVBlockPool {
 private:
-    std::unordered_map<uint64_t, std::shared_ptr<KVCache>> caches_;
+    int num_layers_;
+    int kv_dim_;
+    int block_size_;
+    int num_blocks_;
+    int budget_blocks_;
+    std::vector<id<MTLBuffer>> key_slabs_;
+    std::vector<id<MTLBuffer>> value_slabs_;
+    std::vector<int> ref_counts_;
+    std::vector<int32_t> free_list_;
+    bool mirrored_;
+    std::vector<int32_t> copy_log_;  // (src, dst, slots) of CopyBlock calls not yet taken, mirrored pools only
     std::mutex mutex_;
-    uint64_t next_id_ = 1;
 
 public:
-    uint64_t Insert(std::shared_ptr<KVCache> cache) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        cache->id = next_id_++;
-        caches_[cache->id] = cache;
-        return cache->id;
+    KVBlockPool(int num_layers, int kv_dim, int block_size, int num_blocks, bool mirrored = false)
+        : num_layers_(num_layers), kv_dim_(kv_dim), block_size_(block_size),
+          num_blocks_(num_blocks), budget_blocks_(num_blocks), ref_counts_(num_blocks, 0), mirrored_(mirrored) {
+        NSUInteger slab_bytes = static_cast<NSUInteger>(num_blocks) * block_size * kv_dim * sizeof(float);
+        for (int layer = 0; layer < num_layers; layer++) {
+            id<MTLBuffer> k = [g_device newBufferWithLength:slab_bytes options:MTLResourceStorageModeShared];
+            id<MTLBuffer> v = [g_device newBufferWithLength:slab_bytes options:MTLResourceStorageModeShared];
+            if (!k || !v) throw OutOfMemoryError("Failed to allocate KV cache slabs");
+            key_slabs_.push_back(k);
+            value_slabs_.push_back(v);
+        }
+        // Hand out low block ids first
+        free_list_.reserve(num_blocks);
+        for (int32_t b = num_blocks - 1; b >= 0; b--) free_list_.push_back(b);
     }
 
-    std::shared_ptr<KVCache> Get(uint64_t id) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        auto it = caches_.find(id);
-        return it != caches_.end() ? it->second : nullptr;
+    int block_size() const { return block_size_; }
+    int kv_dim() const { return kv_dim_; }
+    int num_layers() const { return num_layers_; }
+    int num_blocks() const { return num_blocks_; }
+    bool mirrored() const { return mirrored_; }
+
+    // K and V of one block across every layer
+    int64_t block_bytes() const {
+        return static_cast<int64_t>(num_layers_) * 2 * block_size_ * kv_dim_ * sizeof(float);
     }
 
-    void Remove(uint64_t id) {
+    int32_t Allocate() {
         std::lock_guard<std::mutex> lock(mutex_);
-        auto it = caches_.find(id);
-        if (it != caches_.end()) {
-            it->second->ref_count--;
-            if (it->second->ref_count <= 0) caches_.erase(it);
+        if (free_list_.empty()) throw OutOfMemoryError("KV cache block pool exhausted");
+        if (num_blocks_ - static_cast<int>(free_list_.size()) >= budget_blocks_) {
+            throw OutOfMemoryError("KV cache memory budget exceeded");
         }
+        int32_t block = free_list_.back();
+        free_list_.pop_back();
+        ref_counts_[block] = 1;
+        return block;
     }
 
-    void Ref(uint64_t id) {
+    void Retain(int32_t block) {
         std::lock_guard<std::mutex> lock(mutex_);
-        auto it = caches_.find(id);
-        if (it != caches_.end()) it->second->ref_count++;
+        ref_counts_[block]++;
     }
-};
 
-static CacheRegistry g_registry;
+    void Release(int32_t block) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--ref_counts_[block] == 0) free_list_.push_back(block);
+    }
 
-// Qwen2-VL Model with complete forward pass
-class Qwen2VLModel {
-private:
-    ModelConfig config_;
-    std::unordered_map<std::string, std::vector<float>> weights_;
+    bool IsShared(int32_t block) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return ref_counts_[block] > 1;
+    }
 
-    // Metal compute pipelines
-    id<MTLComputePipelineState> matmul_pipeline_;
-    id<MTLComputePipelineState> rmsnorm_pipeline_;
-    id<MTLComputePipelineState> gelu_pipeline_;
-    id<MTLComputePipelineState> rope_pipeline_;
-    id<MTLComputePipelineState> transpose_pipeline_;
-    id<MTLComputePipelineState> softmax_pipeline_;
-    id<MTLComputePipelineState> scale_pipeline_;
-    id<MTLComputePipelineState> add_pipeline_;
+    int FreeBlocks() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return static_cast<int>(free_list_.size());
+    }
 
-    void init_metal() {
-        if (!g_device) {
-            g_device = MTLCreateSystemDefaultDevice();
-            if (!g_device) {
-                throw std::runtime_error("Failed to create Metal device");
-            }
-        }
+    // Caps allocation at budget_bytes (rounded down to whole blocks); <= 0 or
+    // anything above capacity means the whole pool
+    void SetBudgetBytes(int64_t budget_bytes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        int64_t blocks = budget_bytes / block_bytes();
+        budget_blocks_ = budget_bytes <= 0 || blocks > num_blocks_ ? num_blocks_ : static_cast<int>(blocks);
+    }
 
-        NSError* error = nil;
+    struct Usage {
+        int used_blocks;
+        int budget_blocks;
+        int num_blocks;
+    };
 
-        // Comprehensive Metal shader library with all kernels
-        NSString* shaderSource = [NSString stringWithUTF8String:R"(
-            #include <metal_stdlib>
-            using namespace metal;
-
-            // Matrix multiplication kernel
-            kernel void matmul_kernel(
-                const device float* A [[buffer(0)]],
-                const device float* B [[buffer(1)]],
-                device float* C [[buffer(2)]],
-                constant uint& M [[buffer(3)]],
-                constant uint& N [[buffer(4)]],
-                constant uint& K [[buffer(5)]],
-                uint2 gid [[thread_position_in_grid]]) {
-                uint m = gid.x, n = gid.y;
-                if (m >= M || n >= N) return;
-                float sum = 0.0;
-                for (uint k = 0; k < K; k++)
-                    sum += A[m * K + k] * B[k * N + n];
-                C[m * N + n] = sum;
-            }
-
-            // RMSNorm kernel: y = x / sqrt(mean(x^2) + eps) * weight
-            kernel void rmsnorm_kernel(
-                const device float* x [[buffer(0)]],
-                const device float* weight [[buffer(1)]],
-                device float* y [[buffer(2)]],
-                constant uint& size [[buffer(3)]],
-                constant float& eps [[buffer(4)]],
-                uint gid [[thread_position_in_grid]]) {
-                if (gid >= size) return;
-                float sum_sq = 0.0;
-                for (uint i = 0; i < size; i++)
-                    sum_sq += x[i] * x[i];
-                float variance = sum_sq / (float)size + eps;
-                float rsqrt = 1.0 / sqrt(variance);
-                y[gid] = x[gid] * rsqrt * weight[gid];
-            }
-
-            // GeLU activation kernel (approximate)
-            kernel void gelu_kernel(
-                const device float* x [[buffer(0)]],
-                device float* y [[buffer(1)]],
-                uint gid [[thread_position_in_grid]]) {
-                float x_val = x[gid];
-                y[gid] = 0.5 * x_val * (1.0 + tanh(0.7978845608 * x_val * (1.0 + 0.044715 * x_val * x_val)));
-            }
-
-            // Rotary Position Embedding (RoPE) kernel
-            kernel void rope_kernel(
-                device float* q [[buffer(0)]],
-                device float* k [[buffer(1)]],
-                constant uint& seq_len [[buffer(2)]],
-                constant uint& num_heads [[buffer(3)]],
-                constant uint& head_dim [[buffer(4)]],
-                constant uint& position [[buffer(5)]],
-                constant float& theta [[buffer(6)]],
-                uint3 gid [[thread_position_in_grid]]) {
-                uint head = gid.x;
-                uint token = gid.y;
-                uint half_dim = gid.z;
-
-                if (head >= num_heads || token >= seq_len || half_dim >= head_dim / 2) return;
-
-                float freq = 1.0 / pow(theta, (2.0 * half_dim) / head_dim);
-                float angle = position * freq;
-                float cos_a = cos(angle);
-                float sin_a = sin(angle);
-
-                uint offset = (token * num_heads + head) * head_dim;
-                uint i = half_dim;
-                uint j = half_dim + head_dim / 2;
-
-                float q_i = q[offset + i];
-                float q_j = q[offset + j];
-                q[offset + i] = q_i * cos_a - q_j * sin_a;
-                q[offset + j] = q_i * sin_a + q_j * cos_a;
-
-                float k_i = k[offset + i];
-                float k_j = k[offset + j];
-                k[offset + i] = k_i * cos_a - k_j * sin_a;
-                k[offset + j] = k_i * sin_a + k_j * cos_a;
-            }
-
-            // Transpose kernel for matrix operations
-            kernel void transpose_kernel(
-                const device float* A [[buffer(0)]],
-                device float* B [[buffer(1)]],
-                constant uint& M [[buffer(2)]],
-                constant uint& N [[buffer(3)]],
-                uint2 gid [[thread_position_in_grid]]) {
-                uint m = gid.x, n = gid.y;
-                if (m >= M || n >= N) return;
-                B[n * M + m] = A[m * N + n];
-            }
-
-            // Softmax kernel (for attention scores)
-            kernel void softmax_kernel(
-                const device float* x [[buffer(0)]],
-                device float* y [[buffer(1)]],
-                constant uint& seq_len [[buffer(2)]],
-                uint2 gid [[thread_position_in_grid]]) {
-                uint head = gid.x;
-                uint query_pos = gid.y;
-
-                if (query_pos >= seq_len) return;
-
-                uint offset = (query_pos * seq_len);
-
-                // Find max for numerical stability
-                float max_val = x[offset];
-                for (uint i = 1; i < seq_len; i++) {
-                    if (x[offset + i] > max_val) max_val = x[offset + i];
-                }
+    Usage GetUsage() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return {num_blocks_ - static_cast<int>(free_list_.size()), budget_blocks_, num_blocks_};
+    }
 
-                // Compute exp sum
-                float sum_exp = 0.0;
-                for (uint i = 0; i < seq_len; i++) {
-                    sum_exp += exp(x[offset + i] - max_val);
-                }
+    // Blocks of `table` no other table references: what releasing it frees
+    int ExclusiveBlocks(const std::vector<int32_t>& table) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        int count = 0;
+        for (int32_t block : table) {
+            if (ref_counts_[block] == 1) count++;
+        }
+        return count;
+    }
 
-                // Apply softmax
-                for (uint i = 0; i < seq_len; i++) {
-                    y[offset + i] = exp(x[offset + i] - max_val) / sum_exp;
-                }
-            }
+    float* KeyBlock(int layer, int32_t block) {
+        return static_cast<float*>([key_slabs_[layer] contents]) + static_cast<size_t>(block) * block_size_ * kv_dim_;
+    }
 
-            // Scale kernel
-            kernel void scale_kernel(
-                const device float* x [[buffer(0)]],
-                device float* y [[buffer(1)]],
-                constant float& scale [[buffer(2)]],
-                uint gid [[thread_position_in_grid]]) {
-                y[gid] = x[gid] * scale;
-            }
+    float* ValueBlock(int layer, int32_t block) {
+        return static_cast<float*>([value_slabs_[layer] contents]) + static_cast<size_t>(block) * block_size_ * kv_dim_;
+    }
 
-            // Element-wise add kernel
-            kernel void add_kernel(
-                const device float* a [[buffer(0)]],
-                const device float* b [[buffer(1)]],
-                device float* c [[buffer(2)]],
-                uint gid [[thread_position_in_grid]]) {
-                c[gid] = a[gid] + b[gid];
-            }
-        )"];
+    id<MTLBuffer> KeySlab(int layer) const { return key_slabs_[layer]; }
+    id<MTLBuffer> ValueSlab(int layer) const { return value_slabs_[layer]; }
 
-        id<MTLLibrary> library = [g_device newLibraryWithSource:shaderSource options:nil error:&error];
-        if (!library) {
-            NSString* errStr = [error localizedDescription];
-            throw std::runtime_error([errStr UTF8String]);
+    // Copies the first `slots` token slots of every layer from src to dst
+    void CopyBlock(int32_t src, int32_t dst, int slots) {
+        size_t bytes = static_cast<size_t>(slots) * kv_dim_ * sizeof(float);
+        for (int layer = 0; layer < num_layers_; layer++) {
+            memcpy(KeyBlock(layer, dst), KeyBlock(layer, src), bytes);
+            memcpy(ValueBlock(layer, dst), ValueBlock(layer, src), bytes);
         }
-
-        // Create all pipeline states
-        matmul_pipeline_ = [g_device newComputePipelineStateWithFunction:[library newFunctionWithName:@"matmul_kernel"] error:&error];
-        rmsnorm_pipeline_ = [g_device newComputePipelineStateWithFunction:[library newFunctionWithName:@"rmsnorm_kernel"] error:&error];
-        gelu_pipeline_ = [g_device newComputePipelineStateWithFunction:[library newFunctionWithName:@"gelu_kernel"] error:&error];
-        rope_pipeline_ = [g_device newComputePipelineStateWithFunction:[library newFunctionWithName:@"rope_kernel"] error:&error];
-        transpose_pipeline_ = [g_device newComputePipelineStateWithFunction:[library newFunctionWithName:@"transpose_kernel"] error:&error];
-        softmax_pipeline_ = [g_device newComputePipelineStateWithFunction:[library newFunctionWithName:@"softmax_kernel"] error:&error];
-        scale_pipeline_ = [g_device newComputePipelineStateWithFunction:[library newFunctionWithName:@"scale_kernel"] error:&error];
-        add_pipeline_ = [g_device newComputePipelineStateWithFunction:[library newFunctionWithName:@"add_kernel"] error:&error];
-
-        if (!matmul_pipeline_ || !rmsnorm_pipeline_ || !gelu_pipeline_ ||
-            !rope_pipeline_ || !transpose_pipeline_ || !softmax_pipeline_ ||
-            !scale_pipeline_ || !add_pipeline_) {
-            throw std::runtime_error("Failed to create Metal pipelines");
+        if (mirrored_) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            copy_log_.insert(copy_log_.end(), {src, dst, slots});
         }
     }
 
-    // Helper: Execute Metal kernel with 1D grid
-    void execute_1d(id<MTLComputePipelineState> pipeline, const std::vector<id<MTLBuffer>>& buffers, uint gridSize) {
-        @autoreleasepool {
-            id<MTLCommandQueue> queue = [g_device newCommandQueue];
-            id<MTLCommandBuffer> command_buffer = [queue commandBuffer];
-            id<MTLComputeCommandEncoder> encoder = [command_buffer computeCommandEncoder];
+    // Copies logged since the last call, for the other ranks to replay before their next step
+    std::vector<int32_t> TakeCopies() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return std::exchange(copy_log_, {});
+    }
+};
 
-            [encoder setComputePipelineState:pipeline];
-            for (size_t i = 0; i < buffers.size(); i++) {
-                [encoder setBuffer:buffers[i] offset:0 atIndex:i];
-            }
+// Bytes of offloaded K/V held outside every pool, by tier (for MLXGetMemoryStats)
+static std::atomic<int64_t> g_host_offload_bytes{0};
+static std::atomic<int64_t> g_disk_offload_bytes{0};
+static std::atomic<uint64_t> g_offload_file_counter{0};
+
+// Writes all of data; false on any short write
+static bool WriteFully(int fd, const void* data, size_t bytes) {
+    const char* src = static_cast<const char*>(data);
+    while (bytes > 0) {
+        ssize_t n = write(fd, src, bytes);
+        if (n <= 0) return false;
+        src += n;
+        bytes -= static_cast<size_t>(n);
+    }
+    return true;
+}
 
-            MTLSize threadsPerThreadgroup = {256, 1, 1};
-            MTLSize threadgroups = {(gridSize + 255) / 256, 1, 1};
-            [encoder dispatchThreadgroups:threadgroups threadsPerThreadgroup:threadsPerThreadgroup];
-            [encoder endEncoding];
-            [command_buffer commit];
-            [command_buffer waitUntilCompleted];
-        }
+// Reads exactly `bytes`; false on EOF or error first
+static bool ReadFully(int fd, void* data, size_t bytes) {
+    char* dst = static_cast<char*>(data);
+    while (bytes > 0) {
+        ssize_t n = read(fd, dst, bytes);
+        if (n <= 0) return false;
+        dst += n;
+        bytes -= static_cast<size_t>(n);
     }
+    return true;
+}
 
-    // Helper: Execute Metal kernel with 2D grid
-    void execute_2d(id<MTLComputePipelineState> pipeline, const std::vector<id<MTLBuffer>>& buffers, MTLSize gridSize) {
-        @autoreleasepool {
-            id<MTLCommandQueue> queue = [g_device newCommandQueue];
-            id<MTLCommandBuffer> command_buffer = [queue commandBuffer];
-            id<MTLComputeCommandEncoder> encoder = [command_buffer computeCommandEncoder];
+// Cache snapshot file (MLXExportCache)
+//
+// Header, then the token sequence, then K/V in the offload layout starting at
+// a page-aligned data_offset, so an import maps the file and serves it as a
+// disk-tier handle without reading it.
+static constexpr uint32_t kCacheSnapshotMagic = 0x564b4c4d;  // "MLKV"
+static constexpr uint32_t kCacheSnapshotVersion = 1;
+
+struct CacheSnapshotHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t fingerprint;  // Model (config and weights) the K/V was computed with
+    int32_t num_layers;
+    int32_t kv_dim;
+    int32_t block_size;
+    int32_t seq_length;
+    int32_t rope_delta;
+    uint32_t num_blocks;
+    uint64_t data_offset;
+};
 
-            [encoder setComputePipelineState:pipeline];
-            for (size_t i = 0; i < buffers.size(); i++) {
-                [encoder setBuffer:buffers[i] offset:0 atIndex:i];
-            }
+// KV Cache Entry
+//
+// A cache handle is a block table into the KVBlockPool covering positions
+// [0, seq_length). Children start from a copy of their parent's table (sharing
+// every block) and only allocate blocks for their own tokens; a partially
+// filled shared tail block is copied before it is written (copy-on-write).
+//
+// A published handle can be offloaded: its K/V is copied out to a host buffer
+// (MLX_CACHE_TIER_HOST) or an mmap'd spill file (MLX_CACHE_TIER_DISK) and its
+// blocks are released to the pool. Forking an offloaded handle restores it
+// first, into fresh blocks that no longer share its former prefix.
+struct KVCache {
+    uint64_t id;                       // Registry handle, set by CacheRegistry::Insert
+    std::vector<uint32_t> tokens;      // Full token sequence visible through this handle
+    std::vector<int32_t> block_table;  // Block ids for positions [0, seq_length); empty while offloaded
+    std::shared_ptr<KVBlockPool> pool;
+    uint64_t model;  // Fingerprint of the model the K/V was computed with (pools can be shared)
+    int seq_length;
+    int rope_delta;  // RoPE position minus KV position for text tokens (nonzero after M-RoPE image spans)
+
+    // Offloaded K/V: blocks in table order, each laid out [layer][K, V][block_size * kv_dim]
+    int tier = MLX_CACHE_TIER_DEVICE;
+    size_t offloaded_blocks = 0;
+    std::vector<float> host_kv;    // MLX_CACHE_TIER_HOST
+    std::string disk_path;         // MLX_CACHE_TIER_DISK: file mapped read-only at disk_map
+    bool disk_owned = false;       // Spill file (deleted with the handle) rather than an imported snapshot
+    void* disk_map = nullptr;
+    size_t disk_map_bytes = 0;
+    const float* disk_kv = nullptr;  // K/V within disk_map
+    size_t disk_bytes = 0;
+    std::mutex residency_mutex;    // Guards block_table and the offload state of published handles
+
+    KVCache(uint64_t _id, std::shared_ptr<KVBlockPool> _pool, uint64_t _model)
+        : id(_id), pool(std::move(_pool)), model(_model), seq_length(0), rope_delta(0) {}
+
+    KVCache(const KVCache&) = delete;
+    KVCache& operator=(const KVCache&) = delete;
+
+    ~KVCache() {
+        for (int32_t block : block_table) pool->Release(block);
+        DropOffloaded();
+    }
 
-            MTLSize threadsPerThreadgroup = {16, 16, 1};
-            [encoder dispatchThreadgroups:gridSize threadsPerThreadgroup:threadsPerThreadgroup];
-            [encoder endEncoding];
-            [command_buffer commit];
-            [command_buffer waitUntilCompleted];
+    // New handle sharing the first keep_tokens positions of `base`
+    static std::shared_ptr<KVCache> Fork(KVCache& base, int keep_tokens) {
+        std::lock_guard<std::mutex> lock(base.residency_mutex);
+        base.RestoreLocked();
+        auto cache = std::make_shared<KVCache>(0, base.pool, base.model);
+        int bs = base.pool->block_size();
+        size_t keep_blocks = (keep_tokens + bs - 1) / bs;
+        cache->block_table.assign(base.block_table.begin(), base.block_table.begin() + keep_blocks);
+        for (int32_t block : cache->block_table) cache->pool->Retain(block);
+        cache->tokens.assign(base.tokens.begin(), base.tokens.begin() + keep_tokens);
+        cache->seq_length = keep_tokens;
+        cache->rope_delta = base.rope_delta;
+        return cache;
+    }
+
+    // Reserves slots for new tokens at positions [seq_length, seq_length + n)
+    void Append(const uint32_t* new_tokens, int n) {
+        int bs = pool->block_size();
+        int used = seq_length % bs;
+        if (used != 0 && pool->IsShared(block_table.back())) {
+            int32_t copy = pool->Allocate();
+            pool->CopyBlock(block_table.back(), copy, used);
+            pool->Release(block_table.back());
+            block_table.back() = copy;
         }
+        size_t needed = (seq_length + n + bs - 1) / bs;
+        while (block_table.size() < needed) block_table.push_back(pool->Allocate());
+        tokens.insert(tokens.end(), new_tokens, new_tokens + n);
+        seq_length += n;
     }
 
-    // Helper: Execute Metal kernel with 3D grid
-    void execute_3d(id<MTLComputePipelineState> pipeline, const std::vector<id<MTLBuffer>>& buffers, MTLSize gridSize) {
-        @autoreleasepool {
-            id<MTLCommandQueue> queue = [g_device newCommandQueue];
-            id<MTLCommandBuffer> command_buffer = [queue commandBuffer];
-            id<MTLComputeCommandEncoder> encoder = [command_buffer computeCommandEncoder];
+    std::vector<uint32_t> GetFullTokenSequence() const {
+        return tokens;
+    }
 
-            [encoder setComputePipelineState:pipeline];
-            for (size_t i = 0; i < buffers.size(); i++) {
-                [encoder setBuffer:buffers[i] offset:0 atIndex:i];
+    // Moves the K/V out of the pool to `target` (host or disk); a handle already
+    // at or below that tier is left alone. Spill files go in `directory`.
+    void Offload(int target, const std::string& directory) {
+        std::lock_guard<std::mutex> lock(residency_mutex);
+        if (target <= tier) return;
+        if (pool->mirrored()) throw std::runtime_error("Tensor-parallel caches cannot be offloaded");
+
+        if (tier == MLX_CACHE_TIER_DEVICE) {
+            size_t block_elems = static_cast<size_t>(pool->block_size()) * pool->kv_dim();
+            std::vector<float> data(block_table.size() * pool->num_layers() * 2 * block_elems);
+            float* dst = data.data();
+            for (int32_t block : block_table) {
+                for (int layer = 0; layer < pool->num_layers(); layer++) {
+                    memcpy(dst, pool->KeyBlock(layer, block), block_elems * sizeof(float));
+                    dst += block_elems;
+                    memcpy(dst, pool->ValueBlock(layer, block), block_elems * sizeof(float));
+                    dst += block_elems;
+                }
             }
+            host_kv = std::move(data);
+            g_host_offload_bytes += static_cast<int64_t>(host_kv.size() * sizeof(float));
+            for (int32_t block : block_table) pool->Release(block);
+            offloaded_blocks = block_table.size();
+            block_table.clear();
+            tier = MLX_CACHE_TIER_HOST;
+        }
 
-            MTLSize threadsPerThreadgroup = {8, 8, 8};
-            [encoder dispatchThreadgroups:gridSize threadsPerThreadgroup:threadsPerThreadgroup];
-            [encoder endEncoding];
-            [command_buffer commit];
-            [command_buffer waitUntilCompleted];
+        if (target == MLX_CACHE_TIER_DISK && tier == MLX_CACHE_TIER_HOST) {
+            size_t bytes = host_kv.size() * sizeof(float);
+            std::string path = directory + "/kv-" + std::to_string(getpid()) + "-" +
+                               std::to_string(g_offload_file_counter++) + ".bin";
+            int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+            if (fd < 0) throw std::runtime_error("Failed to create KV spill file: " + path);
+            if (!WriteFully(fd, host_kv.data(), bytes)) {
+                close(fd);
+                unlink(path.c_str());
+                throw std::runtime_error("Failed to write KV spill file: " + path);
+            }
+            void* mapped = bytes ? mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0) : nullptr;
+            close(fd);
+            if (mapped == MAP_FAILED) {
+                unlink(path.c_str());
+                throw std::runtime_error("Failed to map KV spill file: " + path);
+            }
+            disk_path = path;
+            disk_owned = true;
+            disk_map = mapped;
+            disk_map_bytes = bytes;
+            disk_kv = static_cast<const float*>(mapped);
+            disk_bytes = bytes;
+            g_disk_offload_bytes += static_cast<int64_t>(bytes);
+            g_host_offload_bytes -= static_cast<int64_t>(bytes);
+            std::vector<float>().swap(host_kv);
+            tier = MLX_CACHE_TIER_DISK;
         }
     }
 
-    // Matrix multiplication on Metal
-    std::vector<float> matmul(const std::vector<float>& A, const std::vector<float>& B, int M, int N, int K) {
-        std::vector<float> C(M * N, 0.0f);
-
-        @autoreleasepool {
-            id<MTLBuffer> bufferA = [g_device newBufferWithBytes:A.data() length:A.size() * sizeof(float) options:0];
-            id<MTLBuffer> bufferB = [g_device newBufferWithBytes:B.data() length:B.size() * sizeof(float) options:0];
-            id<MTLBuffer> bufferC = [g_device newBufferWithLength:C.size() * sizeof(float) options:0];
-
-            uint M_val = M, N_val = N, K_val = K;
-            id<MTLBuffer> sizeBuffers[] = {
-                [g_device newBufferWithBytes:&M_val length:sizeof(M_val) options:0],
-                [g_device newBufferWithBytes:&N_val length:sizeof(N_val) options:0],
-                [g_device newBufferWithBytes:&K_val length:sizeof(K_val) options:0]
-            };
+    // Brings offloaded K/V back into fresh pool blocks
+    void Restore() {
+        std::lock_guard<std::mutex> lock(residency_mutex);
+        RestoreLocked();
+    }
 
-            std::vector<id<MTLBuffer>> buffers = {bufferA, bufferB, bufferC, sizeBuffers[0], sizeBuffers[1], sizeBuffers[2]};
-            MTLSize gridSize = {static_cast<NSUInteger>(M), static_cast<NSUInteger>(N), 1};
-            execute_2d(matmul_pipeline_, buffers, gridSize);
+    int Tier() {
+        std::lock_guard<std::mutex> lock(residency_mutex);
+        return tier;
+    }
 
-            memcpy(C.data(), [bufferC contents], C.size() * sizeof(float));
+    // Writes tokens and K/V to `path` (via a temporary file and rename, so a
+    // reader never sees a partial snapshot and live mappings of an older
+    // snapshot at `path` stay intact). Works from any tier.
+    void WriteSnapshot(const std::string& path, uint64_t fingerprint) {
+        std::lock_guard<std::mutex> lock(residency_mutex);
+        if (pool->mirrored()) throw std::runtime_error("Tensor-parallel caches cannot be exported");
+        size_t block_elems = static_cast<size_t>(pool->block_size()) * pool->kv_dim();
+        size_t blocks = tier == MLX_CACHE_TIER_DEVICE ? block_table.size() : offloaded_blocks;
+
+        CacheSnapshotHeader header = {};
+        header.magic = kCacheSnapshotMagic;
+        header.version = kCacheSnapshotVersion;
+        header.fingerprint = fingerprint;
+        header.num_layers = pool->num_layers();
+        header.kv_dim = pool->kv_dim();
+        header.block_size = pool->block_size();
+        header.seq_length = seq_length;
+        header.rope_delta = rope_delta;
+        header.num_blocks = static_cast<uint32_t>(blocks);
+        size_t page = static_cast<size_t>(getpagesize());
+        size_t head_bytes = sizeof(header) + tokens.size() * sizeof(uint32_t);
+        header.data_offset = (head_bytes + page - 1) / page * page;
+
+        std::string tmp_path = path + ".tmp";
+        int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) throw std::runtime_error("Failed to create cache snapshot: " + path);
+        std::vector<char> padding(header.data_offset - head_bytes, 0);
+        bool ok = WriteFully(fd, &header, sizeof(header)) &&
+                  WriteFully(fd, tokens.data(), tokens.size() * sizeof(uint32_t)) &&
+                  WriteFully(fd, padding.data(), padding.size());
+        if (tier == MLX_CACHE_TIER_DEVICE) {
+            for (size_t b = 0; ok && b < blocks; b++) {
+                for (int layer = 0; ok && layer < pool->num_layers(); layer++) {
+                    ok = WriteFully(fd, pool->KeyBlock(layer, block_table[b]), block_elems * sizeof(float)) &&
+                         WriteFully(fd, pool->ValueBlock(layer, block_table[b]), block_elems * sizeof(float));
+                }
+            }
+        } else {
+            const float* src = tier == MLX_CACHE_TIER_HOST ? host_kv.data() : disk_kv;
+            ok = ok && WriteFully(fd, src, blocks * pool->num_layers() * 2 * block_elems * sizeof(float));
+        }
+        ok = ok && fsync(fd) == 0;
+        close(fd);
+        if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+            unlink(tmp_path.c_str());
+            throw std::runtime_error("Failed to write cache snapshot: " + path);
         }
-
-        return C;
     }
 
-    // RMSNorm on Metal
-    std::vector<float> rmsnorm(const std::vector<float>& x, const std::vector<float>& weight, int size, int rows) {
-        std::vector<float> y(x.size());
-
-        for (int row = 0; row < rows; row++) {
-            @autoreleasepool {
-                id<MTLBuffer> bufferX = [g_device newBufferWithBytes:x.data() + row * size length:size * sizeof(float) options:0];
-                id<MTLBuffer> bufferW = [g_device newBufferWithBytes:weight.data() length:size * sizeof(float) options:0];
-                id<MTLBuffer> bufferY = [g_device newBufferWithLength:size * sizeof(float) options:0];
-
-                uint size_val = size;
-                id<MTLBuffer> sizeBuffer = [g_device newBufferWithBytes:&size_val length:sizeof(size_val) options:0];
-                id<MTLBuffer> epsBuffer = [g_device newBufferWithBytes:&config_.rms_norm_eps length:sizeof(float) options:0];
+    // Maps a snapshot written by WriteSnapshot as a disk-tier handle of `pool`;
+    // its K/V is only read when the handle is first forked or prefetched
+    static std::shared_ptr<KVCache> ReadSnapshot(const std::string& path, std::shared_ptr<KVBlockPool> pool,
+                                                  uint64_t fingerprint) {
+        if (pool->mirrored()) throw std::runtime_error("Tensor-parallel caches cannot be imported");
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Failed to open cache snapshot: " + path);
+        struct stat st;
+        CacheSnapshotHeader header;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(CacheSnapshotHeader) ||
+            !ReadFully(fd, &header, sizeof(header))) {
+            close(fd);
+            throw std::runtime_error("Invalid cache snapshot: " + path);
+        }
+        size_t file_bytes = static_cast<size_t>(st.st_size);
+
+        // Validate the header before mapping: the file comes from disk (snapshot
+        // dirs are imported at startup), so every size is checked for overflow
+        const char* error = nullptr;
+        int bs = pool->block_size();
+        size_t block_floats = static_cast<size_t>(pool->num_layers()) * 2 * bs * pool->kv_dim();
+        size_t page = static_cast<size_t>(getpagesize());
+        size_t payload = 0;
+        if (header.magic != kCacheSnapshotMagic || header.version != kCacheSnapshotVersion) {
+            error = "Not a cache snapshot (or written by an incompatible version)";
+        } else if (header.fingerprint != fingerprint) {
+            error = "Cache snapshot was computed with a different model";
+        } else if (header.num_layers != pool->num_layers() || header.kv_dim != pool->kv_dim() ||
+                   header.block_size != bs) {
+            error = "Cache snapshot KV layout does not match the KV pool";
+        } else if (header.seq_length < 0 ||
+                   header.num_blocks != (static_cast<uint64_t>(header.seq_length) + bs - 1) / bs ||
+                   header.num_blocks > SIZE_MAX / sizeof(float) / block_floats ||
+                   header.data_offset % page != 0 ||
+                   sizeof(CacheSnapshotHeader) + static_cast<size_t>(header.seq_length) * sizeof(uint32_t) > header.data_offset ||
+                   header.data_offset > file_bytes ||
+                   (payload = header.num_blocks * block_floats * sizeof(float)) > file_bytes - header.data_offset) {
+            error = "Cache snapshot is truncated or corrupt";
+        }
+        if (error) {
+            close(fd);
+            throw std::runtime_error(std::string(error) + ": " + path);
+        }
+        void* mapped = mmap(nullptr, file_bytes, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) throw std::runtime_error("Failed to map cache snapshot: " + path);
+
+        auto cache = std::make_shared<KVCache>(0, std::move(pool), fingerprint);
+        const auto* snapshot_tokens = reinterpret_cast<const uint32_t*>(
+            static_cast<const char*>(mapped) + sizeof(CacheSnapshotHeader));
+        cache->tokens.assign(snapshot_tokens, snapshot_tokens + header.seq_length);
+        cache->seq_length = header.seq_length;
+        cache->rope_delta = header.rope_delta;
+        cache->tier = MLX_CACHE_TIER_DISK;
+        cache->offloaded_blocks = header.num_blocks;
+        cache->disk_path = path;
+        cache->disk_map = mapped;
+        cache->disk_map_bytes = file_bytes;
+        cache->disk_kv = reinterpret_cast<const float*>(static_cast<const char*>(mapped) + header.data_offset);
+        cache->disk_bytes = payload;
+        g_disk_offload_bytes += static_cast<int64_t>(cache->disk_bytes);
+        return cache;
+    }
 
-                std::vector<id<MTLBuffer>> buffers = {bufferX, bufferW, bufferY, sizeBuffer, epsBuffer};
-                execute_1d(rmsnorm_pipeline_, buffers, size);
+    // Flat pool slot (block * block_size + offset) for positions [start, start + count)
+    std::vector<int32_t> SlotMapping(int start, int count) const {
+        int bs = pool->block_size();
+        std::vector<int32_t> slots(count);
+        for (int i = 0; i < count; i++) {
+            int pos = start + i;
+            slots[i] = block_table[pos / bs] * bs + pos % bs;
+        }
+        return slots;
+    }
 
-                memcpy(y.data() + row * size, [bufferY contents], size * sizeof(float));
+private:
+    void RestoreLocked() {
+        if (tier == MLX_CACHE_TIER_DEVICE) return;
+        const float* src = tier == MLX_CACHE_TIER_HOST ? host_kv.data() : disk_kv;
+        size_t block_elems = static_cast<size_t>(pool->block_size()) * pool->kv_dim();
+        std::vector<int32_t> table;
+        table.reserve(offloaded_blocks);
+        try {
+            while (table.size() < offloaded_blocks) table.push_back(pool->Allocate());
+        } catch (...) {
+            for (int32_t block : table) pool->Release(block);
+            throw;
+        }
+        for (int32_t block : table) {
+            for (int layer = 0; layer < pool->num_layers(); layer++) {
+                memcpy(pool->KeyBlock(layer, block), src, block_elems * sizeof(float));
+                src += block_elems;
+                memcpy(pool->ValueBlock(layer, block), src, block_elems * sizeof(float));
+                src += block_elems;
             }
         }
-
-        return y;
+        block_table = std::move(table);
+        DropOffloaded();
+        tier = MLX_CACHE_TIER_DEVICE;
     }
 
-    // GeLU activation
-    std::vector<float> gelu(const std::vector<float>& x) {
-        std::vector<float> y(x.size());
-
-        @autoreleasepool {
-            id<MTLBuffer> bufferX = [g_device newBufferWithBytes:x.data() length:x.size() * sizeof(float) options:0];
-            id<MTLBuffer> bufferY = [g_device newBufferWithLength:y.size() * sizeof(float) options:0];
-
-            std::vector<id<MTLBuffer>> buffers = {bufferX, bufferY};
-            execute_1d(gelu_pipeline_, buffers, x.size());
-
-            memcpy(y.data(), [bufferY contents], y.size() * sizeof(float));
+    void DropOffloaded() {
+        if (tier == MLX_CACHE_TIER_HOST) {
+            g_host_offload_bytes -= static_cast<int64_t>(host_kv.size() * sizeof(float));
+            std::vector<float>().swap(host_kv);
+        } else if (tier == MLX_CACHE_TIER_DISK) {
+            if (disk_map) munmap(disk_map, disk_map_bytes);
+            if (disk_owned) unlink(disk_path.c_str());
+            g_disk_offload_bytes -= static_cast<int64_t>(disk_bytes);
+            disk_map = nullptr;
+            disk_map_bytes = 0;
+            disk_kv = nullptr;
+            disk_bytes = 0;
+            disk_path.clear();
+            disk_owned = false;
         }
-
-        return y;
+        offloaded_blocks = 0;
     }
+};
 
-    // Apply RoPE to Q and K
-    void apply_rope(std::vector<float>& q, std::vector<float>& k, int seq_len, int num_heads, int head_dim, int position) {
-        @autoreleasepool {
-            int num_kv_heads = num_heads / (config_.num_attention_heads / config_.num_key_value_heads);
-            MTLSize gridSize = {static_cast<NSUInteger>(num_heads), static_cast<NSUInteger>(seq_len), static_cast<NSUInteger>(head_dim / 2)};
-
-            id<MTLBuffer> bufferQ = [g_device newBufferWithBytes:q.data() length:q.size() * sizeof(float) options:0];
-            id<MTLBuffer> bufferK = [g_device newBufferWithBytes:k.data() length:k.size() * sizeof(float) options:0];
-
-            uint seq_len_val = seq_len, num_heads_val = num_heads, head_dim_val = head_dim, position_val = position;
-            float theta_val = config_.rope_theta;
-
-            id<MTLBuffer> buffers[] = {
-                bufferQ, bufferK,
-                [g_device newBufferWithBytes:&seq_len_val length:sizeof(seq_len_val) options:0],
-                [g_device newBufferWithBytes:&num_heads_val length:sizeof(num_heads_val) options:0],
-                [g_device newBufferWithBytes:&head_dim_val length:sizeof(head_dim_val) options:0],
-                [g_device newBufferWithBytes:&position_val length:sizeof(position_val) options:0],
-                [g_device newBufferWithBytes:&theta_val length:sizeof(theta_val) options:0]
-            };
+// Cache Registry
+//
+// Handles index a generation-tagged slot table: handle = generation << 32 | slot.
+// Each slot packs its generation and reference count into one atomic word, so
+// Get/Ref/Remove are a CAS on that word and never take a lock; a stale handle
+// (freed, or its slot reused) fails the generation check. Handle references
+// and Get's transient pin share the count, and whichever drops it to zero bumps
+// the generation and recycles the slot. Slots live in fixed-size segments that
+// are allocated on demand and never move; freed slots go on a tagged Treiber
+// stack, so only growing the table takes a lock.
+class CacheRegistry {
+private:
+    static constexpr uint32_t kSegmentBits = 12;
+    static constexpr uint32_t kSegmentSize = 1u << kSegmentBits;
+    static constexpr uint32_t kMaxSegments = 4096;  // 16M live handles
+    static constexpr uint64_t kLowMask = 0xffffffffull;
+    static constexpr uint64_t kHighOne = uint64_t(1) << 32;
+
+    struct Slot {
+        std::atomic<uint64_t> word{kHighOne};  // generation << 32 | refcount; generation 0 is never issued
+        std::atomic<uint32_t> next_free{0};    // Free-stack link (slot + 1, 0 = end)
+        std::shared_ptr<KVCache> cache;        // Written only while the slot is unpublished (refcount 0)
+    };
+
+    std::atomic<Slot*> segments_[kMaxSegments];
+    std::atomic<uint32_t> next_slot_{0};
+    std::atomic<uint64_t> free_head_{0};  // ABA tag << 32 | (slot + 1), 0 when empty
+    std::mutex grow_mutex_;
+
+    Slot* Find(uint32_t index) const {
+        if ((index >> kSegmentBits) >= kMaxSegments) return nullptr;
+        Slot* segment = segments_[index >> kSegmentBits].load(std::memory_order_acquire);
+        return segment ? &segment[index & (kSegmentSize - 1)] : nullptr;
+    }
 
-            execute_3d(rope_pipeline_, {buffers[0], buffers[1], buffers[2], buffers[3], buffers[4], buffers[5], buffers[6]}, gridSize);
+    uint32_t AllocateSlot() {
+        uint64_t head = free_head_.load(std::memory_order_acquire);
+        while (head & kLowMask) {
+            uint32_t index = static_cast<uint32_t>(head) - 1;
+            uint64_t next = ((head & ~kLowMask) + kHighOne) | Find(index)->next_free.load(std::memory_order_relaxed);
+            if (free_head_.compare_exchange_weak(head, next, std::memory_order_acquire, std::memory_order_acquire)) {
+                return index;
+            }
+        }
 
-            memcpy(q.data(), [bufferQ contents], q.size() * sizeof(float));
-            memcpy(k.data(), [bufferK contents], k.size() * sizeof(float));
+        uint32_t index = next_slot_.fetch_add(1, std::memory_order_relaxed);
+        if ((index >> kSegmentBits) >= kMaxSegments) throw OutOfMemoryError("Cache handle table is full");
+        if (!Find(index)) {
+            std::lock_guard<std::mutex> lock(grow_mutex_);
+            auto& segment = segments_[index >> kSegmentBits];
+            if (!segment.load(std::memory_order_relaxed)) {
+                segment.store(new Slot[kSegmentSize], std::memory_order_release);
+            }
         }
+        return index;
     }
 
-    // Softmax along last dimension
-    std::vector<float> softmax(const std::vector<float>& x, int seq_len) {
-        std::vector<float> y(x.size());
-
-        @autoreleasepool {
-            id<MTLBuffer> bufferX = [g_device newBufferWithBytes:x.data() length:x.size() * sizeof(float) options:0];
-            id<MTLBuffer> bufferY = [g_device newBufferWithLength:y.size() * sizeof(float) options:0];
+    void FreeSlot(uint32_t index) {
+        Slot* slot = Find(index);
+        uint64_t head = free_head_.load(std::memory_order_relaxed);
+        uint64_t next;
+        do {
+            slot->next_free.store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+            next = ((head & ~kLowMask) + kHighOne) | (index + 1);
+        } while (!free_head_.compare_exchange_weak(head, next, std::memory_order_release, std::memory_order_relaxed));
+    }
 
-            uint seq_len_val = seq_len;
-            id<MTLBuffer> seqBuffer = [g_device newBufferWithBytes:&seq_len_val length:sizeof(seq_len_val) options:0];
+    // Adds a reference if `handle` is live; returns its slot or nullptr
+    Slot* Acquire(uint64_t handle) {
+        uint32_t generation = static_cast<uint32_t>(handle >> 32);
+        Slot* slot = Find(static_cast<uint32_t>(handle));
+        if (!slot) return nullptr;
+        uint64_t word = slot->word.load(std::memory_order_acquire);
+        do {
+            if ((word >> 32) != generation || (word & kLowMask) == 0) return nullptr;
+        } while (!slot->word.compare_exchange_weak(word, word + 1, std::memory_order_acquire, std::memory_order_acquire));
+        return slot;
+    }
 
-            MTLSize gridSize = {1, static_cast<NSUInteger>(seq_len), 1};
-            execute_2d(softmax_pipeline_, {bufferX, bufferY, seqBuffer}, gridSize);
+    // Drops a reference if `handle` is live; the last one retires the handle
+    void Release(uint64_t handle) {
+        uint32_t generation = static_cast<uint32_t>(handle >> 32);
+        uint32_t index = static_cast<uint32_t>(handle);
+        Slot* slot = Find(index);
+        if (!slot) return;
+        uint64_t word = slot->word.load(std::memory_order_acquire);
+        uint64_t next;
+        do {
+            if ((word >> 32) != generation || (word & kLowMask) == 0) return;
+            uint32_t next_generation = generation + 1 ? generation + 1 : 1;
+            next = (word & kLowMask) == 1 ? uint64_t(next_generation) << 32 : word - 1;
+        } while (!slot->word.compare_exchange_weak(word, next, std::memory_order_acq_rel, std::memory_order_acquire));
+        if (next & kLowMask) return;
+
+        slot->cache.reset();
+        FreeSlot(index);
+    }
 
-            memcpy(y.data(), [bufferY contents], y.size() * sizeof(float));
-        }
+public:
+    CacheRegistry() {
+        for (auto& segment : segments_) segment.store(nullptr, std::memory_order_relaxed);
+    }
 
-        return y;
+    ~CacheRegistry() {
+        for (auto& segment : segments_) delete[] segment.load(std::memory_order_relaxed);
     }
 
-    // Element-wise addition
-    std::vector<float> add(const std::vector<float>& a, const std::vector<float>& b) {
-        std::vector<float> c(a.size());
+    CacheRegistry(const CacheRegistry&) = delete;
+    CacheRegistry& operator=(const CacheRegistry&) = delete;
 
-        @autoreleasepool {
-            id<MTLBuffer> bufferA = [g_device newBufferWithBytes:a.data() length:a.size() * sizeof(float) options:0];
-            id<MTLBuffer> bufferB = [g_device newBufferWithBytes:b.data() length:b.size() * sizeof(float) options:0];
-            id<MTLBuffer> bufferC = [g_device newBufferWithLength:c.size() * sizeof(float) options:0];
+    uint64_t Insert(std::shared_ptr<KVCache> cache) {
+        uint32_t index = AllocateSlot();
+        Slot* slot = Find(index);
+        uint64_t generation = slot->word.load(std::memory_order_relaxed) >> 32;
+        uint64_t handle = (generation << 32) | index;
+        cache->id = handle;
+        slot->cache = std::move(cache);
+        slot->word.store((generation << 32) | 1, std::memory_order_release);
+        return handle;
+    }
 
-            std::vector<id<MTLBuffer>> buffers = {bufferA, bufferB, bufferC};
-            execute_1d(add_pipeline_, buffers, a.size());
+    std::shared_ptr<KVCache> Get(uint64_t handle) {
+        Slot* slot = Acquire(handle);
+        if (!slot) return nullptr;
+        std::shared_ptr<KVCache> cache = slot->cache;
+        Release(handle);
+        return cache;
+    }
 
-            memcpy(c.data(), [bufferC contents], c.size() * sizeof(float));
-        }
+    // Decrement refcount, retire the handle when zero
+    void Remove(uint64_t handle) {
+        Release(handle);
+    }
 
-        return c;
+    void Ref(uint64_t handle) {
+        Acquire(handle);
     }
+};
+
+static CacheRegistry g_registry;
+
+// Offload placement
+//
+// The host decides which handles to offload; this only places them. Handles
+// sent to the host tier are remembered in arrival order, and once host-tier
+// bytes exceed the host budget the oldest still there are demoted to spill
+// files. Prefetches restore on a serial queue so the caller never waits.
+class OffloadManager {
+private:
+    std::mutex mutex_;
+    std::string directory_;
+    int64_t host_budget_bytes_ = 0;  // <= 0: unbounded
+    std::deque<std::weak_ptr<KVCache>> host_tier_;
+    dispatch_queue_t restore_queue_;
 
 public:
-    Qwen2VLModel(const std::string& model_path, const ModelConfig& config) : config_(config) {
-        init_metal();
-        load_weights(model_path);
+    OffloadManager() {
+        const char* tmp = getenv("TMPDIR");
+        directory_ = tmp && *tmp ? tmp : "/tmp";
+        while (directory_.size() > 1 && directory_.back() == '/') directory_.pop_back();
+        restore_queue_ = dispatch_queue_create("mlxvllm.kv-restore", DISPATCH_QUEUE_SERIAL);
     }
 
-    // Helper to load a binary weight file
-    std::vector<float> load_binary_file(const std::string& file_path, size_t expected_elements) {
-        std::vector<float> data(expected_elements);
-        std::ifstream file(file_path, std::ios::binary);
-        if (!file) {
-            throw std::runtime_error("Failed to open file: " + file_path);
-        }
-        file.read(reinterpret_cast<char*>(data.data()), expected_elements * sizeof(float));
-        if (!file) {
-            throw std::runtime_error("Failed to read file: " + file_path);
-        }
-        return data;
+    void Configure(const std::string& directory, int64_t host_budget_bytes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!directory.empty()) directory_ = directory;
+        host_budget_bytes_ = host_budget_bytes;
     }
 
-    // Helper to transpose a matrix from [rows, cols] to [cols, rows]
-    std::vector<float> transpose_matrix(const std::vector<float>& matrix, int rows, int cols) {
-        std::vector<float> transposed(matrix.size());
-        for (int i = 0; i < rows; i++) {
-            for (int j = 0; j < cols; j++) {
-                transposed[j * rows + i] = matrix[i * cols + j];
+    void Offload(const std::shared_ptr<KVCache>& cache, int tier) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cache->Offload(tier, directory_);
+        if (cache->Tier() == MLX_CACHE_TIER_HOST) host_tier_.push_back(cache);
+
+        while (host_budget_bytes_ > 0 && g_host_offload_bytes.load() > host_budget_bytes_ && !host_tier_.empty()) {
+            auto oldest = host_tier_.front().lock();
+            host_tier_.pop_front();
+            if (!oldest || oldest->Tier() != MLX_CACHE_TIER_HOST) continue;
+            try {
+                oldest->Offload(MLX_CACHE_TIER_DISK, directory_);
+            } catch (const std::exception&) {
+                break;  // Disk unavailable: stay over the host budget rather than fail this offload
             }
         }
-        return transposed;
     }
 
-    void load_weights(const std::string& model_path) {
-        std::string bin_weights_path = model_path + "/bin_weights";
-
-        // Load embeddings
-        weights_["model.embed_tokens.weight"] = load_binary_file(
-            bin_weights_path + "/embed_tokens.bin",
-            static_cast<size_t>(config_.vocab_size) * config_.hidden_size
-        );
-
-        // Load final norm
-        weights_["model.norm.weight"] = load_binary_file(
-            bin_weights_path + "/final_norm.bin",
-            config_.hidden_size
-        );
+    // Restore failures (pool full) are dropped; the next fork retries synchronously
+    void Prefetch(std::shared_ptr<KVCache> cache) {
+        dispatch_async(restore_queue_, ^{
+            try {
+                cache->Restore();
+            } catch (...) {
+            }
+        });
+    }
+};
 
-        // Load lm_head and transpose
-        {
-            auto loaded = load_binary_file(
-                bin_weights_path + "/lm_head.bin",
-                static_cast<size_t>(config_.vocab_size) * config_.hidden_size
-            );
-            weights_["lm_head.weight"] = transpose_matrix(loaded, config_.vocab_size, config_.hidden_size);
+static OffloadManager g_offload;
+
+// GPU profiling (MLXSetProfiling)
+//
+// While enabled, every CommandBatch splits its work into one compute encoder
+// per (kernel kind, layer) region and attaches a timestamp counter sample
+// buffer to each, sampled at the encoder's start and end (Apple GPUs only
+// sample at stage boundaries). Finished batches fold their region times into
+// per-layer, per-kind totals. While disabled a batch keeps its single encoder
+// and region() is one branch, so the forward pays nothing measurable.
+class Profiler {
+public:
+    static constexpr NSUInteger kSamplesPerBatch = 1024;  // Two per region; later regions go unattributed
+
+    // Sample buffer and region list of one command buffer
+    class BatchProfile {
+    private:
+        struct Region {
+            int kind;
+            int layer;
+            NSUInteger sample;
+        };
+        Profiler* profiler_;
+        id<MTLCounterSampleBuffer> samples_;
+        std::vector<Region> regions_;
+        NSUInteger next_sample_ = 0;
+        MTLTimestamp cpu_start_ = 0;
+        MTLTimestamp gpu_start_ = 0;
+
+    public:
+        BatchProfile(Profiler* profiler, id<MTLCounterSampleBuffer> samples)
+            : profiler_(profiler), samples_(samples) {
+            if (samples_) [g_device sampleTimestamps:&cpu_start_ gpuTimestamp:&gpu_start_];
         }
 
-        // Load all transformer layers
-        for (int i = 0; i < config_.num_hidden_layers; i++) {
-            std::string layer_prefix = "model.layers." + std::to_string(i) + ".";
+        ~BatchProfile() { profiler_->ReturnSamples(samples_); }
+
+        bool sampling() const { return samples_ != nil; }
+
+        // New encoder whose execution time is attributed to (kind, layer)
+        id<MTLComputeCommandEncoder> OpenEncoder(id<MTLCommandBuffer> command_buffer, int kind, int layer) {
+            if (!samples_ || next_sample_ + 2 > kSamplesPerBatch) return [command_buffer computeCommandEncoder];
+            MTLComputePassDescriptor* desc = [MTLComputePassDescriptor computePassDescriptor];
+            desc.dispatchType = MTLDispatchTypeSerial;
+            desc.sampleBufferAttachments[0].sampleBuffer = samples_;
+            desc.sampleBufferAttachments[0].startOfEncoderSampleIndex = next_sample_;
+            desc.sampleBufferAttachments[0].endOfEncoderSampleIndex = next_sample_ + 1;
+            regions_.push_back({kind, layer, next_sample_});
+            next_sample_ += 2;
+            return [command_buffer computeCommandEncoderWithDescriptor:desc];
+        }
 
-            // Attention projections
-            {
-                auto loaded = load_binary_file(
-                    bin_weights_path + "/layer" + std::to_string(i) + ".attn.q_proj.bin",
-                    static_cast<size_t>(config_.hidden_size) * config_.hidden_size
-                );
-                weights_[layer_prefix + "self_attn.q_proj.weight"] = transpose_matrix(loaded, config_.hidden_size, config_.hidden_size);
+        // Folds a completed command buffer's samples into the profiler totals
+        void Finish(id<MTLCommandBuffer> command_buffer) {
+            uint64_t gpu_ns = static_cast<uint64_t>(([command_buffer GPUEndTime] - [command_buffer GPUStartTime]) * 1e9);
+            std::vector<std::array<uint64_t, 3>> times;  // kind, layer, ns
+            if (samples_ && next_sample_ > 0) {
+                MTLTimestamp cpu_end = 0, gpu_end = 0;
+                [g_device sampleTimestamps:&cpu_end gpuTimestamp:&gpu_end];
+                // GPU ticks -> ns, calibrated against the CPU clock (ns) over this batch
+                double ns_per_tick = 1.0;
+                if (gpu_end > gpu_start_) ns_per_tick = static_cast<double>(cpu_end - cpu_start_) / (gpu_end - gpu_start_);
+
+                NSData* data = [samples_ resolveCounterRange:NSMakeRange(0, next_sample_)];
+                const auto* stamps = static_cast<const MTLCounterResultTimestamp*>([data bytes]);
+                for (const Region& region : regions_) {
+                    if (!data || (region.sample + 1) * sizeof(MTLCounterResultTimestamp) > [data length]) break;
+                    uint64_t start = stamps[region.sample].timestamp;
+                    uint64_t end = stamps[region.sample + 1].timestamp;
+                    if (start == MTLCounterErrorValue || end == MTLCounterErrorValue || end < start) continue;
+                    times.push_back({static_cast<uint64_t>(region.kind), static_cast<uint64_t>(region.layer),
+                                     static_cast<uint64_t>((end - start) * ns_per_tick)});
+                }
             }
+            profiler_->Record(gpu_ns, times);
+        }
+    };
 
-            {
-                int kv_dim = config_.num_key_value_heads * config_.head_dim;
-                auto loaded = load_binary_file(
-                    bin_weights_path + "/layer" + std::to_string(i) + ".attn.k_proj.bin",
-                    static_cast<size_t>(kv_dim) * config_.hidden_size
-                );
-                weights_[layer_prefix + "self_attn.k_proj.weight"] = transpose_matrix(loaded, kv_dim, config_.hidden_size);
-            }
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
 
-            {
-                int kv_dim = config_.num_key_value_heads * config_.head_dim;
-                auto loaded = load_binary_file(
-                    bin_weights_path + "/layer" + std::to_string(i) + ".attn.v_proj.bin",
-                    static_cast<size_t>(kv_dim) * config_.hidden_size
-                );
-                weights_[layer_prefix + "self_attn.v_proj.weight"] = transpose_matrix(loaded, kv_dim, config_.hidden_size);
-            }
+    // Enabling clears previous totals; num_layers sizes the per-layer table
+    void SetEnabled(bool enabled, int num_layers) {
+        if (enabled) Reset(num_layers);
+        enabled_.store(enabled, std::memory_order_relaxed);
+    }
 
-            {
-                auto loaded = load_binary_file(
-                    bin_weights_path + "/layer" + std::to_string(i) + ".attn.o_proj.bin",
-                    static_cast<size_t>(config_.hidden_size) * config_.hidden_size
-                );
-                weights_[layer_prefix + "self_attn.o_proj.weight"] = transpose_matrix(loaded, config_.hidden_size, config_.hidden_size);
-            }
+    void Reset(int num_layers) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        num_layers_ = std::max(num_layers, 0);
+        kernel_ns_.assign(static_cast<size_t>(num_layers_ + 1) * MLX_NUM_KERNEL_KINDS, 0);
+        kernel_count_.assign(kernel_ns_.size(), 0);
+        command_buffers_ = 0;
+        gpu_ns_ = 0;
+        upload_bytes_ = 0;
+        download_bytes_ = 0;
+    }
 
-            // Layer norms
-            weights_[layer_prefix + "input_layernorm.weight"] = load_binary_file(
-                bin_weights_path + "/layer" + std::to_string(i) + ".input_layernorm.bin",
-                config_.hidden_size
-            );
+    // Null while disabled
+    std::unique_ptr<BatchProfile> Begin() {
+        if (!enabled()) return nullptr;
+        return std::make_unique<BatchProfile>(this, TakeSamples());
+    }
 
-            weights_[layer_prefix + "post_attention_layernorm.weight"] = load_binary_file(
-                bin_weights_path + "/layer" + std::to_string(i) + ".post_layernorm.bin",
-                config_.hidden_size
-            );
+    void CountUpload(size_t bytes) {
+        if (enabled()) upload_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+    }
 
-            // MLP projections
-            {
-                auto loaded = load_binary_file(
-                    bin_weights_path + "/layer" + std::to_string(i) + ".mlp.gate_proj.bin",
-                    static_cast<size_t>(config_.intermediate_size) * config_.hidden_size
-                );
-                weights_[layer_prefix + "mlp.gate_proj.weight"] = transpose_matrix(loaded, config_.intermediate_size, config_.hidden_size);
-            }
+    void CountDownload(size_t bytes) {
+        if (enabled()) download_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+    }
 
-            {
-                auto loaded = load_binary_file(
-                    bin_weights_path + "/layer" + std::to_string(i) + ".mlp.up_proj.bin",
-                    static_cast<size_t>(config_.intermediate_size) * config_.hidden_size
-                );
-                weights_[layer_prefix + "mlp.up_proj.weight"] = transpose_matrix(loaded, config_.intermediate_size, config_.hidden_size);
+    // Copies up to `capacity` entries of the [(num_layers + 1) * kinds] tables
+    void Snapshot(MLXProfileStats* stats, uint64_t* kernel_ns, uint64_t* kernel_count, int capacity) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats->num_layers = num_layers_;
+        stats->enabled = enabled() ? 1 : 0;
+        stats->timestamps_supported = TimestampCounters() ? 1 : 0;
+        stats->command_buffers = command_buffers_;
+        stats->gpu_ns = gpu_ns_;
+        stats->upload_bytes = upload_bytes_.load();
+        stats->download_bytes = download_bytes_.load();
+        size_t n = std::min<size_t>(std::max(capacity, 0), kernel_ns_.size());
+        if (kernel_ns) std::copy(kernel_ns_.begin(), kernel_ns_.begin() + n, kernel_ns);
+        if (kernel_count) std::copy(kernel_count_.begin(), kernel_count_.begin() + n, kernel_count);
+    }
+
+private:
+    std::atomic<bool> enabled_{false};
+    std::mutex mutex_;  // Guards the totals and idle_samples_
+    int num_layers_ = 0;
+    std::vector<uint64_t> kernel_ns_;
+    std::vector<uint64_t> kernel_count_;
+    uint64_t command_buffers_ = 0;
+    uint64_t gpu_ns_ = 0;
+    std::atomic<uint64_t> upload_bytes_{0};
+    std::atomic<uint64_t> download_bytes_{0};
+    std::vector<id<MTLCounterSampleBuffer>> idle_samples_;
+
+    // The device's timestamp counter set, or nil if it cannot sample at stage boundaries
+    static id<MTLCounterSet> TimestampCounters() {
+        static id<MTLCounterSet> counters = [] () -> id<MTLCounterSet> {
+            if (!g_device || ![g_device supportsCounterSampling:MTLCounterSamplingPointAtStageBoundary]) return nil;
+            for (id<MTLCounterSet> set in [g_device counterSets]) {
+                if ([[set name] isEqualToString:MTLCommonCounterSetTimestamp]) return set;
             }
+            return nil;
+        }();
+        return counters;
+    }
 
-            {
-                auto loaded = load_binary_file(
-                    bin_weights_path + "/layer" + std::to_string(i) + ".mlp.down_proj.bin",
-                    static_cast<size_t>(config_.hidden_size) * config_.intermediate_size
-                );
-                weights_[layer_prefix + "mlp.down_proj.weight"] = transpose_matrix(loaded, config_.hidden_size, config_.intermediate_size);
+    id<MTLCounterSampleBuffer> TakeSamples() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!idle_samples_.empty()) {
+                id<MTLCounterSampleBuffer> samples = idle_samples_.back();
+                idle_samples_.pop_back();
+                return samples;
             }
         }
+        id<MTLCounterSet> counters = TimestampCounters();
+        if (!counters) return nil;
+        MTLCounterSampleBufferDescriptor* desc = [[MTLCounterSampleBufferDescriptor alloc] init];
+        desc.counterSet = counters;
+        desc.storageMode = MTLStorageModeShared;
+        desc.sampleCount = kSamplesPerBatch;
+        NSError* error = nil;
+        return [g_device newCounterSampleBufferWithDescriptor:desc error:&error];
     }
 
-    // Complete forward pass through all 28 layers
-    std::vector<float> forward(const std::vector<int32_t>& input_ids, std::shared_ptr<KVCache> cache = nullptr) {
-        int seq_len = input_ids.size();
-        int position = cache ? cache->seq_length : 0;
-
-        // 1. Embedding lookup
-        std::vector<float> hidden(seq_len * config_.hidden_size);
-        auto& embed = weights_["model.embed_tokens.weight"];
+    void ReturnSamples(id<MTLCounterSampleBuffer> samples) {
+        if (!samples) return;
+        std::lock_guard<std::mutex> lock(mutex_);
+        idle_samples_.push_back(samples);
+    }
 
-        for (int i = 0; i < seq_len; i++) {
-            int token = input_ids[i];
-            if (token >= 0 && token < config_.vocab_size) {
-                memcpy(&hidden[i * config_.hidden_size], &embed[token * config_.hidden_size],
-                       config_.hidden_size * sizeof(float));
-            }
+    void Record(uint64_t gpu_ns, const std::vector<std::array<uint64_t, 3>>& times) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        command_buffers_++;
+        gpu_ns_ += gpu_ns;
+        for (const auto& [kind, layer, ns] : times) {
+            // Regions outside any layer (embedding, final norm, LM head) go in the last row
+            size_t row = layer < static_cast<uint64_t>(num_layers_) ? layer : num_layers_;
+            size_t index = row * MLX_NUM_KERNEL_KINDS + kind;
+            if (index >= kernel_ns_.size()) continue;
+            kernel_ns_[index] += ns;
+            kernel_count_[index]++;
         }
+    }
+};
 
-        // 2. Process through all transformer layers
-        for (int layer = 0; layer < config_.num_hidden_layers; layer++) {
-            std::string p = "model.layers." + std::to_string(layer) + ".";
-
-            // Input layernorm
-            auto& input_norm_weight = weights_[p + "input_layernorm.weight"];
-            auto hidden_normed = rmsnorm(hidden, input_norm_weight, config_.hidden_size, seq_len);
-
-            // Self-attention
-            auto& q_proj = weights_[p + "self_attn.q_proj.weight"];
-            auto& k_proj = weights_[p + "self_attn.k_proj.weight"];
-            auto& v_proj = weights_[p + "self_attn.v_proj.weight"];
-
-            // Q: [seq_len, hidden_size] x [hidden_size, hidden_size] = [seq_len, hidden_size]
-            auto q = matmul(hidden_normed, q_proj, seq_len, config_.hidden_size, config_.hidden_size);
-            // K: [seq_len, hidden_size] x [hidden_size, kv_dim] = [seq_len, kv_dim]
-            int kv_dim = config_.num_key_value_heads * config_.head_dim;
-            auto k = matmul(hidden_normed, k_proj, seq_len, kv_dim, config_.hidden_size);
-            // V: [seq_len, hidden_size] x [hidden_size, kv_dim] = [seq_len, kv_dim]
-            auto v = matmul(hidden_normed, v_proj, seq_len, kv_dim, config_.hidden_size);
-
-            // Apply RoPE to Q and K
-            apply_rope(q, k, seq_len, config_.num_attention_heads, config_.head_dim, position);
-
-            // Reshape Q for multi-head attention: [seq_len, num_heads, head_dim]
-            // Reshape K/V for GQA: [seq_len, num_kv_heads, head_dim]
-
-            // Attention scores: Q x K^T
-            // For simplicity, compute attention using GQA (repeat K/V heads)
-            std::vector<float> attn_out(seq_len * config_.hidden_size, 0.0f);
-
-            int heads_per_kv_head = config_.num_attention_heads / config_.num_key_value_heads;
-
-            for (int h = 0; h < config_.num_attention_heads; h++) {
-                int kv_head = h / heads_per_kv_head;
-
-                // Extract Q head: [seq_len, head_dim]
-                std::vector<float> q_head(seq_len * config_.head_dim);
-                for (int s = 0; s < seq_len; s++) {
-                    memcpy(&q_head[s * config_.head_dim],
-                           &q[(s * config_.num_attention_heads + h) * config_.head_dim],
-                           config_.head_dim * sizeof(float));
-                }
+static Profiler g_profiler;
 
-                // Extract K head: [seq_len, head_dim]
-                std::vector<float> k_head(seq_len * config_.head_dim);
-                for (int s = 0; s < seq_len; s++) {
-                    memcpy(&k_head[s * config_.head_dim],
-                           &k[(s * config_.num_key_value_heads + kv_head) * config_.head_dim],
-                           config_.head_dim * sizeof(float));
-                }
+// Vision tower output for one image: [tokens, hidden_size] LLM input embeddings
+struct ImageEmbedding {
+    id<MTLBuffer> embeddings;
+    int tokens;
+};
 
-                // Extract V head: [seq_len, head_dim]
-                std::vector<float> v_head(seq_len * config_.head_dim);
-                for (int s = 0; s < seq_len; s++) {
-                    memcpy(&v_head[s * config_.head_dim],
-                           &v[(s * config_.num_key_value_heads + kv_head) * config_.head_dim],
-                           config_.head_dim * sizeof(float));
-                }
+// Encoded images keyed by content hash, least recently used evicted past the
+// byte budget. An agent loop resends mostly unchanged screenshots, so a hit
+// skips the vision tower entirely. Entries are shared: a forward keeps the
+// embeddings it reads alive even if they are evicted meanwhile.
+class ImageEmbeddingCache {
+private:
+    struct Entry {
+        std::shared_ptr<ImageEmbedding> embedding;
+        std::list<uint64_t>::iterator lru;
+    };
+    std::mutex mutex_;
+    std::unordered_map<uint64_t, Entry> entries_;
+    std::list<uint64_t> lru_;  // Most recently used first
+    int64_t bytes_ = 0;
+    int64_t budget_bytes_;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+
+    static int64_t SizeOf(const ImageEmbedding& embedding) {
+        return static_cast<int64_t>([embedding.embeddings length]);
+    }
 
-                // Compute attention scores: Q x K^T -> [seq_len, seq_len]
-                auto scores = matmul(q_head, k_head, seq_len, seq_len, config_.head_dim);
+    // Caller holds mutex_
+    void EvictLocked() {
+        while (bytes_ > budget_bytes_ && !lru_.empty()) {
+            auto it = entries_.find(lru_.back());
+            bytes_ -= SizeOf(*it->second.embedding);
+            entries_.erase(it);
+            lru_.pop_back();
+        }
+    }
 
-                // Scale scores
-                float scale = 1.0f / sqrt(config_.head_dim);
-                for (auto& s : scores) s *= scale;
+public:
+    explicit ImageEmbeddingCache(int64_t budget_bytes) : budget_bytes_(std::max<int64_t>(budget_bytes, 0)) {}
 
-                // Apply softmax
-                auto attn_weights = softmax(scores, seq_len);
+    std::shared_ptr<ImageEmbedding> Get(uint64_t key) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(key);
+        if (it == entries_.end()) {
+            misses_++;
+            return nullptr;
+        }
+        hits_++;
+        lru_.splice(lru_.begin(), lru_, it->second.lru);
+        return it->second.embedding;
+    }
 
-                // Apply attention to V: [seq_len, seq_len] x [seq_len, head_dim] = [seq_len, head_dim]
-                auto head_out = matmul(attn_weights, v_head, seq_len, config_.head_dim, seq_len);
+    // Images larger than the whole budget are not kept
+    void Put(uint64_t key, std::shared_ptr<ImageEmbedding> embedding) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (SizeOf(*embedding) > budget_bytes_ || entries_.count(key)) return;
+        lru_.push_front(key);
+        bytes_ += SizeOf(*embedding);
+        entries_[key] = {std::move(embedding), lru_.begin()};
+        EvictLocked();
+    }
 
-                // Copy to output
-                for (int s = 0; s < seq_len; s++) {
-                    memcpy(&attn_out[(s * config_.num_attention_heads + h) * config_.head_dim],
-                           &head_out[s * config_.head_dim],
-                           config_.head_dim * sizeof(float));
-                }
-            }
+    void SetBudgetBytes(int64_t budget_bytes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        budget_bytes_ = std::max<int64_t>(budget_bytes, 0);
+        EvictLocked();
+    }
 
-            // Output projection
-            auto& o_proj = weights_[p + "self_attn.o_proj.weight"];
-            auto attn_output = matmul(attn_out, o_proj, seq_len, config_.hidden_size, config_.hidden_size);
+    MLXImageCacheStats Stats() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return {static_cast<int64_t>(entries_.size()), bytes_, budget_bytes_, hits_, misses_};
+    }
+};
 
-            // Residual connection + input layernorm
-            hidden = add(hidden, attn_output);
+// Image cache key: the caller's content hash (or FNV-1a over the pixel values,
+// a word at a time) combined with the grid, so equal pixels at another
+// resolution never collide
+static uint64_t ImageKey(const MLXImageInput& image, size_t values) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    auto mix = [&](uint64_t word) { hash = (hash ^ word) * 0x100000001b3ull; };
+    if (image.hash != 0) {
+        mix(image.hash);
+    } else {
+        size_t bytes = values * sizeof(float);
+        const auto* data = reinterpret_cast<const uint8_t*>(image.pixel_values);
+        size_t i = 0;
+        for (; i + sizeof(uint64_t) <= bytes; i += sizeof(uint64_t)) {
+            uint64_t word;
+            memcpy(&word, data + i, sizeof(word));
+            mix(word);
+        }
+        for (; i < bytes; i++) mix(data[i]);
+    }
+    mix(static_cast<uint64_t>(image.grid_t));
+    mix(static_cast<uint64_t>(image.grid_h));
+    mix(static_cast<uint64_t>(image.grid_w));
+    return hash;
+}
+
+// Reusable activation buffers in size classes (powers of two split in quarter
+// steps, at least a page), so a forward recycles the intermediates of earlier
+// ones instead of allocating thousands of fresh MTLBuffers. Idle buffers beyond
+// the byte budget are released. Shared by concurrent steps; buffers are only
+// handed back once no command buffer can still touch them (ArenaScope).
+class ActivationArena {
+private:
+    std::mutex mutex_;
+    std::unordered_map<size_t, std::vector<id<MTLBuffer>>> idle_;  // Size class -> idle buffers
+    size_t idle_bytes_ = 0;
+    size_t budget_bytes_;
+
+    static size_t SizeClass(size_t bytes) {
+        constexpr size_t kMinBytes = 4096;
+        if (bytes <= kMinBytes) return kMinBytes;
+        size_t step = size_t(1) << (63 - __builtin_clzll(bytes - 1));  // Largest power of two below bytes
+        step = std::max<size_t>(step / 4, 1);
+        return (bytes + step - 1) / step * step;
+    }
+
+public:
+    explicit ActivationArena(size_t budget_bytes) : budget_bytes_(budget_bytes) {}
+
+    // Default budget: the intermediates of the layers a full step keeps alive
+    // at once (the one being encoded, the one running and its predecessor's
+    // outputs), so a steady stream of steps allocates nothing
+    static size_t BudgetFor(const ModelConfig& config) {
+        if (config.activation_arena_bytes > 0) return static_cast<size_t>(config.activation_arena_bytes);
+        constexpr size_t kLiveLayers = 3;
+        size_t kv_dim = static_cast<size_t>(config.num_key_value_heads) * config.head_dim;
+        size_t per_row = 8 * static_cast<size_t>(config.hidden_size) + 2 * kv_dim + config.intermediate_size;
+        return kLiveLayers * static_cast<size_t>(std::max(config.max_step_tokens, 1)) * per_row * sizeof(float);
+    }
+
+    id<MTLBuffer> Acquire(size_t bytes) {
+        size_t size = SizeClass(bytes);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = idle_.find(size);
+            if (it != idle_.end() && !it->second.empty()) {
+                id<MTLBuffer> buffer = it->second.back();
+                it->second.pop_back();
+                idle_bytes_ -= size;
+                return buffer;
+            }
+        }
+        return [g_device newBufferWithLength:size options:MTLResourceStorageModeShared];
+    }
+
+    void Release(id<MTLBuffer> buffer) {
+        size_t size = [buffer length];
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (idle_bytes_ + size > budget_bytes_) return;
+        idle_[size].push_back(buffer);
+        idle_bytes_ += size;
+    }
+};
+
+// Buffers a forward takes from the arena, handed back when the scope ends. The
+// innermost scope on the thread serves Qwen2VLModel::new_buffer; without one
+// (or with a null arena, for outputs that outlive the forward) buffers are
+// allocated fresh. Pipelined passes call Release() once the command buffers
+// that read a range of leases have completed. A scope left by an exception
+// drops its buffers instead: the GPU may still be using them.
+class ArenaScope {
+private:
+    ActivationArena* arena_;
+    ArenaScope* outer_;
+    std::vector<id<MTLBuffer>> leased_;
+    int exceptions_;
+    static inline thread_local ArenaScope* current_ = nullptr;
+
+public:
+    explicit ArenaScope(ActivationArena* arena)
+        : arena_(arena), outer_(current_), exceptions_(std::uncaught_exceptions()) {
+        current_ = this;
+    }
+    ~ArenaScope() {
+        current_ = outer_;
+        if (std::uncaught_exceptions() > exceptions_) return;
+        Release(0, leased_.size());
+    }
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+
+    static ArenaScope* Current() { return current_; }
+
+    id<MTLBuffer> Acquire(size_t bytes) {
+        if (!arena_) return [g_device newBufferWithLength:bytes options:MTLResourceStorageModeShared];
+        leased_.push_back(arena_->Acquire(bytes));
+        return leased_.back();
+    }
+
+    // Leases so far; marks the start of a range for Release
+    size_t Mark() const { return leased_.size(); }
+
+    // Hands leases [begin, end) back to the arena
+    void Release(size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            if (!leased_[i]) continue;
+            arena_->Release(leased_[i]);
+            leased_[i] = nil;
+        }
+    }
+};
+
+// Kernels linked into the engine binary by `make engine` (mlx_kernels.metal):
+// __TEXT,__mlx_metallib holds the precompiled library and __TEXT,__mlx_kernels
+// the source, compiled at load time only when the build had no Metal compiler
+static std::pair<const uint8_t*, size_t> LinkedSection(const char* section) {
+    Dl_info info;
+    if (!dladdr(reinterpret_cast<const void*>(&LinkedSection), &info) || !info.dli_fbase) return {nullptr, 0};
+    unsigned long size = 0;
+    const uint8_t* data = getsectiondata(static_cast<const struct mach_header_64*>(info.dli_fbase), "__TEXT", section, &size);
+    return {data, data ? static_cast<size_t>(size) : 0};
+}
+
+struct KernelLibrary {
+    id<MTLLibrary> library;
+    uint64_t hash;  // FNV-1a of the metallib or source it came from
+};
+
+static uint64_t Fnv1a(const uint8_t* data, size_t size, uint64_t hash = 0xcbf29ce484222325ull) {
+    for (size_t i = 0; i < size; i++) hash = (hash ^ data[i]) * 0x100000001b3ull;
+    return hash;
+}
+
+static KernelLibrary LoadKernelLibrary() {
+    NSError* error = nil;
+    auto metallib = LinkedSection("__mlx_metallib");
+    if (metallib.first) {
+        // The section lives as long as the image, so the data is not copied
+        dispatch_data_t data = dispatch_data_create(metallib.first, metallib.second, nullptr, ^{});
+        id<MTLLibrary> library = [g_device newLibraryWithData:data error:&error];
+        if (library) return {library, Fnv1a(metallib.first, metallib.second)};
+    }
+    auto source = LinkedSection("__mlx_kernels");
+    if (!source.first) {
+        throw std::runtime_error("No Metal kernels linked into the engine (build it with `make engine`)");
+    }
+    NSString* text = [[NSString alloc] initWithBytes:source.first length:source.second encoding:NSUTF8StringEncoding];
+    id<MTLLibrary> library = [g_device newLibraryWithSource:text options:nil error:&error];
+    if (!library) {
+        NSString* errStr = [error localizedDescription];
+        throw std::runtime_error(errStr ? [errStr UTF8String] : "Failed to compile Metal kernels");
+    }
+    return {library, Fnv1a(source.first, source.second)};
+}
+
+// Directory of the pipeline archives: the load's MLXLoadOptions::pipeline_cache_dir, else $TMPDIR or /tmp
+static std::string PipelineCacheDirectory(const std::string& configured) {
+    const char* tmp = getenv("TMPDIR");
+    std::string directory = !configured.empty() ? configured : tmp && *tmp ? tmp : "/tmp";
+    while (directory.size() > 1 && directory.back() == '/') directory.pop_back();
+    return directory;
+}
+
+// Compiled pipeline states kept across process starts in an MTLBinaryArchive,
+// one file per kernel build, GPU and model specialization (`key`). A warm
+// start loads every pipeline from the archive instead of compiling it; a miss
+// compiles it and adds it, and Save() writes the archive back atomically
+// (concurrent replicas sharing the directory each rename a whole file in).
+// Without a usable archive pipelines are simply compiled.
+class PipelineArchive {
+private:
+    id<MTLBinaryArchive> archive_ = nil;
+    std::string path_;
+    bool dirty_ = false;
+
+public:
+    PipelineArchive(const std::string& directory, uint64_t key) {
+        char name[48];
+        snprintf(name, sizeof(name), "/mlx_pipelines_%016llx.metalar", static_cast<unsigned long long>(key));
+        path_ = directory + name;
+        mkdir(directory.c_str(), 0755);  // Usually exists already
+        MTLBinaryArchiveDescriptor* descriptor = [[MTLBinaryArchiveDescriptor alloc] init];
+        struct stat st;
+        if (stat(path_.c_str(), &st) == 0) {
+            descriptor.url = [NSURL fileURLWithPath:[NSString stringWithUTF8String:path_.c_str()]];
+        }
+        archive_ = [g_device newBinaryArchiveWithDescriptor:descriptor error:nil];
+        if (!archive_ && descriptor.url) {
+            // Unreadable, e.g. written by another OS version: start a fresh one
+            descriptor.url = nil;
+            archive_ = [g_device newBinaryArchiveWithDescriptor:descriptor error:nil];
+        }
+    }
+
+    id<MTLComputePipelineState> Make(id<MTLFunction> function, NSError** error) {
+        MTLComputePipelineDescriptor* descriptor = [[MTLComputePipelineDescriptor alloc] init];
+        descriptor.computeFunction = function;
+        if (archive_) {
+            descriptor.binaryArchives = @[archive_];
+            id<MTLComputePipelineState> pipeline =
+                [g_device newComputePipelineStateWithDescriptor:descriptor options:MTLPipelineOptionFailOnBinaryArchiveMiss
+                                                     reflection:nil error:nil];
+            if (pipeline) return pipeline;
+            if ([archive_ addComputePipelineFunctionsWithDescriptor:descriptor error:nil]) dirty_ = true;
+        }
+        return [g_device newComputePipelineStateWithDescriptor:descriptor options:MTLPipelineOptionNone
+                                                    reflection:nil error:error];
+    }
+
+    // Best effort: a read-only or full directory only costs the next start its compile
+    void Save() {
+        if (!archive_ || !dirty_) return;
+        std::string tmp = path_ + ".tmp." + std::to_string(getpid());
+        NSURL* url = [NSURL fileURLWithPath:[NSString stringWithUTF8String:tmp.c_str()]];
+        if ([archive_ serializeToURL:url error:nil] && rename(tmp.c_str(), path_.c_str()) == 0) {
+            dirty_ = false;
+        } else {
+            unlink(tmp.c_str());
+        }
+    }
+};
+
+// "host:port", "[v6-host]:port" or ":port" (any interface, listening only)
+static bool SplitAddress(const std::string& address, std::string& host, std::string& port) {
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos || colon + 1 == address.size()) return false;
+    host = address.substr(0, colon);
+    port = address.substr(colon + 1);
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']') host = host.substr(1, host.size() - 2);
+    return true;
+}
+
+// Connected (or, with `listen`, bound and listening) TCP socket for `address`; -1 on failure
+static int OpenSocket(const std::string& address, bool listen) {
+    std::string host, port;
+    if (!SplitAddress(address, host, port)) return -1;
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listen ? AI_PASSIVE : 0;
+    struct addrinfo* results = nullptr;
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &results) != 0) return -1;
+    int fd = -1;
+    for (struct addrinfo* ai = results; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        int one = 1;
+        // A peer going away must fail the write, not raise SIGPIPE in the host process
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+        bool ok;
+        if (listen) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            ok = bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && ::listen(fd, 1) == 0;
+        } else {
+            ok = connect(fd, ai->ai_addr, ai->ai_addrlen) == 0;
+            // Activations go out as soon as each layer's partial sum is ready
+            if (ok) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        if (!ok) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(results);
+    return fd;
+}
+
+static constexpr uint32_t kTensorParallelMagic = 0x5054584d;  // "MXTP"
+
+// Connection handshake: rank 0 sends the rank it expects and its shape, the
+// worker answers with its own once its shard is loaded; any difference fails
+// the load on both sides
+struct TensorParallelHello {
+    uint32_t magic;
+    int32_t rank;
+    int32_t size;
+    int32_t hidden_size;
+    int32_t num_layers;
+    int32_t num_heads;
+    int32_t num_kv_heads;
+    int32_t intermediate_size;
+    int32_t kv_block_size;
+    int32_t kv_num_blocks;
+
+    static TensorParallelHello For(const ModelConfig& config) {
+        return {kTensorParallelMagic, config.tp_rank, config.tp_size, config.hidden_size,
+                config.num_hidden_layers, config.num_attention_heads, config.num_key_value_heads,
+                config.intermediate_size, config.kv_block_size, config.kv_num_blocks};
+    }
+
+    bool operator==(const TensorParallelHello& other) const { return memcmp(this, &other, sizeof(*this)) == 0; }
+};
+
+// One engine step as the workers see it: the packed rows' KV addressing and
+// RoPE ids (as in run_forward), followed on the wire by their input hidden states
+struct TensorParallelStep {
+    std::vector<int32_t> row_slots, row_table_offsets, row_positions, rope_ids, block_tables;
+    std::vector<int32_t> copies;  // (src, dst, slots) block copies to replay first (KVBlockPool::TakeCopies)
+};
+
+struct TensorParallelStepHeader {
+    uint32_t magic;
+    int32_t rows;
+    int32_t table_entries;
+    int32_t copies;
+};
+
+// Connections of one tensor-parallel group over TCP
+//
+// The group is a star around rank 0, which owns the scheduler and the KV block
+// tables. Each step rank 0 sends the workers a TensorParallelStep, then every
+// rank runs the layers on its slice of the heads and MLP columns; the o_proj
+// and down_proj partial sums meet in AllReduce, where the workers send theirs
+// to rank 0 and get the total back. A failed exchange closes the connections,
+// so the workers stop serving and every later step fails fast.
+class TensorParallelGroup {
+private:
+    int rank_;
+    int size_;
+    std::vector<int> peers_;  // Rank 0: sockets to ranks 1..size-1; a worker: its socket to rank 0
+    std::vector<float> scratch_;
+    bool failed_ = false;
+    std::mutex step_mutex_;
+
+    void send(int fd, const void* data, size_t bytes) {
+        if (failed_) throw std::runtime_error("Tensor-parallel group has failed");
+        if (!WriteFully(fd, data, bytes)) fail("Tensor-parallel peer disconnected");
+    }
+
+    void receive(int fd, void* data, size_t bytes) {
+        if (failed_) throw std::runtime_error("Tensor-parallel group has failed");
+        if (!ReadFully(fd, data, bytes)) fail("Tensor-parallel peer disconnected");
+    }
+
+    [[noreturn]] void fail(const std::string& message) {
+        Close();
+        throw std::runtime_error(message);
+    }
+
+    template <typename T>
+    void send_vector(int fd, const std::vector<T>& values) {
+        send(fd, values.data(), values.size() * sizeof(T));
+    }
+
+    template <typename T>
+    void receive_vector(int fd, std::vector<T>& values, size_t count) {
+        values.resize(count);
+        receive(fd, values.data(), count * sizeof(T));
+    }
+
+public:
+    TensorParallelGroup(int rank, int size, std::vector<int> peers)
+        : rank_(rank), size_(size), peers_(std::move(peers)) {}
+
+    ~TensorParallelGroup() {
+        for (int fd : peers_) close(fd);
+    }
+
+    TensorParallelGroup(const TensorParallelGroup&) = delete;
+    TensorParallelGroup& operator=(const TensorParallelGroup&) = delete;
+
+    // Rank 0 of a group of peers.size() + 1: connects to the workers in rank
+    // order, retrying for a while as they start listening, and waits for each
+    // one's handshake (sent once its shard has loaded)
+    static std::unique_ptr<TensorParallelGroup> Connect(const std::vector<std::string>& peers,
+                                                        const TensorParallelHello& hello) {
+        constexpr int kConnectAttempts = 300;  // 100 ms apart
+        auto group = std::make_unique<TensorParallelGroup>(0, static_cast<int>(peers.size()) + 1, std::vector<int>());
+        for (size_t i = 0; i < peers.size(); i++) {
+            int fd = -1;
+            for (int attempt = 0; attempt < kConnectAttempts && fd < 0; attempt++) {
+                fd = OpenSocket(peers[i], false);
+                if (fd < 0) usleep(100000);
+            }
+            if (fd < 0) throw std::runtime_error("Failed to connect to tensor-parallel peer " + peers[i]);
+            group->peers_.push_back(fd);
+
+            TensorParallelHello expected = hello;
+            expected.rank = static_cast<int32_t>(i) + 1;
+            TensorParallelHello reply;
+            if (!WriteFully(fd, &expected, sizeof(expected)) || !ReadFully(fd, &reply, sizeof(reply))) {
+                throw std::runtime_error("Tensor-parallel peer " + peers[i] + " closed the connection");
+            }
+            if (!(reply == expected)) {
+                throw std::runtime_error("Tensor-parallel peer " + peers[i] + " serves a different shard");
+            }
+        }
+        return group;
+    }
+
+    // Worker side: takes rank 0's connection on `listen_fd` and answers its handshake with `hello`
+    static std::unique_ptr<TensorParallelGroup> Accept(int listen_fd, const TensorParallelHello& hello) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) throw std::runtime_error("Failed to accept the tensor-parallel coordinator");
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        auto group = std::make_unique<TensorParallelGroup>(hello.rank, hello.size, std::vector<int>{fd});
+        TensorParallelHello request;
+        if (!ReadFully(fd, &request, sizeof(request)) || !WriteFully(fd, &hello, sizeof(hello))) {
+            throw std::runtime_error("Tensor-parallel coordinator closed the connection");
+        }
+        if (!(request == hello)) throw std::runtime_error("Tensor-parallel coordinator expects a different shard");
+        return group;
+    }
+
+    int rank() const { return rank_; }
+    int size() const { return size_; }
+
+    // Held by rank 0 for a whole step: the workers follow one step at a time
+    std::mutex& step_mutex() { return step_mutex_; }
+
+    // Shuts the connections down; the workers' MLXServeShard returns
+    void Close() {
+        for (int fd : peers_) shutdown(fd, SHUT_RDWR);
+        failed_ = true;
+    }
+
+    // Rank 0: starts a step on every worker; `hidden` is [rows, hidden_size]
+    void SendStep(const TensorParallelStep& step, const float* hidden, size_t hidden_elems) {
+        TensorParallelStepHeader header = {kTensorParallelMagic, static_cast<int32_t>(step.row_slots.size()),
+                                           static_cast<int32_t>(step.block_tables.size()),
+                                           static_cast<int32_t>(step.copies.size() / 3)};
+        for (int fd : peers_) {
+            send(fd, &header, sizeof(header));
+            send_vector(fd, step.row_slots);
+            send_vector(fd, step.row_table_offsets);
+            send_vector(fd, step.row_positions);
+            send_vector(fd, step.rope_ids);
+            send_vector(fd, step.block_tables);
+            send_vector(fd, step.copies);
+            send(fd, hidden, hidden_elems * sizeof(float));
+        }
+    }
+
+    // Worker: the next step from rank 0, false once it has closed the
+    // connection; sizes beyond what the pool can address are rejected
+    bool ReceiveStep(TensorParallelStep& step, std::vector<float>& hidden, int hidden_size, int max_rows,
+                     int max_blocks) {
+        TensorParallelStepHeader header;
+        if (failed_ || !ReadFully(peers_[0], &header, sizeof(header))) return false;
+        if (header.magic != kTensorParallelMagic || header.rows <= 0 || header.rows > max_rows ||
+            header.table_entries < 0 || header.table_entries / header.rows > max_blocks ||
+            header.copies < 0 || header.copies > max_blocks) {
+            fail("Invalid tensor-parallel step");
+        }
+        size_t rows = static_cast<size_t>(header.rows);
+        receive_vector(peers_[0], step.row_slots, rows);
+        receive_vector(peers_[0], step.row_table_offsets, rows);
+        receive_vector(peers_[0], step.row_positions, rows);
+        receive_vector(peers_[0], step.rope_ids, 3 * rows);
+        receive_vector(peers_[0], step.block_tables, static_cast<size_t>(header.table_entries));
+        receive_vector(peers_[0], step.copies, 3 * static_cast<size_t>(header.copies));
+        receive_vector(peers_[0], hidden, rows * hidden_size);
+        return true;
+    }
+
+    // Sums `x` ([elems] floats, resident in shared memory) over every rank, in place
+    void AllReduce(float* x, size_t elems) {
+        size_t bytes = elems * sizeof(float);
+        if (rank_ != 0) {
+            send(peers_[0], x, bytes);
+            receive(peers_[0], x, bytes);
+            return;
+        }
+        scratch_.resize(elems);
+        for (int fd : peers_) {
+            receive(fd, scratch_.data(), bytes);
+            for (size_t i = 0; i < elems; i++) x[i] += scratch_[i];
+        }
+        for (int fd : peers_) send(fd, x, bytes);
+    }
+};
+
+// Runtime shared by every loaded model
+//
+// One admission queue bounds forwards across all models (the first load sizes
+// it), and models whose K/V has the same layout draw their blocks from one
+// pool and one budget; models with different layouts (3B vs 7B) cannot share
+// slabs and each get their own. Caches are tagged with their model's
+// fingerprint, so a shared pool never lets one model extend another's handles.
+// Both are held weakly here and live as long as some model holds them.
+static std::mutex g_shared_mutex;
+static std::weak_ptr<ForwardScheduler> g_shared_scheduler;
+static std::vector<std::weak_ptr<KVBlockPool>> g_shared_pools;
+
+static std::shared_ptr<ForwardScheduler> SharedScheduler(int max_in_flight) {
+    std::lock_guard<std::mutex> lock(g_shared_mutex);
+    auto scheduler = g_shared_scheduler.lock();
+    if (!scheduler) {
+        scheduler = std::make_shared<ForwardScheduler>(max_in_flight);
+        g_shared_scheduler = scheduler;
+    }
+    return scheduler;
+}
+
+// The budget only applies to a newly created pool; MLXSetMemoryBudget changes it later
+static std::shared_ptr<KVBlockPool> SharedKVPool(int num_layers, int kv_dim, int block_size, int num_blocks,
+                                                 int64_t budget_bytes) {
+    std::lock_guard<std::mutex> lock(g_shared_mutex);
+    g_shared_pools.erase(std::remove_if(g_shared_pools.begin(), g_shared_pools.end(),
+                                        [](const auto& pool) { return pool.expired(); }),
+                         g_shared_pools.end());
+    for (const auto& weak : g_shared_pools) {
+        auto pool = weak.lock();
+        if (pool && pool->num_layers() == num_layers && pool->kv_dim() == kv_dim &&
+            pool->block_size() == block_size && pool->num_blocks() == num_blocks) {
+            return pool;
+        }
+    }
+    auto pool = std::make_shared<KVBlockPool>(num_layers, kv_dim, block_size, num_blocks);
+    pool->SetBudgetBytes(budget_bytes);
+    g_shared_pools.push_back(pool);
+    return pool;
+}
+
+// Qwen2-VL Model with complete forward pass
+class Qwen2VLModel {
+private:
+    ModelConfig config_;
+    // Weights are uploaded once at load time and bound by reference in every kernel
+    // Linear projections are stored in config_.weight_format; scales/zeros are nil unless quantized
+    struct LinearWeight {
+        id<MTLBuffer> data;
+        id<MTLBuffer> scales;
+        id<MTLBuffer> zeros;
+    };
+    std::unordered_map<std::string, id<MTLBuffer>> weights_;
+    std::unordered_map<std::string, LinearWeight> linear_weights_;
+    // The language model's weights resolved out of the maps once at load time,
+    // so the forward pass builds no names and hashes no strings
+    struct LayerWeights {
+        id<MTLBuffer> input_layernorm;
+        id<MTLBuffer> post_attention_layernorm;
+        LinearWeight q_proj, k_proj, v_proj, o_proj;
+        LinearWeight gate_proj, up_proj, down_proj;
+    };
+    std::vector<LayerWeights> layers_;
+    id<MTLBuffer> embed_tokens_;
+    id<MTLBuffer> final_norm_;
+    LinearWeight lm_head_;
+    id<MTLBuffer> rope_table_;  // [max_position_embeddings, head_dim / 2] (cos, sin)
+    std::shared_ptr<KVBlockPool> kv_pool_;
+    uint64_t fingerprint_ = 0;  // Identifies config + weights for cache snapshots
+    std::shared_ptr<ForwardScheduler> scheduler_;  // Shared with every loaded model
+    bool has_vision_ = false;  // Vision tower weights were found at load time
+    bool has_pointer_ = false;  // Pointer head weights were found at load time
+    ImageEmbeddingCache image_cache_;
+    ActivationArena arena_;  // Per-forward intermediates, leased through ArenaScope
+    id<MTLBuffer> identity_rows_ = nil;  // identity_rows()
+    std::mutex identity_rows_mutex_;
+    std::unique_ptr<TensorParallelGroup> tp_;  // Null unless tp_size > 1; a worker's is set by serve_shard
+
+    // Continuous batching
+    //
+    // Every forward is queued as StepWork and advanced by engine steps. A step
+    // packs pending work into one ragged run_forward of at most max_step_tokens
+    // rows: sequences with the fewest tokens left (decodes) go first and none
+    // contributes more than prefill_chunk_tokens, so a long prompt is prefilled
+    // over several steps that also serve other sessions' decodes. Whichever
+    // waiting caller holds a ForwardScheduler slot runs the next step over
+    // everyone's work; a caller returns once all of its own work is done.
+    // Submitted work (submit_forward) has no waiting caller: step_queue_ drives
+    // steps for it instead, and its `finished` callback reports completion.
+    struct StepWork {
+        KVCache* cache = nullptr;  // Fresh fork; each chunk is appended as its step runs
+        std::vector<uint32_t> tokens;
+        size_t consumed = 0;  // Tokens already in the cache
+        // Encoded after the final chunk, on this sequence's logits row (buffer, byte offset)
+        // or, for hidden_only work, its final-norm hidden state row
+        std::function<void(CommandBatch&, id<MTLBuffer>, NSUInteger)> epilogue;
+        // Host side, once the final chunk's command buffer has completed
+        std::function<void(id<MTLBuffer>, NSUInteger)> complete;
+        // Trailing tokens of the final chunk that get logits rows, starting at the
+        // epilogue/complete offset (speculative verification needs all of them)
+        int logit_rows = 1;
+        bool hidden_only = false;  // Skip the LM head; the epilogue gets the last row's hidden state
+        // Claimed whole or not at all, so logit_rows all come from one step's chunk
+        // (speculative verification); at most prefill_chunk_tokens
+        bool atomic = false;
+        // Multimodal prompts only: [3, tokens.size()] M-RoPE ids and, per token,
+        // an embedding row that replaces the token's (nullptr keeps the lookup)
+        std::vector<int32_t> rope_positions;
+        std::vector<const float*> embeddings;
+        bool claimed = false;  // Inside a running step
+        bool done = false;
+        std::exception_ptr error;
+        // Submitted work only: runs once done, outside step_mutex_, and owns (frees) the work
+        std::function<void()> finished;
+    };
+
+    struct StepChunk {
+        StepWork* work;
+        std::vector<int32_t> input_ids;
+        std::vector<int32_t> rope_positions;  // This chunk's slice of the work's, if any
+        std::vector<const float*> embeddings;
+    };
+
+    std::mutex step_mutex_;  // Guards pending_, submitted_ and the claimed/done/consumed state of queued work
+    std::condition_variable step_cv_;
+    std::vector<StepWork*> pending_;
+    int submitted_ = 0;  // Submitted work not done yet
+    dispatch_queue_t step_queue_;  // Serial: one thread drives submitted work, however much is queued
+
+    // Metal compute pipelines
+    id<MTLComputePipelineState> matmul_pipeline_;
+    id<MTLComputePipelineState> linear_gemm_pipeline_;
+    id<MTLComputePipelineState> linear_gemv_pipeline_;
+    id<MTLComputePipelineState> swiglu_gemm_pipeline_;
+    id<MTLComputePipelineState> swiglu_gemv_pipeline_;
+    id<MTLComputePipelineState> rmsnorm_pipeline_;
+    id<MTLComputePipelineState> add_rmsnorm_pipeline_;
+    id<MTLComputePipelineState> layernorm_pipeline_;
+    id<MTLComputePipelineState> bias_act_pipeline_;
+    id<MTLComputePipelineState> vision_rope_pipeline_;
+    id<MTLComputePipelineState> dense_attention_pipeline_;
+    id<MTLComputePipelineState> pointer_scores_pipeline_;
+    id<MTLComputePipelineState> linear_rope_gemm_pipeline_;
+    id<MTLComputePipelineState> linear_rope_gemv_pipeline_;
+    id<MTLComputePipelineState> transpose_pipeline_;
+    id<MTLComputePipelineState> scale_pipeline_;
+    id<MTLComputePipelineState> add_pipeline_;
+    id<MTLComputePipelineState> mul_pipeline_;
+    id<MTLComputePipelineState> kv_write_pipeline_;
+    id<MTLComputePipelineState> paged_attention_pipeline_;   // Specialized to the language model's heads
+    id<MTLComputePipelineState> vision_attention_pipeline_;  // Same kernel, shapes from the arguments
+    id<MTLComputePipelineState> logit_bias_pipeline_;
+    id<MTLComputePipelineState> sample_pipeline_;
+
+    // Long-lived queue; each forward encodes into one command buffer on it
+    id<MTLCommandQueue> queue_;
+
+    void init_metal() {
+        {
+            std::lock_guard<std::mutex> lock(g_shared_mutex);
+            if (!g_device) g_device = MTLCreateSystemDefaultDevice();
+            if (!g_device) {
+                throw std::runtime_error("Failed to create Metal device");
+            }
+        }
+
+        NSError* error = nil;
+        KernelLibrary kernels = LoadKernelLibrary();
+
+        // Create all pipeline states, specialized for the model's weight format, activation, M-RoPE sections
+        // and attention heads
+        MTLFunctionConstantValues* constants = [[MTLFunctionConstantValues alloc] init];
+        uint weight_format = static_cast<uint>(config_.weight_format);
+        uint weight_group_size = static_cast<uint>(config_.quant_group_size);
+        [constants setConstantValue:&weight_format type:MTLDataTypeUInt atIndex:0];
+        [constants setConstantValue:&weight_group_size type:MTLDataTypeUInt atIndex:1];
+        uint mlp_activation = static_cast<uint>(config_.hidden_act);
+        [constants setConstantValue:&mlp_activation type:MTLDataTypeUInt atIndex:2];
+        uint rope_section_1 = static_cast<uint>(config_.mrope_section[0]);
+        uint rope_section_2 = static_cast<uint>(config_.mrope_section[0] + config_.mrope_section[1]);
+        [constants setConstantValue:&rope_section_1 type:MTLDataTypeUInt atIndex:3];
+        [constants setConstantValue:&rope_section_2 type:MTLDataTypeUInt atIndex:4];
+        // Attention shapes: left to the arguments in the vision tower's variant
+        uint attn_generic = 0;
+        MTLFunctionConstantValues* generic = [constants copy];
+        [generic setConstantValue:&attn_generic type:MTLDataTypeUInt atIndex:5];
+        [generic setConstantValue:&attn_generic type:MTLDataTypeUInt atIndex:6];
+        uint attn_head_dim = static_cast<uint>(config_.head_dim);
+        uint attn_group = static_cast<uint>(config_.num_attention_heads / config_.num_key_value_heads);
+        [constants setConstantValue:&attn_head_dim type:MTLDataTypeUInt atIndex:5];
+        [constants setConstantValue:&attn_group type:MTLDataTypeUInt atIndex:6];
+
+        // The archive is keyed by everything the compiled pipelines depend on
+        uint specialization[] = {weight_format, weight_group_size, mlp_activation, rope_section_1, rope_section_2,
+                                 attn_head_dim, attn_group};
+        uint64_t archive_key = Fnv1a(reinterpret_cast<const uint8_t*>(specialization), sizeof(specialization), kernels.hash);
+        const char* device_name = [[g_device name] UTF8String];
+        archive_key = Fnv1a(reinterpret_cast<const uint8_t*>(device_name), strlen(device_name), archive_key);
+        PipelineArchive archive(PipelineCacheDirectory(config_.pipeline_cache_dir), archive_key);
+
+        auto make_pipeline = [&](NSString* name, MTLFunctionConstantValues* values = nil) -> id<MTLComputePipelineState> {
+            id<MTLFunction> function = [kernels.library newFunctionWithName:name constantValues:values ? values : constants
+                                                                      error:&error];
+            id<MTLComputePipelineState> pipeline = function ? archive.Make(function, &error) : nil;
+            if (!pipeline) {
+                NSString* errStr = [error localizedDescription];
+                throw std::runtime_error(std::string("Failed to create Metal pipeline ") + [name UTF8String] +
+                                         (errStr ? std::string(": ") + [errStr UTF8String] : ""));
+            }
+            return pipeline;
+        };
+
+        matmul_pipeline_ = make_pipeline(@"matmul_kernel");
+        linear_gemm_pipeline_ = make_pipeline(@"linear_gemm_kernel");
+        linear_gemv_pipeline_ = make_pipeline(@"linear_gemv_kernel");
+        swiglu_gemm_pipeline_ = make_pipeline(@"swiglu_gemm_kernel");
+        swiglu_gemv_pipeline_ = make_pipeline(@"swiglu_gemv_kernel");
+        linear_rope_gemm_pipeline_ = make_pipeline(@"linear_rope_gemm_kernel");
+        linear_rope_gemv_pipeline_ = make_pipeline(@"linear_rope_gemv_kernel");
+        rmsnorm_pipeline_ = make_pipeline(@"rmsnorm_kernel");
+        add_rmsnorm_pipeline_ = make_pipeline(@"add_rmsnorm_kernel");
+        layernorm_pipeline_ = make_pipeline(@"layernorm_kernel");
+        bias_act_pipeline_ = make_pipeline(@"bias_act_kernel");
+        vision_rope_pipeline_ = make_pipeline(@"vision_rope_kernel");
+        dense_attention_pipeline_ = make_pipeline(@"dense_attention_kernel");
+        pointer_scores_pipeline_ = make_pipeline(@"pointer_scores_kernel");
+        transpose_pipeline_ = make_pipeline(@"transpose_kernel");
+        scale_pipeline_ = make_pipeline(@"scale_kernel");
+        add_pipeline_ = make_pipeline(@"add_kernel");
+        mul_pipeline_ = make_pipeline(@"mul_kernel");
+        kv_write_pipeline_ = make_pipeline(@"kv_write_kernel");
+        paged_attention_pipeline_ = make_pipeline(@"paged_attention_kernel");
+        vision_attention_pipeline_ = make_pipeline(@"paged_attention_kernel", generic);
+        logit_bias_pipeline_ = make_pipeline(@"logit_bias_kernel");
+        sample_pipeline_ = make_pipeline(@"sample_kernel");
+        archive.Save();
+
+        queue_ = [g_device newCommandQueue];
+        if (!queue_) {
+            throw std::runtime_error("Failed to create Metal command queue");
+        }
+    }
+
+    // A kernel argument: a buffer range (offset in bytes, default 0), or a small
+    // constant (scalar, SamplingParams) passed inline with setBytes
+    struct Binding {
+        id<MTLBuffer> buffer;
+        NSUInteger offset = 0;
+        std::array<uint8_t, 32> bytes;
+        NSUInteger length = 0;  // Inline constant size; 0 for a buffer
+        Binding(id<MTLBuffer> b, NSUInteger off = 0) : buffer(b), offset(off) {}
+
+        template <typename T>
+        static Binding Bytes(const T& value) {
+            static_assert(sizeof(T) <= sizeof(bytes), "Inline kernel constant too large");
+            Binding binding(nil);
+            memcpy(binding.bytes.data(), &value, sizeof(T));
+            binding.length = sizeof(T);
+            return binding;
+        }
+    };
+
+    // A run of kernels encoded into one command buffer with a single serial
+    // compute encoder on the model's queue; the host syncs once in wait().
+    // Serial dispatch order makes each kernel see the results of the previous
+    // ones, so intermediates never leave device memory. While profiling, each
+    // region() starts a new (still serial) encoder timed on its own.
+    struct CommandBatch {
+        id<MTLCommandBuffer> command_buffer;
+        id<MTLComputeCommandEncoder> encoder;
+        std::unique_ptr<Profiler::BatchProfile> profile;  // Null unless profiling
+
+        explicit CommandBatch(id<MTLCommandQueue> queue) { restart(queue); }
+
+        // Continues in a fresh command buffer once the previous one was waited for
+        void restart(id<MTLCommandQueue> queue) {
+            command_buffer = [queue commandBuffer];
+            profile = g_profiler.Begin();
+            encoder = profile ? profile->OpenEncoder(command_buffer, MLX_KERNEL_OTHER, -1)
+                              : [command_buffer computeCommandEncoder];
+        }
+
+        // Attributes kernels encoded from here on to (MLX_KERNEL_* kind, layer; -1 outside layers)
+        void region(int kind, int layer) {
+            if (!profile || !profile->sampling()) return;
+            [encoder endEncoding];
+            encoder = profile->OpenEncoder(command_buffer, kind, layer);
+        }
+
+        void commit() {
+            [encoder endEncoding];
+            [command_buffer commit];
+        }
+
+        void wait() {
+            [command_buffer waitUntilCompleted];
+            if ([command_buffer status] == MTLCommandBufferStatusError) {
+                NSString* errStr = [[command_buffer error] localizedDescription];
+                throw std::runtime_error(errStr ? [errStr UTF8String] : "Metal command buffer failed");
+            }
+            if (profile) profile->Finish(command_buffer);
+            profile.reset();
+        }
+
+        void commit_and_wait() {
+            commit();
+            wait();
+        }
+    };
+
+    void bind(CommandBatch& batch, id<MTLComputePipelineState> pipeline, const std::vector<Binding>& buffers) {
+        [batch.encoder setComputePipelineState:pipeline];
+        for (size_t i = 0; i < buffers.size(); i++) {
+            if (buffers[i].length) {
+                [batch.encoder setBytes:buffers[i].bytes.data() length:buffers[i].length atIndex:i];
+            } else {
+                [batch.encoder setBuffer:buffers[i].buffer offset:buffers[i].offset atIndex:i];
+            }
+        }
+    }
+
+    // Helper: Encode Metal kernel with 1D grid of gridSize threads
+    void execute_1d(CommandBatch& batch, id<MTLComputePipelineState> pipeline, const std::vector<Binding>& buffers, uint gridSize) {
+        bind(batch, pipeline, buffers);
+        MTLSize threadsPerThreadgroup = {256, 1, 1};
+        MTLSize threadgroups = {(gridSize + 255) / 256, 1, 1};
+        [batch.encoder dispatchThreadgroups:threadgroups threadsPerThreadgroup:threadsPerThreadgroup];
+    }
+
+    // Helper: Encode Metal kernel with 2D grid of gridSize threads
+    void execute_2d(CommandBatch& batch, id<MTLComputePipelineState> pipeline, const std::vector<Binding>& buffers, MTLSize gridSize) {
+        bind(batch, pipeline, buffers);
+        MTLSize threadsPerThreadgroup = {16, 16, 1};
+        MTLSize threadgroups = {(gridSize.width + 15) / 16, (gridSize.height + 15) / 16, 1};
+        [batch.encoder dispatchThreadgroups:threadgroups threadsPerThreadgroup:threadsPerThreadgroup];
+    }
+
+    // Helper: Encode Metal kernel with 3D grid of gridSize threads
+    void execute_3d(CommandBatch& batch, id<MTLComputePipelineState> pipeline, const std::vector<Binding>& buffers, MTLSize gridSize) {
+        bind(batch, pipeline, buffers);
+        MTLSize threadsPerThreadgroup = {8, 8, 8};
+        MTLSize threadgroups = {(gridSize.width + 7) / 8, (gridSize.height + 7) / 8, (gridSize.depth + 7) / 8};
+        [batch.encoder dispatchThreadgroups:threadgroups threadsPerThreadgroup:threadsPerThreadgroup];
+    }
+
+    // Helper: Encode a tiled GEMM kernel, one 128-thread threadgroup per kGemmTile x kGemmTile output tile
+    static constexpr int kGemmTile = 32;
+    static constexpr int kGemmThreads = 128;
+    void execute_gemm(CommandBatch& batch, id<MTLComputePipelineState> pipeline, const std::vector<Binding>& buffers, int M, int N) {
+        bind(batch, pipeline, buffers);
+        MTLSize threadgroups = {static_cast<NSUInteger>((N + kGemmTile - 1) / kGemmTile),
+                                static_cast<NSUInteger>((M + kGemmTile - 1) / kGemmTile), 1};
+        [batch.encoder dispatchThreadgroups:threadgroups threadsPerThreadgroup:MTLSizeMake(kGemmThreads, 1, 1)];
+    }
+
+    // Device buffer helpers
+    // Activation buffer of `elements` floats, from the thread's ArenaScope if it has one
+    id<MTLBuffer> new_buffer(size_t elements) {
+        size_t bytes = std::max<size_t>(elements, 1) * sizeof(float);
+        ArenaScope* scope = ArenaScope::Current();
+        id<MTLBuffer> buffer = scope ? scope->Acquire(bytes)
+                                     : [g_device newBufferWithLength:bytes options:MTLResourceStorageModeShared];
+        if (!buffer) {
+            throw std::runtime_error("Failed to allocate Metal buffer");
+        }
+        return buffer;
+    }
+
+    id<MTLBuffer> new_bytes(size_t bytes) {
+        id<MTLBuffer> buffer = [g_device newBufferWithLength:std::max<size_t>(bytes, 1) options:MTLResourceStorageModeShared];
+        if (!buffer) {
+            throw std::runtime_error("Failed to allocate Metal buffer");
+        }
+        return buffer;
+    }
+
+    // `elements` 4-byte values copied into a buffer leased like new_buffer's
+    id<MTLBuffer> upload(const void* data, size_t elements) {
+        g_profiler.CountUpload(elements * sizeof(float));
+        id<MTLBuffer> buffer = new_buffer(elements);
+        if (elements) memcpy([buffer contents], data, elements * sizeof(float));
+        return buffer;
+    }
+
+    id<MTLBuffer> upload_ints(const std::vector<int32_t>& data) { return upload(data.data(), data.size()); }
+
+    // Row ids 0..rows-1 for rmsnorm over every row; grown on demand and never
+    // written once handed out, so concurrent steps share it
+    id<MTLBuffer> identity_rows(int rows) {
+        std::lock_guard<std::mutex> lock(identity_rows_mutex_);
+        size_t capacity = identity_rows_ ? [identity_rows_ length] / sizeof(int32_t) : 0;
+        if (capacity < static_cast<size_t>(rows)) {
+            capacity = std::max<size_t>(rows, 2 * capacity);
+            id<MTLBuffer> buffer = new_bytes(capacity * sizeof(int32_t));
+            int32_t* ids = static_cast<int32_t*>([buffer contents]);
+            for (size_t row = 0; row < capacity; row++) ids[row] = static_cast<int32_t>(row);
+            identity_rows_ = buffer;
+        }
+        return identity_rows_;
+    }
+
+    Binding scalar(uint value) { return Binding::Bytes(value); }
+
+    Binding scalar(float value) { return Binding::Bytes(value); }
+
+    id<MTLBuffer> weight(const std::string& name) const {
+        auto it = weights_.find(name);
+        if (it == weights_.end()) {
+            throw std::runtime_error("Missing weight: " + name);
+        }
+        return it->second;
+    }
+
+    const LinearWeight& linear_weight(const std::string& name) const {
+        auto it = linear_weights_.find(name);
+        if (it == linear_weights_.end()) {
+            throw std::runtime_error("Missing weight: " + name);
+        }
+        return it->second;
+    }
+
+    // Matrix multiplication on Metal: C[M, N] = A[M, K] x B[K, N]
+    id<MTLBuffer> matmul(CommandBatch& batch, Binding A, Binding B, int M, int N, int K) {
+        id<MTLBuffer> bufferC = new_buffer(static_cast<size_t>(M) * N);
+        matmul_into(batch, A, B, bufferC, M, N, K);
+        return bufferC;
+    }
+
+    void matmul_into(CommandBatch& batch, Binding A, Binding B, Binding C, int M, int N, int K) {
+        std::vector<Binding> buffers = {A, B, C, scalar((uint)M), scalar((uint)N), scalar((uint)K)};
+        execute_gemm(batch, matmul_pipeline_, buffers, M, N);
+    }
+
+    // Linear projection on Metal: Y[M, N] = X[M, K] x W[N, K]^T
+    // Decode-sized inputs (M <= kGemvMaxRows) take the GEMV path, one simdgroup per output column
+    static constexpr int kGemvMaxRows = 8;
+    static constexpr int kGemvSimdgroups = 8;
+    id<MTLBuffer> linear(CommandBatch& batch, Binding X, const LinearWeight& W, int M, int N, int K) {
+        id<MTLBuffer> bufferY = new_buffer(static_cast<size_t>(M) * N);
+        linear_into(batch, X, W, bufferY, M, N, K);
+        return bufferY;
+    }
+
+    void linear_into(CommandBatch& batch, Binding X, const LinearWeight& W, Binding Y, int M, int N, int K) {
+        // Unquantized formats never read scales/zeros; bind the data buffer in their place
+        std::vector<Binding> buffers = {X, W.data, Y, scalar((uint)M), scalar((uint)N), scalar((uint)K),
+                                        W.scales ? W.scales : W.data, W.zeros ? W.zeros : W.data};
+        if (M <= kGemvMaxRows) {
+            bind(batch, linear_gemv_pipeline_, buffers);
+            MTLSize threadgroups = {static_cast<NSUInteger>((N + kGemvSimdgroups - 1) / kGemvSimdgroups), 1, 1};
+            [batch.encoder dispatchThreadgroups:threadgroups threadsPerThreadgroup:MTLSizeMake(kGemvSimdgroups * 32, 1, 1)];
+        } else {
+            execute_gemm(batch, linear_gemm_pipeline_, buffers, M, N);
+        }
+    }
+
+    // Gated MLP on Metal: Y[M, N] = act(X x Wg^T) * (X x Wu^T), fused into one kernel
+    id<MTLBuffer> gated_mlp(CommandBatch& batch, Binding X, const LinearWeight& Wg, const LinearWeight& Wu, int M, int N, int K) {
+        id<MTLBuffer> bufferY = new_buffer(static_cast<size_t>(M) * N);
+        gated_mlp_into(batch, X, Wg, Wu, bufferY, M, N, K);
+        return bufferY;
+    }
+
+    void gated_mlp_into(CommandBatch& batch, Binding X, const LinearWeight& Wg, const LinearWeight& Wu, Binding Y, int M, int N,
+                        int K) {
+        std::vector<Binding> buffers = {X, Wg.data, Y, scalar((uint)M), scalar((uint)N), scalar((uint)K),
+                                        Wg.scales ? Wg.scales : Wg.data, Wg.zeros ? Wg.zeros : Wg.data,
+                                        Wu.data, Wu.scales ? Wu.scales : Wu.data, Wu.zeros ? Wu.zeros : Wu.data};
+        if (M <= kGemvMaxRows) {
+            bind(batch, swiglu_gemv_pipeline_, buffers);
+            MTLSize threadgroups = {static_cast<NSUInteger>((N + kGemvSimdgroups - 1) / kGemvSimdgroups), 1, 1};
+            [batch.encoder dispatchThreadgroups:threadgroups threadsPerThreadgroup:MTLSizeMake(kGemvSimdgroups * 32, 1, 1)];
+        } else {
+            execute_gemm(batch, swiglu_gemm_pipeline_, buffers, M, N);
+        }
+    }
+
+    // RMSNorm on Metal, one threadgroup per row in a single dispatch
+    static constexpr int kNormThreads = 256;
+    id<MTLBuffer> rmsnorm(CommandBatch& batch, id<MTLBuffer> x, id<MTLBuffer> weight, int size, int rows) {
+        return rmsnorm_ids(batch, x, weight, size, identity_rows(rows), rows);
+    }
+
+    // RMSNorm of the selected rows of x, packed densely into the result
+    id<MTLBuffer> rmsnorm_rows(CommandBatch& batch, id<MTLBuffer> x, id<MTLBuffer> weight, int size, const std::vector<int>& row_ids) {
+        return rmsnorm_ids(batch, x, weight, size, upload_ints(row_ids), row_ids.size());
+    }
+
+    // RMSNorm of the `rows` rows of x listed in the int32 buffer row_ids
+    id<MTLBuffer> rmsnorm_ids(CommandBatch& batch, id<MTLBuffer> x, id<MTLBuffer> weight, int size,
+                              id<MTLBuffer> row_ids, size_t rows) {
+        id<MTLBuffer> bufferY = new_buffer(static_cast<size_t>(size) * rows);
+        rmsnorm_ids_into(batch, x, weight, bufferY, size, row_ids, rows);
+        return bufferY;
+    }
+
+    void rmsnorm_ids_into(CommandBatch& batch, id<MTLBuffer> x, id<MTLBuffer> weight, id<MTLBuffer> y, int size,
+                          id<MTLBuffer> row_ids, size_t rows) {
+        bind(batch, rmsnorm_pipeline_,
+             {x, weight, y, scalar((uint)size), scalar(config_.rms_norm_eps), row_ids});
+        [batch.encoder dispatchThreadgroups:MTLSizeMake(rows, 1, 1) threadsPerThreadgroup:MTLSizeMake(kNormThreads, 1, 1)];
+    }
+
+    // Residual add fused with RMSNorm: h = x + residual, normed = rmsnorm(h) * weight
+    struct NormedResidual {
+        id<MTLBuffer> hidden;
+        id<MTLBuffer> normed;
+    };
+    NormedResidual add_rmsnorm(CommandBatch& batch, id<MTLBuffer> x, id<MTLBuffer> residual, id<MTLBuffer> weight, int size, int rows) {
+        NormedResidual out = {new_buffer(static_cast<size_t>(size) * rows), new_buffer(static_cast<size_t>(size) * rows)};
+        add_rmsnorm_into(batch, x, residual, weight, out, size, rows);
+        return out;
+    }
+
+    void add_rmsnorm_into(CommandBatch& batch, id<MTLBuffer> x, id<MTLBuffer> residual, id<MTLBuffer> weight,
+                          const NormedResidual& out, int size, int rows) {
+        bind(batch, add_rmsnorm_pipeline_,
+             {x, residual, weight, out.hidden, out.normed, scalar((uint)size), scalar(config_.rms_norm_eps)});
+        [batch.encoder dispatchThreadgroups:MTLSizeMake(rows, 1, 1) threadsPerThreadgroup:MTLSizeMake(kNormThreads, 1, 1)];
+    }
+
+    // LayerNorm with bias over [rows, size] (vision tower, pointer head)
+    id<MTLBuffer> layernorm(CommandBatch& batch, id<MTLBuffer> x, id<MTLBuffer> weight, id<MTLBuffer> bias, int size, int rows,
+                            float eps) {
+        id<MTLBuffer> bufferY = new_buffer(static_cast<size_t>(size) * rows);
+        bind(batch, layernorm_pipeline_,
+             {x, weight, bias, bufferY, scalar((uint)size), scalar(eps)});
+        [batch.encoder dispatchThreadgroups:MTLSizeMake(rows, 1, 1) threadsPerThreadgroup:MTLSizeMake(kNormThreads, 1, 1)];
+        return bufferY;
+    }
+
+    // Bias add plus activation, in place on a [rows, cols] projection output
+    enum class BiasActivation : uint { None = 0, QuickGelu = 1, Gelu = 2 };
+    void bias_act(CommandBatch& batch, id<MTLBuffer> x, id<MTLBuffer> bias, int rows, int cols, BiasActivation act) {
+        size_t size = static_cast<size_t>(rows) * cols;
+        execute_1d(batch, bias_act_pipeline_,
+                   {x, bias, scalar((uint)cols), scalar(static_cast<uint>(act)), scalar((uint)size)}, size);
+    }
+
+    // Vision projection with bias: Y[M, N] = act(X x W^T + b)
+    id<MTLBuffer> linear_bias(CommandBatch& batch, Binding X, const std::string& name, int M, int N, int K,
+                              BiasActivation act = BiasActivation::None) {
+        id<MTLBuffer> y = linear(batch, X, linear_weight(name + ".weight"), M, N, K);
+        bias_act(batch, y, weight(name + ".bias"), M, N, act);
+        return y;
+    }
+
+    // Q or K projection with RoPE fused into the epilogue: Y[M, N] = rope(X x W^T)
+    // N is heads * head_dim (num_kv_heads for K under GQA); rope_positions is the
+    // [3, M] temporal/height/width position buffer for the rows of X
+    id<MTLBuffer> linear_rope(CommandBatch& batch, Binding X, const LinearWeight& W, int M, int N, int K, id<MTLBuffer> rope_positions) {
+        id<MTLBuffer> bufferY = new_buffer(static_cast<size_t>(M) * N);
+        linear_rope_into(batch, X, W, bufferY, M, N, K, rope_positions);
+        return bufferY;
+    }
+
+    void linear_rope_into(CommandBatch& batch, Binding X, const LinearWeight& W, Binding Y, int M, int N, int K,
+                          id<MTLBuffer> rope_positions) {
+        std::vector<Binding> buffers = {X, W.data, Y, scalar((uint)M), scalar((uint)N), scalar((uint)K),
+                                        W.scales ? W.scales : W.data, W.zeros ? W.zeros : W.data,
+                                        rope_table_, rope_positions, scalar((uint)config_.head_dim)};
+        if (M <= kGemvMaxRows) {
+            bind(batch, linear_rope_gemv_pipeline_, buffers);
+            int pairs = N / 2;
+            MTLSize threadgroups = {static_cast<NSUInteger>((pairs + kGemvSimdgroups - 1) / kGemvSimdgroups), 1, 1};
+            [batch.encoder dispatchThreadgroups:threadgroups threadsPerThreadgroup:MTLSizeMake(kGemvSimdgroups * 32, 1, 1)];
+        } else {
+            execute_gemm(batch, linear_rope_gemm_pipeline_, buffers, M, N);
+        }
+    }
+
+    // Element-wise addition
+    id<MTLBuffer> add(CommandBatch& batch, id<MTLBuffer> a, id<MTLBuffer> b, size_t size) {
+        id<MTLBuffer> bufferC = new_buffer(size);
+        execute_1d(batch, add_pipeline_, {a, b, bufferC, scalar((uint)size)}, size);
+        return bufferC;
+    }
+
+    // Element-wise multiplication
+    id<MTLBuffer> mul(CommandBatch& batch, id<MTLBuffer> a, id<MTLBuffer> b, size_t size) {
+        id<MTLBuffer> bufferC = new_buffer(size);
+        execute_1d(batch, mul_pipeline_, {a, b, bufferC, scalar((uint)size)}, size);
+        return bufferC;
+    }
+
+public:
+    Qwen2VLModel(const std::string& model_path, const ModelConfig& config)
+        : config_(config), scheduler_(SharedScheduler(config.max_concurrent_forwards)),
+          image_cache_(config.image_cache_budget_bytes),
+          arena_(ActivationArena::BudgetFor(config)) {
+        // paged_attention_kernel limits: ATTN_MAX_HEAD_DIM, whole query-head groups per KV head
+        if (config_.head_dim > 128 || config_.num_attention_heads % config_.num_key_value_heads != 0) {
+            throw std::runtime_error("Unsupported attention head configuration");
+        }
+        // Tensor-parallel ranks each take whole KV heads (with their query groups) and an equal MLP slice
+        int tp = config_.tp_size;
+        if (tp < 1 || config_.tp_rank < 0 || config_.tp_rank >= tp || config_.num_key_value_heads % tp != 0 ||
+            config_.intermediate_size % tp != 0 ||
+            (config_.tp_rank == 0 && config_.tp_peers.size() + 1 != static_cast<size_t>(tp))) {
+            throw std::runtime_error("Unsupported tensor-parallel configuration");
+        }
+        // Quantized kernels read four weights per group at a time and packed Q4 pairs never straddle a group;
+        // under tensor parallelism o_proj and down_proj take this rank's slice of in_features
+        if (config_.weight_format == WeightFormat::Q8 || config_.weight_format == WeightFormat::Q4) {
+            int g = config_.quant_group_size;
+            int q_dim = config_.num_attention_heads / tp * config_.head_dim;
+            if (g <= 0 || g % 8 != 0 || config_.hidden_size % g != 0 || q_dim % g != 0 ||
+                config_.intermediate_size / tp % g != 0) {
+                throw std::runtime_error("Quantization group size must be a multiple of 8 dividing in_features");
+            }
+        }
+        // Fused RoPE rotates pairs 16 at a time; the M-RoPE sections partition the head_dim / 2 frequencies
+        const auto& sections = config_.mrope_section;
+        if (config_.head_dim % 32 != 0 || sections[0] < 0 || sections[1] < 0 || sections[2] < 0 ||
+            sections[0] + sections[1] + sections[2] != config_.head_dim / 2) {
+            throw std::runtime_error("Unsupported RoPE configuration");
+        }
+        step_queue_ = dispatch_queue_create("mlxvllm.steps", DISPATCH_QUEUE_SERIAL);
+        init_metal();
+        build_rope_table();
+        load_weights(model_path);
+        fingerprint_ = compute_fingerprint();
+        int kv_dim = config_.num_key_value_heads / tp * config_.head_dim;
+        if (tp == 1) {
+            kv_pool_ = SharedKVPool(config_.num_hidden_layers, kv_dim, config_.kv_block_size, config_.kv_num_blocks,
+                                    config_.kv_budget_bytes);
+        } else {
+            // Block ids address every rank's slabs, so the group's pools are private and rank 0's mirrors the rest
+            kv_pool_ = std::make_shared<KVBlockPool>(config_.num_hidden_layers, kv_dim, config_.kv_block_size,
+                                                     config_.kv_num_blocks, config_.tp_rank == 0);
+            kv_pool_->SetBudgetBytes(config_.kv_budget_bytes);
+        }
+        if (config_.tp_rank == 0 && tp > 1) {
+            tp_ = TensorParallelGroup::Connect(config_.tp_peers, TensorParallelHello::For(config_));
+        }
+    }
+
+    // Submitted forwards finish first. Their callbacks hold a model reference
+    // (MLXSubmitForward), dropped through ReleaseModel: this must not run on step_queue_
+    ~Qwen2VLModel() {
+        {
+            std::unique_lock<std::mutex> lock(step_mutex_);
+            step_cv_.wait(lock, [&] { return submitted_ == 0; });
+        }
+        dispatch_sync(step_queue_, ^{});
+    }
+
+    // FNV-1a over everything that changes the K/V a token sequence produces:
+    // the shape and numeric config, and each weight's name, size and first and
+    // last pages. Sampling keeps this cheap on mmap'd weights while still
+    // telling checkpoints apart.
+    uint64_t compute_fingerprint() const {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        auto mix = [&](const void* data, size_t bytes) {
+            const auto* p = static_cast<const uint8_t*>(data);
+            for (size_t i = 0; i < bytes; i++) hash = (hash ^ p[i]) * 0x100000001b3ull;
+        };
+        const int32_t shape[] = {config_.hidden_size, config_.num_attention_heads, config_.num_key_value_heads,
+                                 config_.num_hidden_layers, config_.intermediate_size, config_.vocab_size,
+                                 config_.head_dim, config_.max_position_embeddings,
+                                 static_cast<int32_t>(config_.hidden_act), config_.mrope_section[0],
+                                 config_.mrope_section[1], config_.mrope_section[2],
+                                 static_cast<int32_t>(config_.weight_format), config_.quant_group_size};
+        mix(shape, sizeof(shape));
+        mix(&config_.rms_norm_eps, sizeof(config_.rms_norm_eps));
+        mix(&config_.rope_theta, sizeof(config_.rope_theta));
+        if (config_.tp_size > 1) {
+            const int32_t shard[] = {config_.tp_rank, config_.tp_size};
+            mix(shard, sizeof(shard));
+        }
+
+        std::vector<std::pair<std::string, id<MTLBuffer>>> buffers;
+        for (const auto& [name, buffer] : weights_) buffers.emplace_back(name, buffer);
+        for (const auto& [name, weight] : linear_weights_) {
+            buffers.emplace_back(name, weight.data);
+            if (weight.scales) buffers.emplace_back(name + ".scales", weight.scales);
+            if (weight.zeros) buffers.emplace_back(name + ".zeros", weight.zeros);
+        }
+        std::sort(buffers.begin(), buffers.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+        constexpr size_t kSampleBytes = 4096;
+        for (const auto& [name, buffer] : buffers) {
+            size_t length = [buffer length];
+            const auto* contents = static_cast<const uint8_t*>([buffer contents]);
+            mix(name.data(), name.size());
+            mix(&length, sizeof(length));
+            mix(contents, std::min(length, kSampleBytes));
+            if (length > kSampleBytes) mix(contents + length - kSampleBytes, kSampleBytes);
+        }
+        return hash;
+    }
+
+    // cos/sin of every (position, frequency) pair, computed once in double precision
+    void build_rope_table() {
+        int half_dim = config_.head_dim / 2;
+        size_t entries = static_cast<size_t>(config_.max_position_embeddings) * half_dim;
+        rope_table_ = new_bytes(entries * 2 * sizeof(float));
+        float* table = static_cast<float*>([rope_table_ contents]);
+        std::vector<double> inv_freq(half_dim);
+        for (int i = 0; i < half_dim; i++) {
+            inv_freq[i] = std::pow(static_cast<double>(config_.rope_theta), -2.0 * i / config_.head_dim);
+        }
+        dispatch_apply(config_.max_position_embeddings, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t pos) {
+            float* row = table + pos * half_dim * 2;
+            for (int i = 0; i < half_dim; i++) {
+                double angle = static_cast<double>(pos) * inv_freq[i];
+                row[2 * i] = static_cast<float>(std::cos(angle));
+                row[2 * i + 1] = static_cast<float>(std::sin(angle));
+            }
+        });
+    }
+
+    // Helper to map a binary weight file into a zero-copy Metal buffer
+    //
+    // The file is mmap'd read-only and shared, so pages come straight from the
+    // page cache (and are shared by every server process on the host) and the
+    // buffer aliases the mapping; it is unmapped when the buffer is released.
+    id<MTLBuffer> load_binary_file(const std::string& file_path, size_t expected_elements) {
+        int fd = open(file_path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to open file: " + file_path);
+        }
+
+        struct stat st;
+        size_t expected_bytes = expected_elements * sizeof(float);
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < expected_bytes) {
+            close(fd);
+            throw std::runtime_error("Failed to read file: " + file_path);
+        }
+
+        // newBufferWithBytesNoCopy needs a page-aligned length; the tail of the
+        // last page is backed by the file (zero-filled past EOF)
+        size_t page = static_cast<size_t>(getpagesize());
+        size_t mapped_bytes = (expected_bytes + page - 1) / page * page;
+        void* addr = mmap(nullptr, mapped_bytes, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED) {
+            throw std::runtime_error("Failed to map file: " + file_path);
+        }
+
+        id<MTLBuffer> buffer = [g_device newBufferWithBytesNoCopy:addr
+                                                           length:mapped_bytes
+                                                          options:MTLResourceStorageModeShared
+                                                      deallocator:^(void* pointer, NSUInteger length) {
+                                                          munmap(pointer, length);
+                                                      }];
+        if (!buffer) {
+            munmap(addr, mapped_bytes);
+            throw std::runtime_error("Failed to wrap mapped file: " + file_path);
+        }
+        return buffer;
+    }
+
+    // Helper to load an [N, K] linear weight in config_.weight_format
+    // fp32 stays a zero-copy mapping; other formats are converted from the fp32
+    // file into a device buffer, after which the mapping is released.
+    LinearWeight load_linear_weight(const std::string& file_path, int N, int K) {
+        size_t count = static_cast<size_t>(N) * K;
+        return convert_linear_weight(load_binary_file(file_path, count), count);
+    }
+
+    // Rows [row0, row0 + N) x columns [col0, col0 + K) of the [total_n, total_k]
+    // linear weight in `file_path`: one tensor-parallel rank's slice, copied out
+    // of the mapping before conversion
+    LinearWeight load_linear_shard(const std::string& file_path, int total_n, int total_k,
+                                   int row0, int N, int col0, int K) {
+        if (row0 == 0 && col0 == 0 && N == total_n && K == total_k) return load_linear_weight(file_path, N, K);
+        id<MTLBuffer> file = load_binary_file(file_path, static_cast<size_t>(total_n) * total_k);
+        const float* all = static_cast<const float*>([file contents]);
+        id<MTLBuffer> slice = new_bytes(static_cast<size_t>(N) * K * sizeof(float));
+        float* dst = static_cast<float*>([slice contents]);
+        for (int n = 0; n < N; n++) {
+            memcpy(dst + static_cast<size_t>(n) * K, all + static_cast<size_t>(row0 + n) * total_k + col0, K * sizeof(float));
+        }
+        return convert_linear_weight(slice, static_cast<size_t>(N) * K);
+    }
+
+    // `count` fp32 weights in `source` as config_.weight_format
+    LinearWeight convert_linear_weight(id<MTLBuffer> source, size_t count) {
+        if (config_.weight_format == WeightFormat::F32) {
+            return {source, nil, nil};
+        }
+
+        const float* src = static_cast<const float*>([source contents]);
+        LinearWeight w = {nil, nil, nil};
+        switch (config_.weight_format) {
+        case WeightFormat::F16: {
+            w.data = new_bytes(count * sizeof(_Float16));
+            _Float16* dst = static_cast<_Float16*>([w.data contents]);
+            for (size_t i = 0; i < count; i++) dst[i] = static_cast<_Float16>(src[i]);
+            break;
+        }
+        case WeightFormat::BF16: {
+            w.data = new_bytes(count * sizeof(uint16_t));
+            uint16_t* dst = static_cast<uint16_t*>([w.data contents]);
+            for (size_t i = 0; i < count; i++) dst[i] = float_to_bf16(src[i]);
+            break;
+        }
+        case WeightFormat::Q8:
+        case WeightFormat::Q4: {
+            int bits = config_.weight_format == WeightFormat::Q8 ? 8 : 4;
+            size_t groups = count / config_.quant_group_size;
+            w.data = new_bytes(bits == 8 ? count : count / 2);
+            w.scales = new_bytes(groups * sizeof(_Float16));
+            w.zeros = new_bytes(groups * sizeof(_Float16));
+            quantize_groups(src, count, config_.quant_group_size, bits,
+                            static_cast<uint8_t*>([w.data contents]),
+                            static_cast<_Float16*>([w.scales contents]),
+                            static_cast<_Float16*>([w.zeros contents]));
+            break;
+        }
+        case WeightFormat::F32:
+            break;
+        }
+        return w;
+    }
+
+    // Under tensor parallelism rank r keeps query/KV heads [r, r + 1) * (heads / tp_size)
+    // (q/k/v rows, o_proj columns) and MLP columns [r, r + 1) * (intermediate / tp_size)
+    // (gate/up rows, down_proj columns); embeddings, the LM head, the vision tower
+    // and the pointer head are loaded by rank 0 only
+    void load_weights(const std::string& model_path) {
+        std::string bin_weights_path = model_path + "/bin_weights";
+        int tp = config_.tp_size, rank = config_.tp_rank;
+        int hidden_size = config_.hidden_size;
+        int q_dim = config_.num_attention_heads / tp * config_.head_dim;
+        int kv_dim = config_.num_key_value_heads / tp * config_.head_dim;
+        int intermediate = config_.intermediate_size / tp;
+
+        if (rank == 0) {
+            // Load embeddings
+            weights_["model.embed_tokens.weight"] = load_binary_file(
+                bin_weights_path + "/embed_tokens.bin",
+                static_cast<size_t>(config_.vocab_size) * hidden_size
+            );
+
+            // Load final norm
+            weights_["model.norm.weight"] = load_binary_file(
+                bin_weights_path + "/final_norm.bin",
+                hidden_size
+            );
+
+            // Load lm_head ([vocab_size, hidden_size], consumed as-is by the linear kernels)
+            linear_weights_["lm_head.weight"] = load_linear_weight(
+                bin_weights_path + "/lm_head.bin", config_.vocab_size, hidden_size);
+        }
+
+        // Load all transformer layers
+        for (int i = 0; i < config_.num_hidden_layers; i++) {
+            std::string layer_prefix = "model.layers." + std::to_string(i) + ".";
+            std::string file_prefix = bin_weights_path + "/layer" + std::to_string(i);
+
+            // Attention projections, [out_features, in_features]
+            linear_weights_[layer_prefix + "self_attn.q_proj.weight"] = load_linear_shard(
+                file_prefix + ".attn.q_proj.bin", hidden_size, hidden_size, rank * q_dim, q_dim, 0, hidden_size);
+            linear_weights_[layer_prefix + "self_attn.k_proj.weight"] = load_linear_shard(
+                file_prefix + ".attn.k_proj.bin", tp * kv_dim, hidden_size, rank * kv_dim, kv_dim, 0, hidden_size);
+            linear_weights_[layer_prefix + "self_attn.v_proj.weight"] = load_linear_shard(
+                file_prefix + ".attn.v_proj.bin", tp * kv_dim, hidden_size, rank * kv_dim, kv_dim, 0, hidden_size);
+            linear_weights_[layer_prefix + "self_attn.o_proj.weight"] = load_linear_shard(
+                file_prefix + ".attn.o_proj.bin", hidden_size, hidden_size, 0, hidden_size, rank * q_dim, q_dim);
+
+            // Layer norms
+            weights_[layer_prefix + "input_layernorm.weight"] = load_binary_file(
+                file_prefix + ".input_layernorm.bin", hidden_size);
+            weights_[layer_prefix + "post_attention_layernorm.weight"] = load_binary_file(
+                file_prefix + ".post_layernorm.bin", hidden_size);
+
+            // MLP projections, [out_features, in_features]
+            linear_weights_[layer_prefix + "mlp.gate_proj.weight"] = load_linear_shard(
+                file_prefix + ".mlp.gate_proj.bin", config_.intermediate_size, hidden_size,
+                rank * intermediate, intermediate, 0, hidden_size);
+            linear_weights_[layer_prefix + "mlp.up_proj.weight"] = load_linear_shard(
+                file_prefix + ".mlp.up_proj.bin", config_.intermediate_size, hidden_size,
+                rank * intermediate, intermediate, 0, hidden_size);
+            linear_weights_[layer_prefix + "mlp.down_proj.weight"] = load_linear_shard(
+                file_prefix + ".mlp.down_proj.bin", hidden_size, config_.intermediate_size,
+                0, hidden_size, rank * intermediate, intermediate);
+        }
+        resolve_layer_weights();
+
+        // The vision tower and pointer head are optional: text-only exports leave them out
+        struct stat st;
+        if (rank == 0 && stat((bin_weights_path + "/vision.patch_embed.bin").c_str(), &st) == 0) {
+            load_vision_weights(bin_weights_path);
+        }
+        if (rank == 0 && stat((bin_weights_path + "/pointer.layer_norm.bin").c_str(), &st) == 0) {
+            load_pointer_weights(bin_weights_path);
+        }
+    }
+
+    void resolve_layer_weights() {
+        layers_.clear();
+        layers_.reserve(config_.num_hidden_layers);
+        for (int i = 0; i < config_.num_hidden_layers; i++) {
+            std::string p = "model.layers." + std::to_string(i) + ".";
+            layers_.push_back({weight(p + "input_layernorm.weight"), weight(p + "post_attention_layernorm.weight"),
+                               linear_weight(p + "self_attn.q_proj.weight"), linear_weight(p + "self_attn.k_proj.weight"),
+                               linear_weight(p + "self_attn.v_proj.weight"), linear_weight(p + "self_attn.o_proj.weight"),
+                               linear_weight(p + "mlp.gate_proj.weight"), linear_weight(p + "mlp.up_proj.weight"),
+                               linear_weight(p + "mlp.down_proj.weight")});
+        }
+        if (config_.tp_rank != 0) return;
+        embed_tokens_ = weight("model.embed_tokens.weight");
+        final_norm_ = weight("model.norm.weight");
+        lm_head_ = linear_weight("lm_head.weight");
+    }
+
+    // Projection `key` with bias, from <file>.bin ([N, K]) and <file>.bias.bin ([N])
+    void load_biased_linear(const std::string& key, const std::string& file, int N, int K) {
+        linear_weights_[key + ".weight"] = load_linear_weight(file + ".bin", N, K);
+        weights_[key + ".bias"] = load_binary_file(file + ".bias.bin", N);
+    }
+
+    // LayerNorm `key` from <file>.bin and <file>.bias.bin
+    void load_layernorm(const std::string& key, const std::string& file, int size) {
+        weights_[key + ".weight"] = load_binary_file(file + ".bin", size);
+        weights_[key + ".bias"] = load_binary_file(file + ".bias.bin", size);
+    }
+
+    int pointer_proj_dim() const {
+        return config_.pointer_proj_dim > 0 ? config_.pointer_proj_dim : config_.hidden_size;
+    }
+
+    // GUI-Actor pointer head: self-attention + LayerNorm over the image tokens,
+    // then the encoder and decoder projection MLPs
+    void load_pointer_weights(const std::string& bin_weights_path) {
+        int d = config_.hidden_size;
+        int proj = pointer_proj_dim();
+        int heads = config_.pointer_num_heads;
+        // dense_attention_kernel: DENSE_MAX_HEAD_DIM
+        if (heads <= 0 || d % heads != 0 || d / heads > 512) {
+            throw std::runtime_error("Unsupported pointer head configuration");
+        }
+        if ((config_.weight_format == WeightFormat::Q8 || config_.weight_format == WeightFormat::Q4) &&
+            proj % config_.quant_group_size != 0) {
+            throw std::runtime_error("Quantization group size must divide the pointer head in_features");
+        }
+        std::string prefix = bin_weights_path + "/pointer.";
+        load_biased_linear("pointer_head.self_attention.in_proj", prefix + "attn.in_proj", 3 * d, d);
+        load_biased_linear("pointer_head.self_attention.out_proj", prefix + "attn.out_proj", d, d);
+        load_layernorm("pointer_head.layer_norm", prefix + "layer_norm", d);
+        load_biased_linear("pointer_head.projection_enc.0", prefix + "proj_enc0", proj, d);
+        load_biased_linear("pointer_head.projection_enc.2", prefix + "proj_enc2", d, proj);
+        load_biased_linear("pointer_head.projection_dec.0", prefix + "proj_dec0", proj, d);
+        load_biased_linear("pointer_head.projection_dec.2", prefix + "proj_dec2", d, proj);
+        has_pointer_ = true;
+    }
+
+    // Patch-embed channels per patch: RGB x temporal_patch_size x patch_size^2
+    int vision_patch_dim() const {
+        return 3 * config_.vision_temporal_patch_size * config_.vision_patch_size * config_.vision_patch_size;
+    }
+
+    // Vision tower: patch embedding, vision_depth pre-norm ViT blocks and the
+    // patch merger projecting each spatial_merge_size^2 window to one LLM token
+    void load_vision_weights(const std::string& bin_weights_path) {
+        int embed = config_.vision_embed_dim;
+        int mlp = config_.vision_mlp_dim;
+        int merge = config_.vision_spatial_merge_size;
+        int merger = config_.vision_merger_dim;
+        int head_dim = config_.vision_num_heads > 0 ? embed / config_.vision_num_heads : 0;
+        // paged_attention_kernel limits head_dim; the 2D RoPE splits the pairs into row and column halves
+        if (head_dim <= 0 || embed % config_.vision_num_heads != 0 || head_dim > 128 || head_dim % 4 != 0 ||
+            merge <= 0 || merger != embed * merge * merge) {
+            throw std::runtime_error("Unsupported vision tower configuration");
+        }
+        if (config_.weight_format == WeightFormat::Q8 || config_.weight_format == WeightFormat::Q4) {
+            int g = config_.quant_group_size;
+            if (embed % g != 0 || mlp % g != 0 || merger % g != 0) {
+                throw std::runtime_error("Quantization group size must divide the vision tower in_features");
+            }
+        }
+
+        // [embed, patch_dim] Conv3d kernel (stride == kernel) as a matrix, kept fp32
+        // and transposed to [patch_dim, embed] for matmul_kernel; patch_dim does not
+        // divide into quantization groups
+        int patch_dim = vision_patch_dim();
+        id<MTLBuffer> conv = load_binary_file(bin_weights_path + "/vision.patch_embed.bin",
+                                              static_cast<size_t>(embed) * patch_dim);
+        id<MTLBuffer> patch_embed = new_bytes(static_cast<size_t>(embed) * patch_dim * sizeof(float));
+        const float* src = static_cast<const float*>([conv contents]);
+        float* dst = static_cast<float*>([patch_embed contents]);
+        for (int n = 0; n < embed; n++) {
+            for (int k = 0; k < patch_dim; k++) dst[static_cast<size_t>(k) * embed + n] = src[static_cast<size_t>(n) * patch_dim + k];
+        }
+        weights_["visual.patch_embed.weight"] = patch_embed;
+
+        for (int i = 0; i < config_.vision_depth; i++) {
+            std::string block_prefix = "visual.blocks." + std::to_string(i) + ".";
+            std::string file_prefix = bin_weights_path + "/vision.block" + std::to_string(i);
+            load_layernorm(block_prefix + "norm1", file_prefix + ".norm1", embed);
+            load_layernorm(block_prefix + "norm2", file_prefix + ".norm2", embed);
+            load_biased_linear(block_prefix + "attn.q_proj", file_prefix + ".attn.q_proj", embed, embed);
+            load_biased_linear(block_prefix + "attn.k_proj", file_prefix + ".attn.k_proj", embed, embed);
+            load_biased_linear(block_prefix + "attn.v_proj", file_prefix + ".attn.v_proj", embed, embed);
+            load_biased_linear(block_prefix + "attn.proj", file_prefix + ".attn.proj", embed, embed);
+            load_biased_linear(block_prefix + "mlp.fc1", file_prefix + ".mlp.fc1", mlp, embed);
+            load_biased_linear(block_prefix + "mlp.fc2", file_prefix + ".mlp.fc2", embed, mlp);
+        }
+
+        load_layernorm("visual.merger.ln_q", bin_weights_path + "/vision.merger.ln_q", embed);
+        load_biased_linear("visual.merger.mlp.0", bin_weights_path + "/vision.merger.mlp0", merger, merger);
+        load_biased_linear("visual.merger.mlp.2", bin_weights_path + "/vision.merger.mlp2", config_.hidden_size, merger);
+        has_vision_ = true;
+    }
+
+    // One sequence of a ragged batch: its new tokens and the cache they extend
+    // rope_positions, if set, holds [3, input_ids->size()] temporal/height/width
+    // M-RoPE ids (image spans); otherwise every section uses the KV position
+    // shifted by the cache's rope_delta
+    struct BatchSequence {
+        const std::vector<int32_t>* input_ids;
+        KVCache* cache;
+        const std::vector<int32_t>* rope_positions = nullptr;
+        int logit_rows = 1;  // Trailing input_ids that get logits
+        // embeddings, if set, holds one row pointer per input id; non-null rows
+        // (image placeholders) replace the token embedding
+        const std::vector<const float*>* embeddings = nullptr;
+        bool hidden_only = false;  // Final-norm hidden state of the last row instead of logits
+    };
+
+    // Device outputs of the model head for one pass
+    struct HeadOutput {
+        id<MTLBuffer> logits;  // [logit rows, vocab_size]; nil if every sequence is hidden_only
+        id<MTLBuffer> hidden;  // [hidden_only sequences, hidden_size]; nil if there are none
+    };
+
+    // Queues `works` and drives engine steps until all of them are done
+    // Rethrows the first failure among them once they have all finished.
+    void run_steps(const std::vector<StepWork*>& works) {
+        for (const StepWork* work : works) {
+            if (work->tokens.empty()) throw std::runtime_error("Empty step input");
+        }
+        {
+            std::lock_guard<std::mutex> lock(step_mutex_);
+            pending_.insert(pending_.end(), works.begin(), works.end());
+        }
+        step_cv_.notify_all();
+
+        auto all_done = [&] {
+            return std::all_of(works.begin(), works.end(), [](const StepWork* w) { return w->done; });
+        };
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock(step_mutex_);
+                if (all_done()) break;
+            }
+            {
+                auto slot = scheduler_->Acquire();
+                std::vector<StepChunk> step;
+                {
+                    std::lock_guard<std::mutex> lock(step_mutex_);
+                    if (all_done()) break;
+                    step = claim_step();
+                }
+                if (!step.empty()) {
+                    run_step(step);
+                    continue;
+                }
+            }
+            // Everything pending is inside other callers' steps; wait for one to finish
+            std::unique_lock<std::mutex> lock(step_mutex_);
+            step_cv_.wait(lock, [&] { return all_done() || has_unclaimed(); });
+        }
+
+        for (const StepWork* work : works) {
+            if (work->error) std::rethrow_exception(work->error);
+        }
+    }
+
+    // Caller holds step_mutex_
+    bool has_unclaimed() const {
+        return std::any_of(pending_.begin(), pending_.end(), [](const StepWork* w) { return !w->claimed; });
+    }
+
+    // Drives steps on step_queue_ until no submitted work is left
+    // Steps also carry synchronous callers' work, and those callers may run
+    // steps that advance submitted work; this only waits while every pending
+    // chunk is already inside someone's step.
+    void drive_submitted() {
+        std::unique_lock<std::mutex> lock(step_mutex_);
+        while (submitted_ > 0) {
+            if (!has_unclaimed()) {
+                step_cv_.wait(lock, [&] { return submitted_ == 0 || has_unclaimed(); });
+                continue;
+            }
+            lock.unlock();
+            {
+                auto slot = scheduler_->Acquire();
+                std::vector<StepChunk> step;
+                {
+                    std::lock_guard<std::mutex> guard(step_mutex_);
+                    step = claim_step();
+                }
+                if (!step.empty()) run_step(step);
+            }
+            lock.lock();
+        }
+    }
+
+    // Claims the next step's chunks from pending_; caller holds step_mutex_
+    std::vector<StepChunk> claim_step() {
+        std::vector<StepWork*> ready;
+        for (StepWork* work : pending_) {
+            if (!work->claimed) ready.push_back(work);
+        }
+        // Atomic work goes first: the budget always fits the first of them, so
+        // they cannot be starved by a stream of smaller chunks
+        std::stable_sort(ready.begin(), ready.end(), [](const StepWork* a, const StepWork* b) {
+            if (a->atomic != b->atomic) return a->atomic;
+            return a->tokens.size() - a->consumed < b->tokens.size() - b->consumed;
+        });
+
+        size_t chunk_tokens = std::max(config_.prefill_chunk_tokens, 1);
+        size_t budget = std::max(config_.max_step_tokens, config_.prefill_chunk_tokens);
+        std::vector<StepChunk> step;
+        for (StepWork* work : ready) {
+            size_t remaining = work->tokens.size() - work->consumed;
+            size_t n = std::min({remaining, chunk_tokens, budget});
+            if (n == 0) break;
+            if (work->atomic && n < remaining) continue;  // Waits for a step with room for all of it
+            work->claimed = true;
+            budget -= n;
+            auto first = work->tokens.begin() + work->consumed;
+            StepChunk chunk = {work, std::vector<int32_t>(first, first + n), {}, {}};
+            if (!work->rope_positions.empty()) {
+                for (int s = 0; s < 3; s++) {
+                    auto ids = work->rope_positions.begin() + s * work->tokens.size() + work->consumed;
+                    chunk.rope_positions.insert(chunk.rope_positions.end(), ids, ids + n);
+                }
+            }
+            if (!work->embeddings.empty()) {
+                auto rows = work->embeddings.begin() + work->consumed;
+                chunk.embeddings.assign(rows, rows + n);
+            }
+            step.push_back(std::move(chunk));
+        }
+        return step;
+    }
+
+    // Runs one claimed step and publishes its progress
+    // A chunk whose cache cannot grow fails alone; a failed pass fails the whole step.
+    void run_step(std::vector<StepChunk>& step) {
+        auto finishes = [](const StepChunk& chunk) {
+            return chunk.work->consumed + chunk.input_ids.size() == chunk.work->tokens.size();
+        };
+        std::vector<BatchSequence> sequences;
+        std::vector<StepChunk*> running;
+        // First logits row (hidden state row for hidden_only work) of each running chunk, in bytes
+        std::vector<NSUInteger> head_offsets;
+        NSUInteger row_bytes = config_.vocab_size * sizeof(float);
+        NSUInteger hidden_row_bytes = config_.hidden_size * sizeof(float);
+        NSUInteger logits_bytes = 0, hidden_bytes = 0;
+        for (auto& chunk : step) {
+            StepWork* work = chunk.work;
+            try {
+                work->cache->Append(work->tokens.data() + work->consumed, chunk.input_ids.size());
+                int rows = finishes(chunk) ? std::min<int>(work->logit_rows, chunk.input_ids.size()) : 1;
+                sequences.push_back({&chunk.input_ids, work->cache,
+                                     chunk.rope_positions.empty() ? nullptr : &chunk.rope_positions, rows,
+                                     chunk.embeddings.empty() ? nullptr : &chunk.embeddings, work->hidden_only});
+                running.push_back(&chunk);
+                if (work->hidden_only) {
+                    head_offsets.push_back(hidden_bytes);
+                    hidden_bytes += hidden_row_bytes;
+                } else {
+                    head_offsets.push_back(logits_bytes);
+                    logits_bytes += rows * row_bytes;
+                }
+            } catch (...) {
+                work->error = std::current_exception();
+            }
+        }
+
+        std::exception_ptr step_error;
+        if (!sequences.empty()) {
+            try {
+                // The step's activations go back to arena_ once the results are read
+                ArenaScope arena(&arena_);
+                auto output_of = [](const StepWork* work, const HeadOutput& head) {
+                    return work->hidden_only ? head.hidden : head.logits;
+                };
+                HeadOutput head = run_forward(sequences, [&](CommandBatch& batch, const HeadOutput& head) {
+                    for (size_t i = 0; i < running.size(); i++) {
+                        StepWork* work = running[i]->work;
+                        if (finishes(*running[i]) && work->epilogue) {
+                            work->epilogue(batch, output_of(work, head), head_offsets[i]);
+                        }
+                    }
+                });
+                for (size_t i = 0; i < running.size(); i++) {
+                    StepWork* work = running[i]->work;
+                    if (finishes(*running[i]) && work->complete) {
+                        work->complete(output_of(work, head), head_offsets[i]);
+                    }
+                }
+            } catch (...) {
+                step_error = std::current_exception();
+            }
+        }
+
+        std::vector<std::function<void()>> finished;
+        {
+            std::lock_guard<std::mutex> lock(step_mutex_);
+            for (StepChunk* chunk : running) {
+                if (step_error) chunk->work->error = step_error;
+            }
+            for (auto& chunk : step) {
+                StepWork* work = chunk.work;
+                work->claimed = false;
+                if (!work->error) work->consumed += chunk.input_ids.size();
+                work->done = work->error || work->consumed == work->tokens.size();
+                if (work->done && work->finished) finished.push_back(std::move(work->finished));
+            }
+            pending_.erase(std::remove_if(pending_.begin(), pending_.end(), [](const StepWork* w) { return w->done; }),
+                           pending_.end());
+        }
+        for (auto& callback : finished) callback();
+        if (!finished.empty()) {
+            std::lock_guard<std::mutex> lock(step_mutex_);
+            submitted_ -= finished.size();
+        }
+        step_cv_.notify_all();
+    }
+
+    // Complete forward pass through all 28 layers for a single sequence
+    // cache is a fresh fork that input_ids are appended to, one step chunk at a
+    // time. Writes vocab_size logits to out_logits
+    void forward(const std::vector<int32_t>& input_ids, KVCache& cache, float* out_logits) {
+        forward_batch({{&input_ids, &cache}}, out_logits);
+    }
+
+    // Ragged batch forward; writes [sequences.size(), vocab_size] logits to out_logits
+    // Sequences are queued independently and may finish in different steps.
+    void forward_batch(const std::vector<BatchSequence>& sequences, float* out_logits) {
+        size_t vocab = config_.vocab_size;
+        std::vector<StepWork> works(sequences.size());
+        std::vector<StepWork*> queued;
+        for (size_t i = 0; i < sequences.size(); i++) {
+            works[i].cache = sequences[i].cache;
+            works[i].tokens.assign(sequences[i].input_ids->begin(), sequences[i].input_ids->end());
+            works[i].complete = copy_logits(out_logits + i * vocab);
+            queued.push_back(&works[i]);
+        }
+        run_steps(queued);
+    }
+
+    // StepWork::complete that reads the sequence's vocab_size logits back to dst
+    std::function<void(id<MTLBuffer>, NSUInteger)> copy_logits(float* dst) const {
+        size_t vocab = config_.vocab_size;
+        return [dst, vocab](id<MTLBuffer> logits, NSUInteger offset) {
+            memcpy(dst, static_cast<const char*>([logits contents]) + offset, vocab * sizeof(float));
+            g_profiler.CountDownload(vocab * sizeof(float));
+        };
+    }
+
+    // Queues a forward like `forward` but returns at once; `done` runs on the
+    // engine thread that finished the work, with its failure if any. cache and
+    // out_logits (vocab_size floats) must stay alive until then.
+    void submit_forward(const std::vector<int32_t>& input_ids, KVCache& cache, float* out_logits,
+                        std::function<void(std::exception_ptr)> done) {
+        if (input_ids.empty()) throw std::runtime_error("Empty step input");
+        auto* work = new StepWork;
+        work->cache = &cache;
+        work->tokens.assign(input_ids.begin(), input_ids.end());
+        work->complete = copy_logits(out_logits);
+        work->finished = [work, done = std::move(done)] {
+            std::exception_ptr error = work->error;
+            delete work;
+            done(error);
+        };
+        {
+            std::lock_guard<std::mutex> lock(step_mutex_);
+            pending_.push_back(work);
+            submitted_++;
+        }
+        step_cv_.notify_all();
+        dispatch_async(step_queue_, ^{
+            drive_submitted();
+        });
+    }
+
+    // Candidates sample_kernel selects and sorts: enough for the logprobs and the top-k/top-p prefix
+    uint sample_candidates(const SamplingParams& params) const {
+        uint needed = std::max<uint>(params.num_logprobs, 1);
+        if (params.temperature > 0.0f) {
+            if (params.top_k > 0) needed = std::max<uint>(needed, params.top_k);
+            else if (params.top_p < 1.0f) needed = MLX_MAX_SAMPLE_CANDIDATES;
+        }
+        return std::min<uint>({needed, static_cast<uint>(config_.vocab_size), MLX_MAX_SAMPLE_CANDIDATES});
+    }
+
+    // Forward pass for a single sequence that samples on the GPU
+    // Only the chosen token (and the requested top logprobs) are read back; the
+    // logits never leave the device. bias_ids/bias_values are an optional sparse
+    // additive bias applied before sampling. The sample's noise is keyed on the
+    // seed and the position of the last input token, so a fixed seed draws
+    // fresh noise for every token of a decode.
+    SampleResult forward_sample(const std::vector<int32_t>& input_ids, KVCache& cache, const SamplingParams& sampling,
+                                const std::vector<uint32_t>& bias_ids, const std::vector<float>& bias_values) {
+        uint vocab = config_.vocab_size;
+        SamplingParams params = sampling;
+        params.position = static_cast<uint32_t>(cache.seq_length + input_ids.size() - 1);
+        uint num_candidates = sample_candidates(params);
+
+        id<MTLBuffer> token_buffer = new_bytes(sizeof(uint32_t));
+        id<MTLBuffer> top_ids = new_bytes(std::max<size_t>(params.num_logprobs, 1) * sizeof(uint32_t));
+        id<MTLBuffer> top_logprobs = new_bytes(std::max<size_t>(params.num_logprobs, 1) * sizeof(float));
+
+        StepWork work;
+        work.cache = &cache;
+        work.tokens.assign(input_ids.begin(), input_ids.end());
+        work.epilogue = [&](CommandBatch& batch, id<MTLBuffer> logits_buffer, NSUInteger offset) {
+            Binding logits(logits_buffer, offset);
+            if (!bias_ids.empty()) {
+                // Leased from the step's arena, like the logits they apply to
+                id<MTLBuffer> ids = upload(bias_ids.data(), bias_ids.size());
+                id<MTLBuffer> values = upload(bias_values.data(), bias_values.size());
+                execute_1d(batch, logit_bias_pipeline_,
+                           {logits, ids, values, scalar((uint)bias_ids.size()), scalar(vocab)}, bias_ids.size());
+            }
+
+            bind(batch, sample_pipeline_,
+                 {logits, token_buffer, top_ids, top_logprobs, scalar(vocab), scalar(num_candidates), Binding::Bytes(params)});
+            NSUInteger threads = std::min<NSUInteger>(1024, sample_pipeline_.maxTotalThreadsPerThreadgroup) / 32 * 32;
+            [batch.encoder dispatchThreadgroups:MTLSizeMake(1, 1, 1) threadsPerThreadgroup:MTLSizeMake(threads, 1, 1)];
+        };
+        run_steps({&work});
+
+        SampleResult result;
+        result.token = *static_cast<const uint32_t*>([token_buffer contents]);
+        const uint32_t* ids = static_cast<const uint32_t*>([top_ids contents]);
+        const float* logprobs = static_cast<const float*>([top_logprobs contents]);
+        uint num_logprobs = std::min(params.num_logprobs, num_candidates);
+        result.top_ids.assign(ids, ids + num_logprobs);
+        result.top_logprobs.assign(logprobs, logprobs + num_logprobs);
+        g_profiler.CountDownload(sizeof(uint32_t) + num_logprobs * (sizeof(uint32_t) + sizeof(float)));
+        return result;
+    }
+
+    // Speculative verification: input_ids is the pending token followed by draft
+    // tokens, all forwarded in one pass. Every position's logits row is sampled on
+    // the GPU with `params` at its own position, drawing exactly what
+    // forward_sample would there, and drafts are accepted while
+    // they match the sample of the row before them. For a deterministic draft
+    // (n-gram lookup, greedy draft model) matching the target's own sample accepts
+    // with exactly the target probability of the draft, and the first mismatching
+    // sample is a draw from the corrected distribution, so the output follows the
+    // target model. cache ends up holding all of input_ids; callers keep only the
+    // accepted prefix (KVCache::Fork). out_logits, if set, gets every row.
+    struct VerifyResult {
+        int accepted;                 // Leading drafts that matched
+        std::vector<uint32_t> tokens; // Sample of each row; tokens[accepted] follows the accepted drafts
+    };
+    VerifyResult forward_verify(const std::vector<int32_t>& input_ids, KVCache& cache, const SamplingParams& params,
+                                float* out_logits) {
+        uint vocab = config_.vocab_size;
+        uint rows = input_ids.size();
+        if (rows > static_cast<uint>(std::max(config_.prefill_chunk_tokens, 1))) {
+            throw std::runtime_error("Too many draft tokens for one engine step");
+        }
+        uint num_candidates = sample_candidates(params);
+        id<MTLBuffer> token_buffer = new_bytes(rows * sizeof(uint32_t));
+        id<MTLBuffer> unused = new_bytes(sizeof(float));  // No logprobs are requested
+
+        StepWork work;
+        work.cache = &cache;
+        work.tokens.assign(input_ids.begin(), input_ids.end());
+        work.logit_rows = rows;
+        work.atomic = true;  // One chunk, so the step computes all `rows` logits rows
+        uint32_t position = static_cast<uint32_t>(cache.seq_length);  // Before the step appends input_ids
+        work.epilogue = [&](CommandBatch& batch, id<MTLBuffer> logits_buffer, NSUInteger offset) {
+            SamplingParams row_params = params;
+            row_params.num_logprobs = 0;
+            row_params.position = position;
+            bind(batch, sample_pipeline_,
+                 {Binding(logits_buffer, offset), token_buffer, unused, unused, scalar(vocab), scalar(num_candidates),
+                  Binding::Bytes(row_params)});
+            NSUInteger threads = std::min<NSUInteger>(1024, sample_pipeline_.maxTotalThreadsPerThreadgroup) / 32 * 32;
+            [batch.encoder dispatchThreadgroups:MTLSizeMake(rows, 1, 1) threadsPerThreadgroup:MTLSizeMake(threads, 1, 1)];
+        };
+        if (out_logits) {
+            work.complete = [out_logits, vocab, rows](id<MTLBuffer> logits, NSUInteger offset) {
+                size_t bytes = static_cast<size_t>(rows) * vocab * sizeof(float);
+                memcpy(out_logits, static_cast<const char*>([logits contents]) + offset, bytes);
+                g_profiler.CountDownload(bytes);
+            };
+        }
+        run_steps({&work});
+
+        VerifyResult result;
+        const uint32_t* sampled = static_cast<const uint32_t*>([token_buffer contents]);
+        result.tokens.assign(sampled, sampled + rows);
+        g_profiler.CountDownload(rows * sizeof(uint32_t));
+        result.accepted = 0;
+        while (result.accepted + 1 < static_cast<int>(rows) &&
+               result.tokens[result.accepted] == static_cast<uint32_t>(input_ids[result.accepted + 1])) {
+            result.accepted++;
+        }
+        return result;
+    }
+
+    // LLM tokens an image of this grid expands to (one per merge window)
+    int image_tokens(const MLXImageInput& image) const {
+        int merge = config_.vision_spatial_merge_size;
+        return image.grid_t * (image.grid_h / merge) * (image.grid_w / merge);
+    }
+
+    void validate_image(const MLXImageInput& image) const {
+        int merge = config_.vision_spatial_merge_size;
+        if (!image.pixel_values || image.grid_t <= 0 || image.grid_h <= 0 || image.grid_w <= 0 ||
+            image.grid_h % merge != 0 || image.grid_w % merge != 0 ||
+            static_cast<int64_t>(image.grid_t) * image.grid_h * image.grid_w > (1 << 24)) {
+            throw std::runtime_error("Invalid image grid");
+        }
+    }
+
+    // Vision tower over one preprocessed image: [image_tokens(image), hidden_size]
+    // LLM input embeddings. pixel_values rows are patches in merge-window order
+    // (frame, window row, window column, row in window, column in window), the
+    // order Qwen2-VL's processor emits, so each merge window is
+    // spatial_merge_size^2 consecutive rows. Patches attend within their own
+    // frame: every frame is one "block" of the paged attention kernel, with the
+    // q/k/v projections themselves as the slabs and every row seeing the whole
+    // frame. Like run_forward, each block is its own command buffer, encoded
+    // while the GPU runs the previous one. Profiled time lands in
+    // MLX_KERNEL_OTHER.
+    std::shared_ptr<ImageEmbedding> encode_image(const MLXImageInput& image) {
+        int embed = config_.vision_embed_dim;
+        int heads = config_.vision_num_heads;
+        int head_dim = embed / heads;
+        int merge = config_.vision_spatial_merge_size;
+        int patch_dim = vision_patch_dim();
+        int frame = image.grid_h * image.grid_w;
+        int patches = image.grid_t * frame;
+        int tokens = image_tokens(image);
+        size_t elems = static_cast<size_t>(patches) * embed;
+
+        // Patch row/column ids for the 2D RoPE, and per-frame attention addressing
+        std::vector<int32_t> rope_ids(2 * static_cast<size_t>(patches));
+        std::vector<int32_t> frame_blocks(image.grid_t), row_frames(patches), row_positions(patches, frame - 1);
+        int windows_w = image.grid_w / merge;
+        for (int t = 0; t < image.grid_t; t++) frame_blocks[t] = t;
+        for (int r = 0; r < patches; r++) {
+            int in_frame = r % frame;
+            int window = in_frame / (merge * merge), in_window = in_frame % (merge * merge);
+            rope_ids[r] = (window / windows_w) * merge + in_window / merge;
+            rope_ids[patches + r] = (window % windows_w) * merge + in_window % merge;
+            row_frames[r] = r / frame;
+        }
+
+        id<MTLBuffer> embeddings = nil;
+        @autoreleasepool {
+            ArenaScope arena(&arena_);
+            size_t pixel_bytes = static_cast<size_t>(patches) * patch_dim * sizeof(float);
+            id<MTLBuffer> pixels = [g_device newBufferWithBytes:image.pixel_values length:pixel_bytes
+                                                        options:MTLResourceStorageModeShared];
+            g_profiler.CountUpload(pixel_bytes);
+            id<MTLBuffer> rope_positions = upload_ints(rope_ids);
+            id<MTLBuffer> block_table = upload_ints(frame_blocks);
+            id<MTLBuffer> table_offsets = upload_ints(row_frames);
+            id<MTLBuffer> positions = upload_ints(row_positions);
+            size_t uploads = arena.Mark();  // Read by every block, kept for the whole pass
+            float scale = 1.0f / sqrt(head_dim);
+            MTLSize ropeGrid = {static_cast<NSUInteger>(embed / 2), static_cast<NSUInteger>(patches), 1};
+            MTLSize attnGroups = {static_cast<NSUInteger>(heads), static_cast<NSUInteger>(patches), 1};
+
+            // Patch embedding: [patches, patch_dim] x [patch_dim, embed]
+            auto first = std::make_unique<CommandBatch>(queue_);
+            id<MTLBuffer> hidden = matmul(*first, pixels, weight("visual.patch_embed.weight"), patches, embed, patch_dim);
+            first->commit();
+            std::unique_ptr<CommandBatch> in_flight = std::move(first);
+            size_t retired = uploads, previous_block = uploads;  // Arena leases handed back two command buffers behind
+
+            for (int block = 0; block < config_.vision_depth; block++) {
+                @autoreleasepool {
+                    size_t block_leases = arena.Mark();
+                    std::string p = "visual.blocks." + std::to_string(block) + ".";
+                    auto batch_ptr = std::make_unique<CommandBatch>(queue_);
+                    CommandBatch& batch = *batch_ptr;
+
+                    // Attention: pre-norm, q/k/v with bias, 2D RoPE on q and k
+                    auto normed = layernorm(batch, hidden, weight(p + "norm1.weight"), weight(p + "norm1.bias"), embed, patches,
+                                            config_.vision_norm_eps);
+                    auto q = linear_bias(batch, normed, p + "attn.q_proj", patches, embed, embed);
+                    auto k = linear_bias(batch, normed, p + "attn.k_proj", patches, embed, embed);
+                    auto v = linear_bias(batch, normed, p + "attn.v_proj", patches, embed, embed);
+                    auto rope = [&](id<MTLBuffer> x) {
+                        execute_2d(batch, vision_rope_pipeline_,
+                                   {x, rope_positions, scalar((uint)patches), scalar((uint)heads), scalar((uint)head_dim),
+                                    scalar(config_.vision_rope_theta)}, ropeGrid);
+                    };
+                    rope(q);
+                    rope(k);
+                    auto attn_out = new_buffer(elems);
+                    bind(batch, vision_attention_pipeline_,
+                         {q, k, v, block_table, table_offsets, positions, attn_out,
+                          scalar((uint)heads), scalar((uint)heads), scalar((uint)head_dim),
+                          scalar((uint)frame), scalar(scale)});
+                    [batch.encoder dispatchThreadgroups:attnGroups threadsPerThreadgroup:MTLSizeMake(32, 1, 1)];
+                    auto attn_output = linear_bias(batch, attn_out, p + "attn.proj", patches, embed, embed);
+                    hidden = add(batch, hidden, attn_output, elems);
+
+                    // MLP: pre-norm, fc1 + quick_gelu, fc2
+                    normed = layernorm(batch, hidden, weight(p + "norm2.weight"), weight(p + "norm2.bias"), embed, patches,
+                                       config_.vision_norm_eps);
+                    auto act = linear_bias(batch, normed, p + "mlp.fc1", patches, config_.vision_mlp_dim, embed,
+                                           BiasActivation::QuickGelu);
+                    auto mlp_output = linear_bias(batch, act, p + "mlp.fc2", patches, embed, config_.vision_mlp_dim);
+                    hidden = add(batch, hidden, mlp_output, elems);
+
+                    batch.commit();
+                    in_flight->wait();
+                    in_flight = std::move(batch_ptr);
+                    arena.Release(retired, previous_block);
+                    retired = previous_block;
+                    previous_block = block_leases;
+                }
+            }
+
+            // Patch merger: LayerNorm per patch, then each merge window's rows read
+            // as one [merger_dim] row through a two-layer GELU MLP
+            CommandBatch batch(queue_);
+            auto normed = layernorm(batch, hidden, weight("visual.merger.ln_q.weight"), weight("visual.merger.ln_q.bias"),
+                                    embed, patches, config_.vision_norm_eps);
+            auto merged = linear_bias(batch, normed, "visual.merger.mlp.0", tokens, config_.vision_merger_dim,
+                                      config_.vision_merger_dim, BiasActivation::Gelu);
+            {
+                ArenaScope kept(nullptr);  // The embeddings outlive this pass in image_cache_
+                embeddings = linear_bias(batch, merged, "visual.merger.mlp.2", tokens, config_.hidden_size,
+                                         config_.vision_merger_dim);
+            }
+            batch.commit();
+            in_flight->wait();
+            batch.wait();
+        }
+        return std::make_shared<ImageEmbedding>(ImageEmbedding{embeddings, tokens});
+    }
+
+    // Sets up `work` for a prompt with images. Each run of image_token_id
+    // placeholders takes the next image's embeddings (image_tokens(image) rows);
+    // images are encoded once and then served from image_cache_ by content hash.
+    // M-RoPE ids follow Qwen2-VL: an image span gets temporal/row/column ids
+    // offset from the position it starts at, and the text after it continues
+    // from the largest id the span used. `encoded` receives the embeddings,
+    // which must outlive the work. Returns the M-RoPE id after the prompt.
+    int32_t prepare_multimodal(StepWork& work, const std::vector<int32_t>& input_ids,
+                               const std::vector<MLXImageInput>& images, KVCache& cache,
+                               std::vector<std::shared_ptr<ImageEmbedding>>& encoded) {
+        if (!has_vision_ && !images.empty()) {
+            throw std::runtime_error("Model has no vision tower");
+        }
+        for (const auto& image : images) {
+            validate_image(image);
+            uint64_t key = ImageKey(image, static_cast<size_t>(image.grid_t) * image.grid_h * image.grid_w * vision_patch_dim());
+            auto embedding = image_cache_.Get(key);
+            if (!embedding) {
+                embedding = encode_image(image);
+                image_cache_.Put(key, embedding);
+            }
+            encoded.push_back(std::move(embedding));
+        }
+
+        size_t n = input_ids.size();
+        int merge = config_.vision_spatial_merge_size;
+        int32_t image_token = static_cast<int32_t>(config_.image_token_id);
+        work.cache = &cache;
+        work.tokens.assign(input_ids.begin(), input_ids.end());
+        work.rope_positions.resize(3 * n);
+        work.embeddings.assign(n, nullptr);
+        int32_t next = cache.seq_length + cache.rope_delta;  // M-RoPE id of the first new token
+        size_t num_images = 0;
+        for (size_t i = 0; i < n;) {
+            if (input_ids[i] != image_token) {
+                for (int s = 0; s < 3; s++) work.rope_positions[s * n + i] = next;
+                next++;
+                i++;
+                continue;
+            }
+            if (num_images == images.size()) {
+                throw std::runtime_error("More image placeholders than images");
+            }
+            const MLXImageInput& image = images[num_images];
+            const ImageEmbedding& embedding = *encoded[num_images];
+            int grid_h = image.grid_h / merge, grid_w = image.grid_w / merge;
+            size_t count = embedding.tokens;
+            if (i + count > n || std::any_of(input_ids.begin() + i, input_ids.begin() + i + count,
+                                             [&](int32_t id) { return id != image_token; })) {
+                throw std::runtime_error("Image placeholder count does not match the image grid");
+            }
+            const float* rows = static_cast<const float*>([embedding.embeddings contents]);
+            for (size_t j = 0; j < count; j++) {
+                int t = j / (grid_h * grid_w), h = (j / grid_w) % grid_h, w = j % grid_w;
+                work.rope_positions[i + j] = next + t;
+                work.rope_positions[n + i + j] = next + h;
+                work.rope_positions[2 * n + i + j] = next + w;
+                work.embeddings[i + j] = rows + j * config_.hidden_size;
+            }
+            next += std::max({image.grid_t, grid_h, grid_w});
+            i += count;
+            num_images++;
+        }
+        if (num_images != images.size()) {
+            throw std::runtime_error("Fewer image placeholders than images");
+        }
+        return next;
+    }
+
+    // Forward pass over a prompt with images (prepare_multimodal). cache is a
+    // fresh fork; its rope_delta is updated for later text-only forwards.
+    // Writes vocab_size logits.
+    void forward_multimodal(const std::vector<int32_t>& input_ids, const std::vector<MLXImageInput>& images,
+                            KVCache& cache, float* out_logits) {
+        size_t vocab = config_.vocab_size;
+        StepWork work;
+        std::vector<std::shared_ptr<ImageEmbedding>> encoded;  // Keeps evicted entries alive for this forward
+        int32_t next = prepare_multimodal(work, input_ids, images, cache, encoded);
+        work.complete = [out_logits, vocab](id<MTLBuffer> logits, NSUInteger offset) {
+            memcpy(out_logits, static_cast<const char*>([logits contents]) + offset, vocab * sizeof(float));
+            g_profiler.CountDownload(vocab * sizeof(float));
+        };
+        run_steps({&work});
+        // run_forward tracks rope_delta per chunk; a prompt ending inside an image
+        // span needs the span's full extent
+        cache.rope_delta = next - cache.seq_length;
+    }
+
+    // Pointer-head grounding (GUI-Actor VisionHead_MultiPatch) over a prompt with
+    // images whose last token is the action token (<|pointer_pad|>). The LLM pass
+    // skips the LM head and hands that token's final-norm hidden state, still on
+    // the device, to an epilogue that projects it, scores every image token and
+    // selects the top_k with sample_kernel. The scored side is the image tokens'
+    // input embeddings (vision tower output) contextualized by the head's
+    // self-attention; it is encoded in its own command buffer ahead of the step.
+    // Candidates are in descending score order; scores are softmax probabilities
+    // over all image tokens.
+    struct PointerCandidate {
+        int image;    // Index into images
+        int patch;    // Merged patch within the image, row-major per frame
+        float score;
+        float x, y;   // Patch center, normalized to the image
+    };
+    std::vector<PointerCandidate> forward_pointer(const std::vector<int32_t>& input_ids,
+                                                  const std::vector<MLXImageInput>& images, KVCache& cache, int top_k) {
+        if (!has_pointer_ || !has_vision_) {
+            throw std::runtime_error("Model has no pointer head");
+        }
+        if (images.empty()) {
+            throw std::runtime_error("Grounding needs at least one image");
+        }
+        StepWork work;
+        std::vector<std::shared_ptr<ImageEmbedding>> encoded;
+        int32_t next = prepare_multimodal(work, input_ids, images, cache, encoded);
+        work.hidden_only = true;
+
+        int d = config_.hidden_size;
+        int proj = pointer_proj_dim();
+        int heads = config_.pointer_num_heads;
+        int head_dim = d / heads;
+        int n = 0;
+        for (const auto& embedding : encoded) n += embedding->tokens;
+        uint num_candidates = std::min<uint>({static_cast<uint>(std::max(top_k, 1)), static_cast<uint>(n),
+                                              MLX_MAX_SAMPLE_CANDIDATES});
+
+        std::vector<PointerCandidate> result;
+        @autoreleasepool {
+            ArenaScope arena(&arena_);
+            // Image tokens in prompt order
+            id<MTLBuffer> visual = encoded[0]->embeddings;
+            if (encoded.size() > 1) {
+                visual = new_buffer(static_cast<size_t>(n) * d);
+                char* dst = static_cast<char*>([visual contents]);
+                for (const auto& embedding : encoded) {
+                    size_t bytes = static_cast<size_t>(embedding->tokens) * d * sizeof(float);
+                    memcpy(dst, [embedding->embeddings contents], bytes);
+                    dst += bytes;
+                }
+            }
+
+            // Encoder side: self-attention, residual + LayerNorm, projection_enc
+            CommandBatch enc(queue_);
+            auto qkv = linear_bias(enc, visual, "pointer_head.self_attention.in_proj", n, 3 * d, d);
+            auto attn_out = new_buffer(static_cast<size_t>(n) * d);
+            bind(enc, dense_attention_pipeline_,
+                 {qkv, attn_out, scalar((uint)n), scalar((uint)heads), scalar((uint)head_dim), scalar(1.0f / sqrtf(head_dim))});
+            [enc.encoder dispatchThreadgroups:MTLSizeMake(heads, n, 1) threadsPerThreadgroup:MTLSizeMake(32, 1, 1)];
+            auto attn_output = linear_bias(enc, attn_out, "pointer_head.self_attention.out_proj", n, d, d);
+            auto context = layernorm(enc, add(enc, visual, attn_output, static_cast<size_t>(n) * d),
+                                     weight("pointer_head.layer_norm.weight"), weight("pointer_head.layer_norm.bias"),
+                                     d, n, config_.pointer_norm_eps);
+            auto enc_hidden = linear_bias(enc, context, "pointer_head.projection_enc.0", n, proj, d, BiasActivation::Gelu);
+            id<MTLBuffer> keys = linear_bias(enc, enc_hidden, "pointer_head.projection_enc.2", n, d, proj);
+            enc.commit();
+
+            // Decoder side on the action token, then scores and top-k selection
+            id<MTLBuffer> scores = new_buffer(n);
+            id<MTLBuffer> token_buffer = new_bytes(sizeof(uint32_t));
+            id<MTLBuffer> top_ids = new_bytes(num_candidates * sizeof(uint32_t));
+            id<MTLBuffer> top_logprobs = new_bytes(num_candidates * sizeof(float));
+            SamplingParams params = {0.0f, 0, 1.0f, 0, 0, num_candidates};
+            work.epilogue = [&](CommandBatch& batch, id<MTLBuffer> hidden, NSUInteger offset) {
+                auto dec_hidden = linear_bias(batch, Binding(hidden, offset), "pointer_head.projection_dec.0", 1, proj, d,
+                                              BiasActivation::Gelu);
+                auto query = linear_bias(batch, dec_hidden, "pointer_head.projection_dec.2", 1, d, proj);
+                bind(batch, pointer_scores_pipeline_,
+                     {query, keys, scores, scalar((uint)n), scalar((uint)d), scalar(1.0f / sqrtf(d))});
+                constexpr NSUInteger kScoreSimdgroups = 8;
+                [batch.encoder dispatchThreadgroups:MTLSizeMake((n + kScoreSimdgroups - 1) / kScoreSimdgroups, 1, 1)
+                              threadsPerThreadgroup:MTLSizeMake(kScoreSimdgroups * 32, 1, 1)];
+                bind(batch, sample_pipeline_,
+                     {scores, token_buffer, top_ids, top_logprobs, scalar((uint)n), scalar(num_candidates), Binding::Bytes(params)});
+                NSUInteger threads = std::min<NSUInteger>(1024, sample_pipeline_.maxTotalThreadsPerThreadgroup) / 32 * 32;
+                [batch.encoder dispatchThreadgroups:MTLSizeMake(1, 1, 1) threadsPerThreadgroup:MTLSizeMake(threads, 1, 1)];
+            };
+            try {
+                run_steps({&work});
+            } catch (...) {
+                enc.wait();
+                throw;
+            }
+            enc.wait();
+            cache.rope_delta = next - cache.seq_length;
+
+            // Map each merged patch back to its image and grid cell
+            const uint32_t* ids = static_cast<const uint32_t*>([top_ids contents]);
+            const float* logprobs = static_cast<const float*>([top_logprobs contents]);
+            g_profiler.CountDownload(num_candidates * (sizeof(uint32_t) + sizeof(float)));
+            int merge = config_.vision_spatial_merge_size;
+            for (uint c = 0; c < num_candidates; c++) {
+                int patch = ids[c], image = 0;
+                while (patch >= encoded[image]->tokens) patch -= encoded[image++]->tokens;
+                int grid_h = images[image].grid_h / merge, grid_w = images[image].grid_w / merge;
+                int cell = patch % (grid_h * grid_w);
+                result.push_back({image, patch, std::exp(logprobs[c]),
+                                  (cell % grid_w + 0.5f) / grid_w, (cell / grid_w + 0.5f) / grid_h});
+            }
+        }
+        return result;
+    }
+
+    // Sums a layer's partial projection `x` over the tensor-parallel group. The
+    // host does the exchange, so the layer's command buffer (and the previous
+    // layer's) is drained here and encoding continues in a fresh one.
+    void all_reduce(CommandBatch& batch, std::unique_ptr<CommandBatch>& in_flight, id<MTLBuffer> x, size_t elems) {
+        batch.commit();
+        if (in_flight) {
+            in_flight->wait();
+            in_flight.reset();
+        }
+        batch.wait();
+        tp_->AllReduce(static_cast<float*>([x contents]), elems);
+        batch.restart(queue_);
+    }
+
+    // Every transformer layer over `seq_len` packed rows of `hidden` (replaced by
+    // the last layer's output) with run_forward's paged KV addressing; returns the
+    // last layer's committed command buffer.
+    //
+    // Each layer is one command buffer on queue_; the host encodes layer N+1
+    // while the GPU runs layer N and only blocks on the previous layer's
+    // completion, which bounds how many layers' intermediates are alive at once.
+    // A rank of a tensor-parallel group projects its own heads and MLP columns
+    // and sums the o_proj and down_proj outputs with the other ranks.
+    std::unique_ptr<CommandBatch> run_layers(id<MTLBuffer>& hidden, int seq_len, id<MTLBuffer> slots,
+                                             id<MTLBuffer> block_table, id<MTLBuffer> table_offsets,
+                                             id<MTLBuffer> positions, id<MTLBuffer> rope_positions) {
+        int hidden_size = config_.hidden_size;
+        int head_dim = config_.head_dim;
+        int num_heads = config_.num_attention_heads / config_.tp_size;
+        int num_kv_heads = config_.num_key_value_heads / config_.tp_size;
+        int q_dim = num_heads * head_dim;
+        int kv_dim = num_kv_heads * head_dim;
+        int intermediate = config_.intermediate_size / config_.tp_size;
+        size_t hidden_elems = static_cast<size_t>(seq_len) * hidden_size;
+        const auto& pool = kv_pool_;
+        float scale = 1.0f / sqrt(head_dim);
+        MTLSize attnGroups = {static_cast<NSUInteger>(num_kv_heads), static_cast<NSUInteger>(seq_len), 1};
+        MTLSize attnThreads = {static_cast<NSUInteger>(num_heads / num_kv_heads) * 32, 1, 1};
+
+        std::unique_ptr<CommandBatch> in_flight;
+        id<MTLBuffer> hidden_normed = nil;  // Input layernorm output, produced by the previous layer's fused residual
+
+        // Arena leases are handed back two layers behind: a layer only reads
+        // its own buffers and the previous layer's outputs
+        ArenaScope* arena = ArenaScope::Current();
+        size_t retired = arena ? arena->Mark() : 0, previous_layer = retired;
+
+        for (int layer = 0; layer < config_.num_hidden_layers; layer++) {
+            @autoreleasepool {
+                size_t layer_leases = arena ? arena->Mark() : 0;
+                const LayerWeights& w = layers_[layer];
+                auto batch_ptr = std::make_unique<CommandBatch>(queue_);
+                CommandBatch& batch = *batch_ptr;
+
+                // Input layernorm (later layers get it fused with the previous residual add)
+                if (layer == 0) {
+                    batch.region(MLX_KERNEL_NORM, layer);
+                    hidden_normed = rmsnorm(batch, hidden, w.input_layernorm, hidden_size, seq_len);
+                }
+
+                // Q: [seq_len, hidden_size] x [q_dim, hidden_size]^T = [seq_len, q_dim], rotated
+                batch.region(MLX_KERNEL_ROPE, layer);
+                auto q = linear_rope(batch, hidden_normed, w.q_proj, seq_len, q_dim, hidden_size, rope_positions);
+                // K: [seq_len, hidden_size] x [kv_dim, hidden_size]^T = [seq_len, kv_dim], rotated per KV head
+                auto k = linear_rope(batch, hidden_normed, w.k_proj, seq_len, kv_dim, hidden_size, rope_positions);
+                // V: [seq_len, hidden_size] x [kv_dim, hidden_size]^T = [seq_len, kv_dim]
+                batch.region(MLX_KERNEL_MATMUL, layer);
+                auto v = linear(batch, hidden_normed, w.v_proj, seq_len, kv_dim, hidden_size);
+
+                // Store the new K/V in their paged slots
+                batch.region(MLX_KERNEL_ATTENTION, layer);
+                MTLSize writeGrid = {static_cast<NSUInteger>(kv_dim), static_cast<NSUInteger>(seq_len), 1};
+                execute_2d(batch, kv_write_pipeline_,
+                           {k, v, pool->KeySlab(layer), pool->ValueSlab(layer), slots,
+                            scalar((uint)seq_len), scalar((uint)kv_dim)}, writeGrid);
+
+                // Fused causal attention over each row's paged context: [seq_len, num_heads * head_dim]
+                auto attn_out = new_buffer(static_cast<size_t>(seq_len) * q_dim);
+                bind(batch, paged_attention_pipeline_,
+                     {q, pool->KeySlab(layer), pool->ValueSlab(layer), block_table, table_offsets, positions, attn_out,
+                      scalar((uint)num_heads), scalar((uint)num_kv_heads), scalar((uint)head_dim),
+                      scalar((uint)pool->block_size()), scalar(scale)});
+                [batch.encoder dispatchThreadgroups:attnGroups threadsPerThreadgroup:attnThreads];
+
+                // Output projection
+                batch.region(MLX_KERNEL_MATMUL, layer);
+                auto attn_output = linear(batch, attn_out, w.o_proj, seq_len, hidden_size, q_dim);
+                if (tp_) all_reduce(batch, in_flight, attn_output, hidden_elems);
+
+                // Residual connection fused with the post-attention layernorm
+                batch.region(MLX_KERNEL_NORM, layer);
+                auto attn_residual = add_rmsnorm(batch, hidden, attn_output, w.post_attention_layernorm, hidden_size, seq_len);
+                hidden = attn_residual.hidden;
+                auto post_normed = attn_residual.normed;
+
+                // MLP: act(gate) * up in one fused GEMM, [seq_len, intermediate]
+                batch.region(MLX_KERNEL_MLP, layer);
+                auto act = gated_mlp(batch, post_normed, w.gate_proj,
+                                     w.up_proj, seq_len, intermediate, hidden_size);
+
+                // Down projection
+                auto mlp_output = linear(batch, act, w.down_proj, seq_len, hidden_size, intermediate);
+                if (tp_) all_reduce(batch, in_flight, mlp_output, hidden_elems);
+
+                // Residual connection, fused with the next layer's input layernorm
+                batch.region(MLX_KERNEL_NORM, layer);
+                if (layer + 1 < config_.num_hidden_layers) {
+                    auto mlp_residual = add_rmsnorm(batch, hidden, mlp_output, layers_[layer + 1].input_layernorm, hidden_size, seq_len);
+                    hidden = mlp_residual.hidden;
+                    hidden_normed = mlp_residual.normed;
+                } else {
+                    hidden = add(batch, hidden, mlp_output, hidden_elems);
+                }
+
+                batch.commit();
+                if (in_flight) in_flight->wait();
+                in_flight = std::move(batch_ptr);
+                if (arena) {
+                    arena->Release(retired, previous_layer);
+                    retired = previous_layer;
+                }
+                previous_layer = layer_leases;
+            }
+        }
+        return in_flight;
+    }
+
+    // Complete forward pass through all 28 layers for a ragged batch of sequences
+    // Each cache already has slots reserved for its input_ids at its tail
+    // (KVCache::Append); each layer's post-RoPE K/V for the new tokens is written
+    // there, so later calls only project new tokens. All caches must share kv_pool_.
+    //
+    // The sequences' new tokens are packed into one [total_rows, hidden] activation,
+    // so every projection is a single GEMM/GEMV over the whole batch and weights are
+    // read once per step. Attention stays per sequence through per-row positions and
+    // block-table offsets. Returns device buffers of [logit rows, vocab_size] logits
+    // for each sequence's last logit_rows tokens (usually just the last) and of the
+    // final-norm hidden state of each hidden_only sequence's last token, both in
+    // sequence order; `epilogue`, if set, encodes further work on them into the
+    // final command buffer before it is committed.
+    //
+    // Activations stay in device buffers for the whole pass and weights are bound
+    // by reference (run_layers). Under tensor parallelism the workers are handed
+    // the step's rows first and run the same layers on their shards; steps are
+    // then serialized, since every rank has to follow them in the same order.
+    HeadOutput run_forward(const std::vector<BatchSequence>& sequences,
+                           const std::function<void(CommandBatch&, const HeadOutput&)>& epilogue) {
+        int hidden_size = config_.hidden_size;
+        HeadOutput head = {nil, nil};
+
+        // Ragged packing: per-row position, KV slot and block-table offset
+        std::vector<int32_t> row_positions, row_slots, row_table_offsets, block_tables;
+        std::vector<int32_t> row_rope_positions[3];
+        std::vector<int> last_rows;    // Rows feeding the LM head
+        std::vector<int> hidden_rows;  // Last rows of hidden_only sequences
+        std::vector<const int32_t*> row_tokens;
+        std::vector<const float*> row_embeddings;
+        for (const auto& seq : sequences) {
+            KVCache& cache = *seq.cache;
+            int seq_len = seq.input_ids->size();
+            int position = cache.seq_length - seq_len;
+            if (seq.rope_positions) {
+                int32_t max_position = 0;
+                for (int s = 0; s < 3; s++) {
+                    const int32_t* ids = seq.rope_positions->data() + static_cast<size_t>(s) * seq_len;
+                    row_rope_positions[s].insert(row_rope_positions[s].end(), ids, ids + seq_len);
+                    max_position = std::max(max_position, *std::max_element(ids, ids + seq_len));
+                }
+                // Text after this span continues from the largest id used
+                cache.rope_delta = max_position + 1 - cache.seq_length;
+            } else {
+                for (int s = 0; s < 3; s++) {
+                    for (int i = 0; i < seq_len; i++) row_rope_positions[s].push_back(position + cache.rope_delta + i);
+                }
+            }
+            int table_offset = block_tables.size();
+            block_tables.insert(block_tables.end(), cache.block_table.begin(), cache.block_table.end());
+            std::vector<int32_t> slots = cache.SlotMapping(position, seq_len);
+            for (int i = 0; i < seq_len; i++) {
+                row_positions.push_back(position + i);
+                row_slots.push_back(slots[i]);
+                row_table_offsets.push_back(table_offset);
+                row_tokens.push_back(&(*seq.input_ids)[i]);
+                row_embeddings.push_back(seq.embeddings ? (*seq.embeddings)[i] : nullptr);
+            }
+            if (seq.hidden_only) {
+                hidden_rows.push_back(static_cast<int>(row_positions.size()) - 1);
+                continue;
+            }
+            int logit_rows = std::clamp(seq.logit_rows, 1, seq_len);
+            for (int r = logit_rows; r > 0; r--) last_rows.push_back(static_cast<int>(row_positions.size()) - r);
+        }
+        int seq_len = row_positions.size();  // Packed rows across all sequences
+        size_t hidden_elems = static_cast<size_t>(seq_len) * hidden_size;
+        std::vector<int32_t> rope_ids;
+        rope_ids.reserve(3 * static_cast<size_t>(seq_len));
+        for (const auto& ids : row_rope_positions) {
+            for (int32_t id : ids) {
+                if (id < 0 || id >= config_.max_position_embeddings) {
+                    throw std::runtime_error("Position exceeds max_position_embeddings");
+                }
+            }
+            rope_ids.insert(rope_ids.end(), ids.begin(), ids.end());
+        }
+
+        @autoreleasepool {
+            // 1. Embedding lookup straight into a shared device buffer; image
+            //    placeholder rows take their vision tower embedding instead
+            id<MTLBuffer> hidden = new_buffer(hidden_elems);
+            g_profiler.CountUpload(hidden_elems * sizeof(float));
+            float* hidden_ptr = static_cast<float*>([hidden contents]);
+            const float* embed = static_cast<const float*>([embed_tokens_ contents]);
+
+            for (int i = 0; i < seq_len; i++) {
+                int token = *row_tokens[i];
+                float* row = hidden_ptr + static_cast<size_t>(i) * hidden_size;
+                if (row_embeddings[i]) {
+                    memcpy(row, row_embeddings[i], hidden_size * sizeof(float));
+                } else if (token >= 0 && token < config_.vocab_size) {
+                    memcpy(row, &embed[static_cast<size_t>(token) * hidden_size], hidden_size * sizeof(float));
+                } else {
+                    memset(row, 0, hidden_size * sizeof(float));
+                }
+            }
+
+            // Paged KV addressing for the packed rows
+            id<MTLBuffer> slots = upload_ints(row_slots);
+            id<MTLBuffer> block_table = upload_ints(block_tables);
+            id<MTLBuffer> table_offsets = upload_ints(row_table_offsets);
+            id<MTLBuffer> positions = upload_ints(row_positions);
+            id<MTLBuffer> rope_positions = upload_ints(rope_ids);
+
+            // 2. Process through all transformer layers, on every rank of a tensor-parallel group
+            std::unique_lock<std::mutex> tp_step;
+            if (tp_) {
+                tp_step = std::unique_lock<std::mutex>(tp_->step_mutex());
+                TensorParallelStep step = {std::move(row_slots), std::move(row_table_offsets), std::move(row_positions),
+                                           std::move(rope_ids), std::move(block_tables), kv_pool_->TakeCopies()};
+                tp_->SendStep(step, hidden_ptr, hidden_elems);
+            }
+            std::unique_ptr<CommandBatch> in_flight;
+            try {
+                in_flight = run_layers(hidden, seq_len, slots, block_table, table_offsets, positions, rope_positions);
+            } catch (...) {
+                // The workers are mid-step; nothing later can line up with them again
+                if (tp_) tp_->Close();
+                throw;
+            }
+
+            CommandBatch batch(queue_);
+
+            // 3. Final normalization, only for the rows feeding the language model head
+            //    and the hidden states handed out as is
+            batch.region(MLX_KERNEL_NORM, -1);
+            id<MTLBuffer> last_hidden = nil;
+            if (!last_rows.empty()) {
+                last_hidden = rmsnorm_rows(batch, hidden, final_norm_, hidden_size, last_rows);
+            }
+            if (!hidden_rows.empty()) {
+                head.hidden = rmsnorm_rows(batch, hidden, final_norm_, hidden_size, hidden_rows);
+            }
+
+            // 4. LM head projection
+            if (last_hidden) {
+                batch.region(MLX_KERNEL_MATMUL, -1);
+                head.logits = linear(batch, last_hidden, lm_head_, static_cast<int>(last_rows.size()), config_.vocab_size, hidden_size);
+            }
+            if (epilogue) {
+                batch.region(MLX_KERNEL_SAMPLE, -1);
+                epilogue(batch, head);
+            }
+
+            batch.commit();
+            in_flight->wait();
+            batch.wait();
+        }
+
+        return head;
+    }
+
+    // A worker rank's side of run_forward (MLXServeShard): runs rank 0's steps
+    // on this shard, one at a time, until rank 0 closes the connection. Rank 0
+    // validated the rows; the wire is checked against this pool's bounds.
+    void serve_shard(std::unique_ptr<TensorParallelGroup> group) {
+        tp_ = std::move(group);
+        int blocks = kv_pool_->num_blocks();
+        int block_size = kv_pool_->block_size();
+        TensorParallelStep step;
+        std::vector<float> rows;
+        while (tp_->ReceiveStep(step, rows, config_.hidden_size, blocks * block_size, blocks)) {
+            int seq_len = step.row_slots.size();
+            int table_entries = step.block_tables.size();
+            bool valid = true;
+            for (int i = 0; i < seq_len; i++) {
+                int32_t offset = step.row_table_offsets[i], position = step.row_positions[i];
+                valid = valid && step.row_slots[i] >= 0 && step.row_slots[i] < blocks * block_size && offset >= 0 &&
+                        position >= 0 && offset + position / block_size < table_entries;
+            }
+            for (int32_t rope_id : step.rope_ids) valid = valid && rope_id >= 0 && rope_id < config_.max_position_embeddings;
+            for (int32_t block : step.block_tables) valid = valid && block >= 0 && block < blocks;
+            for (size_t c = 0; c < step.copies.size(); c += 3) {
+                valid = valid && step.copies[c] >= 0 && step.copies[c] < blocks && step.copies[c + 1] >= 0 &&
+                        step.copies[c + 1] < blocks && step.copies[c + 2] >= 0 && step.copies[c + 2] <= block_size;
+            }
+            if (!valid) throw std::runtime_error("Invalid tensor-parallel step");
+            for (size_t c = 0; c < step.copies.size(); c += 3) {
+                kv_pool_->CopyBlock(step.copies[c], step.copies[c + 1], step.copies[c + 2]);
+            }
 
-            // Post-attention layernorm
-            auto& post_norm_weight = weights_[p + "post_attention_layernorm.weight"];
-            auto post_normed = rmsnorm(hidden, post_norm_weight, config_.hidden_size, seq_len);
+            ArenaScope arena(&arena_);
+            @autoreleasepool {
+                id<MTLBuffer> hidden = new_buffer(rows.size());
+                memcpy([hidden contents], rows.data(), rows.size() * sizeof(float));
+                run_layers(hidden, seq_len, upload_ints(step.row_slots), upload_ints(step.block_tables),
+                           upload_ints(step.row_table_offsets), upload_ints(step.row_positions),
+                           upload_ints(step.rope_ids))->wait();
+            }
+        }
+    }
+
+    // Microbenchmark of one kernel (MLXBenchmarkKernel): mean GPU nanoseconds
+    // per dispatch on layer 0's weights with `rows` activation rows (decode-sized
+    // rows take the GEMV kernels, as in run_forward). kv_write and
+    // paged_attention run against a scratch cache of `context` positions; the
+    // lm_head and sample kernels ignore `context`. One warm-up dispatch, then
+    // `iterations` dispatches in a single command buffer timed by the GPU, all
+    // writing one output allocated up front, so no dispatch pays for a fresh
+    // buffer.
+    double benchmark_kernel(const std::string& kernel, int rows, int context, int iterations) {
+        if (rows <= 0 || context < 0 || iterations <= 0 ||
+            context + rows > config_.max_position_embeddings) {
+            throw std::runtime_error("Invalid benchmark shape");
+        }
+        // Layer 0's weights are one shard and the scratch cache would need every rank
+        if (config_.tp_size > 1) throw std::runtime_error("Kernel benchmarks are unsupported under tensor parallelism");
+        int hidden_size = config_.hidden_size;
+        int head_dim = config_.head_dim;
+        int num_heads = config_.num_attention_heads;
+        int num_kv_heads = config_.num_key_value_heads;
+        int kv_dim = num_kv_heads * head_dim;
+        uint vocab = config_.vocab_size;
+        const LayerWeights& w = layers_[0];
+
+        // Deterministic activations in [-1, 1), wide enough for any projection input
+        size_t width = std::max(hidden_size, config_.intermediate_size);
+        id<MTLBuffer> x = new_buffer(static_cast<size_t>(rows) * width);
+        id<MTLBuffer> residual = new_buffer(static_cast<size_t>(rows) * hidden_size);
+        id<MTLBuffer> logits = new_buffer(vocab);
+        uint32_t state = 0x9e3779b9u;
+        auto fill = [&](id<MTLBuffer> buffer) {
+            float* data = static_cast<float*>([buffer contents]);
+            for (size_t i = 0; i < [buffer length] / sizeof(float); i++) {
+                state = state * 1664525u + 1013904223u;
+                data[i] = static_cast<float>(state >> 8) / static_cast<float>(1u << 23) - 1.0f;
+            }
+        };
+        fill(x);
+        fill(residual);
+        fill(logits);
+
+        // Scratch cache: `context` cached positions plus `rows` new ones, released on return
+        KVCache scratch(0, kv_pool_, fingerprint_);
+        std::vector<uint32_t> scratch_tokens(context + rows, 0);
+        scratch.Append(scratch_tokens.data(), context + rows);
+        std::vector<int32_t> row_positions(rows), row_table_offsets(rows, 0), rope_ids(3 * static_cast<size_t>(rows));
+        for (int i = 0; i < rows; i++) {
+            row_positions[i] = context + i;
+            for (int s = 0; s < 3; s++) rope_ids[s * rows + i] = context + i;
+        }
+        id<MTLBuffer> slots = upload_ints(scratch.SlotMapping(context, rows));
+        id<MTLBuffer> block_table = upload_ints(scratch.block_table);
+        id<MTLBuffer> table_offsets = upload_ints(row_table_offsets);
+        id<MTLBuffer> positions = upload_ints(row_positions);
+        id<MTLBuffer> rope_positions = upload_ints(rope_ids);
+
+        SamplingParams params = {1.0f, 50, 1.0f, 1, 0, 0};
+        id<MTLBuffer> token_buffer = new_bytes(sizeof(uint32_t));
+        id<MTLBuffer> top_ids = new_bytes(sizeof(uint32_t));
+        id<MTLBuffer> top_logprobs = new_bytes(sizeof(float));
+
+        // Each kernel's output is allocated once and shared by every dispatch
+        auto output = [&](size_t cols) { return new_buffer(static_cast<size_t>(rows) * cols); };
+        std::function<void(CommandBatch&)> encode;
+        if (kernel == "linear") {
+            id<MTLBuffer> y = output(hidden_size);
+            encode = [&, y](CommandBatch& batch) {
+                linear_into(batch, x, w.o_proj, y, rows, hidden_size, hidden_size);
+            };
+        } else if (kernel == "linear_rope") {
+            id<MTLBuffer> y = output(hidden_size);
+            encode = [&, y](CommandBatch& batch) {
+                linear_rope_into(batch, x, w.q_proj, y, rows, hidden_size, hidden_size, rope_positions);
+            };
+        } else if (kernel == "gated_mlp") {
+            id<MTLBuffer> y = output(config_.intermediate_size);
+            encode = [&, y](CommandBatch& batch) {
+                gated_mlp_into(batch, x, w.gate_proj, w.up_proj, y,
+                               rows, config_.intermediate_size, hidden_size);
+            };
+        } else if (kernel == "down_proj") {
+            id<MTLBuffer> y = output(hidden_size);
+            encode = [&, y](CommandBatch& batch) {
+                linear_into(batch, x, w.down_proj, y, rows, hidden_size, config_.intermediate_size);
+            };
+        } else if (kernel == "rmsnorm") {
+            id<MTLBuffer> y = output(hidden_size);
+            id<MTLBuffer> row_ids = identity_rows(rows);
+            encode = [&, y, row_ids](CommandBatch& batch) {
+                rmsnorm_ids_into(batch, x, w.input_layernorm, y, hidden_size, row_ids, rows);
+            };
+        } else if (kernel == "add_rmsnorm") {
+            NormedResidual out = {output(hidden_size), output(hidden_size)};
+            encode = [&, out](CommandBatch& batch) {
+                add_rmsnorm_into(batch, x, residual, w.post_attention_layernorm, out, hidden_size, rows);
+            };
+        } else if (kernel == "kv_write") {
+            MTLSize grid = {static_cast<NSUInteger>(kv_dim), static_cast<NSUInteger>(rows), 1};
+            encode = [&, grid](CommandBatch& batch) {
+                execute_2d(batch, kv_write_pipeline_,
+                           {x, residual, kv_pool_->KeySlab(0), kv_pool_->ValueSlab(0), slots,
+                            scalar((uint)rows), scalar((uint)kv_dim)}, grid);
+            };
+        } else if (kernel == "paged_attention") {
+            id<MTLBuffer> out = output(static_cast<size_t>(num_heads) * head_dim);
+            MTLSize groups = {static_cast<NSUInteger>(num_kv_heads), static_cast<NSUInteger>(rows), 1};
+            MTLSize threads = {static_cast<NSUInteger>(num_heads / num_kv_heads) * 32, 1, 1};
+            encode = [&, out, groups, threads](CommandBatch& batch) {
+                bind(batch, paged_attention_pipeline_,
+                     {x, kv_pool_->KeySlab(0), kv_pool_->ValueSlab(0), block_table, table_offsets, positions, out,
+                      scalar((uint)num_heads), scalar((uint)num_kv_heads), scalar((uint)head_dim),
+                      scalar((uint)kv_pool_->block_size()), scalar(1.0f / sqrtf(head_dim))});
+                [batch.encoder dispatchThreadgroups:groups threadsPerThreadgroup:threads];
+            };
+        } else if (kernel == "lm_head") {
+            id<MTLBuffer> y = output(vocab);
+            encode = [&, y](CommandBatch& batch) {
+                linear_into(batch, x, lm_head_, y, rows, vocab, hidden_size);
+            };
+        } else if (kernel == "sample") {
+            // One vocab-wide logits row per dispatch, top-k sampled
+            NSUInteger threads = std::min<NSUInteger>(1024, sample_pipeline_.maxTotalThreadsPerThreadgroup) / 32 * 32;
+            encode = [&, threads](CommandBatch& batch) {
+                bind(batch, sample_pipeline_,
+                     {logits, token_buffer, top_ids, top_logprobs, scalar(vocab), scalar((uint)params.top_k), Binding::Bytes(params)});
+                [batch.encoder dispatchThreadgroups:MTLSizeMake(1, 1, 1) threadsPerThreadgroup:MTLSizeMake(threads, 1, 1)];
+            };
+        } else {
+            throw std::runtime_error("Unknown benchmark kernel: " + kernel);
+        }
+
+        double ns_per_dispatch = 0.0;
+        for (int dispatches : {1, iterations}) {
+            @autoreleasepool {
+                CommandBatch batch(queue_);
+                for (int i = 0; i < dispatches; i++) encode(batch);
+                batch.commit_and_wait();
+                CFTimeInterval seconds = [batch.command_buffer GPUEndTime] - [batch.command_buffer GPUStartTime];
+                ns_per_dispatch = seconds * 1e9 / dispatches;
+            }
+        }
+        return ns_per_dispatch;
+    }
+
+    const ModelConfig& GetConfig() const { return config_; }
+    const std::shared_ptr<KVBlockPool>& GetKVPool() const { return kv_pool_; }
+    uint64_t GetFingerprint() const { return fingerprint_; }
+    ImageEmbeddingCache& GetImageCache() { return image_cache_; }
+};
 
-            // MLP
-            auto& gate_proj = weights_[p + "mlp.gate_proj.weight"];
-            auto& up_proj = weights_[p + "mlp.up_proj.weight"];
-            auto& down_proj = weights_[p + "mlp.down_proj.weight"];
+// Fork base_handle (or start empty) for a forward to extend
+// Returns nullptr if base_handle is unknown or holds another model's K/V
+static std::shared_ptr<KVCache> ForkCache(Qwen2VLModel& model, uint64_t base_handle) {
+    // Published caches are never appended to again; Fork only locks out a concurrent offload
+    const auto& pool = model.GetKVPool();
+    std::shared_ptr<KVCache> cache;
+    if (base_handle != MLX_ROOT_CACHE_HANDLE) {
+        auto base_cache = g_registry.Get(base_handle);
+        if (!base_cache || base_cache->pool != pool || base_cache->model != model.GetFingerprint()) return nullptr;
+        cache = KVCache::Fork(*base_cache, base_cache->seq_length);
+    } else {
+        cache = std::make_shared<KVCache>(0, pool, model.GetFingerprint());
+    }
+    return cache;
+}
 
-            auto gate = matmul(post_normed, gate_proj, seq_len, config_.intermediate_size, config_.hidden_size);
-            auto up = matmul(post_normed, up_proj, seq_len, config_.intermediate_size, config_.hidden_size);
+// Prompt-lookup drafting: finds the most recent earlier occurrence of the
+// longest suffix of `context` (max_ngram tokens down to 1) and proposes the up
+// to max_draft tokens that followed it. Empty if no suffix recurs.
+static std::vector<uint32_t> NgramDraft(const std::vector<uint32_t>& context, int max_ngram, int max_draft) {
+    int length = context.size();
+    for (int n = std::min(max_ngram, length - 1); n >= 1; n--) {
+        const uint32_t* suffix = context.data() + length - n;
+        for (int start = length - n - 1; start >= 0; start--) {
+            if (std::equal(suffix, suffix + n, context.data() + start)) {
+                int from = start + n;
+                int count = std::min(max_draft, length - from);
+                return std::vector<uint32_t>(context.begin() + from, context.begin() + from + count);
+            }
+        }
+    }
+    return {};
+}
 
-            // GeLU activation
-            gate = gelu(gate);
+// Loaded models by handle
+//
+// MLX_DEFAULT_MODEL_HANDLE (0) names the default model: the first model
+// loaded, the latest MLXLoadModel / MLXLoadModelWithOptions load (each
+// replaces the model the previous one loaded), or MLXSetDefaultModel's pick.
+// The mutex only guards the map; forward passes take a reference and run
+// without it, so loads and unloads never wait on inference and in-flight
+// requests finish on the model they started with.
+class ModelRegistry {
+private:
+    std::mutex mutex_;
+    std::unordered_map<uintptr_t, std::shared_ptr<Qwen2VLModel>> models_;
+    uintptr_t next_handle_ = 1;
+    uintptr_t default_ = MLX_DEFAULT_MODEL_HANDLE;
+    uintptr_t legacy_ = MLX_DEFAULT_MODEL_HANDLE;  // Loaded by MLXLoadModel*, replaced by the next such load
 
-            // Element-wise multiply
-            for (size_t i = 0; i < gate.size(); i++) {
-                gate[i] *= up[i];
+public:
+    // A replaced legacy model is destroyed after unlocking: ~Qwen2VLModel waits for its submitted work
+    uintptr_t Insert(std::shared_ptr<Qwen2VLModel> model, bool legacy) {
+        std::shared_ptr<Qwen2VLModel> replaced;
+        std::lock_guard<std::mutex> lock(mutex_);
+        uintptr_t handle = next_handle_++;
+        models_[handle] = std::move(model);
+        if (legacy) {
+            auto it = models_.find(legacy_);
+            if (it != models_.end()) {
+                replaced = std::move(it->second);
+                models_.erase(it);
             }
+            legacy_ = handle;
+            default_ = handle;
+        } else if (models_.find(default_) == models_.end()) {
+            default_ = handle;
+        }
+        return handle;
+    }
 
-            // Down projection
-            auto mlp_output = matmul(gate, down_proj, seq_len, config_.hidden_size, config_.intermediate_size);
+    std::shared_ptr<Qwen2VLModel> Get(uintptr_t handle) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = models_.find(handle == MLX_DEFAULT_MODEL_HANDLE ? default_ : handle);
+        return it != models_.end() ? it->second : nullptr;
+    }
 
-            // Residual connection
-            hidden = add(hidden, mlp_output);
+    // First loaded model that computes the K/V tagged `fingerprint`, else the default
+    std::shared_ptr<Qwen2VLModel> Find(uint64_t fingerprint) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const auto& [handle, model] : models_) {
+            if (model->GetFingerprint() == fingerprint) return model;
         }
+        auto it = models_.find(default_);
+        return it != models_.end() ? it->second : nullptr;
+    }
+
+    bool SetDefault(uintptr_t handle) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (models_.find(handle) == models_.end()) return false;
+        default_ = handle;
+        return true;
+    }
+
+    // The model's caches stay valid (they hold its pool); forwards from them need a model with its fingerprint
+    bool Remove(uintptr_t handle) {
+        std::shared_ptr<Qwen2VLModel> removed;  // Destroyed after unlocking, as in Insert
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = models_.find(handle);
+        if (it == models_.end()) return false;
+        removed = std::move(it->second);
+        models_.erase(it);
+        if (legacy_ == handle) legacy_ = MLX_DEFAULT_MODEL_HANDLE;
+        if (default_ == handle) default_ = models_.empty() ? MLX_DEFAULT_MODEL_HANDLE : models_.begin()->first;
+        return true;
+    }
+};
+
+static ModelRegistry g_models;
+
+// Model recorded in the header of the cache snapshot at `path`, 0 if unreadable
+static uint64_t SnapshotFingerprint(const std::string& path) {
+    CacheSnapshotHeader header;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return 0;
+    bool ok = pread(fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header));
+    close(fd);
+    return ok && header.magic == kCacheSnapshotMagic ? header.fingerprint : 0;
+}
+
+// Drops a model reference held by submitted work from a global queue: the
+// completion runs inside a step, possibly on the model's step_queue_, which
+// ~Qwen2VLModel waits for
+static void ReleaseModel(std::shared_ptr<Qwen2VLModel> model) {
+    if (!model) return;
+    auto* held = new std::shared_ptr<Qwen2VLModel>(std::move(model));
+    dispatch_async_f(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), held, [](void* context) {
+        delete static_cast<std::shared_ptr<Qwen2VLModel>*>(context);
+    });
+}
+
+// Forwards submitted with MLXSubmitForward, by ticket
+//
+// The result (logits and published cache handle, or the error) waits here
+// until MLXPollForward / MLXWaitForward collects it and retires the ticket.
+struct SubmittedForward {
+    std::shared_ptr<KVCache> cache;  // Until done; the completion holds the model meanwhile
+    std::vector<float> logits;
+    MLXForwardCallback callback = nullptr;
+    uintptr_t user_data = 0;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool done = false;
+    int status = MLX_SUCCESS;
+    std::string error;
+    uint64_t cache_handle = 0;
+};
+
+class SubmittedForwards {
+private:
+    std::mutex mutex_;
+    std::unordered_map<uint64_t, std::shared_ptr<SubmittedForward>> forwards_;
+    uint64_t next_ticket_ = 1;
+
+public:
+    uint64_t Insert(std::shared_ptr<SubmittedForward> forward) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uint64_t ticket = next_ticket_++;
+        forwards_[ticket] = std::move(forward);
+        return ticket;
+    }
 
-        // 3. Final normalization
-        auto& final_norm_weight = weights_["model.norm.weight"];
-        hidden = rmsnorm(hidden, final_norm_weight, config_.hidden_size, seq_len);
+    std::shared_ptr<SubmittedForward> Get(uint64_t ticket) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = forwards_.find(ticket);
+        return it != forwards_.end() ? it->second : nullptr;
+    }
 
-        // 4. Get last hidden state for language model head
-        std::vector<float> last_hidden(hidden.end() - config_.hidden_size, hidden.end());
+    void Remove(uint64_t ticket) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        forwards_.erase(ticket);
+    }
+};
 
-        // 5. LM head projection
-        auto& lm_head = weights_["lm_head.weight"];
-        auto logits = matmul(last_hidden, lm_head, 1, config_.vocab_size, config_.hidden_size);
+static SubmittedForwards g_submitted;
+
+// Hands a finished forward's result to the caller and retires its ticket
+// Caller holds forward.mutex and has checked forward.done.
+static int CollectForward(uint64_t ticket, SubmittedForward& forward, float* out_logits, int out_logits_size,
+                          uint64_t* out_cache_handle, char** out_error) {
+    if (out_logits && out_logits_size < static_cast<int>(forward.logits.size())) return MLX_ERROR_OUT_OF_MEMORY;
+    g_submitted.Remove(ticket);
+    if (forward.status != MLX_SUCCESS) {
+        *out_error = strdup(forward.error.c_str());
+        return forward.status;
+    }
+    if (out_logits) memcpy(out_logits, forward.logits.data(), forward.logits.size() * sizeof(float));
+    *out_cache_handle = forward.cache_handle;
+    *out_error = nullptr;
+    return MLX_SUCCESS;
+}
 
-        return logits;
+// Fills the load-time fields of config from options (NULL = defaults); false if they are invalid
+static bool ApplyLoadOptions(const MLXLoadOptions* options, ModelConfig& config) {
+    MLXLoadOptions defaults = {};
+    const MLXLoadOptions& o = options ? *options : defaults;
+    if (o.weight_format < MLX_WEIGHT_FORMAT_F32 || o.weight_format > MLX_WEIGHT_FORMAT_Q4) return false;
+    config.weight_format = static_cast<WeightFormat>(o.weight_format);
+    config.quant_group_size = o.quant_group_size > 0 ? o.quant_group_size : MLX_DEFAULT_QUANT_GROUP_SIZE;
+    config.prefill_chunk_tokens = o.prefill_chunk_tokens > 0 ? o.prefill_chunk_tokens : MLX_DEFAULT_PREFILL_CHUNK_TOKENS;
+    if (o.pipeline_cache_dir) config.pipeline_cache_dir = o.pipeline_cache_dir;
+    while (config.pipeline_cache_dir.size() > 1 && config.pipeline_cache_dir.back() == '/') {
+        config.pipeline_cache_dir.pop_back();
+    }
+    config.tp_peers.clear();
+    for (const char* p = o.tensor_parallel_peers ? o.tensor_parallel_peers : ""; *p;) {
+        const char* end = strchr(p, ',');
+        std::string address(p, end ? end - p : strlen(p));
+        std::string host, port;
+        if (!SplitAddress(address, host, port) || host.empty()) return false;
+        config.tp_peers.push_back(address);
+        p = end ? end + 1 : p + address.size();
     }
+    return true;
+}
 
-    const ModelConfig& GetConfig() const { return config_; }
-};
+// Loads a model and registers it; `legacy` loads replace the previous legacy load as the default
+static int LoadModel(const char* model_path, int vocab_size, const MLXLoadOptions* options, bool legacy,
+                     uintptr_t* out_model_handle) {
+    try {
+        ModelConfig config;
+        config.vocab_size = vocab_size;
+        if (!ApplyLoadOptions(options, config)) return MLX_ERROR_INVALID_TOKENS;
+        config.tp_size = static_cast<int>(config.tp_peers.size()) + 1;
+        auto model = std::make_shared<Qwen2VLModel>(model_path, config);
+        *out_model_handle = g_models.Insert(std::move(model), legacy);
+        return MLX_SUCCESS;
+    } catch (...) {
+        return MLX_ERROR_COMPUTATION_FAILED;
+    }
+}
 
 } // namespace mlx_vllm
 
@@ -779,14 +4151,60 @@ public:
 extern "C" {
 
 int MLXLoadModel(const char* model_path, int vocab_size) {
+    return MLXLoadModelWithOptions(model_path, vocab_size, nullptr);
+}
+
+int MLXLoadModelWithOptions(const char* model_path, int vocab_size, const MLXLoadOptions* options) {
+    uintptr_t model_handle;
+    return mlx_vllm::LoadModel(model_path, vocab_size, options, true, &model_handle);
+}
+
+int MLXLoadModelHandle(const char* model_path, int vocab_size, const MLXLoadOptions* options,
+                       uintptr_t* out_model_handle) {
+    if (!out_model_handle) return MLX_ERROR_INVALID_HANDLE;
+    return mlx_vllm::LoadModel(model_path, vocab_size, options, false, out_model_handle);
+}
+
+int MLXUnloadModel(uintptr_t model_handle) {
+    return mlx_vllm::g_models.Remove(model_handle) ? MLX_SUCCESS : MLX_ERROR_MODEL_NOT_LOADED;
+}
+
+int MLXSetDefaultModel(uintptr_t model_handle) {
+    return mlx_vllm::g_models.SetDefault(model_handle) ? MLX_SUCCESS : MLX_ERROR_MODEL_NOT_LOADED;
+}
+
+int MLXServeShard(const char* model_path, int vocab_size, const MLXLoadOptions* options, int rank, int size,
+                  const char* listen_address, char** out_error) {
+    if (!model_path || !listen_address || !out_error) return MLX_ERROR_INVALID_TOKENS;
+    *out_error = nullptr;
+    mlx_vllm::ModelConfig config;
+    config.vocab_size = vocab_size;
+    // Workers are reached by rank 0, so they take no peers of their own
+    if (!mlx_vllm::ApplyLoadOptions(options, config) || !config.tp_peers.empty() || rank < 1 || rank >= size) {
+        return MLX_ERROR_INVALID_TOKENS;
+    }
+    // Listening before the (slow) load lets rank 0 connect early and wait for the handshake
+    int listen_fd = mlx_vllm::OpenSocket(listen_address, true);
+    if (listen_fd < 0) {
+        *out_error = strdup((std::string("Failed to listen on ") + listen_address).c_str());
+        return MLX_ERROR_COMPUTATION_FAILED;
+    }
     try {
-        mlx_vllm::ModelConfig config;
-        config.vocab_size = vocab_size;
-        auto model = std::make_shared<mlx_vllm::Qwen2VLModel>(model_path, config);
-        std::lock_guard<std::mutex> lock(mlx_vllm::g_model_mutex);
-        mlx_vllm::g_model = model;
+        config.tp_rank = rank;
+        config.tp_size = size;
+        auto model = std::make_unique<mlx_vllm::Qwen2VLModel>(model_path, config);
+        auto group = mlx_vllm::TensorParallelGroup::Accept(listen_fd, mlx_vllm::TensorParallelHello::For(config));
+        close(listen_fd);
+        listen_fd = -1;
+        model->serve_shard(std::move(group));
         return MLX_SUCCESS;
-    } catch (...) {
+    } catch (const mlx_vllm::OutOfMemoryError& e) {
+        if (listen_fd >= 0) close(listen_fd);
+        *out_error = strdup(e.what());
+        return MLX_ERROR_OUT_OF_MEMORY;
+    } catch (const std::exception& e) {
+        if (listen_fd >= 0) close(listen_fd);
+        *out_error = strdup(e.what());
         return MLX_ERROR_COMPUTATION_FAILED;
     }
 }
@@ -795,53 +4213,591 @@ int MLXForwardWithCache(uintptr_t model_handle, const uint32_t* tokens, int num_
                         uint64_t base_cache_handle, float* out_logits, int out_logits_size,
                         uint64_t* out_cache_handle, char** out_error) {
     try {
-        std::lock_guard<std::mutex> lock(mlx_vllm::g_model_mutex);
-        if (!mlx_vllm::g_model) {
+        auto model = mlx_vllm::g_models.Get(model_handle);
+        if (!model) {
             *out_error = strdup("Model not loaded");
             return MLX_ERROR_MODEL_NOT_LOADED;
         }
 
-        const auto& config = mlx_vllm::g_model->GetConfig();
+        const auto& config = model->GetConfig();
         if (num_tokens <= 0 || !tokens) return MLX_ERROR_INVALID_TOKENS;
         if (out_logits_size < config.vocab_size) return MLX_ERROR_OUT_OF_MEMORY;
 
-        auto parent_cache = mlx_vllm::g_registry.Get(base_cache_handle);
-        if (parent_cache) mlx_vllm::g_registry.Ref(base_cache_handle);
+        // Start from a fork of the base handle's block table (shares every block)
+        auto new_cache = mlx_vllm::ForkCache(*model, base_cache_handle);
+        if (!new_cache) {
+            *out_error = strdup("Invalid base cache handle");
+            return MLX_ERROR_INVALID_HANDLE;
+        }
+
+        std::vector<int32_t> input_ids(tokens, tokens + num_tokens);
+        model->forward(input_ids, *new_cache, out_logits);
+
+        *out_cache_handle = mlx_vllm::g_registry.Insert(new_cache);
+        *out_error = nullptr;
+        return MLX_SUCCESS;
+    } catch (const mlx_vllm::OutOfMemoryError& e) {
+        *out_error = strdup(e.what());
+        return MLX_ERROR_OUT_OF_MEMORY;
+    } catch (const std::exception& e) {
+        *out_error = strdup(e.what());
+        return MLX_ERROR_COMPUTATION_FAILED;
+    }
+}
+
+int MLXSubmitForward(uintptr_t model_handle, const uint32_t* tokens, int num_tokens, uint64_t base_cache_handle,
+                     MLXForwardCallback callback, uintptr_t user_data, uint64_t* out_ticket, char** out_error) {
+    if (num_tokens <= 0 || !tokens || !out_ticket) return MLX_ERROR_INVALID_TOKENS;
+    uint64_t ticket = 0;
+    try {
+        auto model = mlx_vllm::g_models.Get(model_handle);
+        if (!model) {
+            *out_error = strdup("Model not loaded");
+            return MLX_ERROR_MODEL_NOT_LOADED;
+        }
+        auto forward = std::make_shared<mlx_vllm::SubmittedForward>();
+        forward->cache = mlx_vllm::ForkCache(*model, base_cache_handle);
+        if (!forward->cache) {
+            *out_error = strdup("Invalid base cache handle");
+            return MLX_ERROR_INVALID_HANDLE;
+        }
+        forward->logits.resize(model->GetConfig().vocab_size);
+        forward->callback = callback;
+        forward->user_data = user_data;
+        ticket = mlx_vllm::g_submitted.Insert(forward);
+
+        std::vector<int32_t> input_ids(tokens, tokens + num_tokens);
+        // The callback holds `forward` (its cache and logits) and the model until the work is done
+        model->submit_forward(input_ids, *forward->cache, forward->logits.data(),
+                              [forward, ticket, model](std::exception_ptr error) mutable {
+            int status = MLX_SUCCESS;
+            std::string message;
+            if (error) {
+                try {
+                    std::rethrow_exception(error);
+                } catch (const mlx_vllm::OutOfMemoryError& e) {
+                    status = MLX_ERROR_OUT_OF_MEMORY;
+                    message = e.what();
+                } catch (const std::exception& e) {
+                    status = MLX_ERROR_COMPUTATION_FAILED;
+                    message = e.what();
+                } catch (...) {
+                    status = MLX_ERROR_COMPUTATION_FAILED;
+                    message = "MLX error: unknown failure";
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lock(forward->mutex);
+                forward->status = status;
+                forward->error = message;
+                if (status == MLX_SUCCESS) forward->cache_handle = mlx_vllm::g_registry.Insert(forward->cache);
+                forward->cache.reset();
+                forward->done = true;
+            }
+            forward->cv.notify_all();
+            if (forward->callback) forward->callback(ticket, status, forward->user_data);
+            mlx_vllm::ReleaseModel(std::move(model));
+        });
+        *out_ticket = ticket;
+        *out_error = nullptr;
+        return MLX_SUCCESS;
+    } catch (const mlx_vllm::OutOfMemoryError& e) {
+        if (ticket) mlx_vllm::g_submitted.Remove(ticket);
+        *out_error = strdup(e.what());
+        return MLX_ERROR_OUT_OF_MEMORY;
+    } catch (const std::exception& e) {
+        if (ticket) mlx_vllm::g_submitted.Remove(ticket);
+        *out_error = strdup(e.what());
+        return MLX_ERROR_COMPUTATION_FAILED;
+    }
+}
+
+int MLXPollForward(uint64_t ticket, float* out_logits, int out_logits_size, uint64_t* out_cache_handle,
+                   char** out_error) {
+    auto forward = mlx_vllm::g_submitted.Get(ticket);
+    if (!forward) return MLX_ERROR_INVALID_HANDLE;
+    std::lock_guard<std::mutex> lock(forward->mutex);
+    if (!forward->done) return MLX_PENDING;
+    return mlx_vllm::CollectForward(ticket, *forward, out_logits, out_logits_size, out_cache_handle, out_error);
+}
+
+int MLXWaitForward(uint64_t ticket, float* out_logits, int out_logits_size, uint64_t* out_cache_handle,
+                   char** out_error) {
+    auto forward = mlx_vllm::g_submitted.Get(ticket);
+    if (!forward) return MLX_ERROR_INVALID_HANDLE;
+    std::unique_lock<std::mutex> lock(forward->mutex);
+    forward->cv.wait(lock, [&] { return forward->done; });
+    return mlx_vllm::CollectForward(ticket, *forward, out_logits, out_logits_size, out_cache_handle, out_error);
+}
+
+int MLXForwardBatch(uintptr_t model_handle, int num_sequences, const uint32_t* tokens,
+                    const int* token_counts, const uint64_t* base_cache_handles,
+                    float* out_logits, int out_logits_size,
+                    uint64_t* out_cache_handles, char** out_error) {
+    try {
+        auto model = mlx_vllm::g_models.Get(model_handle);
+        if (!model) {
+            *out_error = strdup("Model not loaded");
+            return MLX_ERROR_MODEL_NOT_LOADED;
+        }
+
+        const auto& config = model->GetConfig();
+        if (num_sequences <= 0 || !tokens || !token_counts || !base_cache_handles || !out_cache_handles ||
+            !out_logits) {
+            return MLX_ERROR_INVALID_TOKENS;
+        }
+        if (out_logits_size < static_cast<int64_t>(num_sequences) * config.vocab_size) return MLX_ERROR_OUT_OF_MEMORY;
+
+        // Fork every sequence's cache; nothing is published unless the whole batch succeeds
+        std::vector<std::shared_ptr<mlx_vllm::KVCache>> caches(num_sequences);
+        std::vector<std::vector<int32_t>> input_ids(num_sequences);
+        std::vector<mlx_vllm::Qwen2VLModel::BatchSequence> batch(num_sequences);
+        const uint32_t* seq_tokens = tokens;
+        for (int i = 0; i < num_sequences; i++) {
+            if (token_counts[i] <= 0) return MLX_ERROR_INVALID_TOKENS;
+            caches[i] = mlx_vllm::ForkCache(*model, base_cache_handles[i]);
+            if (!caches[i]) {
+                *out_error = strdup("Invalid base cache handle");
+                return MLX_ERROR_INVALID_HANDLE;
+            }
+            input_ids[i].assign(seq_tokens, seq_tokens + token_counts[i]);
+            batch[i] = {&input_ids[i], caches[i].get()};
+            seq_tokens += token_counts[i];
+        }
+
+        model->forward_batch(batch, out_logits);
+
+        for (int i = 0; i < num_sequences; i++) {
+            out_cache_handles[i] = mlx_vllm::g_registry.Insert(caches[i]);
+        }
+        *out_error = nullptr;
+        return MLX_SUCCESS;
+    } catch (const mlx_vllm::OutOfMemoryError& e) {
+        *out_error = strdup(e.what());
+        return MLX_ERROR_OUT_OF_MEMORY;
+    } catch (const std::exception& e) {
+        *out_error = strdup(e.what());
+        return MLX_ERROR_COMPUTATION_FAILED;
+    }
+}
+
+int MLXForwardSample(uintptr_t model_handle, const uint32_t* tokens, int num_tokens,
+                     uint64_t base_cache_handle,
+                     float temperature, int top_k, float top_p, uint64_t seed,
+                     const uint32_t* bias_token_ids, const float* bias_values, int num_bias,
+                     int num_logprobs, uint32_t* out_token,
+                     uint32_t* out_top_ids, float* out_top_logprobs,
+                     uint64_t* out_cache_handle, char** out_error) {
+    try {
+        auto model = mlx_vllm::g_models.Get(model_handle);
+        if (!model) {
+            *out_error = strdup("Model not loaded");
+            return MLX_ERROR_MODEL_NOT_LOADED;
+        }
+
+        if (num_tokens <= 0 || !tokens || !out_token) return MLX_ERROR_INVALID_TOKENS;
+        if (num_logprobs < 0 || num_logprobs > MLX_MAX_SAMPLE_CANDIDATES) return MLX_ERROR_INVALID_TOKENS;
+        if (num_logprobs > 0 && (!out_top_ids || !out_top_logprobs)) return MLX_ERROR_OUT_OF_MEMORY;
+        if (num_bias < 0 || (num_bias > 0 && (!bias_token_ids || !bias_values))) return MLX_ERROR_INVALID_TOKENS;
+
+        auto new_cache = mlx_vllm::ForkCache(*model, base_cache_handle);
+        if (!new_cache) {
+            *out_error = strdup("Invalid base cache handle");
+            return MLX_ERROR_INVALID_HANDLE;
+        }
+
+        mlx_vllm::SamplingParams params;
+        params.temperature = temperature;
+        params.top_k = top_k;
+        params.top_p = top_p;
+        params.seed_lo = static_cast<uint32_t>(seed);
+        params.seed_hi = static_cast<uint32_t>(seed >> 32);
+        params.num_logprobs = num_logprobs;
+        std::vector<uint32_t> bias_ids(bias_token_ids, bias_token_ids + num_bias);
+        std::vector<float> bias(bias_values, bias_values + num_bias);
+
+        std::vector<int32_t> input_ids(tokens, tokens + num_tokens);
+        mlx_vllm::SampleResult result = model->forward_sample(input_ids, *new_cache, params, bias_ids, bias);
+
+        *out_token = result.token;
+        if (num_logprobs > 0) {
+            memcpy(out_top_ids, result.top_ids.data(), result.top_ids.size() * sizeof(uint32_t));
+            memcpy(out_top_logprobs, result.top_logprobs.data(), result.top_logprobs.size() * sizeof(float));
+        }
+
+        *out_cache_handle = mlx_vllm::g_registry.Insert(new_cache);
+        *out_error = nullptr;
+        return MLX_SUCCESS;
+    } catch (const mlx_vllm::OutOfMemoryError& e) {
+        *out_error = strdup(e.what());
+        return MLX_ERROR_OUT_OF_MEMORY;
+    } catch (const std::exception& e) {
+        *out_error = strdup(e.what());
+        return MLX_ERROR_COMPUTATION_FAILED;
+    }
+}
+
+int MLXForwardMultimodal(uintptr_t model_handle, const uint32_t* tokens, int num_tokens,
+                         const MLXImageInput* images, int num_images,
+                         uint64_t base_cache_handle, float* out_logits, int out_logits_size,
+                         uint64_t* out_cache_handle, char** out_error) {
+    try {
+        auto model = mlx_vllm::g_models.Get(model_handle);
+        if (!model) {
+            *out_error = strdup("Model not loaded");
+            return MLX_ERROR_MODEL_NOT_LOADED;
+        }
+
+        const auto& config = model->GetConfig();
+        if (num_tokens <= 0 || !tokens || num_images < 0 || (num_images > 0 && !images)) return MLX_ERROR_INVALID_TOKENS;
+        if (out_logits_size < config.vocab_size) return MLX_ERROR_OUT_OF_MEMORY;
+
+        auto new_cache = mlx_vllm::ForkCache(*model, base_cache_handle);
+        if (!new_cache) {
+            *out_error = strdup("Invalid base cache handle");
+            return MLX_ERROR_INVALID_HANDLE;
+        }
 
         std::vector<int32_t> input_ids(tokens, tokens + num_tokens);
-        std::vector<float> logits = mlx_vllm::g_model->forward(input_ids, parent_cache);
+        std::vector<MLXImageInput> image_inputs(images, images + num_images);
+        model->forward_multimodal(input_ids, image_inputs, *new_cache, out_logits);
+
+        *out_cache_handle = mlx_vllm::g_registry.Insert(new_cache);
+        *out_error = nullptr;
+        return MLX_SUCCESS;
+    } catch (const mlx_vllm::OutOfMemoryError& e) {
+        *out_error = strdup(e.what());
+        return MLX_ERROR_OUT_OF_MEMORY;
+    } catch (const std::exception& e) {
+        *out_error = strdup(e.what());
+        return MLX_ERROR_COMPUTATION_FAILED;
+    }
+}
+
+int MLXForwardPointer(uintptr_t model_handle, const uint32_t* tokens, int num_tokens,
+                      const MLXImageInput* images, int num_images,
+                      uint64_t base_cache_handle, int top_k,
+                      MLXPointerCandidate* out_candidates, int* out_count,
+                      uint64_t* out_cache_handle, char** out_error) {
+    try {
+        auto model = mlx_vllm::g_models.Get(model_handle);
+        if (!model) {
+            *out_error = strdup("Model not loaded");
+            return MLX_ERROR_MODEL_NOT_LOADED;
+        }
+
+        if (num_tokens <= 0 || !tokens || num_images <= 0 || !images || top_k <= 0 ||
+            top_k > MLX_MAX_SAMPLE_CANDIDATES || !out_candidates || !out_count) {
+            return MLX_ERROR_INVALID_TOKENS;
+        }
 
-        memcpy(out_logits, logits.data(), logits.size() * sizeof(float));
+        auto new_cache = mlx_vllm::ForkCache(*model, base_cache_handle);
+        if (!new_cache) {
+            *out_error = strdup("Invalid base cache handle");
+            return MLX_ERROR_INVALID_HANDLE;
+        }
 
-        auto new_cache = std::make_shared<mlx_vllm::KVCache>(
-            0, std::vector<uint32_t>(tokens, tokens + num_tokens),
-            parent_cache, parent_cache ? parent_cache->seq_length + num_tokens : num_tokens,
-            config.num_hidden_layers);
-        new_cache->logits = logits;
+        std::vector<int32_t> input_ids(tokens, tokens + num_tokens);
+        std::vector<MLXImageInput> image_inputs(images, images + num_images);
+        auto candidates = model->forward_pointer(input_ids, image_inputs, *new_cache, top_k);
+        for (size_t i = 0; i < candidates.size(); i++) {
+            const auto& c = candidates[i];
+            out_candidates[i] = {c.image, c.patch, c.score, c.x, c.y};
+        }
+        *out_count = candidates.size();
 
         *out_cache_handle = mlx_vllm::g_registry.Insert(new_cache);
         *out_error = nullptr;
         return MLX_SUCCESS;
+    } catch (const mlx_vllm::OutOfMemoryError& e) {
+        *out_error = strdup(e.what());
+        return MLX_ERROR_OUT_OF_MEMORY;
+    } catch (const std::exception& e) {
+        *out_error = strdup(e.what());
+        return MLX_ERROR_COMPUTATION_FAILED;
+    }
+}
+
+int MLXSetImageCacheBudget(int64_t budget_bytes) {
+    auto model = mlx_vllm::g_models.Get(MLX_DEFAULT_MODEL_HANDLE);
+    if (!model) return MLX_ERROR_MODEL_NOT_LOADED;
+    model->GetImageCache().SetBudgetBytes(budget_bytes);
+    return MLX_SUCCESS;
+}
+
+int MLXGetImageCacheStats(MLXImageCacheStats* out_stats) {
+    if (!out_stats) return MLX_ERROR_INVALID_TOKENS;
+    auto model = mlx_vllm::g_models.Get(MLX_DEFAULT_MODEL_HANDLE);
+    if (!model) return MLX_ERROR_MODEL_NOT_LOADED;
+    *out_stats = model->GetImageCache().Stats();
+    return MLX_SUCCESS;
+}
+
+int MLXVerifyDraft(uintptr_t model_handle, const uint32_t* tokens, int num_tokens,
+                   uint64_t base_cache_handle,
+                   float temperature, int top_k, float top_p, uint64_t seed,
+                   int* out_accepted, uint32_t* out_tokens,
+                   float* out_logits, int out_logits_size,
+                   uint64_t* out_cache_handle, char** out_error) {
+    try {
+        auto model = mlx_vllm::g_models.Get(model_handle);
+        if (!model) {
+            *out_error = strdup("Model not loaded");
+            return MLX_ERROR_MODEL_NOT_LOADED;
+        }
+
+        const auto& config = model->GetConfig();
+        if (num_tokens <= 0 || !tokens || !out_accepted || !out_tokens) return MLX_ERROR_INVALID_TOKENS;
+        if (num_tokens > config.prefill_chunk_tokens) return MLX_ERROR_INVALID_TOKENS;
+        if (out_logits && out_logits_size < static_cast<int64_t>(num_tokens) * config.vocab_size) {
+            return MLX_ERROR_OUT_OF_MEMORY;
+        }
+
+        auto full_cache = mlx_vllm::ForkCache(*model, base_cache_handle);
+        if (!full_cache) {
+            *out_error = strdup("Invalid base cache handle");
+            return MLX_ERROR_INVALID_HANDLE;
+        }
+
+        mlx_vllm::SamplingParams params;
+        params.temperature = temperature;
+        params.top_k = top_k;
+        params.top_p = top_p;
+        params.seed_lo = static_cast<uint32_t>(seed);
+        params.seed_hi = static_cast<uint32_t>(seed >> 32);
+        params.num_logprobs = 0;
+
+        std::vector<int32_t> input_ids(tokens, tokens + num_tokens);
+        auto result = model->forward_verify(input_ids, *full_cache, params, out_logits);
+
+        // Keep the pending token and the accepted drafts (MLXSliceCache semantics)
+        int keep_tokens = full_cache->seq_length - num_tokens + result.accepted + 1;
+        auto accepted_cache = keep_tokens == full_cache->seq_length
+            ? full_cache
+            : mlx_vllm::KVCache::Fork(*full_cache, keep_tokens);
+
+        *out_accepted = result.accepted;
+        memcpy(out_tokens, result.tokens.data(), result.tokens.size() * sizeof(uint32_t));
+        *out_cache_handle = mlx_vllm::g_registry.Insert(accepted_cache);
+        *out_error = nullptr;
+        return MLX_SUCCESS;
+    } catch (const mlx_vllm::OutOfMemoryError& e) {
+        *out_error = strdup(e.what());
+        return MLX_ERROR_OUT_OF_MEMORY;
     } catch (const std::exception& e) {
         *out_error = strdup(e.what());
         return MLX_ERROR_COMPUTATION_FAILED;
     }
 }
 
+int MLXDraftNgram(uint64_t cache_handle, const uint32_t* pending_tokens, int num_pending,
+                  int max_ngram, int max_draft, uint32_t* out_draft, int* out_count) {
+    if (num_pending < 0 || (num_pending > 0 && !pending_tokens) || max_ngram <= 0 || max_draft < 0 ||
+        (max_draft > 0 && !out_draft) || !out_count) {
+        return MLX_ERROR_INVALID_TOKENS;
+    }
+    std::vector<uint32_t> context;
+    if (cache_handle != MLX_ROOT_CACHE_HANDLE) {
+        auto cache = mlx_vllm::g_registry.Get(cache_handle);
+        if (!cache) return MLX_ERROR_INVALID_HANDLE;
+        context = cache->GetFullTokenSequence();
+    }
+    context.insert(context.end(), pending_tokens, pending_tokens + num_pending);
+
+    std::vector<uint32_t> draft = mlx_vllm::NgramDraft(context, max_ngram, max_draft);
+    std::copy(draft.begin(), draft.end(), out_draft);
+    *out_count = draft.size();
+    return MLX_SUCCESS;
+}
+
 int MLXSliceCache(uint64_t cache_handle, int keep_tokens, uint64_t* out_sliced_handle, char** out_error) {
     try {
         auto cache = mlx_vllm::g_registry.Get(cache_handle);
         if (!cache) return MLX_ERROR_INVALID_HANDLE;
 
-        auto full_tokens = cache->GetFullTokenSequence();
-        if (keep_tokens < 0 || keep_tokens > (int)full_tokens.size()) return MLX_ERROR_INVALID_TOKENS;
+        if (keep_tokens < 0 || keep_tokens > cache->seq_length) return MLX_ERROR_INVALID_TOKENS;
 
-        std::vector<uint32_t> sliced(full_tokens.begin(), full_tokens.begin() + keep_tokens);
-        auto sliced_cache = std::make_shared<mlx_vllm::KVCache>(0, sliced, cache, keep_tokens, 28);
+        // Block-table truncation: shares the first ceil(keep_tokens / block_size) blocks
+        auto sliced_cache = mlx_vllm::KVCache::Fork(*cache, keep_tokens);
 
         *out_sliced_handle = mlx_vllm::g_registry.Insert(sliced_cache);
         *out_error = nullptr;
         return MLX_SUCCESS;
+    } catch (const mlx_vllm::OutOfMemoryError& e) {
+        *out_error = strdup(e.what());
+        return MLX_ERROR_OUT_OF_MEMORY;
+    } catch (const std::exception& e) {
+        *out_error = strdup(e.what());
+        return MLX_ERROR_COMPUTATION_FAILED;
+    }
+}
+
+int MLXGetMemoryStats(MLXMemoryStats* out_stats) {
+    if (!out_stats) return MLX_ERROR_INVALID_TOKENS;
+    auto model = mlx_vllm::g_models.Get(MLX_DEFAULT_MODEL_HANDLE);
+    if (!model) return MLX_ERROR_MODEL_NOT_LOADED;
+
+    const auto& pool = model->GetKVPool();
+    auto usage = pool->GetUsage();
+    int64_t block_bytes = pool->block_bytes();
+    out_stats->used_bytes = usage.used_blocks * block_bytes;
+    out_stats->budget_bytes = usage.budget_blocks * block_bytes;
+    out_stats->capacity_bytes = usage.num_blocks * block_bytes;
+    out_stats->block_bytes = block_bytes;
+    out_stats->host_bytes = mlx_vllm::g_host_offload_bytes.load();
+    out_stats->disk_bytes = mlx_vllm::g_disk_offload_bytes.load();
+    return MLX_SUCCESS;
+}
+
+int MLXGetCacheBytes(uint64_t cache_handle, int64_t* out_bytes, int64_t* out_exclusive_bytes) {
+    auto cache = mlx_vllm::g_registry.Get(cache_handle);
+    if (!cache) return MLX_ERROR_INVALID_HANDLE;
+
+    std::lock_guard<std::mutex> lock(cache->residency_mutex);
+    int64_t block_bytes = cache->pool->block_bytes();
+    if (out_bytes) *out_bytes = static_cast<int64_t>(cache->block_table.size()) * block_bytes;
+    if (out_exclusive_bytes) *out_exclusive_bytes = cache->pool->ExclusiveBlocks(cache->block_table) * block_bytes;
+    return MLX_SUCCESS;
+}
+
+int MLXSetMemoryBudget(int64_t budget_bytes) {
+    auto model = mlx_vllm::g_models.Get(MLX_DEFAULT_MODEL_HANDLE);
+    if (!model) return MLX_ERROR_MODEL_NOT_LOADED;
+    model->GetKVPool()->SetBudgetBytes(budget_bytes);
+    return MLX_SUCCESS;
+}
+
+int MLXOffloadCache(uint64_t cache_handle, int tier, char** out_error) {
+    if (tier < MLX_CACHE_TIER_HOST || tier > MLX_CACHE_TIER_DISK) return MLX_ERROR_INVALID_TOKENS;
+    try {
+        auto cache = mlx_vllm::g_registry.Get(cache_handle);
+        if (!cache) return MLX_ERROR_INVALID_HANDLE;
+        mlx_vllm::g_offload.Offload(cache, tier);
+        *out_error = nullptr;
+        return MLX_SUCCESS;
+    } catch (const std::exception& e) {
+        *out_error = strdup(e.what());
+        return MLX_ERROR_COMPUTATION_FAILED;
+    }
+}
+
+int MLXPrefetchCache(uint64_t cache_handle) {
+    auto cache = mlx_vllm::g_registry.Get(cache_handle);
+    if (!cache) return MLX_ERROR_INVALID_HANDLE;
+    if (cache->Tier() != MLX_CACHE_TIER_DEVICE) mlx_vllm::g_offload.Prefetch(cache);
+    return MLX_SUCCESS;
+}
+
+int MLXGetCacheTier(uint64_t cache_handle, int* out_tier) {
+    if (!out_tier) return MLX_ERROR_INVALID_TOKENS;
+    auto cache = mlx_vllm::g_registry.Get(cache_handle);
+    if (!cache) return MLX_ERROR_INVALID_HANDLE;
+    *out_tier = cache->Tier();
+    return MLX_SUCCESS;
+}
+
+int MLXSetOffloadConfig(const char* directory, int64_t host_budget_bytes) {
+    mlx_vllm::g_offload.Configure(directory ? directory : "", host_budget_bytes);
+    return MLX_SUCCESS;
+}
+
+int MLXExportCache(uint64_t cache_handle, const char* path, char** out_error) {
+    if (!path) return MLX_ERROR_INVALID_TOKENS;
+    try {
+        // The snapshot records the model the cache's K/V belongs to, which need not be the default
+        auto cache = mlx_vllm::g_registry.Get(cache_handle);
+        if (!cache) return MLX_ERROR_INVALID_HANDLE;
+        cache->WriteSnapshot(path, cache->model);
+        *out_error = nullptr;
+        return MLX_SUCCESS;
+    } catch (const std::exception& e) {
+        *out_error = strdup(e.what());
+        return MLX_ERROR_COMPUTATION_FAILED;
+    }
+}
+
+int MLXImportCache(const char* path, uint64_t* out_cache_handle, char** out_error) {
+    if (!path || !out_cache_handle) return MLX_ERROR_INVALID_TOKENS;
+    try {
+        // Imported into the pool of the loaded model the snapshot was computed with
+        auto model = mlx_vllm::g_models.Find(mlx_vllm::SnapshotFingerprint(path));
+        if (!model) {
+            *out_error = strdup("Model not loaded");
+            return MLX_ERROR_MODEL_NOT_LOADED;
+        }
+        auto cache = mlx_vllm::KVCache::ReadSnapshot(path, model->GetKVPool(), model->GetFingerprint());
+        *out_cache_handle = mlx_vllm::g_registry.Insert(cache);
+        *out_error = nullptr;
+        return MLX_SUCCESS;
+    } catch (const mlx_vllm::OutOfMemoryError& e) {
+        *out_error = strdup(e.what());
+        return MLX_ERROR_OUT_OF_MEMORY;
+    } catch (const std::exception& e) {
+        *out_error = strdup(e.what());
+        return MLX_ERROR_COMPUTATION_FAILED;
+    }
+}
+
+int MLXGetCacheTokens(uint64_t cache_handle, uint32_t* out_tokens, int capacity, int* out_count) {
+    if (!out_count) return MLX_ERROR_INVALID_TOKENS;
+    auto cache = mlx_vllm::g_registry.Get(cache_handle);
+    if (!cache) return MLX_ERROR_INVALID_HANDLE;
+
+    *out_count = cache->seq_length;
+    if (!out_tokens) return MLX_SUCCESS;
+    if (capacity < cache->seq_length) return MLX_ERROR_OUT_OF_MEMORY;
+    memcpy(out_tokens, cache->tokens.data(), cache->tokens.size() * sizeof(uint32_t));
+    return MLX_SUCCESS;
+}
+
+int MLXGetModelFingerprint(uint64_t* out_fingerprint) {
+    if (!out_fingerprint) return MLX_ERROR_INVALID_TOKENS;
+    auto model = mlx_vllm::g_models.Get(MLX_DEFAULT_MODEL_HANDLE);
+    if (!model) return MLX_ERROR_MODEL_NOT_LOADED;
+    *out_fingerprint = model->GetFingerprint();
+    return MLX_SUCCESS;
+}
+
+int MLXSetProfiling(int enabled) {
+    auto model = mlx_vllm::g_models.Get(MLX_DEFAULT_MODEL_HANDLE);
+    if (!model) return MLX_ERROR_MODEL_NOT_LOADED;
+    mlx_vllm::g_profiler.SetEnabled(enabled != 0, model->GetConfig().num_hidden_layers);
+    return MLX_SUCCESS;
+}
+
+int MLXGetProfileStats(MLXProfileStats* out_stats, uint64_t* out_kernel_ns, uint64_t* out_kernel_counts, int capacity) {
+    if (!out_stats) return MLX_ERROR_INVALID_TOKENS;
+    mlx_vllm::g_profiler.Snapshot(out_stats, out_kernel_ns, out_kernel_counts, capacity);
+    return MLX_SUCCESS;
+}
+
+int MLXResetProfileStats(void) {
+    auto model = mlx_vllm::g_models.Get(MLX_DEFAULT_MODEL_HANDLE);
+    if (!model) return MLX_ERROR_MODEL_NOT_LOADED;
+    mlx_vllm::g_profiler.Reset(model->GetConfig().num_hidden_layers);
+    return MLX_SUCCESS;
+}
+
+int MLXBenchmarkKernel(const char* kernel, int rows, int context_tokens, int iterations,
+                       double* out_gpu_ns, char** out_error) {
+    if (!out_error) return MLX_ERROR_INVALID_TOKENS;
+    if (!kernel || !out_gpu_ns) {
+        *out_error = strdup("Kernel name and output pointer are required");
+        return MLX_ERROR_INVALID_TOKENS;
+    }
+    try {
+        auto model = mlx_vllm::g_models.Get(MLX_DEFAULT_MODEL_HANDLE);
+        if (!model) {
+            *out_error = strdup("Model not loaded");
+            return MLX_ERROR_MODEL_NOT_LOADED;
+        }
+
+        *out_gpu_ns = model->benchmark_kernel(kernel, rows, context_tokens, iterations);
+        *out_error = nullptr;
+        return MLX_SUCCESS;
+    } catch (const mlx_vllm::OutOfMemoryError& e) {
+        *out_error = strdup(e.what());
+        return MLX_ERROR_OUT_OF_MEMORY;
     } catch (const std::exception& e) {
         *out_error = strdup(e.what());
         return MLX_ERROR_COMPUTATION_FAILED;
@@ -0,0 +1,1115 @@
+// Metal kernels for the Qwen2-VL engine (mlx_engine.mm)
+//
+// `make engine` compiles this file into a metallib linked into
+// libmlx_runtime.dylib (section __TEXT,__mlx_metallib) and links the source
+// itself as __TEXT,__mlx_kernels, which is compiled at load time instead when
+// the Metal compiler was not available to the build. Pipelines are specialized
+// per model through the function constants below.
+
+#include <metal_stdlib>
+#include <metal_simdgroup_matrix>
+using namespace metal;
+
+// Linear weight storage, specialized per model at pipeline creation
+constant uint WEIGHT_FORMAT [[function_constant(0)]];
+constant uint WEIGHT_GROUP_SIZE [[function_constant(1)]];
+constant uint MLP_ACTIVATION [[function_constant(2)]];
+constant uint ROPE_SECTION_1 [[function_constant(3)]];  // First height frequency (M-RoPE)
+constant uint ROPE_SECTION_2 [[function_constant(4)]];  // First width frequency (M-RoPE)
+constant uint ATTN_HEAD_DIM [[function_constant(5)]];   // Paged attention head_dim; 0 = the argument
+constant uint ATTN_GROUP [[function_constant(6)]];      // Query heads per KV head; 0 = from the arguments
+constant constexpr uint WEIGHT_F16 = 1;
+constant constexpr uint WEIGHT_BF16 = 2;
+constant constexpr uint WEIGHT_Q8 = 3;
+constant constexpr uint WEIGHT_Q4 = 4;
+
+// [N, K] linear weight; quantized formats carry one scale and zero point
+// per WEIGHT_GROUP_SIZE consecutive elements of a row
+struct QuantWeight {
+    const device uchar* data;
+    const device half* scales;
+    const device half* zeros;
+};
+
+inline float bf16_to_float(ushort b) {
+    return as_type<float>(uint(b) << 16);
+}
+
+// Element i (row-major flat index) of W as fp32
+inline float dequant(QuantWeight w, size_t i) {
+    switch (WEIGHT_FORMAT) {
+    case WEIGHT_F16:
+        return float(((const device half*)w.data)[i]);
+    case WEIGHT_BF16:
+        return bf16_to_float(((const device ushort*)w.data)[i]);
+    case WEIGHT_Q8: {
+        size_t g = i / WEIGHT_GROUP_SIZE;
+        return (float(w.data[i]) - float(w.zeros[g])) * float(w.scales[g]);
+    }
+    case WEIGHT_Q4: {
+        size_t g = i / WEIGHT_GROUP_SIZE;
+        uchar b = w.data[i / 2];
+        float q = float((i & 1) ? (b >> 4) : (b & 0xF));
+        return (q - float(w.zeros[g])) * float(w.scales[g]);
+    }
+    default:
+        return ((const device float*)w.data)[i];
+    }
+}
+
+// Elements [i, i + 4) of W as fp32; i is a multiple of 4 inside one group
+inline float4 dequant4(QuantWeight w, size_t i) {
+    switch (WEIGHT_FORMAT) {
+    case WEIGHT_F16:
+        return float4(*(const device half4*)(w.data + i * 2));
+    case WEIGHT_BF16: {
+        ushort4 b = *(const device ushort4*)(w.data + i * 2);
+        return float4(bf16_to_float(b.x), bf16_to_float(b.y), bf16_to_float(b.z), bf16_to_float(b.w));
+    }
+    case WEIGHT_Q8: {
+        size_t g = i / WEIGHT_GROUP_SIZE;
+        float4 q = float4(*(const device uchar4*)(w.data + i));
+        return (q - float(w.zeros[g])) * float(w.scales[g]);
+    }
+    case WEIGHT_Q4: {
+        size_t g = i / WEIGHT_GROUP_SIZE;
+        ushort b = *(const device ushort*)(w.data + i / 2);
+        float4 q = float4(b & 0xF, (b >> 4) & 0xF, (b >> 8) & 0xF, b >> 12);
+        return (q - float(w.zeros[g])) * float(w.scales[g]);
+    }
+    default:
+        return *(const device float4*)(w.data + i * 4);
+    }
+}
+
+// Tiled GEMM: 32x32 output tile per threadgroup of 4 simdgroups (128 threads).
+// Each simdgroup owns a 16x16 quadrant as 2x2 8x8 simdgroup_matrix
+// accumulators; A and B are staged through threadgroup memory GEMM_BK
+// columns of K at a time, zero-padded at the matrix edges.
+constant constexpr uint GEMM_BM = 32;
+constant constexpr uint GEMM_BN = 32;
+constant constexpr uint GEMM_BK = 32;
+constant constexpr uint GEMM_THREADS = 128;
+
+// Rotary embedding applied in a projection's epilogue
+// table: [max_position_embeddings, head_dim / 2] (cos, sin), built at load time
+// positions: [3, rows] temporal/height/width ids; frequency i takes its
+// position from the M-RoPE section it falls in (all equal for text)
+struct RopeArgs {
+    const device float2* table;
+    const device int* positions;
+    uint head_dim;
+    uint rows;
+};
+
+inline float2 rope_cos_sin(RopeArgs rope, uint pair, uint row) {
+    uint half_dim = rope.head_dim / 2;
+    uint i = pair % half_dim;
+    uint section = i < ROPE_SECTION_1 ? 0 : (i < ROPE_SECTION_2 ? 1 : 2);
+    return rope.table[uint(rope.positions[section * rope.rows + row]) * half_dim + i];
+}
+
+// Output column of rotation pair `pair`: (i, i + head_dim / 2) within its head
+inline uint rope_column(RopeArgs rope, uint pair, bool second) {
+    uint half_dim = rope.head_dim / 2;
+    return (pair / half_dim) * rope.head_dim + pair % half_dim + (second ? half_dim : 0);
+}
+
+// B_TRANSPOSED: B is an [N, K] weight in WEIGHT_FORMAT, otherwise fp32 [K, N]
+// ROPE: columns are visited in rotation-pair order (tile column c < 16 and
+// c + 16 hold one pair) so the store can rotate them; needs N % 32 == 0
+template <bool B_TRANSPOSED, bool ROPE = false>
+inline void gemm_tiled(
+    const device float* A, QuantWeight B, device float* C,
+    uint M, uint N, uint K,
+    uint2 tg_pos, uint tid, uint sg,
+    threadgroup float* As, threadgroup float* Bs, RopeArgs rope) {
+    uint row0 = tg_pos.y * GEMM_BM;
+    uint col0 = tg_pos.x * GEMM_BN;
+    uint sg_row = (sg / 2) * 16;
+    uint sg_col = (sg % 2) * 16;
+
+    simdgroup_float8x8 acc[2][2];
+    for (uint i = 0; i < 2; i++)
+        for (uint j = 0; j < 2; j++)
+            acc[i][j] = simdgroup_float8x8(0.0f);
+
+    for (uint k0 = 0; k0 < K; k0 += GEMM_BK) {
+        for (uint i = tid; i < GEMM_BM * GEMM_BK; i += GEMM_THREADS) {
+            uint r = i / GEMM_BK, c = i % GEMM_BK;
+            uint gk = k0 + c;
+            As[i] = (row0 + r < M && gk < K) ? A[(row0 + r) * K + gk] : 0.0f;
+            if (B_TRANSPOSED) {
+                // Bs[n][k]
+                uint n = ROPE ? rope_column(rope, col0 / 2 + r % 16, r >= 16) : col0 + r;
+                Bs[i] = (n < N && gk < K) ? dequant(B, size_t(n) * K + gk) : 0.0f;
+            } else {
+                // Bs[k][n]
+                uint bk = k0 + i / GEMM_BN, bn = col0 + i % GEMM_BN;
+                Bs[i] = (bk < K && bn < N) ? ((const device float*)B.data)[bk * N + bn] : 0.0f;
+            }
+        }
+        threadgroup_barrier(mem_flags::mem_threadgroup);
+
+        for (uint kk = 0; kk < GEMM_BK; kk += 8) {
+            simdgroup_float8x8 a[2], b[2];
+            for (uint i = 0; i < 2; i++)
+                simdgroup_load(a[i], As, GEMM_BK, ulong2(kk, sg_row + i * 8));
+            for (uint j = 0; j < 2; j++) {
+                if (B_TRANSPOSED)
+                    simdgroup_load(b[j], Bs, GEMM_BK, ulong2(kk, sg_col + j * 8), true);
+                else
+                    simdgroup_load(b[j], Bs, GEMM_BN, ulong2(sg_col + j * 8, kk));
+            }
+            for (uint i = 0; i < 2; i++)
+                for (uint j = 0; j < 2; j++)
+                    simdgroup_multiply_accumulate(acc[i][j], a[i], b[j], acc[i][j]);
+        }
+        threadgroup_barrier(mem_flags::mem_threadgroup);
+    }
+
+    // Stage the tile through threadgroup memory for a bounds-checked store
+    threadgroup float* Cs = As;
+    for (uint i = 0; i < 2; i++)
+        for (uint j = 0; j < 2; j++)
+            simdgroup_store(acc[i][j], Cs, GEMM_BN, ulong2(sg_col + j * 8, sg_row + i * 8));
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+
+    if (ROPE) {
+        for (uint i = tid; i < GEMM_BM * 16; i += GEMM_THREADS) {
+            uint r = i / 16, c = i % 16, row = row0 + r;
+            if (row >= M) continue;
+            uint pair = col0 / 2 + c;
+            float x0 = Cs[r * GEMM_BN + c], x1 = Cs[r * GEMM_BN + c + 16];
+            float2 cs = rope_cos_sin(rope, pair, row);
+            C[row * N + rope_column(rope, pair, false)] = x0 * cs.x - x1 * cs.y;
+            C[row * N + rope_column(rope, pair, true)] = x0 * cs.y + x1 * cs.x;
+        }
+        return;
+    }
+    for (uint i = tid; i < GEMM_BM * GEMM_BN; i += GEMM_THREADS) {
+        uint r = row0 + i / GEMM_BN, c = col0 + i % GEMM_BN;
+        if (r < M && c < N) C[r * N + c] = Cs[i];
+    }
+}
+
+// Matrix multiplication kernel: C[M, N] = A[M, K] x B[K, N]
+kernel void matmul_kernel(
+    const device float* A [[buffer(0)]],
+    const device float* B [[buffer(1)]],
+    device float* C [[buffer(2)]],
+    constant uint& M [[buffer(3)]],
+    constant uint& N [[buffer(4)]],
+    constant uint& K [[buffer(5)]],
+    uint2 tg_pos [[threadgroup_position_in_grid]],
+    uint tid [[thread_index_in_threadgroup]],
+    uint sg [[simdgroup_index_in_threadgroup]]) {
+    threadgroup float As[GEMM_BM * GEMM_BK];
+    threadgroup float Bs[GEMM_BK * GEMM_BN];
+    QuantWeight b = {(const device uchar*)B, nullptr, nullptr};
+    RopeArgs no_rope = {nullptr, nullptr, 0, 0};
+    gemm_tiled<false>(A, b, C, M, N, K, tg_pos, tid, sg, As, Bs, no_rope);
+}
+
+// Linear layer GEMM: C[M, N] = A[M, K] x W[N, K]^T
+// W stays in the checkpoint's [out_features, in_features] layout and is
+// dequantized while staging each tile
+kernel void linear_gemm_kernel(
+    const device float* A [[buffer(0)]],
+    const device uchar* W [[buffer(1)]],
+    device float* C [[buffer(2)]],
+    constant uint& M [[buffer(3)]],
+    constant uint& N [[buffer(4)]],
+    constant uint& K [[buffer(5)]],
+    const device half* scales [[buffer(6)]],
+    const device half* zeros [[buffer(7)]],
+    uint2 tg_pos [[threadgroup_position_in_grid]],
+    uint tid [[thread_index_in_threadgroup]],
+    uint sg [[simdgroup_index_in_threadgroup]]) {
+    threadgroup float As[GEMM_BM * GEMM_BK];
+    threadgroup float Ws[GEMM_BN * GEMM_BK];
+    QuantWeight w = {W, scales, zeros};
+    RopeArgs no_rope = {nullptr, nullptr, 0, 0};
+    gemm_tiled<true>(A, w, C, M, N, K, tg_pos, tid, sg, As, Ws, no_rope);
+}
+
+// Q/K projection GEMM with RoPE fused into the store: C = rope(A x W^T)
+// C: [M, heads * head_dim], each row rotated to its own positions
+kernel void linear_rope_gemm_kernel(
+    const device float* A [[buffer(0)]],
+    const device uchar* W [[buffer(1)]],
+    device float* C [[buffer(2)]],
+    constant uint& M [[buffer(3)]],
+    constant uint& N [[buffer(4)]],
+    constant uint& K [[buffer(5)]],
+    const device half* scales [[buffer(6)]],
+    const device half* zeros [[buffer(7)]],
+    const device float2* rope_table [[buffer(8)]],
+    const device int* positions [[buffer(9)]],
+    constant uint& head_dim [[buffer(10)]],
+    uint2 tg_pos [[threadgroup_position_in_grid]],
+    uint tid [[thread_index_in_threadgroup]],
+    uint sg [[simdgroup_index_in_threadgroup]]) {
+    threadgroup float As[GEMM_BM * GEMM_BK];
+    threadgroup float Ws[GEMM_BN * GEMM_BK];
+    QuantWeight w = {W, scales, zeros};
+    RopeArgs rope = {rope_table, positions, head_dim, M};
+    gemm_tiled<true, true>(A, w, C, M, N, K, tg_pos, tid, sg, As, Ws, rope);
+}
+
+// Linear layer GEMV for small M (decode): C[M, N] = A[M, K] x W[N, K]^T
+// One simdgroup per output column n: lanes stride over W's contiguous
+// row with float4 loads, reuse each load for all (<= GEMV_MAX_ROWS)
+// rows of A, and reduce with simd_sum. Weights are dequantized in registers.
+constant constexpr uint GEMV_MAX_ROWS = 8;
+
+kernel void linear_gemv_kernel(
+    const device float* A [[buffer(0)]],
+    const device uchar* W [[buffer(1)]],
+    device float* C [[buffer(2)]],
+    constant uint& M [[buffer(3)]],
+    constant uint& N [[buffer(4)]],
+    constant uint& K [[buffer(5)]],
+    const device half* scales [[buffer(6)]],
+    const device half* zeros [[buffer(7)]],
+    uint tg [[threadgroup_position_in_grid]],
+    uint sg [[simdgroup_index_in_threadgroup]],
+    uint lane [[thread_index_in_simdgroup]],
+    uint sgs_per_tg [[simdgroups_per_threadgroup]]) {
+    uint n = tg * sgs_per_tg + sg;
+    if (n >= N) return;
+
+    float sums[GEMV_MAX_ROWS];
+    for (uint m = 0; m < GEMV_MAX_ROWS; m++) sums[m] = 0.0f;
+
+    QuantWeight w = {W, scales, zeros};
+    size_t row = size_t(n) * K;
+    if (K % 4 == 0) {
+        for (uint k = lane * 4; k < K; k += 128) {
+            float4 wv = dequant4(w, row + k);
+            for (uint m = 0; m < GEMV_MAX_ROWS; m++)
+                if (m < M) sums[m] += dot(wv, *(const device float4*)(A + m * K + k));
+        }
+    } else {
+        for (uint k = lane; k < K; k += 32) {
+            float wv = dequant(w, row + k);
+            for (uint m = 0; m < GEMV_MAX_ROWS; m++)
+                if (m < M) sums[m] += wv * A[m * K + k];
+        }
+    }
+
+    for (uint m = 0; m < GEMV_MAX_ROWS; m++) {
+        if (m >= M) break;
+        float sum = simd_sum(sums[m]);
+        if (lane == 0) C[m * N + n] = sum;
+    }
+}
+
+// Q/K projection GEMV with RoPE fused into the epilogue
+// One simdgroup per rotation pair: both weight rows of the pair are
+// reduced together and rotated before the store
+kernel void linear_rope_gemv_kernel(
+    const device float* A [[buffer(0)]],
+    const device uchar* W [[buffer(1)]],
+    device float* C [[buffer(2)]],
+    constant uint& M [[buffer(3)]],
+    constant uint& N [[buffer(4)]],
+    constant uint& K [[buffer(5)]],
+    const device half* scales [[buffer(6)]],
+    const device half* zeros [[buffer(7)]],
+    const device float2* rope_table [[buffer(8)]],
+    const device int* positions [[buffer(9)]],
+    constant uint& head_dim [[buffer(10)]],
+    uint tg [[threadgroup_position_in_grid]],
+    uint sg [[simdgroup_index_in_threadgroup]],
+    uint lane [[thread_index_in_simdgroup]],
+    uint sgs_per_tg [[simdgroups_per_threadgroup]]) {
+    uint pair = tg * sgs_per_tg + sg;
+    if (pair >= N / 2) return;
+
+    RopeArgs rope = {rope_table, positions, head_dim, M};
+    uint n0 = rope_column(rope, pair, false), n1 = rope_column(rope, pair, true);
+    float sums0[GEMV_MAX_ROWS], sums1[GEMV_MAX_ROWS];
+    for (uint m = 0; m < GEMV_MAX_ROWS; m++) {
+        sums0[m] = 0.0f;
+        sums1[m] = 0.0f;
+    }
+
+    QuantWeight w = {W, scales, zeros};
+    size_t row0 = size_t(n0) * K, row1 = size_t(n1) * K;
+    if (K % 4 == 0) {
+        for (uint k = lane * 4; k < K; k += 128) {
+            float4 w0 = dequant4(w, row0 + k);
+            float4 w1 = dequant4(w, row1 + k);
+            for (uint m = 0; m < GEMV_MAX_ROWS; m++) {
+                if (m >= M) break;
+                float4 av = *(const device float4*)(A + m * K + k);
+                sums0[m] += dot(w0, av);
+                sums1[m] += dot(w1, av);
+            }
+        }
+    } else {
+        for (uint k = lane; k < K; k += 32) {
+            float w0 = dequant(w, row0 + k);
+            float w1 = dequant(w, row1 + k);
+            for (uint m = 0; m < GEMV_MAX_ROWS; m++) {
+                if (m >= M) break;
+                sums0[m] += w0 * A[m * K + k];
+                sums1[m] += w1 * A[m * K + k];
+            }
+        }
+    }
+
+    for (uint m = 0; m < GEMV_MAX_ROWS; m++) {
+        if (m >= M) break;
+        float x0 = simd_sum(sums0[m]);
+        float x1 = simd_sum(sums1[m]);
+        if (lane == 0) {
+            float2 cs = rope_cos_sin(rope, pair, m);
+            C[m * N + n0] = x0 * cs.x - x1 * cs.y;
+            C[m * N + n1] = x0 * cs.y + x1 * cs.x;
+        }
+    }
+}
+
+// MLP gate activation, specialized per model
+constant constexpr uint ACT_GELU = 1;
+
+inline float mlp_act(float x) {
+    switch (MLP_ACTIVATION) {
+    case ACT_GELU:
+        return 0.5f * x * (1.0f + tanh(0.7978845608f * x * (1.0f + 0.044715f * x * x)));
+    default:
+        return x / (1.0f + exp(-x));  // SiLU
+    }
+}
+
+// Fused gated MLP GEMM: C[M, N] = act(A x Wg^T) * (A x Wu^T)
+// Same tiling as gemm_tiled<true>, with one A tile feeding the gate and
+// up accumulators, so neither [M, N] projection is ever written out
+kernel void swiglu_gemm_kernel(
+    const device float* A [[buffer(0)]],
+    const device uchar* Wg [[buffer(1)]],
+    device float* C [[buffer(2)]],
+    constant uint& M [[buffer(3)]],
+    constant uint& N [[buffer(4)]],
+    constant uint& K [[buffer(5)]],
+    const device half* g_scales [[buffer(6)]],
+    const device half* g_zeros [[buffer(7)]],
+    const device uchar* Wu [[buffer(8)]],
+    const device half* u_scales [[buffer(9)]],
+    const device half* u_zeros [[buffer(10)]],
+    uint2 tg_pos [[threadgroup_position_in_grid]],
+    uint tid [[thread_index_in_threadgroup]],
+    uint sg [[simdgroup_index_in_threadgroup]]) {
+    threadgroup float As[GEMM_BM * GEMM_BK];
+    threadgroup float Gs[GEMM_BN * GEMM_BK];
+    threadgroup float Us[GEMM_BN * GEMM_BK];
+    QuantWeight gate = {Wg, g_scales, g_zeros};
+    QuantWeight up = {Wu, u_scales, u_zeros};
+
+    uint row0 = tg_pos.y * GEMM_BM;
+    uint col0 = tg_pos.x * GEMM_BN;
+    uint sg_row = (sg / 2) * 16;
+    uint sg_col = (sg % 2) * 16;
+
+    simdgroup_float8x8 acc_g[2][2], acc_u[2][2];
+    for (uint i = 0; i < 2; i++)
+        for (uint j = 0; j < 2; j++) {
+            acc_g[i][j] = simdgroup_float8x8(0.0f);
+            acc_u[i][j] = simdgroup_float8x8(0.0f);
+        }
+
+    for (uint k0 = 0; k0 < K; k0 += GEMM_BK) {
+        for (uint i = tid; i < GEMM_BM * GEMM_BK; i += GEMM_THREADS) {
+            uint r = i / GEMM_BK, c = i % GEMM_BK;
+            uint gk = k0 + c;
+            As[i] = (row0 + r < M && gk < K) ? A[(row0 + r) * K + gk] : 0.0f;
+            bool in_bounds = col0 + r < N && gk < K;
+            size_t w_idx = size_t(col0 + r) * K + gk;
+            Gs[i] = in_bounds ? dequant(gate, w_idx) : 0.0f;
+            Us[i] = in_bounds ? dequant(up, w_idx) : 0.0f;
+        }
+        threadgroup_barrier(mem_flags::mem_threadgroup);
+
+        for (uint kk = 0; kk < GEMM_BK; kk += 8) {
+            simdgroup_float8x8 a[2], g[2], u[2];
+            for (uint i = 0; i < 2; i++)
+                simdgroup_load(a[i], As, GEMM_BK, ulong2(kk, sg_row + i * 8));
+            for (uint j = 0; j < 2; j++) {
+                simdgroup_load(g[j], Gs, GEMM_BK, ulong2(kk, sg_col + j * 8), true);
+                simdgroup_load(u[j], Us, GEMM_BK, ulong2(kk, sg_col + j * 8), true);
+            }
+            for (uint i = 0; i < 2; i++)
+                for (uint j = 0; j < 2; j++) {
+                    simdgroup_multiply_accumulate(acc_g[i][j], a[i], g[j], acc_g[i][j]);
+                    simdgroup_multiply_accumulate(acc_u[i][j], a[i], u[j], acc_u[i][j]);
+                }
+        }
+        threadgroup_barrier(mem_flags::mem_threadgroup);
+    }
+
+    // Stage both tiles, then apply the gate in the bounds-checked store
+    for (uint i = 0; i < 2; i++)
+        for (uint j = 0; j < 2; j++) {
+            simdgroup_store(acc_g[i][j], Gs, GEMM_BN, ulong2(sg_col + j * 8, sg_row + i * 8));
+            simdgroup_store(acc_u[i][j], Us, GEMM_BN, ulong2(sg_col + j * 8, sg_row + i * 8));
+        }
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+
+    for (uint i = tid; i < GEMM_BM * GEMM_BN; i += GEMM_THREADS) {
+        uint r = row0 + i / GEMM_BN, c = col0 + i % GEMM_BN;
+        if (r < M && c < N) C[r * N + c] = mlp_act(Gs[i]) * Us[i];
+    }
+}
+
+// Fused gated MLP GEMV for small M, laid out like linear_gemv_kernel
+kernel void swiglu_gemv_kernel(
+    const device float* A [[buffer(0)]],
+    const device uchar* Wg [[buffer(1)]],
+    device float* C [[buffer(2)]],
+    constant uint& M [[buffer(3)]],
+    constant uint& N [[buffer(4)]],
+    constant uint& K [[buffer(5)]],
+    const device half* g_scales [[buffer(6)]],
+    const device half* g_zeros [[buffer(7)]],
+    const device uchar* Wu [[buffer(8)]],
+    const device half* u_scales [[buffer(9)]],
+    const device half* u_zeros [[buffer(10)]],
+    uint tg [[threadgroup_position_in_grid]],
+    uint sg [[simdgroup_index_in_threadgroup]],
+    uint lane [[thread_index_in_simdgroup]],
+    uint sgs_per_tg [[simdgroups_per_threadgroup]]) {
+    uint n = tg * sgs_per_tg + sg;
+    if (n >= N) return;
+
+    float sums_g[GEMV_MAX_ROWS], sums_u[GEMV_MAX_ROWS];
+    for (uint m = 0; m < GEMV_MAX_ROWS; m++) {
+        sums_g[m] = 0.0f;
+        sums_u[m] = 0.0f;
+    }
+
+    QuantWeight gate = {Wg, g_scales, g_zeros};
+    QuantWeight up = {Wu, u_scales, u_zeros};
+    size_t row = size_t(n) * K;
+    if (K % 4 == 0) {
+        for (uint k = lane * 4; k < K; k += 128) {
+            float4 gv = dequant4(gate, row + k);
+            float4 uv = dequant4(up, row + k);
+            for (uint m = 0; m < GEMV_MAX_ROWS; m++) {
+                if (m >= M) break;
+                float4 av = *(const device float4*)(A + m * K + k);
+                sums_g[m] += dot(gv, av);
+                sums_u[m] += dot(uv, av);
+            }
+        }
+    } else {
+        for (uint k = lane; k < K; k += 32) {
+            float gv = dequant(gate, row + k);
+            float uv = dequant(up, row + k);
+            for (uint m = 0; m < GEMV_MAX_ROWS; m++) {
+                if (m >= M) break;
+                sums_g[m] += gv * A[m * K + k];
+                sums_u[m] += uv * A[m * K + k];
+            }
+        }
+    }
+
+    for (uint m = 0; m < GEMV_MAX_ROWS; m++) {
+        if (m >= M) break;
+        float g = simd_sum(sums_g[m]);
+        float u = simd_sum(sums_u[m]);
+        if (lane == 0) C[m * N + n] = mlp_act(g) * u;
+    }
+}
+
+// Threadgroup-wide reductions; every thread gets the result
+// scratch holds one value per simdgroup (<= 32)
+inline float tg_max(float v, threadgroup float* scratch, uint lane, uint sg, uint num_sgs) {
+    v = simd_max(v);
+    if (lane == 0) scratch[sg] = v;
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+    v = simd_max(lane < num_sgs ? scratch[lane] : -INFINITY);
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+    return v;
+}
+
+inline float tg_sum(float v, threadgroup float* scratch, uint lane, uint sg, uint num_sgs) {
+    v = simd_sum(v);
+    if (lane == 0) scratch[sg] = v;
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+    v = simd_sum(lane < num_sgs ? scratch[lane] : 0.0f);
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+    return v;
+}
+
+// RMSNorm: y = x / sqrt(mean(x^2) + eps) * weight
+// One threadgroup per output row; output row r normalizes input row row_ids[r]
+kernel void rmsnorm_kernel(
+    const device float* x [[buffer(0)]],
+    const device float* weight [[buffer(1)]],
+    device float* y [[buffer(2)]],
+    constant uint& size [[buffer(3)]],
+    constant float& eps [[buffer(4)]],
+    const device int* row_ids [[buffer(5)]],
+    uint row [[threadgroup_position_in_grid]],
+    uint tid [[thread_index_in_threadgroup]],
+    uint threads [[threads_per_threadgroup]],
+    uint lane [[thread_index_in_simdgroup]],
+    uint sg [[simdgroup_index_in_threadgroup]]) {
+    threadgroup float scratch[32];
+    const device float* x_row = x + uint(row_ids[row]) * size;
+    device float* y_row = y + row * size;
+
+    float sum_sq = 0.0f;
+    for (uint i = tid; i < size; i += threads) sum_sq += x_row[i] * x_row[i];
+    sum_sq = tg_sum(sum_sq, scratch, lane, sg, (threads + 31) / 32);
+
+    float rsqrt_var = rsqrt(sum_sq / float(size) + eps);
+    for (uint i = tid; i < size; i += threads) y_row[i] = x_row[i] * rsqrt_var * weight[i];
+}
+
+// Residual add fused with the following RMSNorm, one threadgroup per row:
+// h = x + residual; y = rmsnorm(h) * weight
+kernel void add_rmsnorm_kernel(
+    const device float* x [[buffer(0)]],
+    const device float* residual [[buffer(1)]],
+    const device float* weight [[buffer(2)]],
+    device float* h [[buffer(3)]],
+    device float* y [[buffer(4)]],
+    constant uint& size [[buffer(5)]],
+    constant float& eps [[buffer(6)]],
+    uint row [[threadgroup_position_in_grid]],
+    uint tid [[thread_index_in_threadgroup]],
+    uint threads [[threads_per_threadgroup]],
+    uint lane [[thread_index_in_simdgroup]],
+    uint sg [[simdgroup_index_in_threadgroup]]) {
+    threadgroup float scratch[32];
+    uint offset = row * size;
+
+    float sum_sq = 0.0f;
+    for (uint i = tid; i < size; i += threads) {
+        float v = x[offset + i] + residual[offset + i];
+        h[offset + i] = v;
+        sum_sq += v * v;
+    }
+    sum_sq = tg_sum(sum_sq, scratch, lane, sg, (threads + 31) / 32);
+
+    // Each thread re-reads only the elements it wrote
+    float rsqrt_var = rsqrt(sum_sq / float(size) + eps);
+    for (uint i = tid; i < size; i += threads) y[offset + i] = h[offset + i] * rsqrt_var * weight[i];
+}
+
+// LayerNorm (vision tower): y = (x - mean) / sqrt(var + eps) * weight + bias
+// One threadgroup per row
+kernel void layernorm_kernel(
+    const device float* x [[buffer(0)]],
+    const device float* weight [[buffer(1)]],
+    const device float* bias [[buffer(2)]],
+    device float* y [[buffer(3)]],
+    constant uint& size [[buffer(4)]],
+    constant float& eps [[buffer(5)]],
+    uint row [[threadgroup_position_in_grid]],
+    uint tid [[thread_index_in_threadgroup]],
+    uint threads [[threads_per_threadgroup]],
+    uint lane [[thread_index_in_simdgroup]],
+    uint sg [[simdgroup_index_in_threadgroup]]) {
+    threadgroup float scratch[32];
+    const device float* x_row = x + row * size;
+    device float* y_row = y + row * size;
+    uint num_sgs = (threads + 31) / 32;
+
+    float sum = 0.0f;
+    for (uint i = tid; i < size; i += threads) sum += x_row[i];
+    float mean = tg_sum(sum, scratch, lane, sg, num_sgs) / float(size);
+
+    float sum_sq = 0.0f;
+    for (uint i = tid; i < size; i += threads) {
+        float d = x_row[i] - mean;
+        sum_sq += d * d;
+    }
+    float rstd = rsqrt(tg_sum(sum_sq, scratch, lane, sg, num_sgs) / float(size) + eps);
+    for (uint i = tid; i < size; i += threads) y_row[i] = (x_row[i] - mean) * rstd * weight[i] + bias[i];
+}
+
+// Bias add and activation in place on a [rows, cols] projection output
+// act: 0 none, 1 quick_gelu (x * sigmoid(1.702x)), 2 GeLU (tanh approximation)
+kernel void bias_act_kernel(
+    device float* x [[buffer(0)]],
+    const device float* bias [[buffer(1)]],
+    constant uint& cols [[buffer(2)]],
+    constant uint& act [[buffer(3)]],
+    constant uint& size [[buffer(4)]],
+    uint gid [[thread_position_in_grid]]) {
+    if (gid >= size) return;
+    float v = x[gid] + bias[gid % cols];
+    if (act == 1) {
+        v = v / (1.0f + exp(-1.702f * v));
+    } else if (act == 2) {
+        v = 0.5f * v * (1.0f + tanh(0.7978845608f * v * (1.0f + 0.044715f * v * v)));
+    }
+    x[gid] = v;
+}
+
+// Dense bidirectional attention of the pointer head over image tokens
+// qkv: [rows, 3 * heads * head_dim] packed q | k | v projections
+// One simdgroup per (head, row), online softmax over all rows; K/V are
+// read straight from device memory since head_dim may exceed
+// ATTN_MAX_HEAD_DIM
+constant constexpr uint DENSE_MAX_HEAD_DIM = 512;
+constant constexpr uint DENSE_DIMS_PER_LANE = DENSE_MAX_HEAD_DIM / 32;
+
+kernel void dense_attention_kernel(
+    const device float* qkv [[buffer(0)]],
+    device float* out [[buffer(1)]],
+    constant uint& rows [[buffer(2)]],
+    constant uint& heads [[buffer(3)]],
+    constant uint& head_dim [[buffer(4)]],
+    constant float& scale [[buffer(5)]],
+    uint2 tg_pos [[threadgroup_position_in_grid]],
+    uint lane [[thread_index_in_simdgroup]]) {
+    uint head = tg_pos.x, row = tg_pos.y;
+    uint dim = heads * head_dim, stride = 3 * dim;
+    const device float* q_row = qkv + row * stride + head * head_dim;
+    float qv[DENSE_DIMS_PER_LANE], acc[DENSE_DIMS_PER_LANE];
+    for (uint i = 0; i < DENSE_DIMS_PER_LANE; i++) {
+        uint d = lane + i * 32;
+        qv[i] = d < head_dim ? q_row[d] * scale : 0.0f;
+        acc[i] = 0.0f;
+    }
+    float max_score = -INFINITY;
+    float sum_exp = 0.0f;
+
+    for (uint j = 0; j < rows; j++) {
+        const device float* k_row = qkv + j * stride + dim + head * head_dim;
+        const device float* v_row = k_row + dim;
+        float partial = 0.0f;
+        for (uint i = 0; i < DENSE_DIMS_PER_LANE; i++) {
+            uint d = lane + i * 32;
+            if (d < head_dim) partial += qv[i] * k_row[d];
+        }
+        float score = simd_sum(partial);
+
+        float new_max = max(max_score, score);
+        float correction = exp(max_score - new_max);
+        float p = exp(score - new_max);
+        sum_exp = sum_exp * correction + p;
+        for (uint i = 0; i < DENSE_DIMS_PER_LANE; i++) {
+            uint d = lane + i * 32;
+            if (d < head_dim) acc[i] = acc[i] * correction + p * v_row[d];
+        }
+        max_score = new_max;
+    }
+
+    device float* out_row = out + (row * heads + head) * head_dim;
+    for (uint i = 0; i < DENSE_DIMS_PER_LANE; i++) {
+        uint d = lane + i * 32;
+        if (d < head_dim) out_row[d] = acc[i] / sum_exp;
+    }
+}
+
+// Pointer logits: scores[j] = dot(query, keys[j]) * scale, one simdgroup per key row
+kernel void pointer_scores_kernel(
+    const device float* query [[buffer(0)]],
+    const device float* keys [[buffer(1)]],
+    device float* scores [[buffer(2)]],
+    constant uint& rows [[buffer(3)]],
+    constant uint& size [[buffer(4)]],
+    constant float& scale [[buffer(5)]],
+    uint tg [[threadgroup_position_in_grid]],
+    uint sg [[simdgroup_index_in_threadgroup]],
+    uint num_sgs [[simdgroups_per_threadgroup]],
+    uint lane [[thread_index_in_simdgroup]]) {
+    uint j = tg * num_sgs + sg;
+    if (j >= rows) return;
+    const device float* key = keys + j * size;
+    float partial = 0.0f;
+    for (uint i = lane; i < size; i += 32) partial += query[i] * key[i];
+    partial = simd_sum(partial);
+    if (lane == 0) scores[j] = partial * scale;
+}
+
+// 2D rotary embedding of the vision tower, in place on [rows, heads * head_dim]
+// Pair i of a head rotates (i, i + head_dim / 2); the first half of the
+// pairs take their angle from the patch row, the second half from the
+// patch column, each with its own head_dim / 4 frequencies.
+// positions: [2, rows] patch row/column ids
+kernel void vision_rope_kernel(
+    device float* x [[buffer(0)]],
+    const device int* positions [[buffer(1)]],
+    constant uint& rows [[buffer(2)]],
+    constant uint& heads [[buffer(3)]],
+    constant uint& head_dim [[buffer(4)]],
+    constant float& theta [[buffer(5)]],
+    uint2 gid [[thread_position_in_grid]]) {
+    uint half_dim = head_dim / 2;
+    uint quarter = half_dim / 2;
+    uint row = gid.y;
+    if (gid.x >= heads * half_dim || row >= rows) return;
+    uint head = gid.x / half_dim, i = gid.x % half_dim;
+    float pos = float(positions[(i < quarter ? 0 : rows) + row]);
+    float angle = pos * pow(theta, -float(2 * (i % quarter)) / float(half_dim));
+    float c = cos(angle), s = sin(angle);
+    device float* x_head = x + row * heads * head_dim + head * head_dim;
+    float x0 = x_head[i], x1 = x_head[i + half_dim];
+    x_head[i] = x0 * c - x1 * s;
+    x_head[i + half_dim] = x0 * s + x1 * c;
+}
+
+// Transpose kernel for matrix operations
+kernel void transpose_kernel(
+    const device float* A [[buffer(0)]],
+    device float* B [[buffer(1)]],
+    constant uint& M [[buffer(2)]],
+    constant uint& N [[buffer(3)]],
+    uint2 gid [[thread_position_in_grid]]) {
+    uint m = gid.x, n = gid.y;
+    if (m >= M || n >= N) return;
+    B[n * M + m] = A[m * N + n];
+}
+
+// Scale kernel
+kernel void scale_kernel(
+    const device float* x [[buffer(0)]],
+    device float* y [[buffer(1)]],
+    constant float& scale [[buffer(2)]],
+    uint gid [[thread_position_in_grid]]) {
+    y[gid] = x[gid] * scale;
+}
+
+// Element-wise add kernel
+kernel void add_kernel(
+    const device float* a [[buffer(0)]],
+    const device float* b [[buffer(1)]],
+    device float* c [[buffer(2)]],
+    constant uint& size [[buffer(3)]],
+    uint gid [[thread_position_in_grid]]) {
+    if (gid >= size) return;
+    c[gid] = a[gid] + b[gid];
+}
+
+// Element-wise multiply kernel
+kernel void mul_kernel(
+    const device float* a [[buffer(0)]],
+    const device float* b [[buffer(1)]],
+    device float* c [[buffer(2)]],
+    constant uint& size [[buffer(3)]],
+    uint gid [[thread_position_in_grid]]) {
+    if (gid >= size) return;
+    c[gid] = a[gid] * b[gid];
+}
+
+// KV write kernel: scatters new K/V rows [rows, kv_dim] into their paged slots
+kernel void kv_write_kernel(
+    const device float* k [[buffer(0)]],
+    const device float* v [[buffer(1)]],
+    device float* k_slab [[buffer(2)]],
+    device float* v_slab [[buffer(3)]],
+    const device int* slots [[buffer(4)]],
+    constant uint& rows [[buffer(5)]],
+    constant uint& kv_dim [[buffer(6)]],
+    uint2 gid [[thread_position_in_grid]]) {
+    uint i = gid.x, row = gid.y;
+    if (i >= kv_dim || row >= rows) return;
+    uint dst = uint(slots[row]) * kv_dim + i;
+    k_slab[dst] = k[row * kv_dim + i];
+    v_slab[dst] = v[row * kv_dim + i];
+}
+
+// Paged flash attention: out = softmax(Q x K^T * scale, causal) x V
+// One threadgroup per (kv_head, query row) with one simdgroup per query
+// head sharing that KV head (GQA), so each K/V tile is staged into
+// threadgroup memory once for the whole group. Keys are streamed through
+// the block table with an online softmax; scores are never materialized.
+// Rows are ragged: row r attends to keys [0, positions[r]] of the
+// sequence whose block table starts at block_tables[table_offsets[r]].
+// q, out: [rows, num_heads, head_dim]; head_dim <= ATTN_MAX_HEAD_DIM
+// The language model's pipeline has head_dim and the GQA group folded
+// in as function constants (ATTN_HEAD_DIM, ATTN_GROUP), so the
+// per-lane dim loops lose their bounds checks and the tile staging
+// divides by a constant; the vision tower's pipeline takes both from
+// the arguments.
+constant constexpr uint ATTN_MAX_HEAD_DIM = 128;
+constant constexpr uint ATTN_DIMS_PER_LANE = ATTN_MAX_HEAD_DIM / 32;
+constant constexpr uint ATTN_TILE_KEYS = 16;
+
+kernel void paged_attention_kernel(
+    const device float* q [[buffer(0)]],
+    const device float* k_slab [[buffer(1)]],
+    const device float* v_slab [[buffer(2)]],
+    const device int* block_tables [[buffer(3)]],
+    const device int* table_offsets [[buffer(4)]],
+    const device int* positions [[buffer(5)]],
+    device float* out [[buffer(6)]],
+    constant uint& num_heads [[buffer(7)]],
+    constant uint& num_kv_heads [[buffer(8)]],
+    constant uint& head_dim_arg [[buffer(9)]],
+    constant uint& block_size [[buffer(10)]],
+    constant float& scale [[buffer(11)]],
+    uint2 tg_pos [[threadgroup_position_in_grid]],
+    uint tid [[thread_index_in_threadgroup]],
+    uint threads [[threads_per_threadgroup]],
+    uint sg [[simdgroup_index_in_threadgroup]],
+    uint lane [[thread_index_in_simdgroup]]) {
+    threadgroup float Ks[ATTN_TILE_KEYS * ATTN_MAX_HEAD_DIM];
+    threadgroup float Vs[ATTN_TILE_KEYS * ATTN_MAX_HEAD_DIM];
+
+    uint head_dim = ATTN_HEAD_DIM ? ATTN_HEAD_DIM : head_dim_arg;
+    uint group = ATTN_GROUP ? ATTN_GROUP : num_heads / num_kv_heads;
+    uint kv_head = tg_pos.x, row = tg_pos.y;
+    uint head = kv_head * group + sg;
+    uint kv_dim = num_kv_heads * head_dim;
+    uint ctx_len = uint(positions[row]) + 1;
+    const device int* block_table = block_tables + table_offsets[row];
+
+    // Each lane owns dims lane, lane + 32, ... of its head
+    const device float* q_row = q + (row * num_heads + head) * head_dim;
+    float qv[ATTN_DIMS_PER_LANE], acc[ATTN_DIMS_PER_LANE];
+    for (uint i = 0; i < ATTN_DIMS_PER_LANE; i++) {
+        uint d = lane + i * 32;
+        qv[i] = d < head_dim ? q_row[d] * scale : 0.0f;
+        acc[i] = 0.0f;
+    }
+    float max_score = -INFINITY;
+    float sum_exp = 0.0f;
+
+    for (uint t0 = 0; t0 < ctx_len; t0 += ATTN_TILE_KEYS) {
+        uint tile = min(ATTN_TILE_KEYS, ctx_len - t0);
+        for (uint i = tid; i < tile * head_dim; i += threads) {
+            uint j = i / head_dim, d = i % head_dim;
+            uint pos = t0 + j;
+            uint slot = uint(block_table[pos / block_size]) * block_size + pos % block_size;
+            uint src = slot * kv_dim + kv_head * head_dim + d;
+            Ks[j * head_dim + d] = k_slab[src];
+            Vs[j * head_dim + d] = v_slab[src];
+        }
+        threadgroup_barrier(mem_flags::mem_threadgroup);
+
+        for (uint j = 0; j < tile; j++) {
+            float partial = 0.0f;
+            for (uint i = 0; i < ATTN_DIMS_PER_LANE; i++) {
+                uint d = lane + i * 32;
+                if (d < head_dim) partial += qv[i] * Ks[j * head_dim + d];
+            }
+            float score = simd_sum(partial);
+
+            float new_max = max(max_score, score);
+            float correction = exp(max_score - new_max);
+            float p = exp(score - new_max);
+            sum_exp = sum_exp * correction + p;
+            for (uint i = 0; i < ATTN_DIMS_PER_LANE; i++) {
+                uint d = lane + i * 32;
+                if (d < head_dim) acc[i] = acc[i] * correction + p * Vs[j * head_dim + d];
+            }
+            max_score = new_max;
+        }
+        threadgroup_barrier(mem_flags::mem_threadgroup);
+    }
+
+    device float* out_row = out + (row * num_heads + head) * head_dim;
+    for (uint i = 0; i < ATTN_DIMS_PER_LANE; i++) {
+        uint d = lane + i * 32;
+        if (d < head_dim) out_row[d] = acc[i] / sum_exp;
+    }
+}
+
+// Sparse logit bias for constrained decoding: logits[ids[i]] += values[i]
+// ids must be unique; -INFINITY bans a token
+kernel void logit_bias_kernel(
+    device float* logits [[buffer(0)]],
+    const device uint* ids [[buffer(1)]],
+    const device float* values [[buffer(2)]],
+    constant uint& count [[buffer(3)]],
+    constant uint& vocab [[buffer(4)]],
+    uint gid [[thread_position_in_grid]]) {
+    if (gid >= count || ids[gid] >= vocab) return;
+    logits[ids[gid]] += values[gid];
+}
+
+// On-device sampling, one threadgroup per logits row
+//
+// 1. max / log-sum-exp over the vocabulary (for logprobs and nucleus mass)
+// 2. radix select of the C-th largest logit (four 8-bit passes over
+//    order-preserving keys) and a rank sort of the C candidates
+// 3. greedy, Gumbel-max over the full vocabulary (no top-k/top-p, exact),
+//    or top-k/top-p sampling among the sorted candidates
+// Only the token id and the top num_logprobs (id, logprob) pairs leave the GPU.
+constant constexpr uint SAMPLE_MAX_CANDIDATES = 256;
+
+struct SamplingParams {
+    float temperature;
+    int top_k;
+    float top_p;
+    uint seed_lo;
+    uint seed_hi;
+    uint num_logprobs;
+    uint position;  // Sequence position of row 0; keys the noise with the seed
+};
+
+inline uint pcg_hash(uint x) {
+    uint state = x * 747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+// Uniform in (0, 1) for (seed, sequence position of the row, index)
+inline float uniform01(constant SamplingParams& params, uint row, uint index) {
+    uint h = pcg_hash(index ^ pcg_hash(params.seed_lo ^ pcg_hash(params.seed_hi ^ pcg_hash(params.position + row))));
+    return (float(h >> 9) + 0.5f) * (1.0f / 8388608.0f);
+}
+
+// Monotonic float -> uint mapping so unsigned compares order floats
+inline uint order_key(float f) {
+    uint b = as_type<uint>(f);
+    return (b & 0x80000000u) ? ~b : (b | 0x80000000u);
+}
+
+kernel void sample_kernel(
+    const device float* logits [[buffer(0)]],
+    device uint* out_tokens [[buffer(1)]],
+    device uint* out_top_ids [[buffer(2)]],
+    device float* out_top_logprobs [[buffer(3)]],
+    constant uint& vocab [[buffer(4)]],
+    constant uint& num_candidates [[buffer(5)]],
+    constant SamplingParams& params [[buffer(6)]],
+    uint row [[threadgroup_position_in_grid]],
+    uint tid [[thread_index_in_threadgroup]],
+    uint threads [[threads_per_threadgroup]],
+    uint lane [[thread_index_in_simdgroup]],
+    uint sg [[simdgroup_index_in_threadgroup]]) {
+    threadgroup float scratch[32];
+    threadgroup uint scratch_ids[32];
+    threadgroup atomic_uint hist[256];
+    threadgroup uint sel_prefix, sel_remaining;
+    threadgroup atomic_uint count_gt, count_eq;
+    threadgroup uint cand_ids[SAMPLE_MAX_CANDIDATES], sorted_ids[SAMPLE_MAX_CANDIDATES];
+    threadgroup float cand_vals[SAMPLE_MAX_CANDIDATES], sorted_vals[SAMPLE_MAX_CANDIDATES];
+
+    const device float* x = logits + row * vocab;
+    uint num_sgs = (threads + 31) / 32;
+    float temperature = params.temperature;
+    uint C = num_candidates;
+
+    // 1. Normalizers
+    float local_max = -INFINITY;
+    for (uint i = tid; i < vocab; i += threads) local_max = max(local_max, x[i]);
+    float max_logit = tg_max(local_max, scratch, lane, sg, num_sgs);
+
+    float local_z = 0.0f, local_zt = 0.0f;
+    for (uint i = tid; i < vocab; i += threads) {
+        local_z += exp(x[i] - max_logit);
+        if (temperature > 0.0f) local_zt += exp((x[i] - max_logit) / temperature);
+    }
+    float log_z = log(tg_sum(local_z, scratch, lane, sg, num_sgs));
+    float z_t = tg_sum(local_zt, scratch, lane, sg, num_sgs);
+
+    // 2. Radix select the C-th largest key, then gather and sort the candidates
+    if (tid == 0) sel_remaining = C;
+    uint prefix = 0, mask = 0;
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        for (uint i = tid; i < 256; i += threads) atomic_store_explicit(&hist[i], 0, memory_order_relaxed);
+        threadgroup_barrier(mem_flags::mem_threadgroup);
+        for (uint i = tid; i < vocab; i += threads) {
+            uint k = order_key(x[i]);
+            if ((k & mask) == prefix) atomic_fetch_add_explicit(&hist[(k >> shift) & 0xFF], 1, memory_order_relaxed);
+        }
+        threadgroup_barrier(mem_flags::mem_threadgroup);
+        if (tid == 0) {
+            uint remaining = sel_remaining;
+            uint bin = 255;
+            for (; bin > 0; bin--) {
+                uint c = atomic_load_explicit(&hist[bin], memory_order_relaxed);
+                if (c >= remaining) break;
+                remaining -= c;
+            }
+            sel_remaining = remaining;
+            sel_prefix = prefix | (bin << shift);
+        }
+        threadgroup_barrier(mem_flags::mem_threadgroup);
+        prefix = sel_prefix;
+        mask |= 0xFFu << shift;
+    }
+
+    uint threshold = prefix;
+    uint ties = sel_remaining;
+    uint above = C - ties;
+    if (tid == 0) {
+        atomic_store_explicit(&count_gt, 0, memory_order_relaxed);
+        atomic_store_explicit(&count_eq, 0, memory_order_relaxed);
+    }
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+    for (uint i = tid; i < vocab; i += threads) {
+        uint k = order_key(x[i]);
+        if (k > threshold) {
+            uint slot = atomic_fetch_add_explicit(&count_gt, 1, memory_order_relaxed);
+            cand_ids[slot] = i;
+            cand_vals[slot] = x[i];
+        } else if (k == threshold) {
+            uint slot = atomic_fetch_add_explicit(&count_eq, 1, memory_order_relaxed);
+            if (slot < ties) {
+                cand_ids[above + slot] = i;
+                cand_vals[above + slot] = x[i];
+            }
+        }
+    }
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+
+    // Descending by logit, ascending id among equals
+    for (uint i = tid; i < C; i += threads) {
+        float v = cand_vals[i];
+        uint id = cand_ids[i];
+        uint rank = 0;
+        for (uint j = 0; j < C; j++) {
+            float w = cand_vals[j];
+            rank += (w > v || (w == v && cand_ids[j] < id)) ? 1 : 0;
+        }
+        sorted_ids[rank] = id;
+        sorted_vals[rank] = v;
+    }
+    threadgroup_barrier(mem_flags::mem_threadgroup);
+
+    // 3. Pick the token
+    bool full_vocab = temperature > 0.0f && params.top_k <= 0 && params.top_p >= 1.0f;
+    if (full_vocab) {
+        // Gumbel-max: argmax(x / T + G) is an exact sample from softmax(x / T)
+        float best = -INFINITY;
+        uint best_id = 0;
+        for (uint i = tid; i < vocab; i += threads) {
+            float g = x[i] / temperature - log(-log(uniform01(params, row, i)));
+            if (g > best) { best = g; best_id = i; }
+        }
+        float winner = tg_max(best, scratch, lane, sg, num_sgs);
+        uint id = simd_min(best == winner ? best_id : 0xFFFFFFFFu);
+        if (lane == 0) scratch_ids[sg] = id;
+        threadgroup_barrier(mem_flags::mem_threadgroup);
+        id = simd_min(lane < num_sgs ? scratch_ids[lane] : 0xFFFFFFFFu);
+        if (tid == 0) out_tokens[row] = id;
+    } else if (tid == 0) {
+        uint token = sorted_ids[0];
+        if (temperature > 0.0f) {
+            uint k_eff = params.top_k > 0 ? min(uint(params.top_k), C) : C;
+            // Nucleus over full-vocabulary probabilities, truncated to the candidates
+            uint n = 0;
+            float mass = 0.0f;
+            while (n < k_eff) {
+                mass += exp((sorted_vals[n] - max_logit) / temperature) / z_t;
+                n++;
+                if (mass >= params.top_p) break;
+            }
+            float u = uniform01(params, row, 0xFFFFFFFFu) * mass;
+            float acc = 0.0f;
+            token = sorted_ids[n - 1];
+            for (uint i = 0; i < n; i++) {
+                acc += exp((sorted_vals[i] - max_logit) / temperature) / z_t;
+                if (u < acc) { token = sorted_ids[i]; break; }
+            }
+        }
+        out_tokens[row] = token;
+    }
+
+    uint num_logprobs = min(params.num_logprobs, C);
+    for (uint i = tid; i < num_logprobs; i += threads) {
+        out_top_ids[row * params.num_logprobs + i] = sorted_ids[i];
+        out_top_logprobs[row * params.num_logprobs + i] = sorted_vals[i] - max_logit - log_z;
+    }
+}
@@ -2,50 +2,84 @@
 
 package mlx
 
+import (
+	"fmt"
+	"io"
+)
+
 // RealMLXEngine implements radix.MLXEngine using actual MLX inference
 type RealMLXEngine struct {
 	loaded    bool
+	model     uintptr // Handle from LoadModelHandle; several engines can be resident at once
 	vocabSize int
 	modelPath string
+	options   LoadOptions
 }
 
 // NewRealMLXEngine creates a new MLX engine instance
 // Note: Model is not loaded until LoadModel() is called
 func NewRealMLXEngine(modelPath string, vocabSize int) *RealMLXEngine {
+	return NewRealMLXEngineWithOptions(modelPath, vocabSize, DefaultLoadOptions())
+}
+
+// NewRealMLXEngineWithOptions creates an engine that loads weights in opts.WeightFormat
+func NewRealMLXEngineWithOptions(modelPath string, vocabSize int, opts LoadOptions) *RealMLXEngine {
 	return &RealMLXEngine{
 		modelPath: modelPath,
 		vocabSize: vocabSize,
 		loaded:    false,
+		options:   opts,
 	}
 }
 
 // LoadModel loads the model weights via CGO bridge
 // This must be called before ForwardWithCache
-// Thread-safe: uses global C++ model state
+// The model gets its own handle, so engines for a draft and a target model
+// (or several checkpoints) can serve from one process
 func (e *RealMLXEngine) LoadModel() error {
 	if e.loaded {
 		return nil // Already loaded
 	}
 
-	if err := LoadModel(e.modelPath, e.vocabSize); err != nil {
+	model, err := LoadModelHandle(e.modelPath, e.vocabSize, e.options)
+	if err != nil {
 		return err
 	}
 
+	e.model = model
 	e.loaded = true
 	return nil
 }
 
+// Unload releases the model; its cache handles stay valid until freed
+func (e *RealMLXEngine) Unload() error {
+	if !e.loaded {
+		return nil
+	}
+	if err := UnloadModel(e.model); err != nil {
+		return err
+	}
+	e.model = 0
+	e.loaded = false
+	return nil
+}
+
+// SetDefault makes this engine's model the one handle-less calls
+// (WriteMetrics, SetMemoryBudget, SetProfiling) report on and configure
+func (e *RealMLXEngine) SetDefault() error {
+	return SetDefaultModel(e.model)
+}
+
 // ForwardWithCache executes inference with KV cache
 // Lock-free: thread safety handled in C++ layer
 // Zero-copy: passes Go pointers directly to CGO
 func (e *RealMLXEngine) ForwardWithCache(model any, tokens []uint32, baseHandle uint64) ([]float32, uint64, error) {
-	// model parameter is ignored - MLX uses global C++ state
-	// This is a design simplification for the initial implementation
+	// model parameter is ignored - the engine forwards on its own model handle
 
 	// Allocate logits buffer in Go (C++ will write directly to this memory)
 	logits := make([]float32, e.vocabSize)
 
-	newHandle, err := forwardWithCacheImpl(tokens, baseHandle, logits)
+	newHandle, err := forwardWithCacheImpl(e.model, tokens, baseHandle, logits)
 	if err != nil {
 		return nil, 0, err
 	}
@@ -55,8 +89,28 @@ func (e *RealMLXEngine) ForwardWithCache(model any, tokens []uint32, baseHandle
 
 // forwardWithCacheImpl is the actual CGO bridge call
 // separated for easier testing with mocks
-func forwardWithCacheImpl(tokens []uint32, baseHandle uint64, logits []float32) (uint64, error) {
-	return ForwardWithCache(0, tokens, baseHandle, logits)
+func forwardWithCacheImpl(model uintptr, tokens []uint32, baseHandle uint64, logits []float32) (uint64, error) {
+	return ForwardWithCache(model, tokens, baseHandle, logits)
+}
+
+// SubmitForward queues a forward and calls done with its logits and cache
+// handle once the engine has finished it (radix.AsyncForwarder). Only a
+// goroutine waits meanwhile; the GPU work runs on the engine's step thread.
+func (e *RealMLXEngine) SubmitForward(model any, tokens []uint32, baseHandle uint64, done func(logits []float32, handle uint64, err error)) error {
+	future, err := SubmitForward(e.model, tokens, baseHandle)
+	if err != nil {
+		return err
+	}
+	go func() {
+		logits := make([]float32, e.vocabSize)
+		handle, err := future.Result(logits)
+		if err != nil {
+			done(nil, 0, err)
+			return
+		}
+		done(logits, handle, nil)
+	}()
+	return nil
 }
 
 // SliceCache creates a zero-copy view of existing cache
@@ -70,3 +124,131 @@ func (e *RealMLXEngine) SliceCache(handle uint64, keepTokens int) (uint64, error
 func (e *RealMLXEngine) FreeCache(handle uint64) {
 	FreeCache(handle)
 }
+
+// SetMemoryBudget caps the KV memory forwards may allocate
+func (e *RealMLXEngine) SetMemoryBudget(budgetBytes int64) error {
+	return SetMemoryBudget(budgetBytes)
+}
+
+// CacheBytes reports what freeing handle would release (radix.MemoryReporter)
+func (e *RealMLXEngine) CacheBytes(handle uint64) int64 {
+	_, exclusive, err := CacheBytes(handle)
+	if err != nil {
+		return 0
+	}
+	return exclusive
+}
+
+// OffloadCache moves handle's KV to the next colder tier (radix.Offloader)
+func (e *RealMLXEngine) OffloadCache(handle uint64) error {
+	tier, err := CacheTier(handle)
+	if err != nil {
+		return err
+	}
+	next, ok := NextTier(tier)
+	if !ok {
+		return fmt.Errorf("cache handle %d is already in the coldest tier", handle)
+	}
+	return OffloadCache(handle, next)
+}
+
+// PrefetchCache starts restoring an offloaded handle (radix.Offloader)
+func (e *RealMLXEngine) PrefetchCache(handle uint64) {
+	_ = PrefetchCache(handle)
+}
+
+// ExportCache writes handle to a snapshot file (radix.CacheSnapshotter)
+func (e *RealMLXEngine) ExportCache(handle uint64, path string) error {
+	return ExportCache(handle, path)
+}
+
+// ImportCache maps a snapshot file as a new handle and returns its tokens (radix.CacheSnapshotter)
+func (e *RealMLXEngine) ImportCache(path string) (uint64, []uint32, error) {
+	handle, err := ImportCache(path)
+	if err != nil {
+		return 0, nil, err
+	}
+	tokens, err := CacheTokens(handle)
+	if err != nil {
+		FreeCache(handle)
+		return 0, nil, err
+	}
+	return handle, tokens, nil
+}
+
+// SpeculativeStep decodes from handle, whose next token pending is already
+// sampled: drafter proposes up to opts.NumDraft tokens, one forward verifies
+// them, and the accepted drafts plus the new pending token are returned with a
+// handle that holds pending and the accepted drafts. Without drafts this is a
+// plain one-token sampled step. The caller owns the returned handle.
+// sample can keep one Seed for the whole decode: the engine keys each row's
+// noise on its position, so every step draws fresh noise and the tokens match
+// a ForwardSample loop with the same options.
+func (e *RealMLXEngine) SpeculativeStep(handle uint64, pending uint32, drafter Drafter, opts SpeculativeOptions, sample SampleOptions) ([]uint32, uint64, error) {
+	if err := opts.Validate(e.options.PrefillChunkTokens); err != nil {
+		return nil, 0, err
+	}
+	var drafts []uint32
+	if opts.NumDraft > 0 && drafter != nil {
+		var err error
+		if drafts, err = drafter.Draft(handle, []uint32{pending}, opts.NumDraft); err != nil {
+			return nil, 0, err
+		}
+	}
+	result, newHandle, err := VerifyDraft(e.model, pending, drafts, handle, sample, nil)
+	if err != nil {
+		return nil, 0, err
+	}
+	return result.Emitted(drafts), newHandle, nil
+}
+
+// Ground runs a grounding request from handle: tokens (with image
+// placeholders for images) are cut after the first pointerPadID action token
+// and the pointer head's topK patch candidates are returned. The caller owns
+// the returned handle, which holds the truncated prompt.
+func (e *RealMLXEngine) Ground(handle uint64, tokens []uint32, images []ImageInput, pointerPadID uint32, topK int) ([]PointerCandidate, uint64, error) {
+	prompt, ok := PointerPrompt(tokens, pointerPadID)
+	if !ok {
+		return nil, 0, fmt.Errorf("grounding prompt has no action token")
+	}
+	return ForwardPointer(e.model, prompt, images, handle, topK)
+}
+
+// SetProfiling turns GPU profiling on or off; per-layer tables follow the default model (SetDefault)
+func (e *RealMLXEngine) SetProfiling(enabled bool) error {
+	return SetProfiling(enabled)
+}
+
+// WriteMetrics writes KV memory, image cache and GPU profile metrics in the Prometheus text format
+// Memory and image cache figures are the default model's (SetDefault), not necessarily this engine's
+func (e *RealMLXEngine) WriteMetrics(w io.Writer) error {
+	stats, err := GetMemoryStats()
+	if err != nil {
+		return err
+	}
+	if err := stats.WritePrometheus(w); err != nil {
+		return err
+	}
+	images, err := GetImageCacheStats()
+	if err != nil {
+		return err
+	}
+	if err := images.WritePrometheus(w); err != nil {
+		return err
+	}
+	profile, err := GetProfileStats()
+	if err != nil {
+		return err
+	}
+	return profile.WritePrometheus(w)
+}
+
+// MemoryOverage reports KV bytes above DefaultEvictionWatermark of the budget (radix.MemoryReporter)
+// The budget is the default model's pool (SetDefault)
+func (e *RealMLXEngine) MemoryOverage() int64 {
+	stats, err := GetMemoryStats()
+	if err != nil {
+		return 0
+	}
+	return stats.Overage(DefaultEvictionWatermark)
+}
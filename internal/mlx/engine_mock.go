@@ -20,6 +20,10 @@ func NewRealMLXEngine(modelPath string, vocabSize int) *MockMLXEngine {
 	}
 }
 
+func NewRealMLXEngineWithOptions(modelPath string, vocabSize int, opts LoadOptions) *MockMLXEngine {
+	return NewRealMLXEngine(modelPath, vocabSize)
+}
+
 func (e *MockMLXEngine) LoadModel() error {
 	return fmt.Errorf("mock: model not loaded")
 }
@@ -43,3 +47,27 @@ func (e *MockMLXEngine) FreeCache(handle uint64) {
 		e.MockMLXEngine.FreeFunc(handle)
 	}
 }
+
+func (e *MockMLXEngine) SetMemoryBudget(budgetBytes int64) error {
+	return SetMemoryBudget(budgetBytes)
+}
+
+func (e *MockMLXEngine) CacheBytes(handle uint64) int64 {
+	return 0
+}
+
+func (e *MockMLXEngine) MemoryOverage() int64 {
+	return 0
+}
+
+func (e *MockMLXEngine) SetProfiling(enabled bool) error {
+	return SetProfiling(enabled)
+}
+
+func (e *MockMLXEngine) OffloadCache(handle uint64) error {
+	return OffloadCache(handle, CacheTierHost)
+}
+
+func (e *MockMLXEngine) PrefetchCache(handle uint64) {
+	_ = PrefetchCache(handle)
+}
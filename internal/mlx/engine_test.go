@@ -3,8 +3,11 @@
 package mlx
 
 import (
+	"math"
 	"os"
 	"path/filepath"
+	"reflect"
+	"sync"
 	"testing"
 )
 
@@ -73,3 +76,184 @@ func TestRealMLXEngine_LoadModel(t *testing.T) {
 
 	t.Log("Model loaded successfully!")
 }
+
+// TestVerifyDraft_ConcurrentOverStepBudget runs verify calls whose drafts
+// together overflow one engine step (max_step_tokens, 2048 rows): each must
+// still be claimed whole, so every sampled token is the argmax of its own
+// logits row rather than of rows from a split chunk or another sequence.
+func TestVerifyDraft_ConcurrentOverStepBudget(t *testing.T) {
+	if testing.Short() {
+		t.Skip("Skipping real model test in short mode")
+	}
+
+	modelPath := os.Getenv("MLX_TEST_MODEL_PATH")
+	if modelPath == "" {
+		t.Skip("Set MLX_TEST_MODEL_PATH to run this test")
+	}
+	const vocabSize = 152064
+	if err := LoadModelWithOptions(modelPath, vocabSize, DefaultLoadOptions()); err != nil {
+		t.Fatalf("Failed to load model: %v", err)
+	}
+
+	const calls = 6
+	numDraft := DefaultPrefillChunkTokens - 1 // calls * DefaultPrefillChunkTokens > 2048
+	results := make([]VerifyResult, calls)
+	errs := make([]error, calls)
+	var wg sync.WaitGroup
+	for c := 0; c < calls; c++ {
+		wg.Add(1)
+		go func(c int) {
+			defer wg.Done()
+			drafts := make([]uint32, numDraft)
+			for i := range drafts {
+				drafts[i] = uint32(1000 + (c*numDraft+i)%5000)
+			}
+			logits := make([]float32, (numDraft+1)*vocabSize)
+			var handle uint64
+			results[c], handle, errs[c] = VerifyDraft(0, uint32(100+c), drafts, RootCacheHandle, SampleOptions{}, logits)
+			if errs[c] == nil {
+				FreeCache(handle)
+			}
+		}(c)
+	}
+	wg.Wait()
+
+	for c, result := range results {
+		if errs[c] != nil {
+			t.Fatalf("call %d: VerifyDraft failed: %v", c, errs[c])
+		}
+		if len(result.Sampled) != numDraft+1 {
+			t.Fatalf("call %d: got %d samples, want %d", c, len(result.Sampled), numDraft+1)
+		}
+		for row, token := range result.Sampled {
+			logitsRow := result.Logits[row*vocabSize : (row+1)*vocabSize]
+			best := 0
+			for i, v := range logitsRow {
+				if math.IsNaN(float64(v)) || math.IsInf(float64(v), 0) {
+					t.Fatalf("call %d row %d: non-finite logit at %d", c, row, i)
+				}
+				if v > logitsRow[best] {
+					best = i
+				}
+			}
+			if logitsRow[token] != logitsRow[best] {
+				t.Fatalf("call %d row %d: greedy sample %d is not the row's argmax %d", c, row, token, best)
+			}
+		}
+	}
+}
+
+// TestForwardSample_SeedDrawsPerPosition decodes with one fixed seed at a
+// temperature high enough that the Gumbel noise alone picks the token: the
+// noise is keyed on the position, so the steps draw different tokens, and the
+// same seed replays the same tokens.
+func TestForwardSample_SeedDrawsPerPosition(t *testing.T) {
+	if testing.Short() {
+		t.Skip("Skipping real model test in short mode")
+	}
+
+	modelPath := os.Getenv("MLX_TEST_MODEL_PATH")
+	if modelPath == "" {
+		t.Skip("Set MLX_TEST_MODEL_PATH to run this test")
+	}
+	if err := LoadModelWithOptions(modelPath, 152064, DefaultLoadOptions()); err != nil {
+		t.Fatalf("Failed to load model: %v", err)
+	}
+
+	decode := func() []uint32 {
+		opts := SampleOptions{Temperature: 1e6, Seed: 42}
+		handle := RootCacheHandle
+		var tokens []uint32
+		for step := 0; step < 4; step++ {
+			result, next, err := ForwardSample(0, []uint32{100}, handle, opts)
+			if err != nil {
+				t.Fatalf("step %d: ForwardSample failed: %v", step, err)
+			}
+			if handle != RootCacheHandle {
+				FreeCache(handle)
+			}
+			handle = next
+			tokens = append(tokens, result.Token)
+		}
+		FreeCache(handle)
+		return tokens
+	}
+
+	first := decode()
+	distinct := map[uint32]bool{}
+	for _, token := range first {
+		distinct[token] = true
+	}
+	if len(distinct) == 1 {
+		t.Errorf("every step sampled token %d: the seed's noise is reused across positions", first[0])
+	}
+	if again := decode(); !reflect.DeepEqual(first, again) {
+		t.Errorf("same seed sampled %v, then %v", first, again)
+	}
+}
+
+// TestSpeculativeStep_MatchesSampleLoop decodes with one fixed seed through
+// SpeculativeStep (no drafter) and through ForwardSample: both draw each
+// position's noise the same way, so every step gets fresh noise and the two
+// decodes agree token for token.
+func TestSpeculativeStep_MatchesSampleLoop(t *testing.T) {
+	if testing.Short() {
+		t.Skip("Skipping real model test in short mode")
+	}
+
+	modelPath := os.Getenv("MLX_TEST_MODEL_PATH")
+	if modelPath == "" {
+		t.Skip("Set MLX_TEST_MODEL_PATH to run this test")
+	}
+	engine := NewRealMLXEngine(modelPath, 152064)
+	if err := engine.LoadModel(); err != nil {
+		t.Fatalf("Failed to load model: %v", err)
+	}
+	defer engine.Unload()
+
+	opts := SampleOptions{Temperature: 0.8, Seed: 7}
+	first, root, err := ForwardSample(engine.model, []uint32{100, 200, 300}, RootCacheHandle, opts)
+	if err != nil {
+		t.Fatalf("ForwardSample failed: %v", err)
+	}
+	defer FreeCache(root)
+
+	const steps = 6
+	var sampled, speculative []uint32
+	handle := root
+	for step := 0; step < steps; step++ {
+		pending := first.Token
+		if step > 0 {
+			pending = sampled[step-1]
+		}
+		result, next, err := ForwardSample(engine.model, []uint32{pending}, handle, opts)
+		if err != nil {
+			t.Fatalf("step %d: ForwardSample failed: %v", step, err)
+		}
+		if handle != root {
+			FreeCache(handle)
+		}
+		handle = next
+		sampled = append(sampled, result.Token)
+	}
+	FreeCache(handle)
+
+	pending, handle := first.Token, root
+	for len(speculative) < steps {
+		emitted, next, err := engine.SpeculativeStep(handle, pending, nil, SpeculativeOptions{}, opts)
+		if err != nil {
+			t.Fatalf("SpeculativeStep failed: %v", err)
+		}
+		if handle != root {
+			FreeCache(handle)
+		}
+		handle = next
+		speculative = append(speculative, emitted...)
+		pending = emitted[len(emitted)-1]
+	}
+	FreeCache(handle)
+
+	if !reflect.DeepEqual(sampled, speculative[:steps]) {
+		t.Errorf("ForwardSample decoded %v, SpeculativeStep %v", sampled, speculative[:steps])
+	}
+}
@@ -0,0 +1,75 @@
+package mlx
+
+import "fmt"
+
+// DefaultEvictionWatermark is the fraction of the KV budget above which cached
+// prefixes are evicted, leaving headroom for in-flight forwards to grow
+const DefaultEvictionWatermark = 0.9
+
+// MemoryStats is the KV pool usage of the loaded model, in bytes
+// Values mirror MLXMemoryStats in mlx_api.h
+type MemoryStats struct {
+	UsedBytes     int64 // Blocks held by live handles and in-flight forwards
+	BudgetBytes   int64 // Allocation limit; forwards past it fail with ErrorOutOfMemory
+	CapacityBytes int64 // Whole KV pool
+	BlockBytes    int64 // Allocation unit
+	HostBytes     int64 // Offloaded KV in host buffers, outside the pool
+	DiskBytes     int64 // Offloaded KV in spill files
+}
+
+// Cache residency tiers, mirroring MLX_CACHE_TIER_* in mlx_api.h
+const (
+	CacheTierDevice = 0
+	CacheTierHost   = 1
+	CacheTierDisk   = 2
+)
+
+// OffloadOptions configures the offload tiers (MLXSetOffloadConfig)
+type OffloadOptions struct {
+	// Directory holds spill files; empty keeps the engine default ($TMPDIR)
+	Directory string
+	// HostBudgetBytes bounds the host tier; the oldest host-tier handles are
+	// spilled to disk beyond it. 0 means unbounded
+	HostBudgetBytes int64
+}
+
+// Validate checks that option values are in range
+func (o OffloadOptions) Validate() error {
+	if o.HostBudgetBytes < 0 {
+		return fmt.Errorf("host offload budget must be >= 0, got %d", o.HostBudgetBytes)
+	}
+	return nil
+}
+
+// NextTier returns the tier OffloadCache moves a handle in tier to, and false
+// if it is already in the coldest tier
+func NextTier(tier int) (int, bool) {
+	if tier >= CacheTierDisk {
+		return tier, false
+	}
+	return tier + 1, true
+}
+
+// Pressure returns used/budget, 0 when there is no budget
+func (s MemoryStats) Pressure() float64 {
+	if s.BudgetBytes <= 0 {
+		return 0
+	}
+	return float64(s.UsedBytes) / float64(s.BudgetBytes)
+}
+
+// Overage returns how many bytes must be freed to bring usage down to
+// watermark * budget, rounded up to whole blocks; 0 when already below
+func (s MemoryStats) Overage(watermark float64) int64 {
+	if s.BudgetBytes <= 0 {
+		return 0
+	}
+	over := s.UsedBytes - int64(watermark*float64(s.BudgetBytes))
+	if over <= 0 {
+		return 0
+	}
+	if s.BlockBytes > 0 {
+		over = (over + s.BlockBytes - 1) / s.BlockBytes * s.BlockBytes
+	}
+	return over
+}
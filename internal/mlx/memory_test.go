@@ -0,0 +1,90 @@
+package mlx
+
+import "testing"
+
+func TestMemoryStatsPressure(t *testing.T) {
+	tests := []struct {
+		name  string
+		stats MemoryStats
+		want  float64
+	}{
+		{"empty", MemoryStats{UsedBytes: 0, BudgetBytes: 1000}, 0},
+		{"half", MemoryStats{UsedBytes: 500, BudgetBytes: 1000}, 0.5},
+		{"full", MemoryStats{UsedBytes: 1000, BudgetBytes: 1000}, 1},
+		{"no budget", MemoryStats{UsedBytes: 500}, 0},
+	}
+
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			if got := tt.stats.Pressure(); got != tt.want {
+				t.Errorf("Pressure() = %v, want %v", got, tt.want)
+			}
+		})
+	}
+}
+
+func TestMemoryStatsOverage(t *testing.T) {
+	tests := []struct {
+		name      string
+		stats     MemoryStats
+		watermark float64
+		want      int64
+	}{
+		{"below watermark", MemoryStats{UsedBytes: 800, BudgetBytes: 1000, BlockBytes: 100}, 0.9, 0},
+		{"at watermark", MemoryStats{UsedBytes: 900, BudgetBytes: 1000, BlockBytes: 100}, 0.9, 0},
+		{"one block over", MemoryStats{UsedBytes: 1000, BudgetBytes: 1000, BlockBytes: 100}, 0.9, 100},
+		{"rounds up to blocks", MemoryStats{UsedBytes: 950, BudgetBytes: 1000, BlockBytes: 100}, 0.9, 100},
+		{"no block size", MemoryStats{UsedBytes: 950, BudgetBytes: 1000}, 0.9, 50},
+		{"no budget", MemoryStats{UsedBytes: 950, BlockBytes: 100}, 0.9, 0},
+	}
+
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			if got := tt.stats.Overage(tt.watermark); got != tt.want {
+				t.Errorf("Overage(%v) = %d, want %d", tt.watermark, got, tt.want)
+			}
+		})
+	}
+}
+
+func TestOffloadOptionsValidate(t *testing.T) {
+	tests := []struct {
+		name    string
+		opts    OffloadOptions
+		wantErr bool
+	}{
+		{"defaults", OffloadOptions{}, false},
+		{"bounded host tier", OffloadOptions{Directory: "/var/tmp", HostBudgetBytes: 1 << 30}, false},
+		{"negative budget", OffloadOptions{HostBudgetBytes: -1}, true},
+	}
+
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			if err := tt.opts.Validate(); (err != nil) != tt.wantErr {
+				t.Errorf("Validate() error = %v, wantErr %v", err, tt.wantErr)
+			}
+		})
+	}
+}
+
+func TestNextTier(t *testing.T) {
+	tests := []struct {
+		name   string
+		tier   int
+		want   int
+		wantOK bool
+	}{
+		{"device to host", CacheTierDevice, CacheTierHost, true},
+		{"host to disk", CacheTierHost, CacheTierDisk, true},
+		{"disk is coldest", CacheTierDisk, CacheTierDisk, false},
+	}
+
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			got, ok := NextTier(tt.tier)
+			if got != tt.want || ok != tt.wantOK {
+				t.Errorf("NextTier(%d) = (%d, %v), want (%d, %v)", tt.tier, got, ok, tt.want, tt.wantOK)
+			}
+		})
+	}
+}
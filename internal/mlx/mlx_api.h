@@ -18,10 +18,11 @@ extern "C" {
 // MLXForwardWithCache executes inference with KV cache
 //
 // Parameters:
-//   model_handle - Opaque pointer to loaded model (cast from uintptr_t)
+//   model_handle - Handle from MLXLoadModelHandle (0 = MLX_DEFAULT_MODEL_HANDLE)
 //   tokens - Array of token IDs (uint32_t*)
 //   num_tokens - Length of tokens array
-//   base_cache_handle - KV cache to extend from (0 = RootCacheHandle, empty cache)
+//   base_cache_handle - KV cache to extend from (0 = RootCacheHandle, empty cache);
+//                       must hold K/V of the same model (MLX_ERROR_INVALID_HANDLE otherwise)
 //   out_logits - Output buffer for logits (pre-allocated by caller, float32*)
 //   out_logits_size - Size of output buffer (number of float32 elements)
 //   out_cache_handle - Output: new cache handle for KV cache
@@ -31,8 +32,12 @@ extern "C" {
 //   0 on success, non-zero error code on failure
 //
 // Thread Safety:
-//   Safe to call concurrently on different cache handles
-//   NOT safe to call concurrently on same cache handle
+//   Safe to call concurrently, including with the same base_cache_handle
+//   (each call forks the base and returns a new handle). Concurrent calls are
+//   batched into shared engine steps: each step carries every pending decode
+//   plus prompt chunks of at most prefill_chunk_tokens per sequence, so a long
+//   prompt delays other sessions by one chunk, not by its whole prefill. Up to
+//   a fixed number of steps run at once.
 //
 // Memory Management:
 //   Caller must allocate out_logits buffer before call
@@ -49,6 +54,255 @@ int MLXForwardWithCache(
     char** out_error
 );
 
+// MLXForwardCallback reports that a submitted forward has finished
+//
+// Parameters:
+//   ticket - Ticket returned by MLXSubmitForward
+//   status - MLX_SUCCESS or the error code MLXPollForward will return
+//   user_data - Value passed to MLXSubmitForward
+//
+// Thread Safety:
+//   Runs on an engine thread that drives every submitted forward of the
+//   model: it must return quickly and must not call into the engine other than
+//   MLXPollForward (in particular not MLXUnloadModel)
+typedef void (*MLXForwardCallback)(uint64_t ticket, int status, uintptr_t user_data);
+
+// MLXSubmitForward queues a forward like MLXForwardWithCache and returns at once
+//
+// The tokens join the same engine steps as synchronous calls; one engine
+// thread per model drives steps while submitted work is pending, so many
+// requests can be in flight without a caller thread blocked on each.
+//
+// Parameters:
+//   model_handle ... base_cache_handle - Same as MLXForwardWithCache
+//   callback - Called once the forward has finished (may be NULL to only poll)
+//   user_data - Passed to callback
+//   out_ticket - Output: ticket for MLXPollForward / MLXWaitForward
+//   out_error - Output: error message (NULL on success, must be freed with MLXFreeError)
+//
+// Returns:
+//   0 once queued; errors that MLXForwardWithCache reports before running
+//   (unknown model or base handle, invalid tokens) are returned here
+//
+// Memory Management:
+//   tokens are copied. The logits are kept by the engine until collected, so
+//   no caller buffer has to outlive the call. Every ticket must be collected
+//   with MLXPollForward or MLXWaitForward, which publish its cache handle
+int MLXSubmitForward(
+    uintptr_t model_handle,
+    const uint32_t* tokens,
+    int num_tokens,
+    uint64_t base_cache_handle,
+    MLXForwardCallback callback,
+    uintptr_t user_data,
+    uint64_t* out_ticket,
+    char** out_error
+);
+
+// MLXPollForward collects the result of a submitted forward without blocking
+//
+// Parameters:
+//   ticket - Ticket from MLXSubmitForward
+//   out_logits - Output: vocab_size logits (NULL to discard them)
+//   out_logits_size - Size of out_logits (number of float32 elements)
+//   out_cache_handle - Output: new cache handle (caller must free)
+//   out_error - Output: error message when the forward failed (caller must free)
+//
+// Returns:
+//   MLX_PENDING while the forward runs. Otherwise the forward's status, and
+//   the ticket is retired; MLX_ERROR_INVALID_HANDLE for unknown or retired
+//   tickets, MLX_ERROR_OUT_OF_MEMORY (ticket kept) if out_logits is too small
+//
+// Thread Safety:
+//   Thread-safe; a ticket is collected by exactly one successful call
+int MLXPollForward(uint64_t ticket, float* out_logits, int out_logits_size, uint64_t* out_cache_handle,
+                   char** out_error);
+
+// MLXWaitForward is MLXPollForward that blocks until the forward has finished
+int MLXWaitForward(uint64_t ticket, float* out_logits, int out_logits_size, uint64_t* out_cache_handle,
+                   char** out_error);
+
+// MLXForwardBatch executes one inference step for several sequences at once
+//
+// The new tokens of every sequence are packed into one ragged batch, so each
+// projection runs as a single GEMM over all sequences and the weights are read
+// once per step. Any mix of prefill spans and single-token decodes may be
+// batched, and each call may name a different set of handles, so sequences
+// can join or leave between steps (continuous batching).
+//
+// Parameters:
+//   model_handle - Handle from MLXLoadModelHandle (0 = MLX_DEFAULT_MODEL_HANDLE)
+//   num_sequences - Number of sequences in the batch
+//   tokens - All sequences' new token IDs back to back (uint32_t*)
+//   token_counts - Number of tokens of each sequence (num_sequences entries, each > 0)
+//   base_cache_handles - KV cache each sequence extends (0 = RootCacheHandle);
+//                        the same handle may appear more than once
+//   out_logits - Output buffer for logits (pre-allocated by caller, float32*);
+//                sequence i's last-token logits start at i * vocab_size
+//   out_logits_size - Size of output buffer (>= num_sequences * vocab_size)
+//   out_cache_handles - Output: one new cache handle per sequence
+//   out_error - Output: error message (NULL on success, must be freed with MLXFreeError)
+//
+// Returns:
+//   0 on success, non-zero error code on failure; on failure no handles are created.
+//   MLX_ERROR_INVALID_TOKENS if num_sequences <= 0 or any array argument is NULL
+//
+// Thread Safety:
+//   Same as MLXForwardWithCache
+//
+// Memory Management:
+//   Caller must call MLXFreeCache on every out_cache_handles entry when done
+//   Caller must call MLXFreeError on out_error when non-NULL
+int MLXForwardBatch(
+    uintptr_t model_handle,
+    int num_sequences,
+    const uint32_t* tokens,
+    const int* token_counts,
+    const uint64_t* base_cache_handles,
+    float* out_logits,
+    int out_logits_size,
+    uint64_t* out_cache_handles,
+    char** out_error
+);
+
+// MLXForwardSample executes inference and samples the next token on the GPU
+//
+// Same as MLXForwardWithCache, but the logits never leave the device: only the
+// chosen token and, optionally, the top num_logprobs (id, logprob) pairs are
+// returned. With temperature > 0, top_k <= 0 and top_p >= 1 the token is an
+// exact sample from the full distribution (Gumbel-max); otherwise it is drawn
+// from the top_k most likely tokens, further cut to the smallest prefix whose
+// probability mass reaches top_p (the prefix is limited to
+// MLX_MAX_SAMPLE_CANDIDATES tokens).
+//
+// Parameters:
+//   model_handle - Handle from MLXLoadModelHandle (0 = MLX_DEFAULT_MODEL_HANDLE)
+//   tokens - Array of token IDs (uint32_t*)
+//   num_tokens - Length of tokens array
+//   base_cache_handle - KV cache to extend from (0 = RootCacheHandle, empty cache)
+//   temperature - Softmax temperature; <= 0 selects greedy decoding
+//   top_k - Keep the k most likely tokens (<= 0 disables, capped at MLX_MAX_SAMPLE_CANDIDATES)
+//   top_p - Nucleus mass in (0, 1]; >= 1 disables
+//   seed - RNG seed; the noise is keyed on the seed and the position of the last
+//          token, so a fixed seed replays the same tokens for the same inputs but
+//          draws fresh noise at every position of a decode
+//   bias_token_ids - Token IDs to bias (NULL when num_bias is 0); must be unique
+//   bias_values - Additive logit bias per ID; -INFINITY bans a token
+//   num_bias - Number of bias entries
+//   num_logprobs - Number of top (id, logprob) pairs to return (0..MLX_MAX_SAMPLE_CANDIDATES)
+//   out_token - Output: sampled token ID
+//   out_top_ids - Output: num_logprobs token IDs, most likely first (NULL when num_logprobs is 0)
+//   out_top_logprobs - Output: their log-probabilities after bias, before temperature
+//   out_cache_handle - Output: new cache handle for KV cache
+//   out_error - Output: error message (NULL on success, must be freed with MLXFreeError)
+//
+// Returns:
+//   0 on success, non-zero error code on failure
+//
+// Thread Safety:
+//   Same as MLXForwardWithCache
+//
+// Memory Management:
+//   Caller must allocate out_top_ids/out_top_logprobs with num_logprobs entries
+//   Caller must call MLXFreeCache on out_cache_handle when done
+//   Caller must call MLXFreeError on out_error when non-NULL
+int MLXForwardSample(
+    uintptr_t model_handle,
+    const uint32_t* tokens,
+    int num_tokens,
+    uint64_t base_cache_handle,
+    float temperature,
+    int top_k,
+    float top_p,
+    uint64_t seed,
+    const uint32_t* bias_token_ids,
+    const float* bias_values,
+    int num_bias,
+    int num_logprobs,
+    uint32_t* out_token,
+    uint32_t* out_top_ids,
+    float* out_top_logprobs,
+    uint64_t* out_cache_handle,
+    char** out_error
+);
+
+// MLXVerifyDraft verifies speculative draft tokens in one multi-token forward
+//
+// tokens is the pending token (sampled but not yet in the cache) followed by
+// K draft tokens. All of them are forwarded with causal masking, every
+// position's logits are sampled on the GPU as in MLXForwardSample, and
+// draft i is accepted while it equals the sample of position i - 1. For
+// deterministic drafts (n-gram lookup, a greedy draft model) this accepts with
+// the target model's probability of each draft, so the output is distributed
+// exactly as plain sampling; with temperature <= 0 it is greedy decoding.
+// Every position draws the noise MLXForwardSample would there, so a decode
+// may keep one seed across verify steps and still gets fresh noise per token.
+//
+// Parameters:
+//   model_handle - Handle from MLXLoadModelHandle (0 = MLX_DEFAULT_MODEL_HANDLE)
+//   tokens - Pending token then draft tokens (uint32_t*)
+//   num_tokens - Length of tokens array, at most the prefill chunk size
+//   base_cache_handle - KV cache to extend from (0 = RootCacheHandle, empty cache)
+//   temperature, top_k, top_p, seed - As in MLXForwardSample
+//   out_accepted - Output: number of leading drafts accepted (0..num_tokens - 1)
+//   out_tokens - Output: num_tokens sampled tokens, one per position;
+//                out_tokens[*out_accepted] is the next pending token
+//   out_logits - Output (optional): [num_tokens, vocab_size] logits, NULL to skip
+//   out_logits_size - Size of out_logits; at least num_tokens * vocab_size when set
+//   out_cache_handle - Output: cache holding the pending token and the accepted
+//                      drafts, sliced as by MLXSliceCache
+//   out_error - Output: error message (NULL on success, must be freed with MLXFreeError)
+//
+// Returns:
+//   0 on success, non-zero error code on failure
+//
+// Thread Safety:
+//   Same as MLXForwardWithCache
+//
+// Memory Management:
+//   Caller must allocate out_tokens with num_tokens entries
+//   Caller must call MLXFreeCache on out_cache_handle when done
+int MLXVerifyDraft(
+    uintptr_t model_handle,
+    const uint32_t* tokens,
+    int num_tokens,
+    uint64_t base_cache_handle,
+    float temperature,
+    int top_k,
+    float top_p,
+    uint64_t seed,
+    int* out_accepted,
+    uint32_t* out_tokens,
+    float* out_logits,
+    int out_logits_size,
+    uint64_t* out_cache_handle,
+    char** out_error
+);
+
+// MLXDraftNgram proposes draft tokens by prompt lookup
+//
+// Finds the most recent earlier occurrence of the longest suffix (max_ngram
+// tokens down to 1) of the cache's tokens followed by pending_tokens, and
+// returns the tokens that followed it. Structured outputs (coordinates, JSON
+// keys) repeat their context often, which makes these drafts cheap and likely.
+//
+// Parameters:
+//   cache_handle - Cache whose tokens form the context (0 = empty)
+//   pending_tokens - Tokens past the cache, usually the pending token (may be NULL if num_pending is 0)
+//   num_pending - Length of pending_tokens
+//   max_ngram - Longest suffix to look up
+//   max_draft - Most tokens to propose
+//   out_draft - Output: up to max_draft draft tokens
+//   out_count - Output: number of drafts written (0 if the suffix never recurs)
+//
+// Returns:
+//   0 on success, MLX_ERROR_INVALID_HANDLE for an unknown cache handle
+//
+// Thread Safety:
+//   Safe to call concurrently; token sequences are immutable once published
+int MLXDraftNgram(uint64_t cache_handle, const uint32_t* pending_tokens, int num_pending,
+                  int max_ngram, int max_draft, uint32_t* out_draft, int* out_count);
+
 // MLXSliceCache creates a zero-copy view of an existing cache
 //
 // This is an O(1) operation using MLX copy-on-write semantics
@@ -87,6 +341,456 @@ int MLXSliceCache(
 //   Memory is freed when refcount reaches zero
 void MLXFreeCache(uint64_t cache_handle);
 
+// =============================================================================
+// KV Cache Memory Accounting
+// =============================================================================
+
+// KV pool usage of the loaded model, in bytes
+// A block holds kv_block_size tokens of K and V for every layer; handles that
+// share a prefix share its blocks, so used_bytes counts each block once.
+typedef struct {
+    int64_t used_bytes;      // Blocks held by live handles and in-flight forwards
+    int64_t budget_bytes;    // Allocation limit; forwards past it fail with MLX_ERROR_OUT_OF_MEMORY
+    int64_t capacity_bytes;  // Whole KV pool
+    int64_t block_bytes;     // One block, the unit every figure is a multiple of
+    int64_t host_bytes;      // Offloaded K/V held in host buffers (outside the pool)
+    int64_t disk_bytes;      // Offloaded K/V held in spill files
+} MLXMemoryStats;
+
+// MLXGetMemoryStats reports KV pool usage
+//
+// Parameters:
+//   out_stats - Output: usage of the default model's pool (MLX_DEFAULT_MODEL_HANDLE,
+//               see MLXSetDefaultModel); host_bytes and disk_bytes cover every model
+//
+// Returns:
+//   0 on success, MLX_ERROR_MODEL_NOT_LOADED before a model is loaded
+//
+// Multiple Models:
+//   Only the default model's pool is reported; make a model the default to
+//   read its pool
+//
+// Use Case:
+//   Callers poll after each forward and evict cached prefixes once used_bytes
+//   approaches budget_bytes, instead of waiting for a forward to fail
+int MLXGetMemoryStats(MLXMemoryStats* out_stats);
+
+// MLXGetCacheBytes reports the KV memory behind one cache handle
+//
+// Parameters:
+//   cache_handle - Cache handle to inspect
+//   out_bytes - Output (optional): bytes of every block the handle references
+//   out_exclusive_bytes - Output (optional): bytes only this handle references,
+//                         i.e. what MLXFreeCache on it would release right now
+//
+// Returns:
+//   0 on success, MLX_ERROR_INVALID_HANDLE for unknown handles
+//
+// Thread Safety:
+//   Safe to call concurrently; exclusive bytes change as other handles are freed
+int MLXGetCacheBytes(uint64_t cache_handle, int64_t* out_bytes, int64_t* out_exclusive_bytes);
+
+// MLXSetMemoryBudget caps the KV memory forwards may allocate
+//
+// Parameters:
+//   budget_bytes - New limit, rounded down to whole blocks; <= 0 (or more than
+//                  the pool holds) removes the cap
+//
+// Returns:
+//   0 on success, MLX_ERROR_MODEL_NOT_LOADED before a model is loaded
+//
+// Thread Safety:
+//   Safe to call while forwards are in flight; lowering the budget below
+//   used_bytes only blocks new allocations until handles are freed
+int MLXSetMemoryBudget(int64_t budget_bytes);
+
+// =============================================================================
+// KV Cache Offload
+// =============================================================================
+
+// Residency of a cache handle's K/V
+#define MLX_CACHE_TIER_DEVICE 0  // In the KV pool, usable by forwards as is
+#define MLX_CACHE_TIER_HOST 1    // Copied to a host buffer; pool blocks released
+#define MLX_CACHE_TIER_DISK 2    // Spilled to an mmap'd file; pool blocks released
+
+// MLXOffloadCache moves a handle's K/V out of the KV pool
+//
+// Parameters:
+//   cache_handle - Cache handle to offload
+//   tier - MLX_CACHE_TIER_HOST or MLX_CACHE_TIER_DISK; a handle already in
+//          that tier or a colder one is left where it is
+//   out_error - Output: error message (caller must free with MLXFreeError)
+//
+// Returns:
+//   0 on success, MLX_ERROR_INVALID_HANDLE for unknown handles,
+//   MLX_ERROR_COMPUTATION_FAILED if the spill file cannot be written
+//
+// Memory Management:
+//   The handle stays valid and keeps its tokens. Its blocks go back to the
+//   pool once no other handle shares them. When host-tier bytes exceed the
+//   host budget (MLXSetOffloadConfig), the oldest host-tier handles are moved
+//   on to disk. Spill files are deleted when the handle is freed.
+//
+// Use Case:
+//   Under memory pressure, offload cold radix-tree prefixes instead of
+//   evicting them, so a later hit costs a copy rather than a prefill
+int MLXOffloadCache(uint64_t cache_handle, int tier, char** out_error);
+
+// MLXPrefetchCache starts restoring an offloaded handle into the KV pool
+//
+// Parameters:
+//   cache_handle - Cache handle to restore (no-op if already on device)
+//
+// Returns:
+//   0 once the restore is queued, MLX_ERROR_INVALID_HANDLE for unknown handles
+//
+// Thread Safety:
+//   Returns immediately; the copy runs on a background queue. A forward that
+//   forks the handle before it finishes waits for it, or restores it itself.
+//   A restore that finds the pool full is dropped; the fork then retries and
+//   reports MLX_ERROR_OUT_OF_MEMORY if it still does not fit.
+//
+// Memory Management:
+//   Restored handles get fresh blocks; they no longer share the prefix
+//   blocks they held before offloading
+int MLXPrefetchCache(uint64_t cache_handle);
+
+// MLXGetCacheTier reports where a handle's K/V resides
+//
+// Parameters:
+//   cache_handle - Cache handle to inspect
+//   out_tier - Output: one of MLX_CACHE_TIER_*
+//
+// Returns:
+//   0 on success, MLX_ERROR_INVALID_HANDLE for unknown handles
+int MLXGetCacheTier(uint64_t cache_handle, int* out_tier);
+
+// MLXSetOffloadConfig configures the offload tiers
+//
+// Parameters:
+//   directory - Directory for spill files (NULL or "" keeps the current one,
+//               $TMPDIR or /tmp by default)
+//   host_budget_bytes - Host-tier bytes beyond which the oldest host-tier
+//                       handles are spilled to disk; <= 0 means unbounded
+//
+// Returns:
+//   0 on success
+int MLXSetOffloadConfig(const char* directory, int64_t host_budget_bytes);
+
+// =============================================================================
+// KV Cache Snapshots
+// =============================================================================
+
+// MLXExportCache writes a cache handle to a snapshot file
+//
+// Parameters:
+//   cache_handle - Cache handle to export (any tier)
+//   path - Destination file; replaced atomically if it exists
+//   out_error - Output: error message (caller must free with MLXFreeError)
+//
+// Returns:
+//   0 on success, MLX_ERROR_INVALID_HANDLE for unknown handles,
+//   MLX_ERROR_COMPUTATION_FAILED on I/O errors
+//
+// Memory Management:
+//   The file holds the token sequence, the K/V blocks and the fingerprint of
+//   the model the cache belongs to (MLXGetModelFingerprint). Offloaded handles are exported
+//   without restoring them.
+int MLXExportCache(uint64_t cache_handle, const char* path, char** out_error);
+
+// MLXImportCache maps a snapshot written by MLXExportCache as a new handle
+//
+// Parameters:
+//   path - Snapshot file
+//   out_cache_handle - Output: new cache handle (caller must free)
+//   out_error - Output: error message (caller must free with MLXFreeError)
+//
+// Returns:
+//   0 on success, MLX_ERROR_COMPUTATION_FAILED if the file is missing,
+//   corrupt, or was computed with a model that is not loaded or a different
+//   KV layout. The handle belongs to the loaded model with the snapshot's
+//   fingerprint.
+//
+// Memory Management:
+//   Zero-copy: the file is mmap'd and the handle starts in
+//   MLX_CACHE_TIER_DISK, so import costs no KV pool blocks. The K/V is copied
+//   into the pool when the handle is first forked or prefetched
+//   (MLXPrefetchCache). The file must not be modified in place while the
+//   handle lives; replacing it (as MLXExportCache does) is safe.
+//
+// Use Case:
+//   Persist hot prefixes (system prompts) at shutdown and re-import them at
+//   startup, or ship prebuilt prefix caches alongside a model
+int MLXImportCache(const char* path, uint64_t* out_cache_handle, char** out_error);
+
+// MLXGetCacheTokens copies the token sequence behind a cache handle
+//
+// Parameters:
+//   cache_handle - Cache handle to inspect
+//   out_tokens - Output buffer, or NULL to only query the count
+//   capacity - Size of out_tokens
+//   out_count - Output: number of tokens in the handle
+//
+// Returns:
+//   0 on success, MLX_ERROR_INVALID_HANDLE for unknown handles,
+//   MLX_ERROR_OUT_OF_MEMORY if capacity < *out_count
+int MLXGetCacheTokens(uint64_t cache_handle, uint32_t* out_tokens, int capacity, int* out_count);
+
+// MLXGetModelFingerprint identifies the default model for snapshot matching
+//
+// Parameters:
+//   out_fingerprint - Output: hash of the model config, weight format and
+//                     sampled weight contents
+//
+// Returns:
+//   0 on success, MLX_ERROR_MODEL_NOT_LOADED before a model is loaded
+int MLXGetModelFingerprint(uint64_t* out_fingerprint);
+
+// =============================================================================
+// Vision
+// =============================================================================
+// Images are preprocessed by the caller (resize, normalize, patchify) and
+// encoded by the model's vision tower inside the forward that uses them. The
+// image tokens of a prompt do not identify the image, so prefix caches must
+// key image spans by the image hash as well.
+// =============================================================================
+
+// One preprocessed image
+typedef struct {
+    const float* pixel_values;  // [grid_t * grid_h * grid_w, 3 * 2 * 14 * 14] normalized patches, merge-window order
+    int grid_t;                 // Frames / temporal_patch_size
+    int grid_h;                 // Patch rows (even)
+    int grid_w;                 // Patch columns (even)
+    uint64_t hash;              // Content hash keying the image cache; 0 hashes pixel_values
+} MLXImageInput;
+
+// Encoded-image cache usage
+typedef struct {
+    int64_t entries;       // Images held
+    int64_t bytes;         // Embedding bytes held
+    int64_t budget_bytes;  // Least recently used images are evicted past this
+    uint64_t hits;         // Images served without running the vision tower
+    uint64_t misses;       // Images encoded
+} MLXImageCacheStats;
+
+// MLXForwardMultimodal executes inference over a prompt containing images
+//
+// Every image expands to grid_t * (grid_h / 2) * (grid_w / 2) consecutive
+// image placeholder tokens (<|image_pad|>), consumed by the images in order.
+// The vision tower's output replaces the placeholders' embeddings in the
+// language model's input, and their M-RoPE positions follow the image grid.
+// Encoded images are cached by content hash, so an agent loop resending an
+// unchanged screenshot skips the vision tower.
+//
+// Parameters:
+//   model_handle - Handle from MLXLoadModelHandle (0 = MLX_DEFAULT_MODEL_HANDLE)
+//   tokens - Input token IDs including the placeholders (uint32_t*)
+//   num_tokens - Length of tokens array
+//   images - Images in prompt order (may be NULL if num_images is 0)
+//   num_images - Length of images array
+//   base_cache_handle - KV cache to extend from (0 = RootCacheHandle, empty cache)
+//   out_logits - Output: logits of the last token (float32*)
+//   out_logits_size - Size of out_logits (must be >= vocab_size)
+//   out_cache_handle - Output: new cache handle containing the whole prompt
+//   out_error - Output: error message (NULL on success, must be freed with MLXFreeError)
+//
+// Returns:
+//   0 on success, non-zero error code on failure; MLX_ERROR_COMPUTATION_FAILED
+//   if the model has no vision tower or the placeholder counts do not match
+//   the images
+//
+// Thread Safety:
+//   Same as MLXForwardWithCache
+//
+// Memory Management:
+//   pixel_values are copied before return
+//   Caller must call MLXFreeCache on out_cache_handle when done
+int MLXForwardMultimodal(
+    uintptr_t model_handle,
+    const uint32_t* tokens,
+    int num_tokens,
+    const MLXImageInput* images,
+    int num_images,
+    uint64_t base_cache_handle,
+    float* out_logits,
+    int out_logits_size,
+    uint64_t* out_cache_handle,
+    char** out_error
+);
+
+// One grounding candidate
+typedef struct {
+    int image;    // Index into the images array
+    int patch;    // Merged patch within the image: frame-major, then row-major on the (grid_h / 2, grid_w / 2) grid
+    float score;  // Pointer head probability, softmax over every image token of the prompt
+    float x;      // Patch center, normalized to the image width
+    float y;      // Patch center, normalized to the image height
+} MLXPointerCandidate;
+
+// MLXForwardPointer grounds an action token to image patches (GUI-Actor)
+//
+// Runs the prompt as MLXForwardMultimodal does, but instead of the LM head
+// the last token's final hidden state feeds the model's pointer head on the
+// device: it attends over the image tokens' embeddings and the top_k scoring
+// patches are returned. No logits or hidden states leave the device.
+//
+// Parameters:
+//   model_handle - Handle from MLXLoadModelHandle (0 = MLX_DEFAULT_MODEL_HANDLE)
+//   tokens - Input token IDs ending with the action token (<|pointer_pad|>)
+//   num_tokens - Length of tokens array
+//   images - Images in prompt order, at least one
+//   num_images - Length of images array
+//   base_cache_handle - KV cache to extend from (0 = RootCacheHandle, empty cache)
+//   top_k - Candidates to return, 1..MLX_MAX_SAMPLE_CANDIDATES
+//   out_candidates - Output: candidates in descending score order
+//   out_count - Output: candidates written, min(top_k, image tokens)
+//   out_cache_handle - Output: new cache handle containing the whole prompt
+//   out_error - Output: error message (NULL on success, must be freed with MLXFreeError)
+//
+// Returns:
+//   0 on success, non-zero error code on failure; MLX_ERROR_COMPUTATION_FAILED
+//   if the model has no pointer head (bin_weights/pointer.*)
+//
+// Thread Safety:
+//   Same as MLXForwardWithCache
+//
+// Memory Management:
+//   Caller must allocate out_candidates with top_k entries
+//   Caller must call MLXFreeCache on out_cache_handle when done
+int MLXForwardPointer(
+    uintptr_t model_handle,
+    const uint32_t* tokens,
+    int num_tokens,
+    const MLXImageInput* images,
+    int num_images,
+    uint64_t base_cache_handle,
+    int top_k,
+    MLXPointerCandidate* out_candidates,
+    int* out_count,
+    uint64_t* out_cache_handle,
+    char** out_error
+);
+
+// MLXSetImageCacheBudget caps the device memory held by encoded images
+//
+// Parameters:
+//   budget_bytes - New limit for the default model's cache (MLX_DEFAULT_MODEL_HANDLE);
+//                  <= 0 disables the cache
+//
+// Returns:
+//   0 on success, MLX_ERROR_MODEL_NOT_LOADED before a model is loaded
+//
+// Multiple Models:
+//   Each model keeps its own image cache; only the default model's is changed
+//
+// Thread Safety:
+//   Safe to call while forwards are in flight; forwards keep the images they
+//   are using alive past eviction
+int MLXSetImageCacheBudget(int64_t budget_bytes);
+
+// MLXGetImageCacheStats reports encoded-image cache usage
+//
+// Parameters:
+//   out_stats - Output: usage of the default model's image cache (MLX_DEFAULT_MODEL_HANDLE)
+//
+// Returns:
+//   0 on success, MLX_ERROR_MODEL_NOT_LOADED before a model is loaded
+int MLXGetImageCacheStats(MLXImageCacheStats* out_stats);
+
+// =============================================================================
+// Profiling
+// =============================================================================
+
+// Kernel kinds GPU time is broken down by
+#define MLX_KERNEL_MATMUL 0     // V/O projections and the LM head
+#define MLX_KERNEL_ROPE 1       // Q/K projections with RoPE fused into their epilogue
+#define MLX_KERNEL_ATTENTION 2  // KV slot writes and paged attention
+#define MLX_KERNEL_NORM 3       // RMSNorm, including the fused residual adds
+#define MLX_KERNEL_MLP 4        // Fused gate/up projection and down projection
+#define MLX_KERNEL_SAMPLE 5     // Logit bias and on-device sampling
+#define MLX_KERNEL_OTHER 6      // Anything encoded before the first region
+#define MLX_NUM_KERNEL_KINDS 7
+
+// Totals since profiling was last enabled or reset
+typedef struct {
+    int num_layers;            // Per-layer tables have num_layers + 1 rows; the last is outside any layer
+    int enabled;               // Profiling is currently on
+    int timestamps_supported;  // Device samples timestamps at encoder boundaries; if 0 only gpu_ns is recorded
+    uint64_t command_buffers;  // Command buffers completed while profiling
+    uint64_t gpu_ns;           // Their summed GPU execution time
+    uint64_t upload_bytes;     // Host writes of embeddings, positions and block tables
+    uint64_t download_bytes;   // Host reads of logits and sampled tokens
+} MLXProfileStats;
+
+// MLXSetProfiling turns GPU profiling on or off
+//
+// Parameters:
+//   enabled - Nonzero to enable (clears previous totals), 0 to disable
+//
+// Returns:
+//   0 on success, MLX_ERROR_MODEL_NOT_LOADED before a model is loaded
+//
+// Multiple Models:
+//   The profiler is process-wide and records forwards of every model, but its
+//   per-layer tables are sized from the default model (MLX_DEFAULT_MODEL_HANDLE);
+//   regions of layers past that depth are counted in the outside-any-layer row
+//
+// Performance:
+//   Disabled (the default) it costs one branch per kernel region. Enabled,
+//   every (kernel kind, layer) region of a forward gets its own compute
+//   encoder with start/end GPU timestamps, which adds encoder overhead.
+int MLXSetProfiling(int enabled);
+
+// MLXGetProfileStats snapshots the profiling totals
+//
+// Parameters:
+//   out_stats - Output: totals
+//   out_kernel_ns - Output (optional): GPU ns per region, indexed
+//                   [layer * MLX_NUM_KERNEL_KINDS + kind]
+//   out_kernel_counts - Output (optional): regions recorded, same indexing
+//   capacity - Entries in each output array; should be
+//              (num_layers + 1) * MLX_NUM_KERNEL_KINDS (call once with 0 to
+//              learn num_layers)
+//
+// Returns:
+//   0 on success
+//
+// Thread Safety:
+//   Safe to call while forwards are running
+int MLXGetProfileStats(MLXProfileStats* out_stats, uint64_t* out_kernel_ns, uint64_t* out_kernel_counts, int capacity);
+
+// MLXResetProfileStats clears the profiling totals without changing whether profiling is on
+//
+// Returns:
+//   0 on success, MLX_ERROR_MODEL_NOT_LOADED before a model is loaded
+//
+// Multiple Models:
+//   Resizes the per-layer tables to the default model, as MLXSetProfiling does
+int MLXResetProfileStats(void);
+
+// MLXBenchmarkKernel times one Metal kernel on its own (cpp/mlx_bench)
+//
+// Parameters:
+//   kernel - "linear", "linear_rope", "gated_mlp", "down_proj", "rmsnorm",
+//            "add_rmsnorm", "kv_write", "paged_attention", "lm_head" or "sample"
+//   rows - Activation rows per dispatch; <= 8 selects the GEMV kernels
+//   context_tokens - Cached positions kv_write/paged_attention run against
+//   iterations - Dispatches encoded back to back into one command buffer
+//   out_gpu_ns - Output: mean GPU nanoseconds per dispatch
+//   out_error - Output: error message (caller must free with MLXFreeError)
+//
+// Returns:
+//   0 on success, MLX_ERROR_INVALID_TOKENS if kernel or out_gpu_ns is NULL,
+//   MLX_ERROR_OUT_OF_MEMORY if the scratch cache does not fit the KV pool, or
+//   an error code
+//
+// Use Case:
+//   Measuring kernel changes without a full forward. Runs on layer 0's
+//   weights with synthetic activations and a scratch cache released on return;
+//   live caches are not touched.
+int MLXBenchmarkKernel(const char* kernel, int rows, int context_tokens, int iterations,
+                       double* out_gpu_ns, char** out_error);
+
 // MLXFreeError frees an error message returned by MLX functions
 //
 // Parameters:
@@ -103,14 +807,159 @@ void MLXFreeError(char* error);
 //   0 on success, non-zero error code on failure
 //
 // Thread Safety:
-//   NOT thread-safe - call once during initialization
+//   Safe to call while forwards are in flight; they finish on the previous
+//   model and later calls use the new one. The model becomes the default
+//   (MLX_DEFAULT_MODEL_HANDLE) and replaces the one the previous MLXLoadModel*
+//   call loaded; models loaded with MLXLoadModelHandle stay resident
 int MLXLoadModel(const char* model_path, int vocab_size);
 
+// Per-load settings (MLXLoadModelWithOptions, MLXLoadModelHandle, MLXServeShard)
+//
+// Every load takes its own options, so concurrent loads (e.g. a sharded target
+// and a local draft model) cannot pick up each other's settings. A
+// zero-initialized struct, or a NULL pointer, selects the defaults.
+typedef struct {
+    // MLX_WEIGHT_FORMAT_* for the linear projections and lm_head (embeddings
+    // and norms stay float32)
+    int weight_format;
+    // Elements per scale/zero-point group for Q8/Q4; must be a multiple of 8
+    // dividing the in_features of every projection. <= 0 selects
+    // MLX_DEFAULT_QUANT_GROUP_SIZE
+    int quant_group_size;
+    // Most prompt tokens of one sequence ingested per engine step; longer
+    // prompts are prefilled over several steps that also carry other sessions'
+    // decode tokens. <= 0 selects MLX_DEFAULT_PREFILL_CHUNK_TOKENS
+    int prefill_chunk_tokens;
+    // Directory of the MTLBinaryArchive the load looks its pipeline states up
+    // in (one file per kernel build, GPU and model configuration) and adds the
+    // ones it had to compile to, so later starts skip shader compilation.
+    // Created if missing; NULL or "" selects $TMPDIR or /tmp
+    const char* pipeline_cache_dir;
+    // Comma-separated host:port of tensor-parallel ranks 1..N-1, in rank
+    // order; NULL or "" loads the whole model on this host (see below)
+    const char* tensor_parallel_peers;
+} MLXLoadOptions;
+
+// MLXLoadModelWithOptions loads a model with the given MLXLoadOptions
+//
+// Parameters:
+//   model_path - Path to the model directory or safetensors file
+//   vocab_size - Vocabulary size of the model
+//   options - Load settings; NULL selects the defaults
+//
+// Returns:
+//   0 on success, MLX_ERROR_INVALID_TOKENS if options are invalid (unknown
+//   weight format, a peer that is not host:port), non-zero error code on
+//   other failures
+//
+// Memory Management:
+//   F32 weights are mapped zero-copy; other formats are converted at load time
+//   (F16/BF16 halve and Q8/Q4 roughly quarter/eighth the resident weight bytes)
+//
+// Tensor Parallelism:
+//   With tensor_parallel_peers the model becomes rank 0 of a tensor-parallel
+//   group of N = peers + 1 ranks: each rank holds 1/N of every layer's
+//   query/KV heads and MLP columns (and the matching slice of the KV cache)
+//   and the per-layer partial sums are exchanged over TCP. Rank 0 keeps the
+//   scheduler, the block tables, the embeddings, the LM head and the vision
+//   and pointer heads, so the rest of the API is unchanged. Forwards of one
+//   group run one step at a time. The load connects to every peer (retrying
+//   for up to 30 seconds while it starts) and fails unless each runs
+//   MLXServeShard for the same model and rank. Caches of a sharded model
+//   cannot be offloaded, exported or imported (MLX_ERROR_COMPUTATION_FAILED),
+//   and MLXBenchmarkKernel is unavailable
+//
+// Thread Safety:
+//   Same as MLXLoadModel
+int MLXLoadModelWithOptions(const char* model_path, int vocab_size, const MLXLoadOptions* options);
+
+// MLXServeShard serves rank `rank` of a tensor-parallel group (blocking)
+//
+// Listens on listen_address, loads this rank's shard of the model and takes
+// the connection of the rank 0 process loading with
+// MLXLoadOptions::tensor_parallel_peers, then runs its steps until it
+// disconnects.
+//
+// Parameters:
+//   model_path - Path to the model directory, as for MLXLoadModel
+//   vocab_size - Vocabulary size of the model
+//   options - As for MLXLoadModelWithOptions, without tensor_parallel_peers;
+//             under Q8/Q4 quant_group_size must also divide the per-rank
+//             o_proj and down_proj in_features
+//   rank - This process's rank, 1..size-1
+//   size - Ranks in the group, rank 0 included
+//   listen_address - host:port to listen on (":port" for every interface)
+//   out_error - Output pointer to error message (caller must free with MLXFreeError)
+//
+// Returns:
+//   0 once rank 0 disconnects, MLX_ERROR_INVALID_TOKENS for invalid arguments,
+//   non-zero error code if the load, the handshake or a step fails
+//
+// Thread Safety:
+//   Blocks the calling thread; the shard is not visible to the other calls
+int MLXServeShard(const char* model_path, int vocab_size, const MLXLoadOptions* options, int rank, int size,
+                  const char* listen_address, char** out_error);
+
+// MLXLoadModelHandle loads an additional resident model and returns its handle
+//
+// Any number of models (e.g. the 3B and 7B variants, or a draft and a target
+// model for speculative decoding) can be resident at once. They share the
+// Metal device and one forward admission queue, and models whose K/V layout
+// (layers, kv_dim, block size, pool size) matches share one KV block pool and
+// budget. Every cache is tagged with its model's fingerprint: forwards reject
+// a base_cache_handle computed by a different model.
+//
+// Parameters:
+//   model_path, vocab_size, options - Same as MLXLoadModelWithOptions
+//   out_model_handle - Output: handle for the model_handle argument of forwards
+//
+// Returns:
+//   0 on success, non-zero error code on failure
+//
+// Calls without a model_handle (memory and image cache stats and budgets,
+// fingerprint, profiling) use the default model, which is the first model
+// loaded unless MLXLoadModel* or MLXSetDefaultModel chose another.
+//
+// Thread Safety:
+//   Thread-safe; models may be loaded concurrently and while others serve
+int MLXLoadModelHandle(const char* model_path, int vocab_size, const MLXLoadOptions* options,
+                       uintptr_t* out_model_handle);
+
+// MLXUnloadModel releases a model handle
+//
+// Forwards in flight finish first; the model's weights are freed once they
+// have. Its cache handles stay valid for MLXFreeCache, export and stats.
+//
+// Returns:
+//   0 on success, MLX_ERROR_MODEL_NOT_LOADED if model_handle is unknown
+int MLXUnloadModel(uintptr_t model_handle);
+
+// MLXSetDefaultModel makes model_handle the model MLX_DEFAULT_MODEL_HANDLE names
+//
+// Returns:
+//   0 on success, MLX_ERROR_MODEL_NOT_LOADED if model_handle is unknown
+int MLXSetDefaultModel(uintptr_t model_handle);
+
 // =============================================================================
 // Constants
 // =============================================================================
 
 #define MLX_ROOT_CACHE_HANDLE 0
+#define MLX_DEFAULT_MODEL_HANDLE 0
+
+// Weight storage formats for MLXLoadOptions
+#define MLX_WEIGHT_FORMAT_F32 0
+#define MLX_WEIGHT_FORMAT_F16 1
+#define MLX_WEIGHT_FORMAT_BF16 2
+#define MLX_WEIGHT_FORMAT_Q8 3
+#define MLX_WEIGHT_FORMAT_Q4 4
+#define MLX_DEFAULT_QUANT_GROUP_SIZE 64
+
+// Default prefill chunk for MLXLoadOptions
+#define MLX_DEFAULT_PREFILL_CHUNK_TOKENS 512
+
+// Largest top_k / num_logprobs served by MLXForwardSample
+#define MLX_MAX_SAMPLE_CANDIDATES 256
 
 // =============================================================================
 // Error Codes
@@ -123,6 +972,9 @@ int MLXLoadModel(const char* model_path, int vocab_size);
 #define MLX_ERROR_COMPUTATION_FAILED -4
 #define MLX_ERROR_MODEL_NOT_LOADED -5
 
+// Not an error: MLXPollForward's submitted forward is still running
+#define MLX_PENDING 1
+
 #ifdef __cplusplus
 }
 #endif
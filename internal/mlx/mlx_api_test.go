@@ -25,8 +25,36 @@ func TestMLXFunctionSignatures(t *testing.T) {
 	// Verify functions are callable (type checking)
 	// If signatures don't match, this will fail to compile
 	_ = ForwardWithCache
+	_ = ForwardBatch
+	_ = ForwardSample
+	_ = ForwardMultimodal
+	_ = ForwardPointer
+	_ = SetImageCacheBudget
+	_ = GetImageCacheStats
+	_ = VerifyDraft
+	_ = DraftNgram
 	_ = SliceCache
 	_ = FreeCache
+	_ = GetMemoryStats
+	_ = CacheBytes
+	_ = SetMemoryBudget
+	_ = OffloadCache
+	_ = PrefetchCache
+	_ = CacheTier
+	_ = SetOffloadOptions
+	_ = ExportCache
+	_ = ImportCache
+	_ = CacheTokens
+	_ = ModelFingerprint
+	_ = SetProfiling
+	_ = GetProfileStats
+	_ = ResetProfileStats
+	_ = LoadModelHandle
+	_ = UnloadModel
+	_ = SetDefaultModel
+	_ = ServeShard
+	_ = SubmitForward
+	_ = (*ForwardFuture).Result
 }
 
 // TestMLXAPIHeaderCompilation verifies the C header compiles with CGO
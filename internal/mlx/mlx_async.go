@@ -0,0 +1,87 @@
+//go:build !mlx_mock
+
+package mlx
+
+/*
+#cgo CFLAGS: -I.
+
+#include "mlx_api.h"
+
+extern void mlxForwardComplete(uint64_t ticket, int status, uintptr_t user_data);
+*/
+import "C"
+import (
+	"errors"
+	"runtime/cgo"
+	"unsafe"
+)
+
+// mlxForwardComplete is the MLXForwardCallback of every SubmitForward; it
+// runs on the engine's step thread, so it only wakes the future's waiters
+//
+//export mlxForwardComplete
+func mlxForwardComplete(ticket C.uint64_t, status C.int, userData C.uintptr_t) {
+	h := cgo.Handle(userData)
+	close(h.Value().(*ForwardFuture).done)
+	h.Delete()
+}
+
+// SubmitForward queues a forward like ForwardWithCache and returns at once
+// The engine drives submitted forwards on its own thread, so waiting on the
+// future holds a goroutine but no OS thread.
+func SubmitForward(modelHandle uintptr, tokens []uint32, baseCacheHandle uint64) (*ForwardFuture, error) {
+	if len(tokens) == 0 {
+		return nil, errors.New("tokens must not be empty")
+	}
+
+	future := &ForwardFuture{done: make(chan struct{})}
+	h := cgo.NewHandle(future)
+
+	var ticket C.uint64_t
+	var outErrorMsg *C.char
+	ret := C.MLXSubmitForward(
+		C.uintptr_t(modelHandle),
+		(*C.uint32_t)(unsafe.Pointer(&tokens[0])),
+		C.int(len(tokens)),
+		C.uint64_t(baseCacheHandle),
+		C.MLXForwardCallback(C.mlxForwardComplete),
+		C.uintptr_t(h),
+		&ticket,
+		&outErrorMsg,
+	)
+	if ret != C.MLX_SUCCESS {
+		h.Delete()
+		if outErrorMsg != nil {
+			errMsg := C.GoString(outErrorMsg)
+			C.MLXFreeError(outErrorMsg)
+			return nil, errors.New(errMsg)
+		}
+		return nil, errors.New("MLX error: unknown failure")
+	}
+
+	future.ticket = uint64(ticket)
+	return future, nil
+}
+
+// Result waits for Done and collects the forward: logits (vocab_size, or nil
+// to discard them) are filled and the new cache handle is returned
+func (f *ForwardFuture) Result(logits []float32) (uint64, error) {
+	<-f.done
+
+	var logitsPtr *C.float
+	if len(logits) > 0 {
+		logitsPtr = (*C.float)(unsafe.Pointer(&logits[0]))
+	}
+	var outCacheHandle C.uint64_t
+	var outErrorMsg *C.char
+	ret := C.MLXPollForward(C.uint64_t(f.ticket), logitsPtr, C.int(len(logits)), &outCacheHandle, &outErrorMsg)
+	if ret != C.MLX_SUCCESS {
+		if outErrorMsg != nil {
+			errMsg := C.GoString(outErrorMsg)
+			C.MLXFreeError(outErrorMsg)
+			return 0, errors.New(errMsg)
+		}
+		return 0, errors.New("MLX error: forward result already collected or logits buffer too small")
+	}
+	return uint64(outCacheHandle), nil
+}
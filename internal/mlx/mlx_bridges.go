@@ -13,6 +13,8 @@ package mlx
 import "C"
 import (
 	"errors"
+	"runtime"
+	"strings"
 	"unsafe"
 )
 
@@ -72,6 +74,374 @@ func ForwardWithCache(
 	return uint64(outCacheHandle), nil
 }
 
+// ForwardBatch runs one step for several sequences at once
+// tokens[i] extends baseCacheHandles[i]; all sequences are packed into one
+// ragged batch so each weight matrix is read once per step.
+// logits must be pre-allocated with len(tokens) * vocab_size elements;
+// sequence i's logits start at i * vocab_size.
+// Returns one new cache handle per sequence
+func ForwardBatch(
+	modelHandle uintptr,
+	tokens [][]uint32,
+	baseCacheHandles []uint64,
+	logits []float32,
+) ([]uint64, error) {
+	flat, counts, err := packBatch(tokens, baseCacheHandles)
+	if err != nil {
+		return nil, err
+	}
+
+	if len(logits) == 0 {
+		return nil, errors.New("logits buffer must be pre-allocated")
+	}
+
+	outCacheHandles := make([]uint64, len(tokens))
+	var outErrorMsg *C.char
+
+	ret := C.MLXForwardBatch(
+		C.uintptr_t(modelHandle),
+		C.int(len(tokens)),
+		(*C.uint32_t)(unsafe.Pointer(&flat[0])),
+		(*C.int)(unsafe.Pointer(&counts[0])),
+		(*C.uint64_t)(unsafe.Pointer(&baseCacheHandles[0])),
+		(*C.float)(unsafe.Pointer(&logits[0])),
+		C.int(len(logits)),
+		(*C.uint64_t)(unsafe.Pointer(&outCacheHandles[0])),
+		&outErrorMsg,
+	)
+
+	if ret != C.MLX_SUCCESS {
+		if outErrorMsg != nil {
+			errMsg := C.GoString(outErrorMsg)
+			C.MLXFreeError(outErrorMsg)
+			return nil, errors.New(errMsg)
+		}
+		return nil, errors.New("MLX error: unknown failure")
+	}
+
+	return outCacheHandles, nil
+}
+
+// ForwardSample executes MLX inference and samples the next token on the GPU
+// Only the token and opts.NumLogprobs top (id, logprob) pairs cross CGO
+func ForwardSample(
+	modelHandle uintptr,
+	tokens []uint32,
+	baseCacheHandle uint64,
+	opts SampleOptions,
+) (SampleResult, uint64, error) {
+	if len(tokens) == 0 {
+		return SampleResult{}, 0, errors.New("empty tokens")
+	}
+	if err := opts.Validate(); err != nil {
+		return SampleResult{}, 0, err
+	}
+
+	biasIDs, biasValues := opts.biasArrays()
+	var cBiasIDs *C.uint32_t
+	var cBiasValues *C.float
+	if len(biasIDs) > 0 {
+		cBiasIDs = (*C.uint32_t)(unsafe.Pointer(&biasIDs[0]))
+		cBiasValues = (*C.float)(unsafe.Pointer(&biasValues[0]))
+	}
+
+	topIDs := make([]uint32, opts.NumLogprobs)
+	topLogprobs := make([]float32, opts.NumLogprobs)
+	var cTopIDs *C.uint32_t
+	var cTopLogprobs *C.float
+	if opts.NumLogprobs > 0 {
+		cTopIDs = (*C.uint32_t)(unsafe.Pointer(&topIDs[0]))
+		cTopLogprobs = (*C.float)(unsafe.Pointer(&topLogprobs[0]))
+	}
+
+	var outToken C.uint32_t
+	var outCacheHandle C.uint64_t
+	var outErrorMsg *C.char
+
+	ret := C.MLXForwardSample(
+		C.uintptr_t(modelHandle),
+		(*C.uint32_t)(unsafe.Pointer(&tokens[0])),
+		C.int(len(tokens)),
+		C.uint64_t(baseCacheHandle),
+		C.float(opts.Temperature),
+		C.int(opts.TopK),
+		C.float(opts.TopP),
+		C.uint64_t(opts.Seed),
+		cBiasIDs,
+		cBiasValues,
+		C.int(len(biasIDs)),
+		C.int(opts.NumLogprobs),
+		&outToken,
+		cTopIDs,
+		cTopLogprobs,
+		&outCacheHandle,
+		&outErrorMsg,
+	)
+
+	if ret != C.MLX_SUCCESS {
+		if outErrorMsg != nil {
+			errMsg := C.GoString(outErrorMsg)
+			C.MLXFreeError(outErrorMsg)
+			return SampleResult{}, 0, errors.New(errMsg)
+		}
+		return SampleResult{}, 0, errors.New("MLX error: unknown failure")
+	}
+
+	result := SampleResult{Token: uint32(outToken)}
+	for i := range topIDs {
+		result.TopLogprobs = append(result.TopLogprobs, TokenLogprob{Token: topIDs[i], Logprob: topLogprobs[i]})
+	}
+	return result, uint64(outCacheHandle), nil
+}
+
+// ForwardMultimodal executes MLX inference over a prompt with images
+// Each image fills the next run of ImageTokenID placeholders in tokens; the
+// engine encodes it (or reuses its cached encoding by Hash) and writes the
+// embeddings at the placeholder positions. logits must hold vocab_size values.
+func ForwardMultimodal(
+	modelHandle uintptr,
+	tokens []uint32,
+	images []ImageInput,
+	baseCacheHandle uint64,
+	logits []float32,
+) (uint64, error) {
+	if len(tokens) == 0 {
+		return 0, nil
+	}
+	if len(logits) == 0 {
+		return 0, errors.New("logits buffer must be pre-allocated")
+	}
+	if err := validateImages(tokens, images); err != nil {
+		return 0, err
+	}
+
+	var pinner runtime.Pinner
+	defer pinner.Unpin()
+	cImages, cImagesPtr := imageInputs(images, &pinner)
+
+	var outCacheHandle C.uint64_t
+	var outErrorMsg *C.char
+
+	ret := C.MLXForwardMultimodal(
+		C.uintptr_t(modelHandle),
+		(*C.uint32_t)(unsafe.Pointer(&tokens[0])),
+		C.int(len(tokens)),
+		cImagesPtr,
+		C.int(len(cImages)),
+		C.uint64_t(baseCacheHandle),
+		(*C.float)(unsafe.Pointer(&logits[0])),
+		C.int(len(logits)),
+		&outCacheHandle,
+		&outErrorMsg,
+	)
+
+	if ret != C.MLX_SUCCESS {
+		if outErrorMsg != nil {
+			errMsg := C.GoString(outErrorMsg)
+			C.MLXFreeError(outErrorMsg)
+			return 0, errors.New(errMsg)
+		}
+		return 0, errors.New("MLX error: unknown failure")
+	}
+
+	return uint64(outCacheHandle), nil
+}
+
+// imageInputs converts images for the C API. The engine copies the pixels
+// during the call; they are pinned so the C array may point at them.
+func imageInputs(images []ImageInput, pinner *runtime.Pinner) ([]C.MLXImageInput, *C.MLXImageInput) {
+	cImages := make([]C.MLXImageInput, len(images))
+	for i, image := range images {
+		pinner.Pin(&image.Pixels[0])
+		cImages[i] = C.MLXImageInput{
+			pixel_values: (*C.float)(unsafe.Pointer(&image.Pixels[0])),
+			grid_t:       C.int(image.GridT),
+			grid_h:       C.int(image.GridH),
+			grid_w:       C.int(image.GridW),
+			hash:         C.uint64_t(image.Hash),
+		}
+	}
+	if len(cImages) == 0 {
+		return cImages, nil
+	}
+	return cImages, &cImages[0]
+}
+
+// ForwardPointer grounds the action token ending tokens (see PointerPrompt)
+// to image patches with the model's pointer head, on the device
+// Returns up to topK candidates in descending score order and a cache handle
+// holding the prompt.
+func ForwardPointer(
+	modelHandle uintptr,
+	tokens []uint32,
+	images []ImageInput,
+	baseCacheHandle uint64,
+	topK int,
+) ([]PointerCandidate, uint64, error) {
+	if len(tokens) == 0 {
+		return nil, 0, errors.New("empty tokens")
+	}
+	if err := validatePointerInput(tokens, images, topK); err != nil {
+		return nil, 0, err
+	}
+
+	var pinner runtime.Pinner
+	defer pinner.Unpin()
+	cImages, cImagesPtr := imageInputs(images, &pinner)
+	cCandidates := make([]C.MLXPointerCandidate, topK)
+
+	var outCount C.int
+	var outCacheHandle C.uint64_t
+	var outErrorMsg *C.char
+
+	ret := C.MLXForwardPointer(
+		C.uintptr_t(modelHandle),
+		(*C.uint32_t)(unsafe.Pointer(&tokens[0])),
+		C.int(len(tokens)),
+		cImagesPtr,
+		C.int(len(cImages)),
+		C.uint64_t(baseCacheHandle),
+		C.int(topK),
+		&cCandidates[0],
+		&outCount,
+		&outCacheHandle,
+		&outErrorMsg,
+	)
+
+	if ret != C.MLX_SUCCESS {
+		if outErrorMsg != nil {
+			errMsg := C.GoString(outErrorMsg)
+			C.MLXFreeError(outErrorMsg)
+			return nil, 0, errors.New(errMsg)
+		}
+		return nil, 0, errors.New("MLX error: unknown failure")
+	}
+
+	candidates := make([]PointerCandidate, int(outCount))
+	for i := range candidates {
+		c := cCandidates[i]
+		candidates[i] = PointerCandidate{
+			Image: int(c.image),
+			Patch: int(c.patch),
+			Score: float32(c.score),
+			X:     float32(c.x),
+			Y:     float32(c.y),
+		}
+	}
+	return candidates, uint64(outCacheHandle), nil
+}
+
+// SetImageCacheBudget caps device memory held by encoded images; budgetBytes <= 0 disables the cache
+// Only the default model's cache is changed (see SetDefaultModel)
+func SetImageCacheBudget(budgetBytes int64) error {
+	if ret := C.MLXSetImageCacheBudget(C.int64_t(budgetBytes)); ret != C.MLX_SUCCESS {
+		return errors.New("MLX error: model not loaded")
+	}
+	return nil
+}
+
+// GetImageCacheStats reports encoded-image cache usage of the default model (see SetDefaultModel)
+func GetImageCacheStats() (ImageCacheStats, error) {
+	var stats C.MLXImageCacheStats
+	if ret := C.MLXGetImageCacheStats(&stats); ret != C.MLX_SUCCESS {
+		return ImageCacheStats{}, errors.New("MLX error: model not loaded")
+	}
+	return ImageCacheStats{
+		Entries:     int64(stats.entries),
+		Bytes:       int64(stats.bytes),
+		BudgetBytes: int64(stats.budget_bytes),
+		Hits:        uint64(stats.hits),
+		Misses:      uint64(stats.misses),
+	}, nil
+}
+
+// VerifyDraft forwards pending followed by drafts in one pass and accepts the
+// leading drafts the target model's own samples agree with
+// The returned handle holds pending and the accepted drafts. logits, if
+// non-nil, receives every position's logits and must hold
+// (len(drafts) + 1) * vocab_size values.
+func VerifyDraft(
+	modelHandle uintptr,
+	pending uint32,
+	drafts []uint32,
+	baseCacheHandle uint64,
+	opts SampleOptions,
+	logits []float32,
+) (VerifyResult, uint64, error) {
+	if err := validateVerifyOptions(opts); err != nil {
+		return VerifyResult{}, 0, err
+	}
+
+	tokens := verifyInput(pending, drafts)
+	sampled := make([]uint32, len(tokens))
+	var cLogits *C.float
+	if len(logits) > 0 {
+		cLogits = (*C.float)(unsafe.Pointer(&logits[0]))
+	}
+
+	var outAccepted C.int
+	var outCacheHandle C.uint64_t
+	var outErrorMsg *C.char
+
+	ret := C.MLXVerifyDraft(
+		C.uintptr_t(modelHandle),
+		(*C.uint32_t)(unsafe.Pointer(&tokens[0])),
+		C.int(len(tokens)),
+		C.uint64_t(baseCacheHandle),
+		C.float(opts.Temperature),
+		C.int(opts.TopK),
+		C.float(opts.TopP),
+		C.uint64_t(opts.Seed),
+		&outAccepted,
+		(*C.uint32_t)(unsafe.Pointer(&sampled[0])),
+		cLogits,
+		C.int(len(logits)),
+		&outCacheHandle,
+		&outErrorMsg,
+	)
+
+	if ret != C.MLX_SUCCESS {
+		if outErrorMsg != nil {
+			errMsg := C.GoString(outErrorMsg)
+			C.MLXFreeError(outErrorMsg)
+			return VerifyResult{}, 0, errors.New(errMsg)
+		}
+		return VerifyResult{}, 0, errors.New("MLX error: unknown failure")
+	}
+
+	result := VerifyResult{Accepted: int(outAccepted), Sampled: sampled}
+	if len(logits) > 0 {
+		result.Logits = logits
+	}
+	return result, uint64(outCacheHandle), nil
+}
+
+// DraftNgram proposes up to maxDraft tokens by prompt lookup over the cache's
+// tokens followed by pending; nil when no suffix of up to maxNgram tokens recurs
+func DraftNgram(cacheHandle uint64, pending []uint32, maxNgram, maxDraft int) ([]uint32, error) {
+	if maxDraft <= 0 {
+		return nil, nil
+	}
+	var cPending *C.uint32_t
+	if len(pending) > 0 {
+		cPending = (*C.uint32_t)(unsafe.Pointer(&pending[0]))
+	}
+	draft := make([]uint32, maxDraft)
+	var count C.int
+	ret := C.MLXDraftNgram(C.uint64_t(cacheHandle), cPending, C.int(len(pending)), C.int(maxNgram),
+		C.int(maxDraft), (*C.uint32_t)(unsafe.Pointer(&draft[0])), &count)
+	if ret == C.MLX_ERROR_INVALID_HANDLE {
+		return nil, errors.New("MLX error: invalid cache handle")
+	}
+	if ret != C.MLX_SUCCESS {
+		return nil, errors.New("MLX error: invalid draft request")
+	}
+	if count == 0 {
+		return nil, nil
+	}
+	return draft[:int(count)], nil
+}
+
 // SliceCache creates a zero-copy view of an existing cache
 func SliceCache(cacheHandle uint64, keepTokens int) (uint64, error) {
 	var outSlicedHandle C.uint64_t
@@ -101,6 +471,197 @@ func FreeCache(cacheHandle uint64) {
 	C.MLXFreeCache(C.uint64_t(cacheHandle))
 }
 
+// GetMemoryStats reports KV pool usage of the default model (see SetDefaultModel);
+// HostBytes and DiskBytes cover every loaded model
+func GetMemoryStats() (MemoryStats, error) {
+	var stats C.MLXMemoryStats
+	if ret := C.MLXGetMemoryStats(&stats); ret != C.MLX_SUCCESS {
+		return MemoryStats{}, errors.New("MLX error: model not loaded")
+	}
+	return MemoryStats{
+		UsedBytes:     int64(stats.used_bytes),
+		BudgetBytes:   int64(stats.budget_bytes),
+		CapacityBytes: int64(stats.capacity_bytes),
+		BlockBytes:    int64(stats.block_bytes),
+		HostBytes:     int64(stats.host_bytes),
+		DiskBytes:     int64(stats.disk_bytes),
+	}, nil
+}
+
+// CacheBytes reports the KV memory a handle references and the part only it
+// references (what FreeCache would release now)
+func CacheBytes(cacheHandle uint64) (total int64, exclusive int64, err error) {
+	var outBytes, outExclusive C.int64_t
+	if ret := C.MLXGetCacheBytes(C.uint64_t(cacheHandle), &outBytes, &outExclusive); ret != C.MLX_SUCCESS {
+		return 0, 0, errors.New("MLX error: invalid cache handle")
+	}
+	return int64(outBytes), int64(outExclusive), nil
+}
+
+// SetMemoryBudget caps KV memory; budgetBytes <= 0 removes the cap
+func SetMemoryBudget(budgetBytes int64) error {
+	if ret := C.MLXSetMemoryBudget(C.int64_t(budgetBytes)); ret != C.MLX_SUCCESS {
+		return errors.New("MLX error: model not loaded")
+	}
+	return nil
+}
+
+// OffloadCache moves a handle's KV out of the device pool to tier (CacheTierHost or CacheTierDisk)
+func OffloadCache(cacheHandle uint64, tier int) error {
+	var outErrorMsg *C.char
+	ret := C.MLXOffloadCache(C.uint64_t(cacheHandle), C.int(tier), &outErrorMsg)
+	if ret != C.MLX_SUCCESS {
+		if outErrorMsg != nil {
+			errMsg := C.GoString(outErrorMsg)
+			C.MLXFreeError(outErrorMsg)
+			return errors.New(errMsg)
+		}
+		return errors.New("MLX error: invalid cache handle")
+	}
+	return nil
+}
+
+// PrefetchCache starts restoring an offloaded handle in the background
+func PrefetchCache(cacheHandle uint64) error {
+	if ret := C.MLXPrefetchCache(C.uint64_t(cacheHandle)); ret != C.MLX_SUCCESS {
+		return errors.New("MLX error: invalid cache handle")
+	}
+	return nil
+}
+
+// CacheTier reports where a handle's KV resides (CacheTier*)
+func CacheTier(cacheHandle uint64) (int, error) {
+	var outTier C.int
+	if ret := C.MLXGetCacheTier(C.uint64_t(cacheHandle), &outTier); ret != C.MLX_SUCCESS {
+		return 0, errors.New("MLX error: invalid cache handle")
+	}
+	return int(outTier), nil
+}
+
+// SetOffloadOptions configures the spill directory and host-tier budget
+func SetOffloadOptions(opts OffloadOptions) error {
+	if err := opts.Validate(); err != nil {
+		return err
+	}
+	cDir := C.CString(opts.Directory)
+	defer C.free(unsafe.Pointer(cDir))
+	C.MLXSetOffloadConfig(cDir, C.int64_t(opts.HostBudgetBytes))
+	return nil
+}
+
+// ExportCache writes a cache handle (tokens, K/V, model fingerprint) to path
+func ExportCache(cacheHandle uint64, path string) error {
+	cPath := C.CString(path)
+	defer C.free(unsafe.Pointer(cPath))
+
+	var outErrorMsg *C.char
+	ret := C.MLXExportCache(C.uint64_t(cacheHandle), cPath, &outErrorMsg)
+	if ret != C.MLX_SUCCESS {
+		if outErrorMsg != nil {
+			errMsg := C.GoString(outErrorMsg)
+			C.MLXFreeError(outErrorMsg)
+			return errors.New(errMsg)
+		}
+		return errors.New("MLX error: invalid cache handle")
+	}
+	return nil
+}
+
+// ImportCache maps a snapshot written by ExportCache as a new (disk-tier) handle
+func ImportCache(path string) (uint64, error) {
+	cPath := C.CString(path)
+	defer C.free(unsafe.Pointer(cPath))
+
+	var outCacheHandle C.uint64_t
+	var outErrorMsg *C.char
+	ret := C.MLXImportCache(cPath, &outCacheHandle, &outErrorMsg)
+	if ret != C.MLX_SUCCESS {
+		if outErrorMsg != nil {
+			errMsg := C.GoString(outErrorMsg)
+			C.MLXFreeError(outErrorMsg)
+			return 0, errors.New(errMsg)
+		}
+		return 0, errors.New("MLX error: unknown failure")
+	}
+	return uint64(outCacheHandle), nil
+}
+
+// CacheTokens returns the token sequence behind a cache handle
+func CacheTokens(cacheHandle uint64) ([]uint32, error) {
+	var count C.int
+	if ret := C.MLXGetCacheTokens(C.uint64_t(cacheHandle), nil, 0, &count); ret != C.MLX_SUCCESS {
+		return nil, errors.New("MLX error: invalid cache handle")
+	}
+	tokens := make([]uint32, int(count))
+	if count == 0 {
+		return tokens, nil
+	}
+	ret := C.MLXGetCacheTokens(C.uint64_t(cacheHandle), (*C.uint32_t)(unsafe.Pointer(&tokens[0])), count, &count)
+	if ret != C.MLX_SUCCESS {
+		return nil, errors.New("MLX error: invalid cache handle")
+	}
+	return tokens, nil
+}
+
+// ModelFingerprint identifies the loaded model's config and weights
+func ModelFingerprint() (uint64, error) {
+	var out C.uint64_t
+	if ret := C.MLXGetModelFingerprint(&out); ret != C.MLX_SUCCESS {
+		return 0, errors.New("MLX error: model not loaded")
+	}
+	return uint64(out), nil
+}
+
+// SetProfiling turns GPU profiling on (clearing previous totals) or off
+// The profiler records every model but sizes its per-layer tables from the default model
+func SetProfiling(enabled bool) error {
+	flag := C.int(0)
+	if enabled {
+		flag = 1
+	}
+	if ret := C.MLXSetProfiling(flag); ret != C.MLX_SUCCESS {
+		return errors.New("MLX error: model not loaded")
+	}
+	return nil
+}
+
+// GetProfileStats snapshots the GPU profile
+func GetProfileStats() (ProfileStats, error) {
+	var stats C.MLXProfileStats
+	if ret := C.MLXGetProfileStats(&stats, nil, nil, 0); ret != C.MLX_SUCCESS {
+		return ProfileStats{}, errors.New("MLX error: profile unavailable")
+	}
+	rows := int(stats.num_layers) + 1
+	entries := rows * NumKernelKinds
+	nanos := make([]C.uint64_t, entries)
+	counts := make([]C.uint64_t, entries)
+	if ret := C.MLXGetProfileStats(&stats, &nanos[0], &counts[0], C.int(entries)); ret != C.MLX_SUCCESS {
+		return ProfileStats{}, errors.New("MLX error: profile unavailable")
+	}
+
+	profile := ProfileStats{
+		Enabled:             stats.enabled != 0,
+		TimestampsSupported: stats.timestamps_supported != 0,
+		CommandBuffers:      uint64(stats.command_buffers),
+		GPUNanos:            uint64(stats.gpu_ns),
+		UploadBytes:         uint64(stats.upload_bytes),
+		DownloadBytes:       uint64(stats.download_bytes),
+		Layers:              make([][NumKernelKinds]KernelTime, rows),
+	}
+	for i := range nanos {
+		profile.Layers[i/NumKernelKinds][i%NumKernelKinds] = KernelTime{Nanos: uint64(nanos[i]), Count: uint64(counts[i])}
+	}
+	return profile, nil
+}
+
+// ResetProfileStats clears the profiling totals, resizing them to the default model
+func ResetProfileStats() error {
+	if ret := C.MLXResetProfileStats(); ret != C.MLX_SUCCESS {
+		return errors.New("MLX error: model not loaded")
+	}
+	return nil
+}
+
 // FreeError frees an error message
 func FreeError(errMsg *C.char) {
 	C.MLXFreeError(errMsg)
@@ -119,3 +680,118 @@ func LoadModel(modelPath string, vocabSize int) error {
 
 	return nil
 }
+
+// LoadModelWithOptions loads an MLX model with the given weight storage format and prefill chunking
+func LoadModelWithOptions(modelPath string, vocabSize int, opts LoadOptions) error {
+	if err := opts.Validate(); err != nil {
+		return err
+	}
+
+	cPath := C.CString(modelPath)
+	defer C.free(unsafe.Pointer(cPath))
+	cOpts, free := loadOptions(opts)
+	defer free()
+
+	ret := C.MLXLoadModelWithOptions(cPath, C.int(vocabSize), &cOpts)
+
+	if ret != C.MLX_SUCCESS {
+		return errors.New("MLX error: failed to load model")
+	}
+
+	return nil
+}
+
+// loadOptions converts opts for one load call; free releases its strings once the call returns
+func loadOptions(opts LoadOptions) (C.MLXLoadOptions, func()) {
+	cOpts := C.MLXLoadOptions{
+		weight_format:        C.int(opts.WeightFormat),
+		quant_group_size:     C.int(opts.QuantGroupSize),
+		prefill_chunk_tokens: C.int(opts.PrefillChunkTokens),
+	}
+	if opts.PipelineCacheDir != "" {
+		cOpts.pipeline_cache_dir = C.CString(opts.PipelineCacheDir)
+	}
+	if len(opts.TensorParallelPeers) > 0 {
+		cOpts.tensor_parallel_peers = C.CString(strings.Join(opts.TensorParallelPeers, ","))
+	}
+	return cOpts, func() {
+		C.free(unsafe.Pointer(cOpts.pipeline_cache_dir))
+		C.free(unsafe.Pointer(cOpts.tensor_parallel_peers))
+	}
+}
+
+// LoadModelHandle loads an additional resident model and returns its handle
+// for the modelHandle argument of the forward calls. Models share the Metal
+// device, the forward queue and (for matching KV layouts) the KV block pool;
+// caches of one model are rejected as the base of another's forwards.
+func LoadModelHandle(modelPath string, vocabSize int, opts LoadOptions) (uintptr, error) {
+	if err := opts.Validate(); err != nil {
+		return 0, err
+	}
+
+	cPath := C.CString(modelPath)
+	defer C.free(unsafe.Pointer(cPath))
+	cOpts, free := loadOptions(opts)
+	defer free()
+
+	var handle C.uintptr_t
+	ret := C.MLXLoadModelHandle(cPath, C.int(vocabSize), &cOpts, &handle)
+
+	if ret != C.MLX_SUCCESS {
+		return 0, errors.New("MLX error: failed to load model")
+	}
+
+	return uintptr(handle), nil
+}
+
+// UnloadModel releases a handle from LoadModelHandle; in-flight forwards finish first
+func UnloadModel(modelHandle uintptr) error {
+	if ret := C.MLXUnloadModel(C.uintptr_t(modelHandle)); ret != C.MLX_SUCCESS {
+		return errors.New("MLX error: model not loaded")
+	}
+	return nil
+}
+
+// ServeShard loads tensor-parallel rank `rank` of `size` of modelPath and serves
+// it to the rank 0 process whose LoadOptions.TensorParallelPeers lists
+// listenAddress (host:port, or :port for every interface). It blocks until
+// rank 0 disconnects, which returns nil; the group's caches die with it.
+func ServeShard(modelPath string, vocabSize int, opts LoadOptions, rank, size int, listenAddress string) error {
+	if err := opts.Validate(); err != nil {
+		return err
+	}
+	if rank < 1 || rank >= size {
+		return errors.New("MLX error: shard rank must be in [1, size)")
+	}
+	if len(opts.TensorParallelPeers) > 0 {
+		return errors.New("MLX error: shards take no tensor-parallel peers")
+	}
+
+	cPath := C.CString(modelPath)
+	defer C.free(unsafe.Pointer(cPath))
+	cAddress := C.CString(listenAddress)
+	defer C.free(unsafe.Pointer(cAddress))
+	cOpts, free := loadOptions(opts)
+	defer free()
+
+	var outErrorMsg *C.char
+	ret := C.MLXServeShard(cPath, C.int(vocabSize), &cOpts, C.int(rank), C.int(size), cAddress, &outErrorMsg)
+	if ret != C.MLX_SUCCESS {
+		if outErrorMsg != nil {
+			errMsg := C.GoString(outErrorMsg)
+			C.MLXFreeError(outErrorMsg)
+			return errors.New(errMsg)
+		}
+		return errors.New("MLX error: failed to serve shard")
+	}
+	return nil
+}
+
+// SetDefaultModel selects the model used by calls without a model handle
+// (memory, image cache and profile stats, budgets, ModelFingerprint)
+func SetDefaultModel(modelHandle uintptr) error {
+	if ret := C.MLXSetDefaultModel(C.uintptr_t(modelHandle)); ret != C.MLX_SUCCESS {
+		return errors.New("MLX error: model not loaded")
+	}
+	return nil
+}
@@ -37,6 +37,122 @@ func ForwardWithCache(
 	return logits, baseCacheHandle + 1, nil
 }
 
+// ForwardBatch is a mock implementation
+func ForwardBatch(
+	modelHandle uintptr,
+	tokens [][]uint32,
+	baseCacheHandles []uint64,
+	logits []float32,
+) ([]uint64, error) {
+	if _, _, err := packBatch(tokens, baseCacheHandles); err != nil {
+		return nil, err
+	}
+
+	// Mock: fake logits and one new cache handle per sequence
+	for i := range logits {
+		logits[i] = 0.01
+	}
+	handles := make([]uint64, len(tokens))
+	for i, base := range baseCacheHandles {
+		handles[i] = base + 1
+	}
+	return handles, nil
+}
+
+// ForwardSample is a mock implementation
+func ForwardSample(
+	modelHandle uintptr,
+	tokens []uint32,
+	baseCacheHandle uint64,
+	opts SampleOptions,
+) (SampleResult, uint64, error) {
+	if len(tokens) == 0 {
+		return SampleResult{}, 0, errors.New("empty tokens")
+	}
+	if err := opts.Validate(); err != nil {
+		return SampleResult{}, 0, err
+	}
+
+	// Mock: always pick token 0 with uniform logprobs over a 32000-token vocabulary
+	result := SampleResult{}
+	for i := 0; i < opts.NumLogprobs; i++ {
+		result.TopLogprobs = append(result.TopLogprobs, TokenLogprob{Token: uint32(i), Logprob: -10.373491})
+	}
+	return result, baseCacheHandle + 1, nil
+}
+
+// ForwardMultimodal is a mock implementation
+func ForwardMultimodal(
+	modelHandle uintptr,
+	tokens []uint32,
+	images []ImageInput,
+	baseCacheHandle uint64,
+	logits []float32,
+) (uint64, error) {
+	if err := validateImages(tokens, images); err != nil {
+		return 0, err
+	}
+	if len(tokens) == 0 {
+		return 0, errors.New("empty tokens")
+	}
+	for i := range logits {
+		logits[i] = 0.01
+	}
+	return baseCacheHandle + 1, nil
+}
+
+// ForwardPointer is a mock implementation
+func ForwardPointer(
+	modelHandle uintptr,
+	tokens []uint32,
+	images []ImageInput,
+	baseCacheHandle uint64,
+	topK int,
+) ([]PointerCandidate, uint64, error) {
+	if len(tokens) == 0 {
+		return nil, 0, errors.New("empty tokens")
+	}
+	if err := validatePointerInput(tokens, images, topK); err != nil {
+		return nil, 0, err
+	}
+
+	// Mock: all the mass on the first image's center
+	return []PointerCandidate{{Score: 1, X: 0.5, Y: 0.5}}, baseCacheHandle + 1, nil
+}
+
+// SetImageCacheBudget is a mock implementation
+func SetImageCacheBudget(budgetBytes int64) error {
+	return nil
+}
+
+// GetImageCacheStats is a mock implementation
+func GetImageCacheStats() (ImageCacheStats, error) {
+	return ImageCacheStats{}, nil
+}
+
+// VerifyDraft is a mock implementation
+func VerifyDraft(
+	modelHandle uintptr,
+	pending uint32,
+	drafts []uint32,
+	baseCacheHandle uint64,
+	opts SampleOptions,
+	logits []float32,
+) (VerifyResult, uint64, error) {
+	if err := validateVerifyOptions(opts); err != nil {
+		return VerifyResult{}, 0, err
+	}
+
+	// Mock: the target agrees with every draft, then picks token 0
+	sampled := append(append([]uint32(nil), drafts...), 0)
+	return VerifyResult{Accepted: len(drafts), Sampled: sampled}, baseCacheHandle + 1, nil
+}
+
+// DraftNgram is a mock implementation
+func DraftNgram(cacheHandle uint64, pending []uint32, maxNgram, maxDraft int) ([]uint32, error) {
+	return nil, nil
+}
+
 // SliceCache is a mock implementation
 func SliceCache(cacheHandle uint64, keepTokens int) (uint64, error) {
 	return cacheHandle + 100, nil
@@ -47,7 +163,131 @@ func FreeCache(cacheHandle uint64) {
 	// No-op for mock
 }
 
+// GetMemoryStats is a mock implementation
+func GetMemoryStats() (MemoryStats, error) {
+	return MemoryStats{}, nil
+}
+
+// CacheBytes is a mock implementation
+func CacheBytes(cacheHandle uint64) (int64, int64, error) {
+	return 0, 0, nil
+}
+
+// SetMemoryBudget is a mock implementation
+func SetMemoryBudget(budgetBytes int64) error {
+	return nil
+}
+
+// OffloadCache is a mock implementation
+func OffloadCache(cacheHandle uint64, tier int) error {
+	return nil
+}
+
+// PrefetchCache is a mock implementation
+func PrefetchCache(cacheHandle uint64) error {
+	return nil
+}
+
+// CacheTier is a mock implementation
+func CacheTier(cacheHandle uint64) (int, error) {
+	return CacheTierDevice, nil
+}
+
+// SetOffloadOptions is a mock implementation
+func SetOffloadOptions(opts OffloadOptions) error {
+	return opts.Validate()
+}
+
+// ExportCache is a mock implementation
+func ExportCache(cacheHandle uint64, path string) error {
+	return errors.New("mock: cache snapshots not supported")
+}
+
+// ImportCache is a mock implementation
+func ImportCache(path string) (uint64, error) {
+	return 0, errors.New("mock: cache snapshots not supported")
+}
+
+// CacheTokens is a mock implementation
+func CacheTokens(cacheHandle uint64) ([]uint32, error) {
+	return nil, nil
+}
+
+// ModelFingerprint is a mock implementation
+func ModelFingerprint() (uint64, error) {
+	return 0, nil
+}
+
+// SetProfiling is a mock implementation
+func SetProfiling(enabled bool) error {
+	return nil
+}
+
+// GetProfileStats is a mock implementation
+func GetProfileStats() (ProfileStats, error) {
+	return ProfileStats{}, nil
+}
+
+// ResetProfileStats is a mock implementation
+func ResetProfileStats() error {
+	return nil
+}
+
 // FreeError is a mock implementation
 func FreeError(errMsg *byte) {
 	// No-op for mock
 }
+
+// LoadModelWithOptions is a mock implementation
+func LoadModelWithOptions(modelPath string, vocabSize int, opts LoadOptions) error {
+	return opts.Validate()
+}
+
+// LoadModelHandle is a mock implementation
+func LoadModelHandle(modelPath string, vocabSize int, opts LoadOptions) (uintptr, error) {
+	if err := opts.Validate(); err != nil {
+		return 0, err
+	}
+	return 1, nil
+}
+
+// UnloadModel is a mock implementation
+func UnloadModel(modelHandle uintptr) error {
+	return nil
+}
+
+// SetDefaultModel is a mock implementation
+func SetDefaultModel(modelHandle uintptr) error {
+	return nil
+}
+
+// ServeShard is a mock implementation; it returns as if rank 0 disconnected at once
+func ServeShard(modelPath string, vocabSize int, opts LoadOptions, rank, size int, listenAddress string) error {
+	if err := opts.Validate(); err != nil {
+		return err
+	}
+	if rank < 1 || rank >= size {
+		return errors.New("MLX error: shard rank must be in [1, size)")
+	}
+	if len(opts.TensorParallelPeers) > 0 {
+		return errors.New("MLX error: shards take no tensor-parallel peers")
+	}
+	return nil
+}
+
+// SubmitForward is a mock implementation; the future is already done and
+// its result is the next handle, like ForwardWithCache
+func SubmitForward(modelHandle uintptr, tokens []uint32, baseCacheHandle uint64) (*ForwardFuture, error) {
+	if len(tokens) == 0 {
+		return nil, errors.New("empty tokens")
+	}
+	future := &ForwardFuture{ticket: baseCacheHandle + 1, done: make(chan struct{})}
+	close(future.done)
+	return future, nil
+}
+
+// Result is a mock implementation
+func (f *ForwardFuture) Result(logits []float32) (uint64, error) {
+	<-f.done
+	return f.ticket, nil
+}
@@ -0,0 +1,100 @@
+package mlx
+
+import (
+	"fmt"
+	"net"
+	"strconv"
+	"strings"
+)
+
+// WeightFormat selects how linear projection weights are stored on the GPU
+// Values match MLX_WEIGHT_FORMAT_* in mlx_api.h
+type WeightFormat int
+
+const (
+	WeightFormatF32  WeightFormat = 0 // float32, mapped zero-copy
+	WeightFormatF16  WeightFormat = 1 // IEEE half
+	WeightFormatBF16 WeightFormat = 2 // bfloat16
+	WeightFormatQ8   WeightFormat = 3 // group-wise uint8 with fp16 scale/zero point
+	WeightFormatQ4   WeightFormat = 4 // group-wise uint4 with fp16 scale/zero point
+)
+
+// DefaultQuantGroupSize is the number of weights sharing one scale/zero point
+const DefaultQuantGroupSize = 64
+
+// DefaultPrefillChunkTokens is the most prompt tokens one sequence feeds into a single engine step
+const DefaultPrefillChunkTokens = 512
+
+var weightFormatNames = map[WeightFormat]string{
+	WeightFormatF32:  "f32",
+	WeightFormatF16:  "f16",
+	WeightFormatBF16: "bf16",
+	WeightFormatQ8:   "q8",
+	WeightFormatQ4:   "q4",
+}
+
+// String returns the flag spelling of the format
+func (f WeightFormat) String() string {
+	if name, ok := weightFormatNames[f]; ok {
+		return name
+	}
+	return fmt.Sprintf("WeightFormat(%d)", int(f))
+}
+
+// ParseWeightFormat parses a format name (f32, f16, bf16, q8, q4), case-insensitive
+func ParseWeightFormat(s string) (WeightFormat, error) {
+	name := strings.ToLower(strings.TrimSpace(s))
+	for format, formatName := range weightFormatNames {
+		if formatName == name {
+			return format, nil
+		}
+	}
+	return 0, fmt.Errorf("unknown weight format %q (want f32, f16, bf16, q8 or q4)", s)
+}
+
+// LoadOptions configures model loading
+type LoadOptions struct {
+	WeightFormat   WeightFormat
+	QuantGroupSize int // Only used by WeightFormatQ8/Q4
+	// PrefillChunkTokens bounds how much of a prompt is ingested per engine step, so
+	// long prefills interleave with other sessions' decodes; 0 selects the default
+	PrefillChunkTokens int
+	// PipelineCacheDir keeps the compiled Metal pipelines across restarts (shared by
+	// replicas on one host); "" leaves the engine's default, $TMPDIR
+	PipelineCacheDir string
+	// TensorParallelPeers shards the model over this process (rank 0) and one
+	// ServeShard process per entry (host:port, ranks 1..N in order); nil loads
+	// the whole model here
+	TensorParallelPeers []string
+}
+
+// DefaultLoadOptions returns float32 weights with the default group size
+func DefaultLoadOptions() LoadOptions {
+	return LoadOptions{
+		WeightFormat:       WeightFormatF32,
+		QuantGroupSize:     DefaultQuantGroupSize,
+		PrefillChunkTokens: DefaultPrefillChunkTokens,
+	}
+}
+
+// Validate checks the options before they are passed to the C++ engine
+func (o LoadOptions) Validate() error {
+	if _, ok := weightFormatNames[o.WeightFormat]; !ok {
+		return fmt.Errorf("invalid weight format %d", int(o.WeightFormat))
+	}
+	if o.WeightFormat == WeightFormatQ8 || o.WeightFormat == WeightFormatQ4 {
+		if o.QuantGroupSize <= 0 || o.QuantGroupSize%8 != 0 {
+			return fmt.Errorf("quant group size must be a positive multiple of 8, got %d", o.QuantGroupSize)
+		}
+	}
+	if o.PrefillChunkTokens < 0 {
+		return fmt.Errorf("prefill chunk must not be negative, got %d", o.PrefillChunkTokens)
+	}
+	for _, peer := range o.TensorParallelPeers {
+		host, port, err := net.SplitHostPort(peer)
+		if n, perr := strconv.Atoi(port); err != nil || host == "" || perr != nil || n <= 0 || n > 65535 {
+			return fmt.Errorf("tensor-parallel peer must be host:port, got %q", peer)
+		}
+	}
+	return nil
+}
@@ -0,0 +1,79 @@
+package mlx
+
+import "testing"
+
+func TestParseWeightFormat(t *testing.T) {
+	tests := []struct {
+		input   string
+		want    WeightFormat
+		wantErr bool
+	}{
+		{"f32", WeightFormatF32, false},
+		{"F16", WeightFormatF16, false},
+		{" bf16 ", WeightFormatBF16, false},
+		{"q8", WeightFormatQ8, false},
+		{"q4", WeightFormatQ4, false},
+		{"int3", 0, true},
+		{"", 0, true},
+	}
+
+	for _, tt := range tests {
+		t.Run(tt.input, func(t *testing.T) {
+			got, err := ParseWeightFormat(tt.input)
+			if (err != nil) != tt.wantErr {
+				t.Fatalf("ParseWeightFormat(%q) error = %v, wantErr %v", tt.input, err, tt.wantErr)
+			}
+			if !tt.wantErr && got != tt.want {
+				t.Errorf("ParseWeightFormat(%q) = %v, want %v", tt.input, got, tt.want)
+			}
+		})
+	}
+}
+
+func TestWeightFormatString(t *testing.T) {
+	tests := []struct {
+		format WeightFormat
+		want   string
+	}{
+		{WeightFormatF32, "f32"},
+		{WeightFormatBF16, "bf16"},
+		{WeightFormatQ4, "q4"},
+		{WeightFormat(9), "WeightFormat(9)"},
+	}
+
+	for _, tt := range tests {
+		if got := tt.format.String(); got != tt.want {
+			t.Errorf("WeightFormat(%d).String() = %q, want %q", int(tt.format), got, tt.want)
+		}
+	}
+}
+
+func TestLoadOptionsValidate(t *testing.T) {
+	tests := []struct {
+		name    string
+		opts    LoadOptions
+		wantErr bool
+	}{
+		{"default", DefaultLoadOptions(), false},
+		{"f16 ignores group size", LoadOptions{WeightFormat: WeightFormatF16}, false},
+		{"q4 default group", LoadOptions{WeightFormat: WeightFormatQ4, QuantGroupSize: 64}, false},
+		{"q8 zero group", LoadOptions{WeightFormat: WeightFormatQ8, QuantGroupSize: 0}, true},
+		{"q4 unaligned group", LoadOptions{WeightFormat: WeightFormatQ4, QuantGroupSize: 12}, true},
+		{"unknown format", LoadOptions{WeightFormat: WeightFormat(7)}, true},
+		{"engine default chunk", LoadOptions{WeightFormat: WeightFormatF32, PrefillChunkTokens: 0}, false},
+		{"negative chunk", LoadOptions{WeightFormat: WeightFormatF32, PrefillChunkTokens: -1}, true},
+		{"tensor-parallel peers", LoadOptions{TensorParallelPeers: []string{"gpu1:7070", "[::1]:7071"}}, false},
+		{"peer without port", LoadOptions{TensorParallelPeers: []string{"gpu1"}}, true},
+		{"peer without host", LoadOptions{TensorParallelPeers: []string{":7070"}}, true},
+		{"peer port out of range", LoadOptions{TensorParallelPeers: []string{"gpu1:70000"}}, true},
+	}
+
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			err := tt.opts.Validate()
+			if (err != nil) != tt.wantErr {
+				t.Errorf("Validate() error = %v, wantErr %v", err, tt.wantErr)
+			}
+		})
+	}
+}
@@ -0,0 +1,122 @@
+package mlx
+
+import (
+	"fmt"
+	"io"
+)
+
+// Kernel kinds GPU time is broken down by, mirroring MLX_KERNEL_* in mlx_api.h
+const (
+	KernelMatmul = iota
+	KernelRope
+	KernelAttention
+	KernelNorm
+	KernelMLP
+	KernelSample
+	KernelOther
+	NumKernelKinds
+)
+
+// KernelKindNames labels each kernel kind in metrics
+var KernelKindNames = [NumKernelKinds]string{"matmul", "rope", "attention", "norm", "mlp", "sample", "other"}
+
+// KernelTime is the GPU time recorded for one (layer, kernel kind) pair
+type KernelTime struct {
+	Nanos uint64
+	Count uint64 // Regions (one per kind per layer per forward step)
+}
+
+// ProfileStats is a snapshot of the engine's GPU profile
+// Values mirror MLXProfileStats in mlx_api.h
+type ProfileStats struct {
+	Enabled             bool
+	TimestampsSupported bool // False: only GPUNanos is recorded
+	CommandBuffers      uint64
+	GPUNanos            uint64
+	UploadBytes         uint64
+	DownloadBytes       uint64
+	// Layers holds one row per transformer layer plus a last row for work
+	// outside any layer (final norm, LM head, sampling)
+	Layers [][NumKernelKinds]KernelTime
+}
+
+// KindTotals sums each kernel kind over all layers
+func (p ProfileStats) KindTotals() [NumKernelKinds]KernelTime {
+	var totals [NumKernelKinds]KernelTime
+	for _, row := range p.Layers {
+		for kind, t := range row {
+			totals[kind].Nanos += t.Nanos
+			totals[kind].Count += t.Count
+		}
+	}
+	return totals
+}
+
+// WritePrometheus writes the profile in the Prometheus text exposition format
+// Per-layer series are labeled layer="0".."N-1", and layer="head" for the last row
+func (p ProfileStats) WritePrometheus(w io.Writer) error {
+	enabled := 0.0
+	if p.Enabled {
+		enabled = 1
+	}
+	metrics := []struct {
+		name, help, kind string
+		value            float64
+	}{
+		{"mlx_profiling_enabled", "Whether GPU profiling is on", "gauge", enabled},
+		{"mlx_command_buffers_total", "Command buffers completed while profiling", "counter", float64(p.CommandBuffers)},
+		{"mlx_gpu_seconds_total", "GPU execution time of profiled command buffers", "counter", seconds(p.GPUNanos)},
+		{"mlx_upload_bytes_total", "Bytes written by the host for forwards", "counter", float64(p.UploadBytes)},
+		{"mlx_download_bytes_total", "Bytes read back by the host from forwards", "counter", float64(p.DownloadBytes)},
+	}
+	for _, m := range metrics {
+		if _, err := fmt.Fprintf(w, "# HELP %s %s\n# TYPE %s %s\n%s %g\n", m.name, m.help, m.name, m.kind, m.name, m.value); err != nil {
+			return err
+		}
+	}
+
+	if _, err := fmt.Fprint(w, "# HELP mlx_kernel_seconds_total GPU time per kernel kind and layer\n"+
+		"# TYPE mlx_kernel_seconds_total counter\n"); err != nil {
+		return err
+	}
+	for layer, row := range p.Layers {
+		label := fmt.Sprint(layer)
+		if layer == len(p.Layers)-1 {
+			label = "head"
+		}
+		for kind, t := range row {
+			if t.Count == 0 {
+				continue
+			}
+			if _, err := fmt.Fprintf(w, "mlx_kernel_seconds_total{kind=%q,layer=%q} %g\n",
+				KernelKindNames[kind], label, seconds(t.Nanos)); err != nil {
+				return err
+			}
+		}
+	}
+	return nil
+}
+
+// WritePrometheus writes KV memory usage in the Prometheus text exposition format
+func (s MemoryStats) WritePrometheus(w io.Writer) error {
+	metrics := []struct {
+		name, help string
+		value      int64
+	}{
+		{"mlx_kv_used_bytes", "KV pool bytes held by live handles", s.UsedBytes},
+		{"mlx_kv_budget_bytes", "KV pool allocation limit", s.BudgetBytes},
+		{"mlx_kv_capacity_bytes", "KV pool size", s.CapacityBytes},
+		{"mlx_kv_host_offload_bytes", "Offloaded KV held in host memory", s.HostBytes},
+		{"mlx_kv_disk_offload_bytes", "Offloaded KV held in spill files", s.DiskBytes},
+	}
+	for _, m := range metrics {
+		if _, err := fmt.Fprintf(w, "# HELP %s %s\n# TYPE %s gauge\n%s %d\n", m.name, m.help, m.name, m.name, m.value); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+func seconds(nanos uint64) float64 {
+	return float64(nanos) / 1e9
+}
@@ -0,0 +1,96 @@
+package mlx
+
+import (
+	"bytes"
+	"strings"
+	"testing"
+)
+
+func TestProfileStatsKindTotals(t *testing.T) {
+	var stats ProfileStats
+	stats.Layers = make([][NumKernelKinds]KernelTime, 3)
+	stats.Layers[0][KernelMatmul] = KernelTime{Nanos: 100, Count: 2}
+	stats.Layers[1][KernelMatmul] = KernelTime{Nanos: 50, Count: 1}
+	stats.Layers[2][KernelSample] = KernelTime{Nanos: 7, Count: 1}
+
+	totals := stats.KindTotals()
+
+	tests := []struct {
+		kind      int
+		wantNanos uint64
+		wantCount uint64
+	}{
+		{KernelMatmul, 150, 3},
+		{KernelSample, 7, 1},
+		{KernelAttention, 0, 0},
+	}
+	for _, tt := range tests {
+		t.Run(KernelKindNames[tt.kind], func(t *testing.T) {
+			if got := totals[tt.kind]; got.Nanos != tt.wantNanos || got.Count != tt.wantCount {
+				t.Errorf("KindTotals()[%d] = %+v, want {%d %d}", tt.kind, got, tt.wantNanos, tt.wantCount)
+			}
+		})
+	}
+}
+
+func TestProfileStatsWritePrometheus(t *testing.T) {
+	stats := ProfileStats{
+		Enabled:        true,
+		CommandBuffers: 4,
+		GPUNanos:       2500000000,
+		UploadBytes:    1024,
+		Layers:         make([][NumKernelKinds]KernelTime, 2),
+	}
+	stats.Layers[0][KernelAttention] = KernelTime{Nanos: 1500000, Count: 1}
+	stats.Layers[1][KernelMatmul] = KernelTime{Nanos: 500000000, Count: 1}
+
+	var buf bytes.Buffer
+	if err := stats.WritePrometheus(&buf); err != nil {
+		t.Fatalf("WritePrometheus() error = %v", err)
+	}
+	out := buf.String()
+
+	tests := []struct {
+		name string
+		want string
+		has  bool
+	}{
+		{"enabled gauge", "mlx_profiling_enabled 1\n", true},
+		{"command buffers", "mlx_command_buffers_total 4\n", true},
+		{"gpu seconds", "mlx_gpu_seconds_total 2.5\n", true},
+		{"upload bytes", "mlx_upload_bytes_total 1024\n", true},
+		{"layer series", `mlx_kernel_seconds_total{kind="attention",layer="0"} 0.0015` + "\n", true},
+		{"head row", `mlx_kernel_seconds_total{kind="matmul",layer="head"} 0.5` + "\n", true},
+		{"empty series omitted", `kind="mlp"`, false},
+		{"type line", "# TYPE mlx_kernel_seconds_total counter\n", true},
+	}
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			if strings.Contains(out, tt.want) != tt.has {
+				t.Errorf("output contains %q = %v, want %v\n%s", tt.want, !tt.has, tt.has, out)
+			}
+		})
+	}
+}
+
+func TestMemoryStatsWritePrometheus(t *testing.T) {
+	stats := MemoryStats{UsedBytes: 10, BudgetBytes: 20, CapacityBytes: 30, HostBytes: 40, DiskBytes: 50}
+
+	var buf bytes.Buffer
+	if err := stats.WritePrometheus(&buf); err != nil {
+		t.Fatalf("WritePrometheus() error = %v", err)
+	}
+
+	for _, want := range []string{
+		"mlx_kv_used_bytes 10\n",
+		"mlx_kv_budget_bytes 20\n",
+		"mlx_kv_capacity_bytes 30\n",
+		"mlx_kv_host_offload_bytes 40\n",
+		"mlx_kv_disk_offload_bytes 50\n",
+		"# TYPE mlx_kv_used_bytes gauge\n",
+	} {
+		if !strings.Contains(buf.String(), want) {
+			t.Errorf("Expected %q in output:\n%s", want, buf.String())
+		}
+	}
+}
@@ -0,0 +1,67 @@
+package mlx
+
+import (
+	"fmt"
+	"math"
+	"sort"
+)
+
+// MaxSampleCandidates is the largest TopK / NumLogprobs served on the GPU
+// Matches MLX_MAX_SAMPLE_CANDIDATES in mlx_api.h
+const MaxSampleCandidates = 256
+
+// SampleOptions configures on-device sampling
+type SampleOptions struct {
+	Temperature float32 // <= 0 selects greedy decoding
+	TopK        int     // <= 0 disables
+	TopP        float32 // >= 1 disables
+	Seed        uint64  // Noise is keyed on the seed and the position, so each decoded token gets a fresh draw
+	// LogitBias is added to the logits before sampling; math.Inf(-1) bans a token
+	LogitBias   map[uint32]float32
+	NumLogprobs int // Top (id, logprob) pairs to return
+}
+
+// TokenLogprob is one entry of the returned top-k distribution
+type TokenLogprob struct {
+	Token   uint32
+	Logprob float32
+}
+
+// SampleResult is the outcome of a sampled forward pass
+type SampleResult struct {
+	Token       uint32
+	TopLogprobs []TokenLogprob // Most likely first
+}
+
+// Validate checks the options before they are passed to the C++ engine
+func (o SampleOptions) Validate() error {
+	if o.NumLogprobs < 0 || o.NumLogprobs > MaxSampleCandidates {
+		return fmt.Errorf("num logprobs must be in [0, %d], got %d", MaxSampleCandidates, o.NumLogprobs)
+	}
+	if math.IsNaN(float64(o.TopP)) || (o.Temperature > 0 && o.TopP <= 0) {
+		return fmt.Errorf("top_p must be in (0, 1], got %v", o.TopP)
+	}
+	for token, bias := range o.LogitBias {
+		if math.IsNaN(float64(bias)) {
+			return fmt.Errorf("logit bias for token %d is NaN", token)
+		}
+	}
+	return nil
+}
+
+// biasArrays flattens LogitBias into parallel id/value slices, ordered by id
+func (o SampleOptions) biasArrays() ([]uint32, []float32) {
+	if len(o.LogitBias) == 0 {
+		return nil, nil
+	}
+	ids := make([]uint32, 0, len(o.LogitBias))
+	for token := range o.LogitBias {
+		ids = append(ids, token)
+	}
+	sort.Slice(ids, func(i, j int) bool { return ids[i] < ids[j] })
+	values := make([]float32, len(ids))
+	for i, token := range ids {
+		values[i] = o.LogitBias[token]
+	}
+	return ids, values
+}
@@ -0,0 +1,59 @@
+package mlx
+
+import (
+	"math"
+	"reflect"
+	"testing"
+)
+
+func TestSampleOptionsValidate(t *testing.T) {
+	tests := []struct {
+		name    string
+		opts    SampleOptions
+		wantErr bool
+	}{
+		{"greedy", SampleOptions{}, false},
+		{"top-k top-p", SampleOptions{Temperature: 0.7, TopK: 40, TopP: 0.9}, false},
+		{"full vocabulary", SampleOptions{Temperature: 1, TopP: 1}, false},
+		{"max logprobs", SampleOptions{NumLogprobs: MaxSampleCandidates}, false},
+		{"too many logprobs", SampleOptions{NumLogprobs: MaxSampleCandidates + 1}, true},
+		{"negative logprobs", SampleOptions{NumLogprobs: -1}, true},
+		{"zero top-p when sampling", SampleOptions{Temperature: 1, TopP: 0}, true},
+		{"NaN top-p", SampleOptions{TopP: float32(math.NaN())}, true},
+		{"ban token", SampleOptions{LogitBias: map[uint32]float32{7: float32(math.Inf(-1))}}, false},
+		{"NaN bias", SampleOptions{LogitBias: map[uint32]float32{7: float32(math.NaN())}}, true},
+	}
+
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			err := tt.opts.Validate()
+			if (err != nil) != tt.wantErr {
+				t.Errorf("Validate() error = %v, wantErr %v", err, tt.wantErr)
+			}
+		})
+	}
+}
+
+func TestSampleOptionsBiasArrays(t *testing.T) {
+	tests := []struct {
+		name       string
+		bias       map[uint32]float32
+		wantIDs    []uint32
+		wantValues []float32
+	}{
+		{"no bias", nil, nil, nil},
+		{"sorted by id", map[uint32]float32{9: -1, 2: 0.5, 5: 3}, []uint32{2, 5, 9}, []float32{0.5, 3, -1}},
+	}
+
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			ids, values := SampleOptions{LogitBias: tt.bias}.biasArrays()
+			if !reflect.DeepEqual(ids, tt.wantIDs) {
+				t.Errorf("ids = %v, want %v", ids, tt.wantIDs)
+			}
+			if !reflect.DeepEqual(values, tt.wantValues) {
+				t.Errorf("values = %v, want %v", values, tt.wantValues)
+			}
+		})
+	}
+}
@@ -0,0 +1,95 @@
+package mlx
+
+import (
+	"errors"
+	"fmt"
+)
+
+// DefaultNumDraft is how many draft tokens are verified per forward
+const DefaultNumDraft = 8
+
+// DefaultMaxNgram is the longest suffix the n-gram drafter looks up
+const DefaultMaxNgram = 4
+
+// SpeculativeOptions configures speculative decoding
+type SpeculativeOptions struct {
+	NumDraft int // Draft tokens verified per forward; 0 disables speculation
+	MaxNgram int // Longest context suffix NgramDrafter matches
+}
+
+// DefaultSpeculativeOptions returns prompt-lookup speculation with DefaultNumDraft drafts
+func DefaultSpeculativeOptions() SpeculativeOptions {
+	return SpeculativeOptions{NumDraft: DefaultNumDraft, MaxNgram: DefaultMaxNgram}
+}
+
+// Validate checks the options before they are passed to the C++ engine
+// The pending token and its drafts must fit one prefill chunk of the model,
+// loaded with LoadOptions.PrefillChunkTokens (0 selects the default)
+func (o SpeculativeOptions) Validate(prefillChunkTokens int) error {
+	if prefillChunkTokens <= 0 {
+		prefillChunkTokens = DefaultPrefillChunkTokens
+	}
+	if o.NumDraft < 0 || o.NumDraft >= prefillChunkTokens {
+		return fmt.Errorf("num draft must be in [0, %d), got %d", prefillChunkTokens, o.NumDraft)
+	}
+	if o.NumDraft > 0 && o.MaxNgram <= 0 {
+		return fmt.Errorf("max ngram must be positive, got %d", o.MaxNgram)
+	}
+	return nil
+}
+
+// Drafter proposes tokens likely to follow a cache handle's tokens and pending
+// An n-gram drafter runs inside the engine (NgramDrafter); a small draft model
+// only has to implement the same method
+type Drafter interface {
+	Draft(baseHandle uint64, pending []uint32, maxDraft int) ([]uint32, error)
+}
+
+// NgramDrafter drafts by prompt lookup: the tokens that followed the most
+// recent earlier occurrence of the context's last MaxNgram (or fewer) tokens
+type NgramDrafter struct {
+	MaxNgram int
+}
+
+// Draft implements Drafter via the engine's MLXDraftNgram
+func (d NgramDrafter) Draft(baseHandle uint64, pending []uint32, maxDraft int) ([]uint32, error) {
+	return DraftNgram(baseHandle, pending, d.MaxNgram, maxDraft)
+}
+
+// VerifyResult is the outcome of verifying drafts in one forward
+type VerifyResult struct {
+	Accepted int      // Leading drafts that matched the target model
+	Sampled  []uint32 // Sample at every verified position
+	Logits   []float32
+}
+
+// Next returns the new pending token: the sample after the last accepted draft
+func (r VerifyResult) Next() uint32 {
+	return r.Sampled[r.Accepted]
+}
+
+// Emitted returns the tokens a verification step produces: the accepted
+// drafts followed by the new pending token
+func (r VerifyResult) Emitted(drafts []uint32) []uint32 {
+	out := make([]uint32, 0, r.Accepted+1)
+	out = append(out, drafts[:r.Accepted]...)
+	return append(out, r.Next())
+}
+
+// verifyInput packs the pending token and its drafts into one forward's tokens
+func verifyInput(pending uint32, drafts []uint32) []uint32 {
+	tokens := make([]uint32, 0, len(drafts)+1)
+	tokens = append(tokens, pending)
+	return append(tokens, drafts...)
+}
+
+// validateVerifyOptions rejects sampling options verification does not support
+func validateVerifyOptions(opts SampleOptions) error {
+	if err := opts.Validate(); err != nil {
+		return err
+	}
+	if len(opts.LogitBias) > 0 || opts.NumLogprobs > 0 {
+		return errors.New("logit bias and logprobs are not supported when verifying drafts")
+	}
+	return nil
+}
@@ -0,0 +1,71 @@
+package mlx
+
+import (
+	"reflect"
+	"testing"
+)
+
+func TestSpeculativeOptionsValidate(t *testing.T) {
+	tests := []struct {
+		name      string
+		opts      SpeculativeOptions
+		chunkSize int
+		wantErr   bool
+	}{
+		{"defaults", DefaultSpeculativeOptions(), 0, false},
+		{"disabled", SpeculativeOptions{}, 0, false},
+		{"negative drafts", SpeculativeOptions{NumDraft: -1, MaxNgram: 2}, 0, true},
+		{"drafts fill the chunk", SpeculativeOptions{NumDraft: DefaultPrefillChunkTokens, MaxNgram: 2}, 0, true},
+		{"largest draft", SpeculativeOptions{NumDraft: DefaultPrefillChunkTokens - 1, MaxNgram: 2}, 0, false},
+		{"drafts fill a small chunk", SpeculativeOptions{NumDraft: 8, MaxNgram: 2}, 8, true},
+		{"largest draft in a small chunk", SpeculativeOptions{NumDraft: 7, MaxNgram: 2}, 8, false},
+		{"no ngram", SpeculativeOptions{NumDraft: 4}, 0, true},
+	}
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			if err := tt.opts.Validate(tt.chunkSize); (err != nil) != tt.wantErr {
+				t.Errorf("Validate() error = %v, wantErr %v", err, tt.wantErr)
+			}
+		})
+	}
+}
+
+func TestVerifyResultEmitted(t *testing.T) {
+	drafts := []uint32{11, 12, 13}
+	tests := []struct {
+		name   string
+		result VerifyResult
+		want   []uint32
+	}{
+		{"all rejected", VerifyResult{Accepted: 0, Sampled: []uint32{7, 8, 9, 10}}, []uint32{7}},
+		{"prefix accepted", VerifyResult{Accepted: 2, Sampled: []uint32{11, 12, 9, 10}}, []uint32{11, 12, 9}},
+		{"all accepted", VerifyResult{Accepted: 3, Sampled: []uint32{11, 12, 13, 14}}, []uint32{11, 12, 13, 14}},
+	}
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			if got := tt.result.Emitted(drafts); !reflect.DeepEqual(got, tt.want) {
+				t.Errorf("Emitted() = %v, want %v", got, tt.want)
+			}
+		})
+	}
+}
+
+func TestValidateVerifyOptions(t *testing.T) {
+	tests := []struct {
+		name    string
+		opts    SampleOptions
+		wantErr bool
+	}{
+		{"greedy", SampleOptions{}, false},
+		{"sampled", SampleOptions{Temperature: 0.7, TopP: 0.9}, false},
+		{"logit bias", SampleOptions{LogitBias: map[uint32]float32{1: 2}}, true},
+		{"logprobs", SampleOptions{NumLogprobs: 5}, true},
+	}
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			if err := validateVerifyOptions(tt.opts); (err != nil) != tt.wantErr {
+				t.Errorf("validateVerifyOptions() error = %v, wantErr %v", err, tt.wantErr)
+			}
+		})
+	}
+}
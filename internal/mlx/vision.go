@@ -0,0 +1,162 @@
+package mlx
+
+import (
+	"fmt"
+	"hash/fnv"
+	"io"
+)
+
+// Vision tower geometry of Qwen2-VL, mirroring the engine's ModelConfig
+const (
+	PatchSize         = 14     // Pixels per patch side
+	TemporalPatchSize = 2      // Frames per patch (a still image is repeated)
+	SpatialMergeSize  = 2      // Patch rows/columns merged into one LLM token
+	ImageTokenID      = 151655 // <|image_pad|>, one per LLM image token
+	PatchDim          = 3 * TemporalPatchSize * PatchSize * PatchSize
+)
+
+// ImageInput is one preprocessed image (MLXImageInput)
+// Pixels holds GridT*GridH*GridW patches of PatchDim normalized values, in
+// merge-window order as Qwen2-VL's image processor emits them.
+type ImageInput struct {
+	Pixels []float32
+	GridT  int
+	GridH  int
+	GridW  int
+	// Hash keys the engine's encoded-image cache, usually HashImage of the
+	// source image bytes; 0 makes the engine hash Pixels
+	Hash uint64
+}
+
+// Validate checks the grid and pixel count before the image is passed to the C++ engine
+func (im ImageInput) Validate() error {
+	if im.GridT <= 0 || im.GridH <= 0 || im.GridW <= 0 {
+		return fmt.Errorf("image grid must be positive, got %dx%dx%d", im.GridT, im.GridH, im.GridW)
+	}
+	if im.GridH%SpatialMergeSize != 0 || im.GridW%SpatialMergeSize != 0 {
+		return fmt.Errorf("image grid %dx%d must be a multiple of %d", im.GridH, im.GridW, SpatialMergeSize)
+	}
+	if want := im.GridT * im.GridH * im.GridW * PatchDim; len(im.Pixels) != want {
+		return fmt.Errorf("image has %d pixel values, want %d", len(im.Pixels), want)
+	}
+	return nil
+}
+
+// PlaceholderTokens is how many ImageTokenID tokens the image expands to in the prompt
+func (im ImageInput) PlaceholderTokens() int {
+	return im.GridT * (im.GridH / SpatialMergeSize) * (im.GridW / SpatialMergeSize)
+}
+
+// HashImage returns the image cache key of an encoded image file (PNG, JPEG)
+// Hashing the source bytes is cheaper than hashing the preprocessed pixels and
+// lets callers skip preprocessing on a repeated screenshot. Never 0.
+func HashImage(data []byte) uint64 {
+	h := fnv.New64a()
+	h.Write(data)
+	if sum := h.Sum64(); sum != 0 {
+		return sum
+	}
+	return 1
+}
+
+// validateImages checks that every image is well formed and that tokens hold
+// exactly one placeholder run per image, in order
+func validateImages(tokens []uint32, images []ImageInput) error {
+	next := 0
+	for i := 0; i < len(tokens); {
+		if tokens[i] != ImageTokenID {
+			i++
+			continue
+		}
+		if next == len(images) {
+			return fmt.Errorf("more image placeholders than the %d images", len(images))
+		}
+		if err := images[next].Validate(); err != nil {
+			return fmt.Errorf("image %d: %w", next, err)
+		}
+		n := images[next].PlaceholderTokens()
+		for j := 0; j < n; j++ {
+			if i+j >= len(tokens) || tokens[i+j] != ImageTokenID {
+				return fmt.Errorf("image %d needs %d placeholder tokens", next, n)
+			}
+		}
+		i += n
+		next++
+	}
+	if next != len(images) {
+		return fmt.Errorf("%d images but %d placeholder runs", len(images), next)
+	}
+	return nil
+}
+
+// ImageCacheStats is the engine's encoded-image cache usage (MLXImageCacheStats)
+type ImageCacheStats struct {
+	Entries     int64
+	Bytes       int64
+	BudgetBytes int64
+	Hits        uint64
+	Misses      uint64
+}
+
+// HitRate returns hits / lookups, 0 before the first lookup
+func (s ImageCacheStats) HitRate() float64 {
+	if total := s.Hits + s.Misses; total > 0 {
+		return float64(s.Hits) / float64(total)
+	}
+	return 0
+}
+
+// WritePrometheus writes image cache usage in the Prometheus text exposition format
+func (s ImageCacheStats) WritePrometheus(w io.Writer) error {
+	metrics := []struct {
+		name, help, kind string
+		value            float64
+	}{
+		{"mlx_image_cache_entries", "Encoded images held", "gauge", float64(s.Entries)},
+		{"mlx_image_cache_bytes", "Device bytes held by encoded images", "gauge", float64(s.Bytes)},
+		{"mlx_image_cache_budget_bytes", "Encoded image cache limit", "gauge", float64(s.BudgetBytes)},
+		{"mlx_image_cache_hits_total", "Images served without running the vision tower", "counter", float64(s.Hits)},
+		{"mlx_image_cache_misses_total", "Images encoded by the vision tower", "counter", float64(s.Misses)},
+	}
+	for _, m := range metrics {
+		if _, err := fmt.Fprintf(w, "# HELP %s %s\n# TYPE %s %s\n%s %g\n", m.name, m.help, m.name, m.kind, m.name, m.value); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+// DefaultPointerTopK is how many grounding candidates ForwardPointer returns by default
+const DefaultPointerTopK = 5
+
+// PointerCandidate is one image patch the pointer head scored for the action token
+type PointerCandidate struct {
+	Image int     // Index into the request's images
+	Patch int     // Merged patch within the image
+	Score float32 // Probability over every image token of the prompt
+	X, Y  float32 // Patch center, normalized to the image
+}
+
+// PointerPrompt truncates tokens right after the first action token
+// (pointerPadID), the position whose hidden state the pointer head reads.
+// Causal attention makes the rest of the prompt irrelevant to it. ok is false
+// if tokens have no action token.
+func PointerPrompt(tokens []uint32, pointerPadID uint32) (prompt []uint32, ok bool) {
+	for i, t := range tokens {
+		if t == pointerPadID {
+			return tokens[:i+1], true
+		}
+	}
+	return tokens, false
+}
+
+// validatePointerInput checks a grounding request before it is passed to the C++ engine
+func validatePointerInput(tokens []uint32, images []ImageInput, topK int) error {
+	if len(images) == 0 {
+		return fmt.Errorf("grounding needs at least one image")
+	}
+	if topK <= 0 || topK > MaxSampleCandidates {
+		return fmt.Errorf("pointer top k must be in [1, %d], got %d", MaxSampleCandidates, topK)
+	}
+	return validateImages(tokens, images)
+}
@@ -0,0 +1,177 @@
+package mlx
+
+import (
+	"bytes"
+	"reflect"
+	"strings"
+	"testing"
+)
+
+func testImage(gridT, gridH, gridW int) ImageInput {
+	return ImageInput{
+		Pixels: make([]float32, gridT*gridH*gridW*PatchDim),
+		GridT:  gridT,
+		GridH:  gridH,
+		GridW:  gridW,
+	}
+}
+
+func placeholders(n int) []uint32 {
+	tokens := make([]uint32, n)
+	for i := range tokens {
+		tokens[i] = ImageTokenID
+	}
+	return tokens
+}
+
+func TestImageInputValidate(t *testing.T) {
+	short := testImage(1, 4, 4)
+	short.Pixels = short.Pixels[:len(short.Pixels)-1]
+	tests := []struct {
+		name    string
+		image   ImageInput
+		wantErr bool
+	}{
+		{"still image", testImage(1, 4, 6), false},
+		{"video", testImage(3, 2, 2), false},
+		{"odd grid", testImage(1, 3, 4), true},
+		{"empty grid", ImageInput{GridT: 1}, true},
+		{"short pixels", short, true},
+	}
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			if err := tt.image.Validate(); (err != nil) != tt.wantErr {
+				t.Errorf("Validate() error = %v, wantErr %v", err, tt.wantErr)
+			}
+		})
+	}
+}
+
+func TestPlaceholderTokens(t *testing.T) {
+	tests := []struct {
+		image ImageInput
+		want  int
+	}{
+		{ImageInput{GridT: 1, GridH: 2, GridW: 2}, 1},
+		{ImageInput{GridT: 1, GridH: 36, GridW: 64}, 576},
+		{ImageInput{GridT: 2, GridH: 4, GridW: 6}, 12},
+	}
+	for _, tt := range tests {
+		if got := tt.image.PlaceholderTokens(); got != tt.want {
+			t.Errorf("PlaceholderTokens(%dx%dx%d) = %d, want %d", tt.image.GridT, tt.image.GridH, tt.image.GridW, got, tt.want)
+		}
+	}
+}
+
+func TestValidateImages(t *testing.T) {
+	image := testImage(1, 4, 4) // 4 placeholders
+	prompt := func(runs ...int) []uint32 {
+		tokens := []uint32{1, 2}
+		for _, n := range runs {
+			tokens = append(tokens, placeholders(n)...)
+			tokens = append(tokens, 3)
+		}
+		return tokens
+	}
+	tests := []struct {
+		name    string
+		tokens  []uint32
+		images  []ImageInput
+		wantErr bool
+	}{
+		{"text only", prompt(), nil, false},
+		{"one image", prompt(4), []ImageInput{image}, false},
+		{"two images", prompt(4, 4), []ImageInput{image, image}, false},
+		{"adjacent images", append(prompt(), placeholders(8)...), []ImageInput{image, image}, false},
+		{"short run", prompt(3), []ImageInput{image}, true},
+		{"missing image", prompt(4, 4), []ImageInput{image}, true},
+		{"extra image", prompt(4), []ImageInput{image, image}, true},
+		{"invalid image", prompt(4), []ImageInput{{GridT: 1, GridH: 4, GridW: 4}}, true},
+	}
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			if err := validateImages(tt.tokens, tt.images); (err != nil) != tt.wantErr {
+				t.Errorf("validateImages() error = %v, wantErr %v", err, tt.wantErr)
+			}
+		})
+	}
+}
+
+func TestHashImage(t *testing.T) {
+	a := HashImage([]byte("frame one"))
+	if a == 0 {
+		t.Fatal("HashImage returned 0, which asks the engine to hash pixels")
+	}
+	if a != HashImage([]byte("frame one")) {
+		t.Error("HashImage is not deterministic")
+	}
+	if a == HashImage([]byte("frame two")) {
+		t.Error("HashImage collides on different frames")
+	}
+}
+
+func TestImageCacheStatsWritePrometheus(t *testing.T) {
+	stats := ImageCacheStats{Entries: 2, Bytes: 4096, BudgetBytes: 1 << 20, Hits: 3, Misses: 1}
+	if got := stats.HitRate(); got != 0.75 {
+		t.Errorf("HitRate() = %v, want 0.75", got)
+	}
+	var buf bytes.Buffer
+	if err := stats.WritePrometheus(&buf); err != nil {
+		t.Fatal(err)
+	}
+	for _, want := range []string{"mlx_image_cache_hits_total 3\n", "mlx_image_cache_bytes 4096\n", "# TYPE mlx_image_cache_misses_total counter\n"} {
+		if !strings.Contains(buf.String(), want) {
+			t.Errorf("output missing %q:\n%s", want, buf.String())
+		}
+	}
+}
+
+func TestPointerPrompt(t *testing.T) {
+	const pad = 9
+	tests := []struct {
+		name   string
+		tokens []uint32
+		want   []uint32
+		wantOK bool
+	}{
+		{"trailing text", []uint32{1, 2, 8, pad, 10, 11}, []uint32{1, 2, 8, pad}, true},
+		{"ends with pad", []uint32{1, pad}, []uint32{1, pad}, true},
+		{"first pad wins", []uint32{pad, 1, pad}, []uint32{pad}, true},
+		{"no pad", []uint32{1, 2}, []uint32{1, 2}, false},
+	}
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			got, ok := PointerPrompt(tt.tokens, pad)
+			if ok != tt.wantOK || !reflect.DeepEqual(got, tt.want) {
+				t.Errorf("PointerPrompt() = %v, %v; want %v, %v", got, ok, tt.want, tt.wantOK)
+			}
+		})
+	}
+}
+
+func TestValidatePointerInput(t *testing.T) {
+	image := testImage(1, 2, 2)
+	tokens := []uint32{1, ImageTokenID, 2}
+	tests := []struct {
+		name    string
+		images  []ImageInput
+		topK    int
+		wantErr bool
+	}{
+		{"default", []ImageInput{image}, DefaultPointerTopK, false},
+		{"no image", nil, DefaultPointerTopK, true},
+		{"zero top k", []ImageInput{image}, 0, true},
+		{"top k too large", []ImageInput{image}, MaxSampleCandidates + 1, true},
+	}
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			in := tokens
+			if tt.images == nil {
+				in = []uint32{1, 2}
+			}
+			if err := validatePointerInput(in, tt.images, tt.topK); (err != nil) != tt.wantErr {
+				t.Errorf("validatePointerInput() error = %v, wantErr %v", err, tt.wantErr)
+			}
+		})
+	}
+}
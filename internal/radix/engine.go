@@ -17,6 +17,47 @@ type MLXEngine interface {
 	FreeCache(handle uint64)
 }
 
+// MemoryReporter is implemented by engines that account KV cache memory
+// Callers use it to evict by bytes (Tree.EvictBytes) before the engine's budget is hit
+type MemoryReporter interface {
+	// CacheBytes reports how many bytes freeing handle would release now
+	CacheBytes(handle uint64) int64
+
+	// MemoryOverage reports how many bytes should be freed to relieve memory
+	// pressure; 0 when usage is below the engine's eviction watermark
+	MemoryOverage() int64
+}
+
+// Offloader is implemented by engines that can move a cache handle's KV out of
+// device memory and back. An offloaded handle stays valid; using it as a base
+// restores it first, so prefetching only hides that copy.
+type Offloader interface {
+	// OffloadCache moves handle's KV to the next colder tier (host, then disk)
+	OffloadCache(handle uint64) error
+
+	// PrefetchCache starts restoring an offloaded handle and returns immediately
+	PrefetchCache(handle uint64)
+}
+
+// CacheSnapshotter is implemented by engines that can persist cache handles
+// across restarts (Tree.SaveSnapshots, Tree.LoadSnapshots)
+type CacheSnapshotter interface {
+	// ExportCache writes handle's tokens and KV to a file at path
+	ExportCache(handle uint64, path string) error
+
+	// ImportCache loads a file written by ExportCache as a new handle and
+	// returns it with its token sequence; the caller owns the handle
+	ImportCache(path string) (handle uint64, tokens []uint32, err error)
+}
+
+// AsyncForwarder is implemented by engines that can run ForwardWithCache
+// without holding the caller (and, under cgo, an OS thread) for the whole GPU
+// execution. done is called exactly once, from another goroutine, with what
+// ForwardWithCache would have returned; pending nodes finalize or poison there.
+type AsyncForwarder interface {
+	SubmitForward(model any, tokens []uint32, baseHandle uint64, done func(logits []float32, handle uint64, err error)) error
+}
+
 // CacheHandle constants
 const (
 	RootCacheHandle uint64 = 0 // Represents empty/root cache state
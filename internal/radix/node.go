@@ -32,6 +32,18 @@ type Node struct {
 	// lruElem points to this node's position in the LRU queue
 	// Nil when node is pinned (refCount > 0) or is internal node
 	lruElem *list.Element
+
+	// offloaded is set when the handle's KV was moved off the device
+	// (Tree.OffloadBytes) and cleared when a Match hit prefetches it back
+	offloaded atomic.Bool
+
+	// offloading is set while Tree.OffloadBytes copies the handle's KV with the
+	// tree lock released; eviction skips the node until it is cleared
+	offloading atomic.Bool
+
+	// touched records a Match hit while offloading was set, so OffloadBytes
+	// restores the node instead of marking it offloaded
+	touched atomic.Bool
 }
 
 // NewNode creates a pending node that is not yet ready
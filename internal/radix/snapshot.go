@@ -0,0 +1,136 @@
+package radix
+
+import (
+	"errors"
+	"fmt"
+	"os"
+	"path/filepath"
+	"sort"
+)
+
+// SnapshotExt is the file extension of cache snapshots written by SaveSnapshots
+const SnapshotExt = ".kvc"
+
+// SaveSnapshots exports the cache handle of every ready node to dir, one
+// file per node, then deletes snapshots an earlier save left there. Nodes
+// that fail to export are skipped and reported in the returned error.
+// Returns the number of snapshots written
+// Thread-safe: holds RLock while exporting, so tree writers wait
+func (t *Tree) SaveSnapshots(dir string, snap CacheSnapshotter) (int, error) {
+	if err := os.MkdirAll(dir, 0o755); err != nil {
+		return 0, err
+	}
+
+	t.mu.RLock()
+	var errs []error
+	written := make(map[string]bool)
+	t.walkReady(t.Root, func(node *Node) {
+		path := filepath.Join(dir, fmt.Sprintf("prefix-%06d%s", len(written), SnapshotExt))
+		if err := snap.ExportCache(node.CacheHandle, path); err != nil {
+			errs = append(errs, fmt.Errorf("export handle %d: %w", node.CacheHandle, err))
+			return
+		}
+		written[path] = true
+	})
+	t.mu.RUnlock()
+
+	stale, err := filepath.Glob(filepath.Join(dir, "*"+SnapshotExt))
+	if err != nil {
+		errs = append(errs, err)
+	}
+	for _, path := range stale {
+		if !written[path] {
+			if err := os.Remove(path); err != nil {
+				errs = append(errs, err)
+			}
+		}
+	}
+	return len(written), errors.Join(errs...)
+}
+
+// LoadSnapshots imports every snapshot in dir and inserts it as a ready,
+// unpinned node, shortest sequences first so shared prefixes become parents.
+// Imported nodes are marked offloaded: their KV stays in the file until a
+// Match hit prefetches it or a forward forks it. Snapshots whose tokens are
+// already cached are released with free. Files that fail to import are
+// skipped and reported in the returned error.
+// Returns the number of nodes inserted
+// Thread-safe: acquires write lock per insert
+func (t *Tree) LoadSnapshots(dir string, snap CacheSnapshotter, free func(handle uint64)) (int, error) {
+	paths, err := filepath.Glob(filepath.Join(dir, "*"+SnapshotExt))
+	if err != nil {
+		return 0, err
+	}
+
+	type imported struct {
+		handle uint64
+		tokens []uint32
+	}
+	var entries []imported
+	var errs []error
+	for _, path := range paths {
+		handle, tokens, err := snap.ImportCache(path)
+		if err != nil {
+			errs = append(errs, fmt.Errorf("import %s: %w", path, err))
+			continue
+		}
+		entries = append(entries, imported{handle, tokens})
+	}
+	sort.SliceStable(entries, func(i, j int) bool { return len(entries[i].tokens) < len(entries[j].tokens) })
+
+	inserted := 0
+	for _, entry := range entries {
+		if t.insertReady(entry.tokens, entry.handle) {
+			inserted++
+		} else if free != nil {
+			free(entry.handle)
+		}
+	}
+	return inserted, errors.Join(errs...)
+}
+
+// walkReady calls fn for every ready, unpoisoned node below start
+// Caller must hold the tree lock
+func (t *Tree) walkReady(start *Node, fn func(node *Node)) {
+	for _, child := range start.Children {
+		if child.IsReady() && child.err == nil {
+			fn(child)
+		}
+		t.walkReady(child, fn)
+	}
+}
+
+// insertReady attaches an offloaded, finalized node for tokens backed by
+// handle; false (and nothing inserted) if tokens are empty, already cached,
+// or diverge partway along an existing edge
+func (t *Tree) insertReady(tokens []uint32, handle uint64) bool {
+	if len(tokens) == 0 {
+		return false
+	}
+
+	t.mu.Lock()
+	defer t.mu.Unlock()
+
+	existing, remaining := t.findExactOrPending(tokens, t.Root)
+	if existing != nil {
+		return false
+	}
+
+	// A diverging edge would need a split, which the tree does not do
+	parent := t.findParentFor(tokens, t.Root)
+	if _, taken := parent.Children[remaining[0]]; taken {
+		return false
+	}
+	node := NewNode(remaining, parent)
+	FinalizeNode(node, handle)
+	node.offloaded.Store(true)
+	parent.Children[remaining[0]] = node
+
+	// The parent is no longer a leaf
+	if parent.lruElem != nil {
+		t.lruList.Remove(parent.lruElem)
+		parent.lruElem = nil
+	}
+	node.lruElem = t.lruList.PushFront(node)
+	return true
+}
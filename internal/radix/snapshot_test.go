@@ -0,0 +1,196 @@
+package radix
+
+import (
+	"encoding/json"
+	"errors"
+	"os"
+	"path/filepath"
+	"testing"
+)
+
+// fileSnapshotter persists handle tokens as JSON files
+type fileSnapshotter struct {
+	tokens     map[uint64][]uint32 // Live handles
+	nextHandle uint64
+	failExport uint64 // Handle whose export fails, 0 for none
+}
+
+func newFileSnapshotter() *fileSnapshotter {
+	return &fileSnapshotter{tokens: make(map[uint64][]uint32), nextHandle: 1000}
+}
+
+func (s *fileSnapshotter) ExportCache(handle uint64, path string) error {
+	if handle == s.failExport {
+		return errors.New("export failed")
+	}
+	data, err := json.Marshal(s.tokens[handle])
+	if err != nil {
+		return err
+	}
+	return os.WriteFile(path, data, 0o644)
+}
+
+func (s *fileSnapshotter) ImportCache(path string) (uint64, []uint32, error) {
+	data, err := os.ReadFile(path)
+	if err != nil {
+		return 0, nil, err
+	}
+	var tokens []uint32
+	if err := json.Unmarshal(data, &tokens); err != nil {
+		return 0, nil, err
+	}
+	s.nextHandle++
+	s.tokens[s.nextHandle] = tokens
+	return s.nextHandle, tokens, nil
+}
+
+// insertFinalized adds a ready, unpinned node and records its full tokens
+func insertFinalized(t *testing.T, tree *Tree, snap *fileSnapshotter, tokens []uint32, handle uint64) *Node {
+	t.Helper()
+	node, err := tree.InsertPending(tokens, &MockMLXEngine{}, nil)
+	if err != nil {
+		t.Fatalf("InsertPending failed: %v", err)
+	}
+	FinalizeNode(node, handle)
+	tree.Unpin(node)
+	snap.tokens[handle] = tokens
+	return node
+}
+
+func TestSnapshotRoundTrip(t *testing.T) {
+	dir := t.TempDir()
+	snap := newFileSnapshotter()
+	tree := NewTree()
+	insertFinalized(t, tree, snap, []uint32{1, 2}, 100)
+	insertFinalized(t, tree, snap, []uint32{1, 2, 3, 4}, 200)
+
+	saved, err := tree.SaveSnapshots(dir, snap)
+	if err != nil || saved != 2 {
+		t.Fatalf("SaveSnapshots() = %d, %v; want 2, nil", saved, err)
+	}
+
+	restored := NewTree()
+	var prefetched []uint64
+	restored.SetPrefetch(func(h uint64) { prefetched = append(prefetched, h) })
+	loaded, err := restored.LoadSnapshots(dir, snap, nil)
+	if err != nil || loaded != 2 {
+		t.Fatalf("LoadSnapshots() = %d, %v; want 2, nil", loaded, err)
+	}
+
+	node := restored.Match([]uint32{1, 2, 3, 4, 5})
+	if node == nil {
+		t.Fatal("Expected match on restored tree")
+	}
+	if got := snap.tokens[node.CacheHandle]; len(got) != 4 {
+		t.Errorf("Expected deepest restored node to cover 4 tokens, got %v", got)
+	}
+	if len(node.Parent.Tokens) != 2 || len(node.Tokens) != 2 {
+		t.Errorf("Expected shared prefix restored as parent, got edges %v / %v", node.Parent.Tokens, node.Tokens)
+	}
+	if len(prefetched) != 1 || prefetched[0] != node.CacheHandle {
+		t.Errorf("Expected restored node prefetched on match, got %v", prefetched)
+	}
+	if restored.lruList.Len() != 1 {
+		t.Errorf("Expected only the restored leaf in LRU, got %d", restored.lruList.Len())
+	}
+}
+
+func TestSaveSnapshots(t *testing.T) {
+	tests := []struct {
+		name       string
+		failExport uint64
+		wantSaved  int
+		wantErr    bool
+		wantOnDisk int
+	}{
+		{"all exported", 0, 2, false, 2},
+		{"export failure skipped", 200, 1, true, 1},
+	}
+
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			dir := t.TempDir()
+			stale := filepath.Join(dir, "prefix-999999"+SnapshotExt)
+			if err := os.WriteFile(stale, []byte("[]"), 0o644); err != nil {
+				t.Fatal(err)
+			}
+			other := filepath.Join(dir, "notes.txt")
+			if err := os.WriteFile(other, nil, 0o644); err != nil {
+				t.Fatal(err)
+			}
+
+			snap := newFileSnapshotter()
+			snap.failExport = tt.failExport
+			tree := NewTree()
+			insertFinalized(t, tree, snap, []uint32{1}, 100)
+			insertFinalized(t, tree, snap, []uint32{2}, 200)
+
+			saved, err := tree.SaveSnapshots(dir, snap)
+
+			if saved != tt.wantSaved {
+				t.Errorf("SaveSnapshots() = %d, want %d", saved, tt.wantSaved)
+			}
+			if (err != nil) != tt.wantErr {
+				t.Errorf("SaveSnapshots() error = %v, wantErr %v", err, tt.wantErr)
+			}
+			files, _ := filepath.Glob(filepath.Join(dir, "*"+SnapshotExt))
+			if len(files) != tt.wantOnDisk {
+				t.Errorf("Expected %d snapshots on disk, got %v", tt.wantOnDisk, files)
+			}
+			if _, err := os.Stat(stale); !os.IsNotExist(err) {
+				t.Error("Expected stale snapshot to be removed")
+			}
+			if _, err := os.Stat(other); err != nil {
+				t.Error("Expected non-snapshot file to be kept")
+			}
+		})
+	}
+}
+
+func TestLoadSnapshots(t *testing.T) {
+	tests := []struct {
+		name       string
+		files      map[string]string // file name -> contents
+		cached     [][]uint32        // already in the tree
+		wantLoaded int
+		wantFreed  int
+		wantErr    bool
+	}{
+		{"empty dir", nil, nil, 0, 0, false},
+		{"one snapshot", map[string]string{"a.kvc": "[1,2]"}, nil, 1, 0, false},
+		{"already cached", map[string]string{"a.kvc": "[1,2]"}, [][]uint32{{1, 2}}, 0, 1, false},
+		{"diverging edge", map[string]string{"a.kvc": "[1,3]"}, [][]uint32{{1, 2}}, 0, 1, false},
+		{"empty sequence", map[string]string{"a.kvc": "[]"}, nil, 0, 1, false},
+		{"corrupt file", map[string]string{"a.kvc": "not json", "b.kvc": "[5]"}, nil, 1, 0, true},
+		{"other extensions ignored", map[string]string{"a.bin": "[1]"}, nil, 0, 0, false},
+	}
+
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			dir := t.TempDir()
+			for name, contents := range tt.files {
+				if err := os.WriteFile(filepath.Join(dir, name), []byte(contents), 0o644); err != nil {
+					t.Fatal(err)
+				}
+			}
+			snap := newFileSnapshotter()
+			tree := NewTree()
+			for i, tokens := range tt.cached {
+				insertFinalized(t, tree, snap, tokens, uint64(i+1)*100)
+			}
+
+			var freed []uint64
+			loaded, err := tree.LoadSnapshots(dir, snap, func(h uint64) { freed = append(freed, h) })
+
+			if loaded != tt.wantLoaded {
+				t.Errorf("LoadSnapshots() = %d, want %d", loaded, tt.wantLoaded)
+			}
+			if len(freed) != tt.wantFreed {
+				t.Errorf("Expected %d handles freed, got %v", tt.wantFreed, freed)
+			}
+			if (err != nil) != tt.wantErr {
+				t.Errorf("LoadSnapshots() error = %v, wantErr %v", err, tt.wantErr)
+			}
+		})
+	}
+}
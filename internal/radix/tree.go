@@ -17,6 +17,10 @@ type Tree struct {
 	// lruList is the intrusive doubly-linked list for O(1) eviction
 	// Only contains unpinned leaf nodes ready for eviction
 	lruList *list.List
+
+	// prefetch, when set, is called with the handle of an offloaded node
+	// returned by Match so its restore overlaps the caller's own work
+	prefetch func(handle uint64)
 }
 
 // NewTree creates an empty Radix tree with initialized root
@@ -30,12 +34,32 @@ func NewTree() *Tree {
 // Match finds the longest prefix match for given tokens
 // Returns the deepest node whose token sequence is a prefix of query
 // Returns nil if no match found
+// An offloaded match is prefetched (see SetPrefetch) before returning; a match
+// on a node whose offload is in flight keeps OffloadBytes from marking it offloaded
 // Thread-safe: uses RLock for concurrent reads
 func (t *Tree) Match(tokens []uint32) *Node {
 	t.mu.RLock()
 	defer t.mu.RUnlock()
 
-	return t.match(tokens)
+	node := t.match(tokens)
+	if node == nil {
+		return nil
+	}
+	if node.offloading.Load() {
+		node.touched.Store(true)
+	}
+	if t.prefetch != nil && node.offloaded.CompareAndSwap(true, false) {
+		t.prefetch(node.CacheHandle)
+	}
+	return node
+}
+
+// SetPrefetch installs the hook Match calls for offloaded hits (nil disables)
+// Thread-safe: acquires write lock
+func (t *Tree) SetPrefetch(prefetch func(handle uint64)) {
+	t.mu.Lock()
+	defer t.mu.Unlock()
+	t.prefetch = prefetch
 }
 
 // match is the internal implementation without locking
@@ -267,6 +291,7 @@ func (t *Tree) unpin(node *Node) {
 
 // EvictLRU evicts the oldest n nodes from the LRU list
 // Evicted nodes are removed from the tree and their cache handles are freed
+// Nodes with an offload in flight are skipped
 // Thread-safe: acquires write lock
 func (t *Tree) EvictLRU(n int) {
 	if n <= 0 {
@@ -276,14 +301,16 @@ func (t *Tree) EvictLRU(n int) {
 	t.mu.Lock()
 	defer t.mu.Unlock()
 
-	for i := 0; i < n && t.lruList.Len() > 0; i++ {
-		// Get oldest element (back of list)
-		elem := t.lruList.Back()
-		if elem == nil {
-			break
-		}
-
+	// Walk from the oldest element (back of list); removeNode only pushes
+	// parents to the front, so prev stays valid
+	evicted := 0
+	for elem := t.lruList.Back(); elem != nil && evicted < n; {
+		prev := elem.Prev()
 		node := elem.Value.(*Node)
+		if node.offloading.Load() {
+			elem = prev
+			continue
+		}
 
 		// Remove from LRU list
 		t.lruList.Remove(elem)
@@ -291,7 +318,113 @@ func (t *Tree) EvictLRU(n int) {
 
 		// Remove from tree
 		t.removeNode(node)
+		evicted++
+		elem = prev
+	}
+}
+
+// EvictBytes evicts least recently used nodes until at least target bytes are reclaimed
+// sizeOf reports how many bytes freeing a node's cache handle releases; free, when
+// non-nil, is called with each evicted handle right after its node is removed, so
+// sizes of the remaining nodes reflect previous evictions. Nodes that release
+// nothing (their blocks are shared with pinned handles) are still evicted.
+// Offloaded nodes hold no device memory and are skipped, so the host tier
+// OffloadBytes filled is not thrown away before a resident byte is freed;
+// nodes with an offload in flight are skipped too.
+// Returns the number of bytes reclaimed
+// Thread-safe: acquires write lock
+func (t *Tree) EvictBytes(target int64, sizeOf func(handle uint64) int64, free func(handle uint64)) int64 {
+	if target <= 0 {
+		return 0
+	}
+
+	t.mu.Lock()
+	defer t.mu.Unlock()
+
+	var reclaimed int64
+	for elem := t.lruList.Back(); elem != nil && reclaimed < target; {
+		prev := elem.Prev()
+		node := elem.Value.(*Node)
+		if node.offloaded.Load() || node.offloading.Load() {
+			elem = prev
+			continue
+		}
+
+		t.lruList.Remove(elem)
+		node.lruElem = nil
+
+		reclaimed += sizeOf(node.CacheHandle)
+		t.removeNode(node)
+		if free != nil {
+			free(node.CacheHandle)
+		}
+		elem = prev
+	}
+	return reclaimed
+}
+
+// OffloadBytes offloads least recently used nodes until at least target bytes
+// of device memory are reclaimed. Unlike EvictBytes, nodes stay in the tree and
+// in LRU order, so a later Match still hits them and EvictLRU can still drop
+// them; nodes already offloaded are skipped. Candidates and their sizeOf are
+// picked under the write lock and marked in flight, then offload runs with the
+// lock released so Match, InsertPending and Unpin are not blocked behind the
+// copy. A candidate matched meanwhile is prefetched back instead of being
+// marked offloaded and does not count as reclaimed. Stops at the first offload
+// error.
+// Returns the number of bytes reclaimed
+// Thread-safe: acquires write lock around candidate selection and completion
+func (t *Tree) OffloadBytes(target int64, sizeOf func(handle uint64) int64, offload func(handle uint64) error) int64 {
+	if target <= 0 {
+		return 0
+	}
+
+	t.mu.Lock()
+	var candidates []*Node
+	var sizes []int64
+	var planned int64
+	for elem := t.lruList.Back(); elem != nil && planned < target; elem = elem.Prev() {
+		node := elem.Value.(*Node)
+		if node.offloaded.Load() || node.offloading.Load() {
+			continue
+		}
+
+		size := sizeOf(node.CacheHandle)
+		node.offloading.Store(true)
+		candidates = append(candidates, node)
+		sizes = append(sizes, size)
+		planned += size
+	}
+	t.mu.Unlock()
+
+	// Eviction skips in-flight nodes, so every candidate is still in the tree
+	done := len(candidates)
+	for i, node := range candidates {
+		if err := offload(node.CacheHandle); err != nil {
+			done = i
+			break
+		}
+	}
+
+	t.mu.Lock()
+	defer t.mu.Unlock()
+
+	var reclaimed int64
+	for i, node := range candidates {
+		touched := node.touched.Swap(false)
+		node.offloading.Store(false)
+		if i >= done {
+			continue
+		}
+		if touched && t.prefetch != nil {
+			// Matched mid-offload: bring the KV straight back
+			t.prefetch(node.CacheHandle)
+			continue
+		}
+		node.offloaded.Store(true)
+		reclaimed += sizes[i]
 	}
+	return reclaimed
 }
 
 // removeNode removes a node from the tree structure
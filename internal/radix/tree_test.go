@@ -1,8 +1,10 @@
 package radix
 
 import (
+	"errors"
 	"sync"
 	"testing"
+	"time"
 )
 
 func TestNewTree(t *testing.T) {
@@ -837,3 +839,283 @@ func TestMultipleUnpin(t *testing.T) {
 		t.Error("Expected node to be in LRU after fully unpinned")
 	}
 }
+
+func TestEvictBytes(t *testing.T) {
+	tests := []struct {
+		name        string
+		sizes       []int64 // bytes per node, oldest first
+		target      int64
+		wantEvicted int
+		wantBytes   int64
+	}{
+		{"zero target", []int64{100, 100}, 0, 0, 0},
+		{"exact fit", []int64{100, 200, 300}, 300, 2, 300},
+		{"overshoots to whole node", []int64{100, 200, 300}, 150, 2, 300},
+		{"more than available", []int64{100, 200}, 1000, 2, 300},
+		{"shared nodes reclaim nothing", []int64{0, 0, 500}, 100, 3, 500},
+	}
+
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			tree := NewTree()
+			engine := &MockMLXEngine{}
+			sizes := make(map[uint64]int64)
+			for i, size := range tt.sizes {
+				node, _ := tree.InsertPending([]uint32{uint32(i + 1)}, engine, nil)
+				handle := uint64(i+1) * 100
+				FinalizeNode(node, handle)
+				tree.Unpin(node)
+				sizes[handle] = size
+			}
+
+			var freed []uint64
+			got := tree.EvictBytes(tt.target, func(h uint64) int64 { return sizes[h] }, func(h uint64) {
+				freed = append(freed, h)
+			})
+
+			if got != tt.wantBytes {
+				t.Errorf("EvictBytes() = %d, want %d", got, tt.wantBytes)
+			}
+			if len(freed) != tt.wantEvicted {
+				t.Fatalf("Expected %d handles freed, got %d", tt.wantEvicted, len(freed))
+			}
+			for i, h := range freed {
+				if want := uint64(i+1) * 100; h != want {
+					t.Errorf("Expected handle %d evicted in LRU order, got %d", want, h)
+				}
+			}
+			if tree.lruList.Len() != len(tt.sizes)-tt.wantEvicted {
+				t.Errorf("Expected LRU length %d, got %d", len(tt.sizes)-tt.wantEvicted, tree.lruList.Len())
+			}
+		})
+	}
+}
+
+func TestEvictBytesNilFree(t *testing.T) {
+	tree := NewTree()
+	engine := &MockMLXEngine{}
+
+	node, _ := tree.InsertPending([]uint32{1}, engine, nil)
+	FinalizeNode(node, 100)
+	tree.Unpin(node)
+
+	got := tree.EvictBytes(1, func(uint64) int64 { return 64 }, nil)
+
+	if got != 64 {
+		t.Errorf("Expected 64 bytes reclaimed, got %d", got)
+	}
+	if nodeIsChild(tree.Root, node) {
+		t.Error("Expected evicted node to be removed from tree")
+	}
+}
+
+func TestOffloadBytes(t *testing.T) {
+	tests := []struct {
+		name          string
+		sizes         []int64 // bytes per node, oldest first
+		offloaded     []bool  // already offloaded before the call
+		failAt        int     // index whose offload fails, -1 for none
+		target        int64
+		wantOffloaded []uint64
+		wantBytes     int64
+	}{
+		{"zero target", []int64{100, 100}, nil, -1, 0, nil, 0},
+		{"oldest first", []int64{100, 200, 300}, nil, -1, 250, []uint64{100, 200}, 300},
+		{"skips offloaded", []int64{100, 200, 300}, []bool{true, false, false}, -1, 200, []uint64{200}, 200},
+		{"stops at error", []int64{100, 200, 300}, nil, 1, 1000, []uint64{100}, 100},
+		{"more than available", []int64{100, 200}, nil, -1, 1000, []uint64{100, 200}, 300},
+	}
+
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			tree := NewTree()
+			engine := &MockMLXEngine{}
+			sizes := make(map[uint64]int64)
+			var nodes []*Node
+			for i, size := range tt.sizes {
+				node, _ := tree.InsertPending([]uint32{uint32(i + 1)}, engine, nil)
+				handle := uint64(i+1) * 100
+				FinalizeNode(node, handle)
+				tree.Unpin(node)
+				sizes[handle] = size
+				if i < len(tt.offloaded) && tt.offloaded[i] {
+					node.offloaded.Store(true)
+				}
+				nodes = append(nodes, node)
+			}
+
+			var offloaded []uint64
+			got := tree.OffloadBytes(tt.target, func(h uint64) int64 { return sizes[h] }, func(h uint64) error {
+				if tt.failAt >= 0 && h == uint64(tt.failAt+1)*100 {
+					return errors.New("offload failed")
+				}
+				offloaded = append(offloaded, h)
+				return nil
+			})
+
+			if got != tt.wantBytes {
+				t.Errorf("OffloadBytes() = %d, want %d", got, tt.wantBytes)
+			}
+			if len(offloaded) != len(tt.wantOffloaded) {
+				t.Fatalf("Expected handles %v offloaded, got %v", tt.wantOffloaded, offloaded)
+			}
+			for i, h := range offloaded {
+				if h != tt.wantOffloaded[i] {
+					t.Errorf("Expected handle %d offloaded in LRU order, got %d", tt.wantOffloaded[i], h)
+				}
+			}
+			if tree.lruList.Len() != len(tt.sizes) {
+				t.Errorf("Expected offloaded nodes to stay in LRU, got length %d", tree.lruList.Len())
+			}
+			for _, node := range nodes {
+				if !nodeIsChild(tree.Root, node) {
+					t.Errorf("Expected node %d to stay in tree", node.CacheHandle)
+				}
+			}
+		})
+	}
+}
+
+func TestOffloadBytesUnlocksDuringOffload(t *testing.T) {
+	tree := NewTree()
+	engine := &MockMLXEngine{}
+	var nodes []*Node
+	for i := 0; i < 2; i++ {
+		node, _ := tree.InsertPending([]uint32{uint32(i + 1)}, engine, nil)
+		FinalizeNode(node, uint64(i+1)*100)
+		tree.Unpin(node)
+		nodes = append(nodes, node)
+	}
+
+	var prefetched []uint64
+	tree.SetPrefetch(func(h uint64) { prefetched = append(prefetched, h) })
+
+	entered := make(chan uint64)
+	release := make(chan struct{})
+	result := make(chan int64)
+	go func() {
+		result <- tree.OffloadBytes(1000, func(uint64) int64 { return 100 }, func(h uint64) error {
+			entered <- h
+			<-release
+			return nil
+		})
+	}()
+
+	// The oldest node's offload is blocked; Match and eviction must finish
+	if h := <-entered; h != 100 {
+		t.Fatalf("Expected oldest handle 100 offloaded first, got %d", h)
+	}
+	matched := make(chan *Node)
+	go func() { matched <- tree.Match([]uint32{1}) }()
+	select {
+	case got := <-matched:
+		if got != nodes[0] {
+			t.Fatalf("Expected match on node 100, got %v", got)
+		}
+	case <-time.After(time.Second):
+		t.Fatal("Match blocked behind an in-flight offload")
+	}
+	if freed := tree.EvictBytes(1000, func(uint64) int64 { return 100 }, nil); freed != 0 {
+		t.Errorf("Expected in-flight nodes to be skipped by eviction, freed %d bytes", freed)
+	}
+
+	release <- struct{}{}
+	<-entered
+	release <- struct{}{}
+	if got := <-result; got != 100 {
+		t.Errorf("OffloadBytes() = %d, want 100 (matched node not counted)", got)
+	}
+
+	if nodes[0].offloaded.Load() {
+		t.Error("Expected node matched mid-offload to stay resident")
+	}
+	if len(prefetched) != 1 || prefetched[0] != 100 {
+		t.Errorf("Expected node matched mid-offload to be prefetched, got %v", prefetched)
+	}
+	if !nodes[1].offloaded.Load() {
+		t.Error("Expected unmatched node to be marked offloaded")
+	}
+	for _, node := range nodes {
+		if node.offloading.Load() || node.touched.Load() {
+			t.Errorf("Expected in-flight state of node %d cleared", node.CacheHandle)
+		}
+		if !nodeIsChild(tree.Root, node) {
+			t.Errorf("Expected node %d to stay in tree", node.CacheHandle)
+		}
+	}
+}
+
+func TestEvictBytesSkipsOffloaded(t *testing.T) {
+	tree := NewTree()
+	engine := &MockMLXEngine{}
+	var nodes []*Node
+	for i := 0; i < 3; i++ {
+		node, _ := tree.InsertPending([]uint32{uint32(i + 1)}, engine, nil)
+		FinalizeNode(node, uint64(i+1)*100)
+		tree.Unpin(node)
+		nodes = append(nodes, node)
+	}
+	nodes[0].offloaded.Store(true)
+
+	var freed []uint64
+	got := tree.EvictBytes(100, func(uint64) int64 { return 100 }, func(h uint64) {
+		freed = append(freed, h)
+	})
+
+	if got != 100 {
+		t.Errorf("EvictBytes() = %d, want 100", got)
+	}
+	if len(freed) != 1 || freed[0] != 200 {
+		t.Errorf("Expected oldest resident handle 200 freed, got %v", freed)
+	}
+	if !nodeIsChild(tree.Root, nodes[0]) {
+		t.Error("Expected offloaded node to stay in tree")
+	}
+}
+
+func TestMatchPrefetchesOffloaded(t *testing.T) {
+	tests := []struct {
+		name         string
+		offloaded    bool
+		hook         bool
+		wantPrefetch []uint64
+		wantFlag     bool
+	}{
+		{"resident", false, true, nil, false},
+		{"offloaded", true, true, []uint64{100}, false},
+		{"no hook", true, false, nil, true},
+	}
+
+	for _, tt := range tests {
+		t.Run(tt.name, func(t *testing.T) {
+			tree := NewTree()
+			engine := &MockMLXEngine{}
+			node, _ := tree.InsertPending([]uint32{1, 2}, engine, nil)
+			FinalizeNode(node, 100)
+			tree.Unpin(node)
+			node.offloaded.Store(tt.offloaded)
+
+			var prefetched []uint64
+			if tt.hook {
+				tree.SetPrefetch(func(h uint64) { prefetched = append(prefetched, h) })
+			}
+
+			if got := tree.Match([]uint32{1, 2, 3}); got != node {
+				t.Fatalf("Expected match on node, got %v", got)
+			}
+			tree.Match([]uint32{1, 2})
+
+			if len(prefetched) != len(tt.wantPrefetch) {
+				t.Fatalf("Expected prefetches %v, got %v", tt.wantPrefetch, prefetched)
+			}
+			for i, h := range prefetched {
+				if h != tt.wantPrefetch[i] {
+					t.Errorf("Expected prefetch of %d, got %d", tt.wantPrefetch[i], h)
+				}
+			}
+			if node.offloaded.Load() != tt.wantFlag {
+				t.Errorf("Expected offloaded=%v after match, got %v", tt.wantFlag, node.offloaded.Load())
+			}
+		})
+	}
+}
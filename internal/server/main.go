@@ -19,11 +19,19 @@ import (
 
 var (
 	// Server configuration
-	addr         = flag.String("addr", ":8080", "Server address")
-	modelPath    = flag.String("model", "", "Path to model weights")
-	vocabSize    = flag.Int("vocab-size", 32000, "Tokenizer vocabulary size")
-	maxCacheSize = flag.Int("max-cache-size", 1000, "Maximum cache entries (0 = unlimited)")
-	logLevel     = flag.String("log-level", "info", "Log level (debug, info, warn, error)")
+	addr          = flag.String("addr", ":8080", "Server address")
+	modelPath     = flag.String("model", "", "Path to model weights")
+	vocabSize     = flag.Int("vocab-size", 32000, "Tokenizer vocabulary size")
+	weightFormat  = flag.String("weight-format", "f32", "Weight storage format (f32, f16, bf16, q8, q4)")
+	quantGroup    = flag.Int("quant-group-size", mlx.DefaultQuantGroupSize, "Weights per scale/zero point for q8/q4")
+	prefillChunk  = flag.Int("prefill-chunk", mlx.DefaultPrefillChunkTokens, "Prompt tokens per sequence per engine step")
+	kvBudgetMB    = flag.Int64("kv-budget-mb", 0, "KV cache memory budget in MiB (0 = whole KV pool)")
+	offloadDir    = flag.String("kv-offload-dir", "", "Directory for KV spill files (empty = $TMPDIR)")
+	hostOffloadMB = flag.Int64("kv-host-offload-mb", 0, "Host RAM for offloaded KV in MiB before spilling to disk (0 = unlimited)")
+	profileGPU    = flag.Bool("profile", false, "Record per-layer GPU kernel times, exported on /metrics")
+	snapshotDir   = flag.String("kv-snapshot-dir", "", "Directory cached prefixes are restored from at startup and saved to at shutdown (empty = disabled)")
+	maxCacheSize  = flag.Int("max-cache-size", 1000, "Maximum cache entries (0 = unlimited)")
+	logLevel      = flag.String("log-level", "info", "Log level (debug, info, warn, error)")
 	// MLX configuration
 	mlxLibrary = flag.String("mlx-library", "libmlx_runtime.dylib", "Path to MLX runtime library")
 )
@@ -96,6 +104,16 @@ func main() {
 	}
 	slog.Info("Loaded model", "path", *modelPath, "vocab_size", *vocabSize)
 
+	// Warm start: re-import the prefixes saved by the previous shutdown
+	snapshotter, canSnapshot := engine.(radix.CacheSnapshotter)
+	if *snapshotDir != "" && canSnapshot {
+		loaded, err := tree.LoadSnapshots(*snapshotDir, snapshotter, engine.FreeCache)
+		if err != nil {
+			slog.Warn("Some cache snapshots failed to load", "dir", *snapshotDir, "error", err)
+		}
+		slog.Info("Restored cached prefixes", "dir", *snapshotDir, "count", loaded)
+	}
+
 	// Create HTTP server
 	server := httpserver.NewServer(tree, engine, tok, model)
 
@@ -141,6 +159,14 @@ func main() {
 	// Cleanup resources
 	slog.Info("Cleaning up resources")
 
+	if *snapshotDir != "" && canSnapshot {
+		saved, err := tree.SaveSnapshots(*snapshotDir, snapshotter)
+		if err != nil {
+			slog.Warn("Some cached prefixes failed to save", "dir", *snapshotDir, "error", err)
+		}
+		slog.Info("Saved cached prefixes", "dir", *snapshotDir, "count", saved)
+	}
+
 	// Evict all LRU entries
 	// Note: lruList is private, we'd need to add a public method
 	// tree.EvictLRU(tree.lruList.Len())
@@ -199,12 +225,35 @@ func setupMLXEngine() (radix.MLXEngine, error) {
 	slog.Info("Initializing real MLX engine",
 		"path", *modelPath,
 		"vocab_size", *vocabSize,
+		"weight_format", *weightFormat,
 	)
 
-	engine := mlx.NewRealMLXEngine(*modelPath, *vocabSize)
+	format, err := mlx.ParseWeightFormat(*weightFormat)
+	if err != nil {
+		return nil, err
+	}
+	engine := mlx.NewRealMLXEngineWithOptions(*modelPath, *vocabSize, mlx.LoadOptions{
+		WeightFormat:       format,
+		QuantGroupSize:     *quantGroup,
+		PrefillChunkTokens: *prefillChunk,
+	})
 	if err := engine.LoadModel(); err != nil {
 		return nil, fmt.Errorf("failed to load MLX model: %w", err)
 	}
+	if *kvBudgetMB > 0 {
+		if err := engine.SetMemoryBudget(*kvBudgetMB << 20); err != nil {
+			return nil, fmt.Errorf("failed to set KV memory budget: %w", err)
+		}
+	}
+	offload := mlx.OffloadOptions{Directory: *offloadDir, HostBudgetBytes: *hostOffloadMB << 20}
+	if err := mlx.SetOffloadOptions(offload); err != nil {
+		return nil, fmt.Errorf("invalid KV offload options: %w", err)
+	}
+	if *profileGPU {
+		if err := engine.SetProfiling(true); err != nil {
+			return nil, fmt.Errorf("failed to enable GPU profiling: %w", err)
+		}
+	}
 
 	slog.Info("MLX engine loaded successfully", "type", "real")
 	return engine, nil